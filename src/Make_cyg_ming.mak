@@ -778,7 +778,7 @@ copy-apitest-collateral:
 	ls $(DEST_BIN)/collateral
 
 apitest/%.test.exe: apitest/%.c libvim.a
-	$(CC) -I. -Iproto -L. -Lproto $< $(EXELFLAGS) -Wall -Wno-pointer-sign -Werror -o $@ libvim.a -lstdc++ -lole32 -lws2_32 -lnetapi32 -lversion -lcomctl32 -luuid -lgdi32
+	$(CC) -I. -Iproto -L. -Lproto $< $(EXELFLAGS) -Wall -Wno-pointer-sign -Werror -pthread -o $@ libvim.a -lstdc++ -lole32 -lws2_32 -lnetapi32 -lversion -lcomctl32 -luuid -lgdi32
 	echo "Copying $@ to $(DEST_BIN)"
 	$(INSTALL_PROG) $@ $(DEST_BIN)
 
@@ -0,0 +1,233 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 400000
+
+static char_u *fname;
+static char_u *backupName;
+
+static void writeFile(char_u *name, int count)
+{
+  FILE *fp = fopen((char *)name, "wb");
+  for (int i = 0; i < count; i++)
+  {
+    fprintf(fp, "Line %d of the file with some text on it\n", i);
+  }
+  fclose(fp);
+}
+
+static int fileHasLines(char_u *name, int count)
+{
+  FILE *fp = fopen((char *)name, "rb");
+  char line[256];
+  char expected[256];
+  int lnum = 0;
+  int ok = fp != NULL;
+
+  while (ok && fgets(line, sizeof(line), fp) != NULL)
+  {
+    sprintf(expected, "Line %d of the file with some text on it\n", lnum);
+    ok = STRCMP(line, expected) == 0;
+    lnum++;
+  }
+  if (fp != NULL)
+  {
+    fclose(fp);
+  }
+  return ok && lnum == count;
+}
+
+// The read() and write() loop the backup used to be copied with.
+static double copyWithBuffer(char_u *from, char_u *to)
+{
+  char buffer[8192];
+  int n;
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int fdIn = open((char *)from, O_RDONLY);
+  int fdOut = open((char *)to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  while ((n = read(fdIn, buffer, sizeof(buffer))) > 0)
+  {
+    vim_ignored = write(fdOut, buffer, n);
+  }
+  close(fdIn);
+  close(fdOut);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) * 1000000.0 +
+         (end.tv_nsec - start.tv_nsec) / 1000.0;
+}
+
+static char *methodName(backupMethod_T method)
+{
+  switch (method)
+  {
+  case BACKUP_NONE:
+    return "none";
+  case BACKUP_RENAME:
+    return "rename";
+  case BACKUP_CLONE:
+    return "FICLONE";
+  case BACKUP_COPY_RANGE:
+    return "copy_file_range";
+  case BACKUP_COPY:
+    return "read/write";
+  }
+  return "?";
+}
+
+static backupStats_T writeBuffer(void)
+{
+  backupStats_T stats;
+
+  vimExecute("w");
+  vimGetBackupStats(&stats);
+  printf("Backup of %ld bytes (%s): %ld usec\n", (long)stats.bs_size,
+         methodName(stats.bs_method), stats.bs_usec);
+  return stats;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+  vimExecute("set backup writebackup backupdir=. backupext=~ backupskip=");
+
+  fname = vim_tempname('b', FALSE);
+  backupName = concat_str(fname, (char_u *)"~");
+  writeFile(fname, LINE_COUNT);
+}
+
+void test_teardown(void)
+{
+  vimExecute("set nobackup backupcopy& backupdir& backupext& backupskip&");
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(fname);
+  mch_remove(backupName);
+  VIM_CLEAR(fname);
+  VIM_CLEAR(backupName);
+}
+
+MU_TEST(test_rename_with_auto)
+{
+  vimExecute("set backupcopy=auto");
+  vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  stat_T before, after;
+  mch_stat((char *)fname, &before);
+  backupStats_T stats = writeBuffer();
+  mch_stat((char *)backupName, &after);
+
+  // The original file became the backup
+  mu_check(stats.bs_method == BACKUP_RENAME);
+  mu_check(after.st_ino == before.st_ino);
+  mu_check(fileHasLines(backupName, LINE_COUNT));
+  mu_check(vimBufferGetLineCount(curbuf) == LINE_COUNT - 1);
+}
+
+MU_TEST(test_copy_with_yes)
+{
+  vimExecute("set backupcopy=yes");
+  vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  stat_T before, after;
+  mch_stat((char *)fname, &before);
+  backupStats_T stats = writeBuffer();
+  mch_stat((char *)fname, &after);
+
+  // The file is overwritten, the backup is a copy
+  mu_check(after.st_ino == before.st_ino);
+  mu_check(stats.bs_size == before.st_size);
+  mu_check(fileHasLines(backupName, LINE_COUNT));
+#ifdef __linux__
+  mu_check(stats.bs_method == BACKUP_CLONE ||
+           stats.bs_method == BACKUP_COPY_RANGE);
+#endif
+
+  char_u *plainName = concat_str(fname, (char_u *)".plain");
+  double usec = copyWithBuffer(fname, plainName);
+  printf("Copy of %ld bytes (read/write): %.0f usec\n", (long)after.st_size,
+         usec);
+  mch_remove(plainName);
+  vim_free(plainName);
+}
+
+MU_TEST(test_copy_hard_link)
+{
+  char_u *linkName = concat_str(fname, (char_u *)".link");
+  mu_check(link((char *)fname, (char *)linkName) == 0);
+
+  // A hard link is never renamed with "auto"
+  vimExecute("set backupcopy=auto");
+  vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+  backupStats_T stats = writeBuffer();
+
+  mu_check(stats.bs_method != BACKUP_RENAME);
+  mu_check(stats.bs_method != BACKUP_NONE);
+  mu_check(fileHasLines(backupName, LINE_COUNT));
+
+  // The link still has the same file
+  stat_T st;
+  mu_check(mch_stat((char *)linkName, &st) == 0 && st.st_nlink == 2);
+
+  mch_remove(linkName);
+  vim_free(linkName);
+}
+
+MU_TEST(test_copy_empty_file)
+{
+  writeFile(fname, 0);
+  vimExecute("set backupcopy=yes");
+  vimBufferOpen(fname, 1, 0);
+  vimInput("i");
+  vimInput("text");
+  vimKey("<esc>");
+
+  backupStats_T stats = writeBuffer();
+  mu_check(stats.bs_method != BACKUP_NONE);
+  mu_check(stats.bs_size == 0);
+  mu_check(fileHasLines(backupName, 0));
+}
+
+MU_TEST(test_no_backup)
+{
+  vimExecute("set nobackup nowritebackup");
+  vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  backupStats_T stats = writeBuffer();
+  mu_check(stats.bs_method == BACKUP_NONE);
+  mu_check(mch_getperm(backupName) < 0);
+  vimExecute("set writebackup");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_rename_with_auto);
+  MU_RUN_TEST(test_copy_with_yes);
+  MU_RUN_TEST(test_copy_hard_link);
+  MU_RUN_TEST(test_copy_empty_file);
+  MU_RUN_TEST(test_no_backup);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
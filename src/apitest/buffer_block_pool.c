@@ -0,0 +1,85 @@
+#include "libvim.h"
+#include "minunit.h"
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_stats_after_load)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  blockPoolStats_T stats;
+
+  vimBufferGetBlockPoolStats(buf, &stats);
+  printf("used: %lu free: %lu slabs: %d\n", stats.used, stats.free, stats.slabs);
+
+  // The text is in the blocks, and only part of the last slab is left over
+  mu_check(stats.slabs > 0);
+  mu_check(stats.used > 250000);
+  mu_check(stats.free < stats.used);
+}
+
+MU_TEST(test_freed_pages_are_reused)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  blockPoolStats_T before, deleted, after;
+
+  vimExecute("1000,5000d");
+  vimBufferGetBlockPoolStats(buf, &deleted);
+  vimExecute("u");
+  vimBufferGetBlockPoolStats(buf, &before);
+
+  // Deleting and restoring the lines again takes the same pages
+  for (int i = 0; i < 5; i++)
+  {
+    vimExecute("1000,5000d");
+    vimExecute("u");
+  }
+  vimBufferGetBlockPoolStats(buf, &after);
+  printf("slabs before: %d after: %d\n", before.slabs, after.slabs);
+
+  mu_check(deleted.free > 0);
+  mu_check(after.slabs == before.slabs);
+  mu_check(after.used + after.free == before.used + before.free);
+}
+
+MU_TEST(test_memory_released_on_unload)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  blockPoolStats_T stats;
+
+  char cmd[64];
+  sprintf(cmd, "bunload! %d", vimBufferGetId(buf));
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute(cmd);
+
+  vimBufferGetBlockPoolStats(buf, &stats);
+  mu_check(stats.used == 0);
+  mu_check(stats.free == 0);
+  mu_check(stats.slabs == 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_stats_after_load);
+  MU_RUN_TEST(test_freed_pages_are_reused);
+  MU_RUN_TEST(test_memory_released_on_unload);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,161 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+// Check every line's offset against the sum of the line lengths, and the
+// line found for its first byte, its end-of-line and the byte after it.
+static int offsetsMatch(buf_T *buf, int eolLen)
+{
+  long expected = 0;
+  linenr_T lineCount = vimBufferGetLineCount(buf);
+
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    long len = (long)STRLEN(vimBufferGetLine(buf, lnum));
+
+    if (vimBufferGetByteOffset(buf, lnum) != expected ||
+        vimBufferGetLineFromOffset(buf, expected) != lnum ||
+        vimBufferGetLineFromOffset(buf, expected + len) != lnum)
+    {
+      printf("line %ld: expected offset %ld but got %ld\n", (long)lnum,
+             expected, vimBufferGetByteOffset(buf, lnum));
+      return FALSE;
+    }
+    expected += len + eolLen;
+  }
+
+  if (vimBufferGetByteOffset(buf, lineCount + 1) != expected ||
+      vimBufferGetLineFromOffset(buf, expected) != -1)
+  {
+    printf("end: expected offset %ld but got %ld\n", expected,
+           vimBufferGetByteOffset(buf, lineCount + 1));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_offsets)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  mu_check(vimBufferGetByteOffset(buf, 0) == -1);
+  mu_check(vimBufferGetByteOffset(buf, vimBufferGetLineCount(buf) + 2) == -1);
+  mu_check(vimBufferGetLineFromOffset(buf, -1) == -1);
+  mu_check(vimBufferGetByteOffset(buf, 1) == 0);
+  mu_check(offsetsMatch(buf, 1));
+}
+
+MU_TEST(test_offsets_after_insert)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  // Enough lines to split chunks
+  for (int i = 0; i < 1000; i++)
+  {
+    vimExecute("3000t3000");
+  }
+  mu_check(offsetsMatch(buf, 1));
+
+  vimExecute("$");
+  vimInput("o");
+  vimInput("last line");
+  vimKey("<esc>");
+  mu_check(offsetsMatch(buf, 1));
+
+  vimExecute("e!");
+}
+
+MU_TEST(test_offsets_after_delete)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  vimExecute("1000,2500d");
+  mu_check(offsetsMatch(buf, 1));
+  vimExecute("1d");
+  mu_check(offsetsMatch(buf, 1));
+
+  vimExecute("u");
+  vimExecute("u");
+  mu_check(offsetsMatch(buf, 1));
+}
+
+MU_TEST(test_offsets_after_replace)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  vimExecute("5000");
+  vimInput("I");
+  vimInput("a longer line now");
+  vimKey("<esc>");
+  // The changed line may still be the cached line
+  mu_check(vimBufferGetByteOffset(buf, 5001) ==
+           vimBufferGetByteOffset(buf, 5000) +
+               (long)STRLEN(vimBufferGetLine(buf, 5000)) + 1);
+  mu_check(offsetsMatch(buf, 1));
+
+  vimExecute("%s/a/bc/g");
+  mu_check(offsetsMatch(buf, 1));
+
+  vimExecute("e!");
+}
+
+MU_TEST(test_offsets_dos)
+{
+  char_u *fname = vim_tempname('o', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 0; i < 5000; i++)
+  {
+    fprintf(fp, "Line %d\r\n", i);
+  }
+  fclose(fp);
+
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  mu_check(vimBufferGetFileFormat(buf) == EOL_DOS);
+  mu_check(offsetsMatch(buf, 2));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_offsets_set_lines)
+{
+  buf_T *buf = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  char_u *lines[] = {(char_u *)"a", (char_u *)"bc", (char_u *)"def"};
+
+  vimBufferSetLines(buf, 1, 2, lines, 3);
+  mu_check(vimBufferGetLineCount(buf) == 5);
+  mu_check(vimBufferGetByteOffset(buf, 3) == 38 + 2);
+  mu_check(offsetsMatch(buf, 1));
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_offsets);
+  MU_RUN_TEST(test_offsets_after_insert);
+  MU_RUN_TEST(test_offsets_after_delete);
+  MU_RUN_TEST(test_offsets_after_replace);
+  MU_RUN_TEST(test_offsets_dos);
+  MU_RUN_TEST(test_offsets_set_lines);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
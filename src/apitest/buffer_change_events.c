@@ -0,0 +1,431 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static char_u *fname;
+static buf_T *buf;
+
+// Copy of the text, kept up to date from the change events only
+static garray_T mirror;
+static int changeCount;
+static int reloadCount;
+static int tickMatches;
+static bufferChange_T lastChange;
+static char lastText[256];
+
+static void readMirror(void)
+{
+  mirror.ga_len = 0;
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++)
+  {
+    if (lnum > 1)
+    {
+      ga_append(&mirror, '\n');
+    }
+    ga_concat(&mirror, vimBufferGetLine(buf, lnum));
+  }
+}
+
+// Offset of "lnum" / "col" in the mirror, -1 when not there
+static long mirrorOffset(linenr_T lnum, colnr_T col)
+{
+  long off = 0;
+  char *text = (char *)mirror.ga_data;
+
+  for (linenr_T l = 1; l < lnum; l++)
+  {
+    while (off < mirror.ga_len && text[off] != '\n')
+    {
+      off++;
+    }
+    if (off == mirror.ga_len)
+    {
+      return -1;
+    }
+    off++;
+  }
+  return off + col;
+}
+
+static void onBufferChange(bufferChange_T *change)
+{
+  if (change->buf != buf)
+  {
+    return;
+  }
+  changeCount++;
+  lastChange = *change;
+  // The text is only valid during the callback
+  if (change->newText != NULL)
+  {
+    vim_strncpy((char_u *)lastText, change->newText, sizeof(lastText) - 1);
+    lastChange.newText = (char_u *)lastText;
+  }
+  tickMatches = tickMatches && change->changedtick == vimBufferGetLastChangedTick(buf);
+
+  if (change->newText == NULL)
+  {
+    reloadCount++;
+    readMirror();
+    return;
+  }
+
+  long start = mirrorOffset(change->lnum, change->col);
+  long end = mirrorOffset(change->oldEndLnum, change->oldEndCol);
+  mu_check(start >= 0 && end >= start);
+  mu_check(change->byteOffset == start);
+  mu_check(change->oldLength == end - start);
+  mu_check(change->newLength == (long)STRLEN(change->newText));
+
+  ga_grow(&mirror, (int)change->newLength);
+  char *text = (char *)mirror.ga_data;
+  memmove(text + start + change->newLength, text + end, mirror.ga_len - end);
+  memmove(text + start, change->newText, change->newLength);
+  mirror.ga_len += change->newLength - (end - start);
+}
+
+// TRUE when the mirror has the same text as the buffer
+static int mirrorMatches(void)
+{
+  garray_T actual;
+  int same;
+
+  ga_init2(&actual, 1, 1000);
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++)
+  {
+    if (lnum > 1)
+    {
+      ga_append(&actual, '\n');
+    }
+    ga_concat(&actual, vimBufferGetLine(buf, lnum));
+  }
+  same = actual.ga_len == mirror.ga_len &&
+         (actual.ga_len == 0 || memcmp(actual.ga_data, mirror.ga_data, actual.ga_len) == 0);
+  if (!same)
+  {
+    int i = 0;
+    while (i < actual.ga_len && i < mirror.ga_len &&
+           ((char *)actual.ga_data)[i] == ((char *)mirror.ga_data)[i])
+    {
+      i++;
+    }
+    printf("differs at %d: buffer '%.20s' mirror '%.20s'\n", i,
+           (char *)actual.ga_data + i, (char *)mirror.ga_data + i);
+  }
+  ga_clear(&actual);
+  return same;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('c', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 1; i <= 200; i++)
+  {
+    fprintf(fp, "line %d of the file\n", i);
+  }
+  fclose(fp);
+
+  ga_init2(&mirror, 1, 1000);
+  changeCount = 0;
+  reloadCount = 0;
+  tickMatches = TRUE;
+  vimSetBufferChangeCallback(&onBufferChange);
+  // Known before it is read, for the events while opening it
+  buf = vimBufferLoad(fname, 1, 0);
+  vimBufferOpen(fname, 1, 0);
+}
+
+void test_teardown(void)
+{
+  vimSetBufferChangeCallback(NULL);
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  mch_remove(fname);
+  VIM_CLEAR(fname);
+  ga_clear(&mirror);
+}
+
+MU_TEST(test_file_read)
+{
+  // Reading the file is one event, not one per line
+  mu_check(changeCount == 1);
+  mu_check(reloadCount == 1);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_single_line_change)
+{
+  vimExecute("2");
+  vimInput("0");
+  vimInput("w");
+  vimInput("x");
+
+  mu_check(lastChange.lnum == 2);
+  mu_check(lastChange.col == 5);
+  mu_check(lastChange.oldEndLnum == 2);
+  mu_check(lastChange.oldEndCol == 6);
+  mu_check(lastChange.oldLength == 1);
+  mu_check(lastChange.newLength == 0);
+  mu_check(lastChange.byteOffset == (long)STRLEN("line 1 of the file\n") + 5);
+  mu_check(tickMatches);
+  mu_check(mirrorMatches());
+
+  vimInput("c");
+  vimInput("w");
+  vimInput("changed");
+  vimKey("<esc>");
+  mu_check(lastChange.lnum == 2);
+  mu_check(lastChange.col == 5);
+  mu_check(STRCMP(lastChange.newText, "changed") == 0);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_typing)
+{
+  vimExecute("10");
+  vimInput("A");
+  vimInput("abc");
+  vimKey("<cr>");
+  vimInput("new line");
+  vimKey("<bs>");
+  vimKey("<bs>");
+  vimKey("<esc>");
+  mu_check(mirrorMatches());
+
+  vimInput("O");
+  vimInput("above");
+  vimKey("<esc>");
+  vimExecute("$");
+  vimInput("o");
+  vimInput("at the end");
+  vimKey("<esc>");
+  mu_check(vimBufferGetLineCount(buf) == 203);
+  mu_check(tickMatches);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_line_commands)
+{
+  vimExecute("5");
+  vimInput("d");
+  vimInput("d");
+  vimInput("3");
+  vimInput("J");
+  vimInput("y");
+  vimInput("y");
+  vimInput("5");
+  vimInput("p");
+  mu_check(mirrorMatches());
+
+  vimExecute("%s/of the/in a/");
+  vimExecute("g/5/d");
+  vimExecute("$-2,$d");
+  mu_check(mirrorMatches());
+
+  vimInput("u");
+  vimInput("u");
+  vimInput("u");
+  vimKey("<c-r>");
+  mu_check(tickMatches);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_delete_all)
+{
+  vimInput("g");
+  vimInput("g");
+  vimInput("d");
+  vimInput("G");
+  mu_check(vimBufferGetLineCount(buf) == 1);
+  mu_check(mirror.ga_len == 0);
+  mu_check(mirrorMatches());
+
+  vimInput("i");
+  vimInput("only");
+  vimKey("<esc>");
+  vimInput("u");
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == 200);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_changed_in_place)
+{
+  // "~" and "gUU" change the text without replacing the line
+  vimExecute("3");
+  vimInput("0");
+  int before = changeCount;
+  vimInput("~");
+  mu_check(changeCount == before + 1);
+  mu_check(lastChange.lnum == 3);
+  mu_check(lastChange.col == 0);
+  mu_check(STRCMP(lastChange.newText, "L") == 0);
+  mu_check(mirrorMatches());
+
+  vimInput("g");
+  vimInput("U");
+  vimInput("U");
+  mu_check(STRCMP(vimBufferGetLine(buf, 3), "LINE 3 OF THE FILE") == 0);
+  mu_check(mirrorMatches());
+
+  // Backspace in Replace mode puts back the old text in place
+  vimExecute("4");
+  vimInput("0");
+  vimInput("R");
+  vimInput("xyz");
+  vimKey("<bs>");
+  vimKey("<bs>");
+  vimKey("<esc>");
+  mu_check(STRCMP(vimBufferGetLine(buf, 4), "xine 4 of the file") == 0);
+  mu_check(tickMatches);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_multibyte)
+{
+  vimExecute("1");
+  vimInput("0");
+  vimInput("i");
+  vimInput("\xc3\xa9");
+  vimKey("<esc>");
+  mu_check(mirrorMatches());
+
+  // Only the second byte differs, the change is still the whole character
+  vimInput("r");
+  vimInput("\xc3\xa8");
+  mu_check(lastChange.col == 0);
+  mu_check(lastChange.oldEndCol == 2);
+  mu_check(STRCMP(lastChange.newText, "\xc3\xa8") == 0);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_set_lines)
+{
+  char_u *lines[300];
+  char text[300][32];
+
+  for (int i = 0; i < 300; i++)
+  {
+    sprintf(text[i], "set %d", i);
+    lines[i] = (char_u *)text[i];
+  }
+
+  // Few lines are appended and deleted one by one, many are spliced
+  vimBufferSetLines(buf, 3, 5, lines, 3);
+  mu_check(mirrorMatches());
+  vimBufferSetLines(buf, 10, 150, lines, 300);
+  mu_check(lastChange.lnum == 11);
+  mu_check(lastChange.oldEndLnum == 151);
+  mu_check(mirrorMatches());
+
+  // Replacing the last lines and all lines
+  vimBufferSetLines(buf, 400, -1, lines, 120);
+  mu_check(mirrorMatches());
+  vimBufferSetLines(buf, 0, -1, lines, 2);
+  mu_check(vimBufferGetLineCount(buf) == 2);
+  mu_check(mirrorMatches());
+  vimBufferSetLines(buf, 0, -1, lines, 0);
+  mu_check(mirrorMatches());
+  mu_check(tickMatches);
+}
+
+MU_TEST(test_dos_file_format)
+{
+  vimExecute("set fileformat=dos");
+  vimExecute("100");
+  vimInput("x");
+
+  // Line breaks count as one byte
+  mu_check(lastChange.byteOffset == mirrorOffset(100, 0));
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_appended_to_file)
+{
+  vimBufferSetTailMode(buf, TRUE);
+  FILE *fp = fopen((char *)fname, "ab");
+  fputs("appended 1\nappended 2\n", fp);
+  fclose(fp);
+
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 202);
+  mu_check(reloadCount == 1);
+  mu_check(lastChange.lnum == 200);
+  mu_check(STRCMP(lastChange.newText, "\nappended 1\nappended 2") == 0);
+  mu_check(mirrorMatches());
+  vimBufferSetTailMode(buf, FALSE);
+}
+
+MU_TEST(test_open_async)
+{
+  char_u *bigname = vim_tempname('c', FALSE);
+  FILE *fp = fopen((char *)bigname, "wb");
+  for (int i = 1; i <= 5000; i++)
+  {
+    fprintf(fp, "line %d of the big file\n", i);
+  }
+  fclose(fp);
+
+  buf = vimBufferLoad(bigname, 1, 0);
+  changeCount = 0;
+  reloadCount = 0;
+  bufload_T *load = vimBufferOpenAsync(bigname, 1, 0, 100, NULL, NULL);
+
+  // The first lines are sent before the rest is appended
+  mu_check(reloadCount == 1);
+  mu_check(mirrorMatches());
+  mu_check(vimBufferLoadWait(load) == LOAD_DONE);
+  mu_check(vimBufferGetLineCount(buf) == 5000);
+  mu_check(mirrorMatches());
+  mu_check(tickMatches);
+  vimBufferLoadFree(load);
+
+  buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("bwipe! #");
+  mch_remove(bigname);
+  vim_free(bigname);
+}
+
+MU_TEST(test_not_recorded_without_callback)
+{
+  vimSetBufferChangeCallback(NULL);
+  vimInput("x");
+  vimExecute("3d");
+  vimInput("o");
+  mu_check(buf->b_changes.ga_len == 0);
+  vimKey("<esc>");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_file_read);
+  MU_RUN_TEST(test_single_line_change);
+  MU_RUN_TEST(test_typing);
+  MU_RUN_TEST(test_line_commands);
+  MU_RUN_TEST(test_delete_all);
+  MU_RUN_TEST(test_changed_in_place);
+  MU_RUN_TEST(test_multibyte);
+  MU_RUN_TEST(test_set_lines);
+  MU_RUN_TEST(test_dos_file_format);
+  MU_RUN_TEST(test_appended_to_file);
+  MU_RUN_TEST(test_open_async);
+  MU_RUN_TEST(test_not_recorded_without_callback);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,198 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static buf_T *buf;
+static buf_T *other;
+static garray_T lines;
+
+// Make all blocks look unused for an hour, each call is an hour later.
+// Compressing after the command is avoided, the tests do that themselves.
+static void waitAnHour(void)
+{
+  static int hours = 0;
+  char cmd[64];
+  int seconds = vimOptionGetCompressAfter();
+
+  vimOptionSetCompressAfter(0);
+  hours++;
+  sprintf(cmd, "call test_settime(%ld)", (long)time(NULL) + hours * 3600);
+  vimExecute(cmd);
+  vimOptionSetCompressAfter(seconds);
+}
+
+static int linesMatch(void)
+{
+  if (vimBufferGetLineCount(buf) != lines.ga_len)
+  {
+    return FALSE;
+  }
+  for (int i = 0; i < lines.ga_len; i++)
+  {
+    if (STRCMP(vimBufferGetLine(buf, i + 1), ((char_u **)lines.ga_data)[i]) != 0)
+    {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("e!");
+
+  ga_init2(&lines, sizeof(char_u *), 1000);
+  for (linenr_T lnum = 1; lnum <= vimBufferGetLineCount(buf); lnum++)
+  {
+    char_u *line = vim_strsave(vimBufferGetLine(buf, lnum));
+    ga_grow(&lines, 1);
+    ((char_u **)lines.ga_data)[lines.ga_len++] = line;
+  }
+
+  // The buffer is hidden while its blocks get cold
+  other = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimOptionSetCompressAfter(60);
+}
+
+void test_teardown(void)
+{
+  vimOptionSetCompressAfter(0);
+  vimExecute("call test_settime(0)");
+  ga_clear_strings(&lines);
+}
+
+MU_TEST(test_disabled_by_default)
+{
+  vimOptionSetCompressAfter(0);
+  waitAnHour();
+  mu_check(vimCompressColdBlocks() == 0);
+
+  memoryStats_T stats;
+  vimGetMemoryStats(buf, &stats);
+  mu_check(stats.compressed_blocks == 0);
+  mu_check(stats.compress_saved == 0);
+}
+
+MU_TEST(test_recently_used_not_compressed)
+{
+  mu_check(vimCompressColdBlocks() == 0);
+}
+
+MU_TEST(test_compress_cold_blocks)
+{
+  memoryStats_T before, after;
+
+  vimGetMemoryStats(buf, &before);
+  waitAnHour();
+  long count = vimCompressColdBlocks();
+  vimGetMemoryStats(buf, &after);
+  printf("compressed %ld of %ld blocks, saved %lu bytes, memline %lu -> %lu\n",
+         count, after.blocks, after.compress_saved, before.memline,
+         after.memline);
+
+  // The count includes the blocks of the other buffers
+  mu_check(count > 0);
+  mu_check(after.compressed_blocks > 0 && after.compressed_blocks <= count);
+  mu_check(after.compress_saved > 0);
+  mu_check(after.compressed > 0);
+  mu_check(after.memline < before.memline);
+
+  // Nothing left to compress
+  mu_check(vimCompressColdBlocks() == 0);
+
+  // The text is unchanged, the blocks get uncompressed when used
+  mu_check(linesMatch());
+  vimGetMemoryStats(buf, &after);
+  mu_check(after.compressed_blocks == 0);
+  mu_check(after.compress_saved == 0);
+}
+
+MU_TEST(test_compressed_after_command)
+{
+  memoryStats_T stats;
+
+  waitAnHour();
+  vimExecute("echo 'cold'");
+  vimGetMemoryStats(buf, &stats);
+  mu_check(stats.compressed_blocks > 0);
+}
+
+MU_TEST(test_edit_after_compress)
+{
+  waitAnHour();
+  mu_check(vimCompressColdBlocks() > 0);
+
+  vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("100,200d");
+  vimExecute("$");
+  vimInput("o");
+  vimInput("added line");
+  vimKey("<esc>");
+  mu_check(vimBufferGetLineCount(buf) == lines.ga_len - 100);
+  mu_check(STRCMP(vimBufferGetLine(buf, 100),
+                  ((char_u **)lines.ga_data)[200]) == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, vimBufferGetLineCount(buf)),
+                  "added line") == 0);
+
+  vimExecute("e!");
+  mu_check(linesMatch());
+}
+
+MU_TEST(test_snapshot_after_compress)
+{
+  waitAnHour();
+  mu_check(vimCompressColdBlocks() > 0);
+
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  mu_check(snapshot != NULL);
+  mu_check(vimSnapshotGetLineCount(snapshot) == lines.ga_len);
+  mu_check(STRCMP(vimSnapshotGetLine(snapshot, lines.ga_len),
+                  ((char_u **)lines.ga_data)[lines.ga_len - 1]) == 0);
+  vimSnapshotRelease(snapshot);
+}
+
+MU_TEST(test_swap_file_written_compressed)
+{
+  vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("1d");
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+
+  waitAnHour();
+  mu_check(vimCompressColdBlocks() > 0);
+
+  // Dirty blocks are uncompressed to write them
+  vimExecute("preserve");
+  vimExecute("b #");
+  mu_check(vimBufferGetLineCount(buf) == lines.ga_len - 1);
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), ((char_u **)lines.ga_data)[1]) == 0);
+  vimExecute("e!");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_disabled_by_default);
+  MU_RUN_TEST(test_recently_used_not_compressed);
+  MU_RUN_TEST(test_compress_cold_blocks);
+  MU_RUN_TEST(test_compressed_after_command);
+  MU_RUN_TEST(test_edit_after_compress);
+  MU_RUN_TEST(test_snapshot_after_compress);
+  MU_RUN_TEST(test_swap_file_written_compressed);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
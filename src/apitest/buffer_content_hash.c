@@ -0,0 +1,234 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 200000
+
+static char_u *fname;
+static buf_T *buf;
+
+static void sha256Hex(char_u *data, size_t len, size_t step, char *hex)
+{
+  context_sha256_T ctx;
+  char_u digest[32];
+
+  sha256_start(&ctx);
+  for (size_t done = 0; done < len; done += step)
+  {
+    sha256_update(&ctx, data + done, (UINT32_T)(len - done < step ? len - done : step));
+  }
+  sha256_finish(&ctx, digest);
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+}
+
+static double secondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('h', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 1; i <= LINE_COUNT; i++)
+  {
+    fprintf(fp, "line %d of the file\n", i);
+  }
+  fclose(fp);
+  buf = vimBufferOpen(fname, 1, 0);
+}
+
+void test_teardown(void)
+{
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  mch_remove(fname);
+  VIM_CLEAR(fname);
+}
+
+MU_TEST(test_sha256)
+{
+  char hex[65];
+  char_u *million = alloc(1000000);
+
+  sha256Hex((char_u *)"", 0, 1, hex);
+  mu_check(strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") == 0);
+  sha256Hex((char_u *)"abc", 3, 3, hex);
+  mu_check(strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+  sha256Hex((char_u *)"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, 56, hex);
+  mu_check(strcmp(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1") == 0);
+
+  // Many blocks at once and odd pieces that span blocks
+  vim_memset(million, 'a', 1000000);
+  sha256Hex(million, 1000000, 1000000, hex);
+  mu_check(strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0);
+  sha256Hex(million, 1000000, 997, hex);
+  mu_check(strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0);
+  vim_free(million);
+}
+
+MU_TEST(test_hash_changes_with_text)
+{
+  char_u before[32], after[32], undone[32];
+
+  mu_check(vimBufferGetContentHash(buf, before));
+
+  // Same length, only the text differs
+  vimExecute("1000");
+  vimInput("r");
+  vimInput("X");
+  mu_check(vimBufferGetContentHash(buf, after));
+  mu_check(memcmp(before, after, 32) != 0);
+
+  vimInput("u");
+  mu_check(vimBufferGetContentHash(buf, undone));
+  mu_check(memcmp(before, undone, 32) == 0);
+
+  // Deleting an empty line at the end changes the hash
+  vimExecute("$");
+  vimInput("o");
+  vimKey("<esc>");
+  mu_check(vimBufferGetContentHash(buf, after));
+  mu_check(memcmp(before, after, 32) != 0);
+  vimExecute("$d");
+  mu_check(vimBufferGetContentHash(buf, undone));
+  mu_check(memcmp(before, undone, 32) == 0);
+}
+
+MU_TEST(test_hash_changes_in_place)
+{
+  char_u before[32], after[32];
+
+  // "~" and "gUU" change the text without replacing the line
+  mu_check(vimBufferGetContentHash(buf, before));
+  vimExecute("1000");
+  vimInput("~");
+  mu_check(vimBufferGetContentHash(buf, after));
+  mu_check(memcmp(before, after, 32) != 0);
+
+  memcpy(before, after, 32);
+  vimExecute("2000");
+  vimInput("g");
+  vimInput("U");
+  vimInput("U");
+  mu_check(vimBufferGetContentHash(buf, after));
+  mu_check(memcmp(before, after, 32) != 0);
+}
+
+MU_TEST(test_same_text_same_hash)
+{
+  char_u loaded[32], built[32];
+  char line[64];
+  char_u *lines[1];
+
+  mu_check(vimBufferGetContentHash(buf, loaded));
+
+  // Build the same text backwards, the lines end up in different chunks
+  buf_T *other = vimBufferNew(0);
+  vimBufferSetCurrent(other);
+  lines[0] = (char_u *)line;
+  for (int i = LINE_COUNT; i >= 1; i--)
+  {
+    sprintf(line, "line %d of the file", i);
+    vimBufferSetLines(other, 0, i == LINE_COUNT ? 1 : 0, lines, 1);
+  }
+  mu_check(vimBufferGetLineCount(other) == LINE_COUNT);
+  mu_check(vimBufferGetContentHash(other, built));
+  mu_check(memcmp(loaded, built, 32) == 0);
+
+  vimExecute("bwipe!");
+  vimBufferSetCurrent(buf);
+}
+
+MU_TEST(test_only_changed_lines_hashed)
+{
+  char_u hash[32];
+
+  clock_t start = clock();
+  vimBufferGetContentHash(buf, hash);
+  double first = secondsSince(start);
+
+  vimExecute("5000");
+  vimInput("x");
+  start = clock();
+  vimBufferGetContentHash(buf, hash);
+  double again = secondsSince(start);
+  printf("hash of %d lines: %f seconds, after a change: %f seconds\n",
+         LINE_COUNT, first, again);
+  mu_check(again * 4 < first);
+}
+
+MU_TEST(test_undo_file_checked_with_hash)
+{
+  char_u *undoName;
+
+  vimExecute("set undofile");
+  vimExecute("100,200d");
+  vimExecute("w");
+  undoName = u_get_undo_file_name(buf->b_ffname, FALSE);
+
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  buf = vimBufferOpen(fname, 1, 0);
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+
+  vimExecute("set undofile&");
+  mch_remove(undoName);
+  vim_free(undoName);
+}
+
+MU_TEST(test_undo_file_after_change_in_place)
+{
+  char_u *undoName;
+
+  vimExecute("set undofile");
+  vimExecute("100");
+  vimInput("~");
+  vimExecute("w");
+  undoName = u_get_undo_file_name(buf->b_ffname, FALSE);
+
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  buf = vimBufferOpen(fname, 1, 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, 100), "Line 100 of the file") == 0);
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 100), "line 100 of the file") == 0);
+
+  vimExecute("set undofile&");
+  mch_remove(undoName);
+  vim_free(undoName);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_sha256);
+  MU_RUN_TEST(test_hash_changes_with_text);
+  MU_RUN_TEST(test_hash_changes_in_place);
+  MU_RUN_TEST(test_same_text_same_hash);
+  MU_RUN_TEST(test_only_changed_lines_hashed);
+  MU_RUN_TEST(test_undo_file_checked_with_hash);
+  MU_RUN_TEST(test_undo_file_after_change_in_place);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
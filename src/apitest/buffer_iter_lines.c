@@ -0,0 +1,194 @@
+#include "libvim.h"
+#include "minunit.h"
+
+typedef struct
+{
+  buf_T *buf;
+  linenr_T next;
+  linenr_T stop;
+  int ok;
+} check_T;
+
+// Compare each line handed out with the line the caller gets from
+// `vimBufferGetLine`, saved before the walk.
+static char_u **expected;
+static linenr_T lineCount;
+
+static int checkLine(void *context, linenr_T lnum, char_u *line, size_t len)
+{
+  check_T *check = (check_T *)context;
+
+  if (lnum != check->next || len != STRLEN(expected[lnum]) ||
+      memcmp(line, expected[lnum], len) != 0)
+  {
+    printf("line %ld does not match\n", (long)lnum);
+    check->ok = FALSE;
+    return FALSE;
+  }
+  check->next++;
+  return lnum != check->stop;
+}
+
+static void saveLines(buf_T *buf)
+{
+  lineCount = vimBufferGetLineCount(buf);
+  expected = ALLOC_MULT(char_u *, lineCount + 1);
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    expected[lnum] = vim_strsave(vimBufferGetLine(buf, lnum));
+  }
+}
+
+static void freeLines(void)
+{
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    vim_free(expected[lnum]);
+  }
+  VIM_CLEAR(expected);
+}
+
+static char *readFile(char *fname, size_t *len)
+{
+  FILE *fp = fopen(fname, "rb");
+  char *contents = malloc(1024 * 1024);
+  *len = fread(contents, 1, 1024 * 1024, fp);
+  fclose(fp);
+  return contents;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_iter_all_lines)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  saveLines(buf);
+
+  check_T check = {buf, 1, 0, TRUE};
+  mu_check(vimBufferIterLines(buf, 1, lineCount, checkLine, &check));
+  mu_check(check.ok);
+  mu_check(check.next == lineCount + 1);
+
+  freeLines();
+}
+
+MU_TEST(test_iter_range_and_stop)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  saveLines(buf);
+
+  check_T check = {buf, 1000, 2000, TRUE};
+  mu_check(vimBufferIterLines(buf, 1000, 3000, checkLine, &check));
+  mu_check(check.ok);
+  mu_check(check.next == 2001);
+
+  // The end is limited to the last line
+  check_T tail = {buf, lineCount - 5, 0, TRUE};
+  mu_check(vimBufferIterLines(buf, lineCount - 5, lineCount + 100, checkLine, &tail));
+  mu_check(tail.ok);
+  mu_check(tail.next == lineCount + 1);
+
+  freeLines();
+}
+
+MU_TEST(test_iter_changed_line)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  // Leave the changed line in allocated memory
+  vimExecute("100");
+  vimInput("I");
+  vimInput("changed ");
+  vimKey("<esc>");
+  saveLines(buf);
+  mu_check(STRNCMP(expected[100], "changed ", 8) == 0);
+
+  check_T check = {buf, 1, 0, TRUE};
+  mu_check(vimBufferIterLines(buf, 1, lineCount, checkLine, &check));
+  mu_check(check.ok);
+  mu_check(STRCMP(vimBufferGetLine(buf, 100), expected[100]) == 0);
+
+  freeLines();
+  vimExecute("e!");
+}
+
+MU_TEST(test_serialize_matches_file)
+{
+  buf_T *buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  size_t fileLen;
+  char *contents = readFile("collateral/large-c-file.c", &fileLen);
+
+  size_t len = vimBufferSerialize(buf, EOL_UNKNOWN, NULL, 0);
+  mu_check(len == fileLen);
+
+  char_u *dest = alloc(len);
+  mu_check(vimBufferSerialize(buf, EOL_UNIX, dest, len) == len);
+  mu_check(memcmp(dest, contents, len) == 0);
+
+  vim_free(dest);
+  free(contents);
+}
+
+MU_TEST(test_serialize_eol_styles)
+{
+  buf_T *buf = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  char_u dest[256];
+  size_t len;
+
+  len = vimBufferSerialize(buf, EOL_DOS, dest, sizeof(dest));
+  mu_check(len == 115 + 3);
+  mu_check(memcmp(dest, "This is the first line of a test file\r\n", 39) == 0);
+  mu_check(memcmp(dest + len - 2, "\r\n", 2) == 0);
+
+  len = vimBufferSerialize(buf, EOL_MAC, dest, sizeof(dest));
+  mu_check(len == 115);
+  mu_check(dest[37] == '\r');
+
+  // No end-of-line after the last line for 'noeol'
+  vimExecute("set nofixeol noeol");
+  len = vimBufferSerialize(buf, EOL_UNIX, dest, sizeof(dest));
+  mu_check(len == 114);
+  mu_check(dest[len - 1] == 'e');
+  vimExecute("set fixeol eol");
+}
+
+MU_TEST(test_serialize_truncated)
+{
+  buf_T *buf = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  char_u dest[16];
+
+  memset(dest, 'x', sizeof(dest));
+  mu_check(vimBufferSerialize(buf, EOL_UNIX, dest, 10) == 115);
+  mu_check(memcmp(dest, "This is th", 10) == 0);
+  mu_check(dest[10] == 'x');
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_iter_all_lines);
+  MU_RUN_TEST(test_iter_range_and_stop);
+  MU_RUN_TEST(test_iter_changed_line);
+  MU_RUN_TEST(test_serialize_matches_file);
+  MU_RUN_TEST(test_serialize_eol_styles);
+  MU_RUN_TEST(test_serialize_truncated);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,134 @@
+#include "libvim.h"
+#include "minunit.h"
+
+static buf_T *buf;
+static char_u **expected;
+static linenr_T lineCount;
+
+static void saveLines(void)
+{
+  lineCount = vimBufferGetLineCount(buf);
+  expected = ALLOC_MULT(char_u *, lineCount + 1);
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    expected[lnum] = vim_strsave(vimBufferGetLine(buf, lnum));
+  }
+}
+
+static void freeLines(void)
+{
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    vim_free(expected[lnum]);
+  }
+  VIM_CLEAR(expected);
+}
+
+static int lineMatches(linenr_T lnum, linenr_T expectedLnum)
+{
+  return STRCMP(vimBufferGetLine(buf, lnum), expected[expectedLnum]) == 0;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+  vimExecute("e!");
+
+  buf = curbuf;
+  saveLines();
+}
+
+void test_teardown(void) { freeLines(); }
+
+MU_TEST(test_alternating_lines_hit_cache)
+{
+  long hitsBefore, missesBefore, hits, misses;
+  linenr_T places[] = {10, lineCount / 3, lineCount / 2, lineCount - 10};
+  int ok = TRUE;
+
+  vimBufferGetLineCacheStats(buf, &hitsBefore, &missesBefore);
+  for (int i = 0; i < 1000; i++)
+  {
+    for (int j = 0; j < 4; j++)
+    {
+      ok = ok && lineMatches(places[j], places[j]);
+      ok = ok && lineMatches(places[j] + 1, places[j] + 1);
+    }
+  }
+  vimBufferGetLineCacheStats(buf, &hits, &misses);
+
+  printf("hits: %ld misses: %ld\n", hits - hitsBefore, misses - missesBefore);
+  mu_check(ok);
+  mu_check(hits - hitsBefore >= 3990);
+  mu_check(misses - missesBefore <= 10);
+}
+
+MU_TEST(test_cache_after_delete)
+{
+  linenr_T far = lineCount - 100;
+
+  // Get the far lines in the cache, then delete a line before them
+  mu_check(lineMatches(far, far));
+  mu_check(lineMatches(20, 20));
+  vimExecute("50d");
+
+  mu_check(lineMatches(far, far + 1));
+  mu_check(lineMatches(20, 20));
+  mu_check(lineMatches(far - 1, far));
+  mu_check(lineMatches(50, 51));
+
+  vimExecute("u");
+  mu_check(lineMatches(far, far));
+  mu_check(lineMatches(50, 50));
+}
+
+MU_TEST(test_cache_after_insert)
+{
+  linenr_T far = lineCount - 100;
+
+  mu_check(lineMatches(far, far));
+  mu_check(lineMatches(5, 5));
+  for (int i = 0; i < 200; i++)
+  {
+    // Also splits the data block of line 30
+    vimExecute("30t30");
+  }
+
+  mu_check(lineMatches(far + 200, far));
+  mu_check(lineMatches(5, 5));
+  mu_check(lineMatches(230, 30));
+  mu_check(lineMatches(231, 31));
+
+  for (linenr_T lnum = 231; lnum <= lineCount + 200; lnum++)
+  {
+    if (!lineMatches(lnum, lnum - 200))
+    {
+      mu_check(FALSE);
+      break;
+    }
+  }
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_alternating_lines_hit_cache);
+  MU_RUN_TEST(test_cache_after_delete);
+  MU_RUN_TEST(test_cache_after_insert);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  vimBufferOpen("collateral/large-c-file.c", 1, 0);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
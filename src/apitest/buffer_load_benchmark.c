@@ -0,0 +1,265 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 400000
+
+static char_u *fname;
+
+static double secondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Write LINE_COUNT lines made with `format`, ending each in `eol`.
+static void writeFile(char *format, char *eol)
+{
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 0; i < LINE_COUNT; i++)
+  {
+    fprintf(fp, format, i);
+    fputs(eol, fp);
+  }
+  fclose(fp);
+}
+
+static buf_T *loadFile(char *what)
+{
+  clock_t start = clock();
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  printf("Load %d lines (%s): %fs\n", LINE_COUNT, what, secondsSince(start));
+  return buf;
+}
+
+static int linesMatch(buf_T *buf, char *format)
+{
+  char expected[256];
+
+  if (vimBufferGetLineCount(buf) != LINE_COUNT)
+  {
+    printf("expected %d lines but got %ld\n", LINE_COUNT,
+           (long)vimBufferGetLineCount(buf));
+    return FALSE;
+  }
+
+  for (linenr_T lnum = 1; lnum <= LINE_COUNT; lnum++)
+  {
+    sprintf(expected, format, (int)lnum - 1);
+    if (STRCMP(vimBufferGetLine(buf, lnum), expected) != 0)
+    {
+      printf("line %ld: expected '%s' but got '%s'\n", (long)lnum, expected,
+             vimBufferGetLine(buf, lnum));
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// The byte-at-a-time split that readfile() used to do.
+static long countLinesPlain(char_u *p, size_t len)
+{
+  long count = 0;
+
+  for (char_u *end = p + len; p < end; p++)
+  {
+    if (*p == NUL || *p == NL)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+static long countLinesScan(char_u *p, size_t len)
+{
+  long count = 0;
+
+  for (char_u *end = p + len; (p = vim_memchr3(p, end - p, NUL, NL, NL)) != NULL;
+       p++)
+  {
+    count++;
+  }
+  return count;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+  vimExecute("set fileformats=unix,dos,mac");
+  vimExecute("set fileencodings=utf-8,latin1");
+
+  fname = vim_tempname('l', FALSE);
+}
+
+void test_teardown(void)
+{
+  // Open another buffer, so the next load of the file is read again
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(fname);
+  VIM_CLEAR(fname);
+}
+
+MU_TEST(test_kernels_match_plain_loops)
+{
+  char_u text[200];
+
+  // Every length and position, to cover the vector and the tail loops
+  for (int len = 0; len < 100; len++)
+  {
+    for (int offset = 0; offset < 4; offset++)
+    {
+      char_u *p = text + offset;
+
+      memset(text, 'a', sizeof(text));
+      mu_check(vim_memchr3(p, len, NUL, NL, CAR) == NULL);
+      mu_check(vim_memcount(p, len, 'a') == (size_t)len);
+      mu_check(vim_ascii_len(p, len) == (size_t)len);
+
+      for (int i = 0; i < len; i++)
+      {
+        memset(text, 'a', sizeof(text));
+        p[i] = CAR;
+        p[len] = NL;
+        mu_check(vim_memchr3(p, len, NUL, NL, CAR) == p + i);
+        mu_check(vim_memcount(p, len, CAR) == 1);
+
+        p[i] = 0xc3;
+        mu_check(vim_ascii_len(p, len) == (size_t)i);
+      }
+    }
+  }
+}
+
+MU_TEST(test_scan_speed)
+{
+  writeFile("Line %d of a file with some text on it", "\n");
+
+  FILE *fp = fopen((char *)fname, "rb");
+  char_u *contents = alloc(32 * 1024 * 1024);
+  size_t len = fread(contents, 1, 32 * 1024 * 1024, fp);
+  fclose(fp);
+
+  clock_t start = clock();
+  long plainCount = countLinesPlain(contents, len);
+  double plainTime = secondsSince(start);
+
+  start = clock();
+  long scanCount = countLinesScan(contents, len);
+  double scanTime = secondsSince(start);
+
+  printf("Split %lu bytes - byte loop: %fs vim_memchr3: %fs\n",
+         (unsigned long)len, plainTime, scanTime);
+  mu_check(plainCount == LINE_COUNT);
+  mu_check(scanCount == LINE_COUNT);
+
+  start = clock();
+  mu_check(utf_valid_len(contents, (long)len) == (long)len);
+  printf("Check %lu bytes of UTF-8: %fs\n", (unsigned long)len,
+         secondsSince(start));
+
+  vim_free(contents);
+}
+
+MU_TEST(test_load_unix)
+{
+  writeFile("Line %d of a file with some text on it", "\n");
+
+  buf_T *buf = loadFile("unix");
+  mu_check(vimBufferGetFileFormat(buf) == EOL_UNIX);
+  mu_check(linesMatch(buf, "Line %d of a file with some text on it"));
+}
+
+MU_TEST(test_load_dos)
+{
+  writeFile("Line %d of a file with some text on it", "\r\n");
+
+  buf_T *buf = loadFile("dos");
+  mu_check(vimBufferGetFileFormat(buf) == EOL_DOS);
+  mu_check(linesMatch(buf, "Line %d of a file with some text on it"));
+}
+
+MU_TEST(test_load_mac)
+{
+  writeFile("Line %d of a file with some text on it", "\r");
+
+  buf_T *buf = loadFile("mac");
+  mu_check(vimBufferGetFileFormat(buf) == EOL_MAC);
+  mu_check(linesMatch(buf, "Line %d of a file with some text on it"));
+}
+
+MU_TEST(test_load_utf8)
+{
+  writeFile("Line %d: \xc3\xa9t\xc3\xa9, \xe6\x97\xa5\xe6\x9c\xac, "
+            "\xf0\x9f\x98\x80 and some ASCII",
+            "\n");
+
+  buf_T *buf = loadFile("utf-8");
+  mu_check(STRCMP(buf->b_p_fenc, "utf-8") == 0);
+  mu_check(linesMatch(buf, "Line %d: \xc3\xa9t\xc3\xa9, \xe6\x97\xa5\xe6\x9c\xac, "
+                           "\xf0\x9f\x98\x80 and some ASCII"));
+}
+
+MU_TEST(test_load_illegal_utf8)
+{
+  writeFile("Line %d with some text on it", "\n");
+
+  // An illegal byte far into the file makes it latin1
+  FILE *fp = fopen((char *)fname, "ab");
+  fputs("caf\xe9\n", fp);
+  fclose(fp);
+
+  buf_T *buf = loadFile("latin1");
+  mu_check(STRCMP(buf->b_p_fenc, "latin1") == 0);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT + 1);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT + 1), "caf\xc3\xa9") == 0);
+}
+
+MU_TEST(test_load_nul_bytes)
+{
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 0; i < LINE_COUNT; i++)
+  {
+    fprintf(fp, "Line %d", i);
+    fputc(NUL, fp);
+    fputs("after NUL\n", fp);
+  }
+  fclose(fp);
+
+  buf_T *buf = loadFile("NUL bytes");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  // NULs are kept as NL in the memline
+  mu_check(STRCMP(vimBufferGetLine(buf, 10), "Line 9\nafter NUL") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT),
+                  "Line 399999\nafter NUL") == 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_kernels_match_plain_loops);
+  MU_RUN_TEST(test_scan_speed);
+  MU_RUN_TEST(test_load_unix);
+  MU_RUN_TEST(test_load_dos);
+  MU_RUN_TEST(test_load_mac);
+  MU_RUN_TEST(test_load_utf8);
+  MU_RUN_TEST(test_load_illegal_utf8);
+  MU_RUN_TEST(test_load_nul_bytes);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,170 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static buf_T *buf;
+
+static void printStats(char *what, memoryStats_T *stats)
+{
+  printf("%s: total %lu memline %lu snapshots %lu line cache %lu undo %lu "
+         "marks %lu folds %lu eval %lu buffer %lu\n",
+         what, stats->total, stats->memline, stats->snapshots,
+         stats->line_cache, stats->undo, stats->marks, stats->folds,
+         stats->eval, stats->buffer);
+  printf("  %ld blocks, %ld cached, %ld undo headers with %ld entries and "
+         "%ld lines\n",
+         stats->blocks, stats->cached_blocks, stats->undo_headers,
+         stats->undo_entries, stats->undo_lines);
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("e!");
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_loaded_buffer)
+{
+  memoryStats_T stats;
+
+  vimGetMemoryStats(buf, &stats);
+  printStats("loaded", &stats);
+
+  mu_check(stats.buffers == 1);
+  mu_check(stats.blocks > 0);
+  mu_check(stats.memline >= (long_u)stats.blocks * buf->b_ml.ml_mfp->mf_page_size);
+  mu_check(stats.undo_headers == 0);
+  mu_check(stats.buffer >= sizeof(buf_T) / 2);
+  mu_check(stats.total == stats.buffer + stats.memline + stats.snapshots +
+                              stats.line_cache + stats.undo + stats.marks +
+                              stats.folds + stats.eval);
+}
+
+MU_TEST(test_undo)
+{
+  memoryStats_T before, after;
+  long_u deletedBytes = 0;
+
+  vimGetMemoryStats(buf, &before);
+  for (linenr_T lnum = 100; lnum <= 200; lnum++)
+  {
+    deletedBytes += STRLEN(vimBufferGetLine(buf, lnum)) + 1;
+  }
+  vimExecute("100,200d");
+  vimGetMemoryStats(buf, &after);
+  printStats("after delete", &after);
+
+  mu_check(after.undo_headers == before.undo_headers + 1);
+  mu_check(after.undo_entries == before.undo_entries + 1);
+  mu_check(after.undo_lines == before.undo_lines + 101);
+  mu_check(after.undo >= before.undo + deletedBytes);
+
+  // Undo keeps the header for redo, reloading the file frees it
+  vimExecute("u");
+  vimExecute("e!");
+  vimGetMemoryStats(buf, &after);
+  mu_check(after.undo_headers == 0);
+  mu_check(after.undo == 0);
+}
+
+MU_TEST(test_folds)
+{
+  memoryStats_T before, after;
+
+  vimGetMemoryStats(buf, &before);
+  vimExecute("set foldmethod=manual");
+  vimExecute("1,10fold");
+  vimExecute("20,30fold");
+  vimGetMemoryStats(buf, &after);
+  printStats("with folds", &after);
+
+  mu_check(after.folds > before.folds);
+  vimExecute("normal! zE");
+}
+
+MU_TEST(test_buffer_variables)
+{
+  memoryStats_T before, after;
+
+  vimGetMemoryStats(buf, &before);
+  vimExecute("let b:big = repeat('x', 10000)");
+  vimGetMemoryStats(buf, &after);
+
+  mu_check(after.eval >= before.eval + 10000);
+  vimExecute("unlet b:big");
+}
+
+MU_TEST(test_snapshot)
+{
+  memoryStats_T before, after;
+
+  vimGetMemoryStats(buf, &before);
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  vimGetMemoryStats(buf, &after);
+  printStats("with snapshot", &after);
+
+  // The blocks in memory keep a copy of their text for the snapshot
+  mu_check(before.snapshots == 0);
+  mu_check(after.snapshots > 0);
+
+  vimSnapshotRelease(snapshot);
+}
+
+MU_TEST(test_global)
+{
+  memoryStats_T stats, bufStats, global;
+  char cmd[64];
+
+  buf_T *other = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimGetMemoryStats(buf, &stats);
+  vimGetMemoryStats(other, &bufStats);
+  vimGetGlobalMemoryStats(&global);
+  printStats("all buffers", &global);
+
+  int count = 0;
+  buf_T *b;
+  FOR_ALL_BUFFERS(b) { count++; }
+  mu_check(global.buffers == count);
+  mu_check(global.memline >= stats.memline + bufStats.memline);
+  mu_check(global.total >= stats.total + bufStats.total);
+  // File marks and jumplists are only in the global stats
+  mu_check(global.marks > stats.marks + bufStats.marks);
+
+  // An unloaded buffer has no memline
+  sprintf(cmd, "bunload! %d", vimBufferGetId(buf));
+  vimExecute(cmd);
+  vimGetMemoryStats(buf, &stats);
+  mu_check(stats.memline == 0);
+  mu_check(stats.blocks == 0);
+  mu_check(stats.undo == 0);
+  mu_check(stats.total > 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_loaded_buffer);
+  MU_RUN_TEST(test_undo);
+  MU_RUN_TEST(test_folds);
+  MU_RUN_TEST(test_buffer_variables);
+  MU_RUN_TEST(test_snapshot);
+  MU_RUN_TEST(test_global);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,258 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 20000
+
+// Write LINE_COUNT numbered lines ending in `eol` to a new temp file,
+// the last line only gets `eol` when `lastEol` is set.
+static char_u *makeFile(char *eol, int lastEol)
+{
+  char_u *fname = vim_tempname('m', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+
+  for (int i = 1; i <= LINE_COUNT; i++)
+  {
+    fprintf(fp, "Line %d of the mapped file", i);
+    if (i < LINE_COUNT || lastEol)
+    {
+      fputs(eol, fp);
+    }
+  }
+  fclose(fp);
+  return fname;
+}
+
+static int lineIs(buf_T *buf, linenr_T lnum, char *expected)
+{
+  char *line = (char *)vimBufferGetLine(buf, lnum);
+  if (strcmp(line, expected) != 0)
+  {
+    printf("line %ld: expected '%s' but got '%s'\n", (long)lnum, expected, line);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static int allLinesMatch(buf_T *buf)
+{
+  char expected[64];
+
+  for (linenr_T lnum = 1; lnum <= LINE_COUNT; lnum++)
+  {
+    sprintf(expected, "Line %ld of the mapped file", (long)lnum);
+    if (!lineIs(buf, lnum, expected))
+    {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+  vimOptionSetMmapThreshold(1);
+}
+
+void test_teardown(void) { vimOptionSetMmapThreshold(0); }
+
+MU_TEST(test_open_mapped)
+{
+  char_u *fname = makeFile("\n", TRUE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(vimBufferGetFileFormat(buf) == EOL_UNIX);
+  mu_check(buf->b_p_eol == TRUE);
+  mu_check(allLinesMatch(buf));
+
+  // Byte offsets are known without copying the blocks
+  mu_check(ml_find_line_or_offset(buf, LINE_COUNT, NULL) ==
+           ml_find_line_or_offset(buf, LINE_COUNT - 1, NULL) +
+               (long)STRLEN(vimBufferGetLine(buf, LINE_COUNT - 1)) + 1);
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_threshold)
+{
+  char_u *fname = makeFile("\n", TRUE);
+  vimOptionSetMmapThreshold(1024 * 1024 * 1024);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(!vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(allLinesMatch(buf));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_no_eol)
+{
+  char_u *fname = makeFile("\n", FALSE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(buf->b_p_eol == FALSE);
+  mu_check(allLinesMatch(buf));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_dos_file)
+{
+  char_u *fname = makeFile("\r\n", TRUE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(vimBufferIsMapped(buf));
+  mu_check(vimBufferGetFileFormat(buf) == EOL_DOS);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(allLinesMatch(buf));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_invalid_utf8_is_not_mapped)
+{
+  char_u *fname = vim_tempname('m', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  fputs("abc\n\xff\xfe latin1\n", fp);
+  fclose(fp);
+
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(!vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == 2);
+  mu_check(lineIs(buf, 1, "abc"));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_bom_is_not_mapped)
+{
+  char_u *fname = vim_tempname('m', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  fputs("\xef\xbb\xbf" "abc\ndef\n", fp);
+  fclose(fp);
+
+  // Without "ucs-bom" the file is not converted and could be mapped
+  vimExecute("set fileencodings=utf-8");
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("set fileencodings&");
+
+  // The BOM is not part of the text, 'bomb' is set to write it again
+  mu_check(!vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == 2);
+  mu_check(lineIs(buf, 1, "abc"));
+  mu_check(buf->b_p_bomb == TRUE);
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_edit_mapped)
+{
+  char_u *fname = makeFile("\n", TRUE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  vimExecute("10000");
+  vimInput("d");
+  vimInput("d");
+  vimInput("O");
+  vimInput("new line");
+  vimKey("<esc>");
+
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(lineIs(buf, 9999, "Line 9999 of the mapped file"));
+  mu_check(lineIs(buf, 10000, "new line"));
+  mu_check(lineIs(buf, 10001, "Line 10001 of the mapped file"));
+  mu_check(lineIs(buf, LINE_COUNT, "Line 20000 of the mapped file"));
+
+  vimExecute("u");
+  vimExecute("u");
+  mu_check(allLinesMatch(buf));
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_blocks_are_released)
+{
+  // With a small 'maxmem' unchanged blocks are dropped and copied again
+  vimExecute("set maxmem=16");
+  char_u *fname = makeFile("\n", TRUE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  mu_check(vimBufferIsMapped(buf));
+  mu_check(allLinesMatch(buf));
+  mu_check(buf->b_ml.ml_mfp->mf_used_count <= 20);
+
+  vimExecute("5000d");
+  mu_check(lineIs(buf, 5000, "Line 5001 of the mapped file"));
+  vimExecute("u");
+  mu_check(allLinesMatch(buf));
+  mu_check(buf->b_ml.ml_mfp->mf_used_count <= 20);
+
+  vimExecute("set maxmem&");
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_write_mapped_file)
+{
+  char_u *fname = makeFile("\n", TRUE);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+
+  vimExecute("1d");
+  vimExecute("w");
+
+  mu_check(!vimBufferIsMapped(buf));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 1);
+  mu_check(lineIs(buf, 1, "Line 2 of the mapped file"));
+  mu_check(lineIs(buf, LINE_COUNT - 1, "Line 20000 of the mapped file"));
+
+  char line[64];
+  FILE *fp = fopen((char *)fname, "rb");
+  fgets(line, sizeof(line), fp);
+  fclose(fp);
+  mu_check(strcmp(line, "Line 2 of the mapped file\n") == 0);
+
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_open_mapped);
+  MU_RUN_TEST(test_threshold);
+  MU_RUN_TEST(test_no_eol);
+  MU_RUN_TEST(test_dos_file);
+  MU_RUN_TEST(test_invalid_utf8_is_not_mapped);
+  MU_RUN_TEST(test_bom_is_not_mapped);
+  MU_RUN_TEST(test_edit_mapped);
+  MU_RUN_TEST(test_blocks_are_released);
+  MU_RUN_TEST(test_write_mapped_file);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
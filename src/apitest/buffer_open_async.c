@@ -0,0 +1,243 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 500000
+
+static int progressCount;
+static loadProgress_T lastProgress;
+static long appendedLines;
+
+static void onProgress(loadProgress_T *progress, void *context)
+{
+  progressCount++;
+  lastProgress = *progress;
+}
+
+static void onBufferUpdate(bufferUpdate_T update)
+{
+  // Appended lines don't change any existing line, unless all the lines
+  // are replaced when the file is read again
+  if (update.xtra > 0 && update.lnum != 1)
+  {
+    mu_check(update.lnum == update.lnume);
+    appendedLines += update.xtra;
+  }
+}
+
+// Write a file of "count" lines ending in "eol", with "eol" after the
+// last line when "lastEol" is TRUE.
+static char_u *writeFile(int count, char *eol, int lastEol)
+{
+  char_u *fname = vim_tempname('a', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+
+  for (int i = 1; i <= count; i++)
+  {
+    fprintf(fp, "line %d of the file%s", i, i < count || lastEol ? eol : "");
+  }
+  fclose(fp);
+  return fname;
+}
+
+static int linesMatch(buf_T *buf, linenr_T count)
+{
+  char line[64];
+
+  for (linenr_T lnum = 1; lnum <= count; lnum++)
+  {
+    sprintf(line, "line %ld of the file", (long)lnum);
+    if (STRCMP(vimBufferGetLine(buf, lnum), line) != 0)
+    {
+      printf("line %ld: '%s'\n", (long)lnum, vimBufferGetLine(buf, lnum));
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  progressCount = 0;
+  appendedLines = 0;
+  vim_memset(&lastProgress, 0, sizeof(lastProgress));
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_initial_lines_then_poll)
+{
+  char_u *fname = writeFile(LINE_COUNT, "\n", TRUE);
+  bufload_T *load = vimBufferOpenAsync(fname, 1, 0, 100, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+
+  // The top of the file is there right away
+  mu_check(buf == curbuf);
+  mu_check(vimBufferGetLineCount(buf) >= 100);
+  mu_check(vimBufferGetLineCount(buf) < LINE_COUNT);
+  mu_check(linesMatch(buf, 100));
+  mu_check(vimBufferGetModifiable(buf) == FALSE);
+  mu_check(progressCount == 1);
+  mu_check(lastProgress.state == LOAD_RUNNING);
+
+  linenr_T initial = vimBufferGetLineCount(buf);
+  while (vimBufferLoadPoll(load) == LOAD_RUNNING)
+  {
+    mu_check(lastProgress.lines == vimBufferGetLineCount(buf));
+  }
+
+  mu_check(lastProgress.state == LOAD_DONE);
+  mu_check(lastProgress.lines == LINE_COUNT);
+  mu_check(lastProgress.bytesRead == lastProgress.totalBytes);
+  mu_check(progressCount > 2);
+  mu_check(appendedLines == LINE_COUNT - initial);
+
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(linesMatch(buf, LINE_COUNT));
+  mu_check(vimBufferGetModifiable(buf) == TRUE);
+  mu_check(vimBufferGetModified(buf) == FALSE);
+  mu_check(vimBufferGetReadOnly(buf) == FALSE);
+  mu_check(buf->b_p_eol == TRUE);
+
+  // Editing works when done
+  vimInput("x");
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "ine 1 of the file") == 0);
+
+  vimBufferLoadFree(load);
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_dos_without_last_eol)
+{
+  char_u *fname = writeFile(LINE_COUNT, "\r\n", FALSE);
+  bufload_T *load = vimBufferOpenAsync(fname, 1, 0, 10, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+
+  mu_check(vimBufferLoadWait(load) == LOAD_DONE);
+  mu_check(vimBufferGetFileFormat(buf) == EOL_DOS);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(linesMatch(buf, LINE_COUNT));
+  mu_check(buf->b_p_eol == FALSE);
+
+  vimBufferLoadFree(load);
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_illegal_byte_after_initial_lines)
+{
+  char_u *fname = writeFile(LINE_COUNT, "\n", TRUE);
+  FILE *fp = fopen((char *)fname, "ab");
+
+  // A Latin-1 byte far below the first lines
+  fprintf(fp, "caf\xe9\n");
+  fclose(fp);
+
+  bufload_T *load = vimBufferOpenAsync(fname, 1, 0, 100, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+
+  mu_check(vimBufferGetLineCount(buf) < LINE_COUNT);
+  mu_check(STRCMP(buf->b_p_fenc, "utf-8") == 0);
+
+  // The file is read again with the next encoding in 'fileencodings'
+  mu_check(vimBufferLoadWait(load) == LOAD_DONE);
+  mu_check(STRCMP(buf->b_p_fenc, "latin1") == 0);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT + 1);
+  mu_check(linesMatch(buf, LINE_COUNT));
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT + 1), "caf\xc3\xa9") == 0);
+  mu_check(lastProgress.lines == LINE_COUNT + 1);
+  mu_check(vimBufferGetModifiable(buf) == TRUE);
+  mu_check(vimBufferGetModified(buf) == FALSE);
+  mu_check(vimBufferGetReadOnly(buf) == FALSE);
+
+  vimBufferLoadFree(load);
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_small_file_is_read_at_once)
+{
+  bufload_T *load = vimBufferOpenAsync((char_u *)"collateral/testfile.txt", 1, 0, 100, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+
+  mu_check(progressCount == 1);
+  mu_check(lastProgress.state == LOAD_DONE);
+  mu_check(vimBufferLoadPoll(load) == LOAD_DONE);
+  mu_check(vimBufferGetLineCount(buf) == 3);
+  mu_check(vimBufferGetModifiable(buf) == TRUE);
+
+  vimBufferLoadFree(load);
+}
+
+MU_TEST(test_cancel)
+{
+  char_u *fname = writeFile(LINE_COUNT, "\n", TRUE);
+  bufload_T *load = vimBufferOpenAsync(fname, 1, 0, 100, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+
+  vimBufferLoadPoll(load);
+  vimBufferLoadCancel(load);
+  mu_check(lastProgress.state == LOAD_CANCELLED);
+  mu_check(vimBufferLoadPoll(load) == LOAD_CANCELLED);
+
+  // The lines read stay, but writing them would truncate the file
+  linenr_T count = vimBufferGetLineCount(buf);
+  mu_check(count >= 100 && count < LINE_COUNT);
+  mu_check(linesMatch(buf, count));
+  mu_check(vimBufferGetReadOnly(buf) == TRUE);
+  mu_check(vimBufferGetModifiable(buf) == TRUE);
+
+  vimBufferLoadFree(load);
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_unload_while_loading)
+{
+  char_u *fname = writeFile(LINE_COUNT, "\n", TRUE);
+  bufload_T *load = vimBufferOpenAsync(fname, 1, 0, 100, onProgress, NULL);
+  buf_T *buf = vimBufferLoadGetBuffer(load);
+  char cmd[64];
+
+  sprintf(cmd, "bunload! %d", vimBufferGetId(buf));
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute(cmd);
+
+  mu_check(buf->b_ml.ml_mfp == NULL);
+  mu_check(lastProgress.state == LOAD_CANCELLED);
+  mu_check(vimBufferLoadPoll(load) == LOAD_CANCELLED);
+
+  vimBufferLoadFree(load);
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_initial_lines_then_poll);
+  MU_RUN_TEST(test_dos_without_last_eol);
+  MU_RUN_TEST(test_illegal_byte_after_initial_lines);
+  MU_RUN_TEST(test_small_file_is_read_at_once);
+  MU_RUN_TEST(test_cancel);
+  MU_RUN_TEST(test_unload_while_loading);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  vimSetBufferUpdateCallback(&onBufferUpdate);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,317 @@
+#include <utime.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 200000
+
+static char_u *fname;
+static int completeCount;
+static saveState_T lastState;
+static buf_T *lastBuf;
+static int failureCount;
+static writeFailureReason_T lastReason;
+
+static void onSaveComplete(buf_T *buf, saveState_T state, void *context)
+{
+  completeCount++;
+  lastState = state;
+  lastBuf = buf;
+}
+
+static void onWriteFailure(writeFailureReason_T reason, buf_T *buf)
+{
+  failureCount++;
+  lastReason = reason;
+}
+
+static void writeFile(char_u *name, int count)
+{
+  FILE *fp = fopen((char *)name, "wb");
+  for (int i = 0; i < count; i++)
+  {
+    fprintf(fp, "Line %d of the file\n", i);
+  }
+  fclose(fp);
+}
+
+// Check that the file has the lines of the buffer.
+static int fileMatches(buf_T *buf, char_u *name)
+{
+  FILE *fp = fopen((char *)name, "rb");
+  char line[256];
+  linenr_T lnum = 0;
+  int ok = TRUE;
+
+  while (ok && fgets(line, sizeof(line), fp) != NULL)
+  {
+    line[strlen(line) - 1] = NUL;
+    lnum++;
+    ok = lnum <= vimBufferGetLineCount(buf) &&
+         STRCMP(line, vimBufferGetLine(buf, lnum)) == 0;
+  }
+  fclose(fp);
+  return ok && lnum == vimBufferGetLineCount(buf);
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  completeCount = 0;
+  failureCount = 0;
+  lastBuf = NULL;
+  fname = vim_tempname('s', FALSE);
+  writeFile(fname, LINE_COUNT);
+}
+
+void test_teardown(void)
+{
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(fname);
+  VIM_CLEAR(fname);
+}
+
+MU_TEST(test_save)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1000,2000d");
+  mu_check(vimBufferGetModified(buf));
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(save != NULL);
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  mu_check(completeCount == 1);
+  mu_check(lastState == SAVE_DONE);
+  mu_check(lastBuf == buf);
+
+  mu_check(!vimBufferGetModified(buf));
+  mu_check(fileMatches(buf, fname));
+
+  // Done only once
+  mu_check(vimBufferSavePoll(save) == SAVE_DONE);
+  mu_check(completeCount == 1);
+  vimBufferSaveFree(save);
+
+  // Not reported as changed outside of libvim
+  mu_check(vimBufferCheckIfChanged(buf) == 0);
+}
+
+MU_TEST(test_poll)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  int polls = 0;
+  while (vimBufferSavePoll(save) == SAVE_RUNNING)
+  {
+    polls++;
+  }
+  printf("polled %d times\n", polls);
+
+  mu_check(completeCount == 1);
+  mu_check(lastState == SAVE_DONE);
+  mu_check(!vimBufferGetModified(buf));
+  mu_check(fileMatches(buf, fname));
+  vimBufferSaveFree(save);
+}
+
+MU_TEST(test_edit_while_saving)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  vimExecute("1,100d");
+  vimExecute("$");
+  vimInput("o");
+  vimInput("added while saving");
+  vimKey("<esc>");
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+
+  // The file has the lines from when the save started
+  mu_check(vimBufferGetModified(buf));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 100);
+  vimExecute("e!");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 1);
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "Line 1 of the file") == 0);
+}
+
+MU_TEST(test_save_while_saving)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  // The second save starts after the first one is done
+  bufsave_T *first = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  vimExecute("1,100d");
+  bufsave_T *second = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(vimBufferSavePoll(first) == SAVE_DONE);
+  mu_check(vimBufferSaveWait(second) == SAVE_DONE);
+  mu_check(vimBufferSavePoll(first) == SAVE_DONE);
+  vimBufferSaveFree(first);
+  vimBufferSaveFree(second);
+
+  mu_check(completeCount == 2);
+  mu_check(failureCount == 0);
+  mu_check(!vimBufferGetModified(buf));
+  mu_check(fileMatches(buf, fname));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 101);
+}
+
+MU_TEST(test_write_while_saving)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  // ":w" waits for the save, it is not overwritten by it
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  vimExecute("1,100d");
+  vimExecute("w");
+  mu_check(completeCount == 1);
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+
+  mu_check(failureCount == 0);
+  mu_check(!vimBufferGetModified(buf));
+  mu_check(fileMatches(buf, fname));
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 101);
+}
+
+MU_TEST(test_keeps_permissions)
+{
+  mch_setperm(fname, 0640);
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  stat_T before, after;
+  mch_stat((char *)fname, &before);
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+  mch_stat((char *)fname, &after);
+
+  // A new file replaced the old one
+  mu_check(after.st_ino != before.st_ino);
+  mu_check((after.st_mode & 07777) == 0640);
+}
+
+MU_TEST(test_symlink)
+{
+  char_u *link = vim_tempname('l', FALSE);
+  mu_check(symlink((char *)fname, (char *)link) == 0);
+
+  buf_T *buf = vimBufferOpen(link, 1, 0);
+  vimExecute("1d");
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+
+  // The file the link points to was replaced, the link is kept
+  stat_T st;
+  mu_check(mch_lstat((char *)link, &st) == 0 && S_ISLNK(st.st_mode));
+  mu_check(fileMatches(buf, fname));
+
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  mch_remove(link);
+  vim_free(link);
+}
+
+MU_TEST(test_changed_since_read)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  // Make the file look changed
+  struct utimbuf times = {time(NULL) + 100, time(NULL) + 100};
+  utime((char *)fname, &times);
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(vimBufferSaveWait(save) == SAVE_FAILED);
+  vimBufferSaveFree(save);
+
+  mu_check(completeCount == 1);
+  mu_check(lastState == SAVE_FAILED);
+  mu_check(failureCount == 1);
+  mu_check(lastReason == FILE_CHANGED);
+  mu_check(vimBufferGetModified(buf));
+}
+
+MU_TEST(test_conversion_writes_right_away)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("set fileencoding=latin1");
+  vimExecute("1d");
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  mu_check(completeCount == 1);
+  mu_check(vimBufferSavePoll(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+
+  mu_check(!vimBufferGetModified(buf));
+  mu_check(fileMatches(buf, fname));
+}
+
+MU_TEST(test_unloaded_while_saving)
+{
+  buf_T *buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("1d");
+
+  bufsave_T *save = vimBufferSaveAsync(buf, onSaveComplete, NULL);
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  mu_check(vimBufferSaveWait(save) == SAVE_DONE);
+  vimBufferSaveFree(save);
+
+  mu_check(completeCount == 1);
+  mu_check(lastBuf == NULL);
+
+  // The snapshot was written
+  buf = vimBufferOpen(fname, 1, 0);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 1);
+}
+
+MU_TEST(test_no_file_name)
+{
+  buf_T *buf = vimBufferNew(0);
+  mu_check(vimBufferSaveAsync(buf, onSaveComplete, NULL) == NULL);
+  mu_check(completeCount == 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_save);
+  MU_RUN_TEST(test_poll);
+  MU_RUN_TEST(test_edit_while_saving);
+  MU_RUN_TEST(test_save_while_saving);
+  MU_RUN_TEST(test_write_while_saving);
+  MU_RUN_TEST(test_keeps_permissions);
+  MU_RUN_TEST(test_symlink);
+  MU_RUN_TEST(test_changed_since_read);
+  MU_RUN_TEST(test_conversion_writes_right_away);
+  MU_RUN_TEST(test_unloaded_while_saving);
+  MU_RUN_TEST(test_no_file_name);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  vimSetFileWriteFailureCallback(&onWriteFailure);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
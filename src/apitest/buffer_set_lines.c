@@ -152,6 +152,96 @@ MU_TEST(test_modified_is_set)
   mu_check(vimBufferGetModified(curbuf) == TRUE);
 }
 
+#define MANY_LINES 5000
+
+static char_u *manyLines[MANY_LINES];
+
+static void makeManyLines(const char *prefix)
+{
+  char buf[64];
+  for (int i = 0; i < MANY_LINES; i++)
+  {
+    vim_free(manyLines[i]);
+    sprintf(buf, "%s %d", prefix, i);
+    manyLines[i] = vim_strsave((char_u *)buf);
+  }
+}
+
+static long bytesBefore(linenr_T lnum)
+{
+  long total = 0;
+  for (linenr_T i = 1; i < lnum; i++)
+  {
+    total += STRLEN(vimBufferGetLine(curbuf, i)) + 1;
+  }
+  return total;
+}
+
+MU_TEST(test_replace_entire_buffer_with_many_lines)
+{
+  makeManyLines("many");
+  vimBufferSetLines(curbuf, 0, -1, manyLines, MANY_LINES);
+
+  mu_check(vimBufferGetLineCount(curbuf) == MANY_LINES);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1), "many 0") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 2500), "many 2499") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, MANY_LINES), "many 4999") == 0);
+
+  mu_check(lastLnum == 1);
+  mu_check(lastLnume == 4);
+  mu_check(lastXtra == MANY_LINES - 3);
+
+  // The byte offsets must be kept up-to-date
+  mu_check(ml_find_line_or_offset(curbuf, 4000, NULL) == bytesBefore(4000));
+}
+
+MU_TEST(test_splice_many_lines_in_middle)
+{
+  makeManyLines("first");
+  vimBufferSetLines(curbuf, 0, -1, manyLines, MANY_LINES);
+
+  makeManyLines("second");
+  vimBufferSetLines(curbuf, 1000, 1010, manyLines, MANY_LINES);
+
+  mu_check(vimBufferGetLineCount(curbuf) == 2 * MANY_LINES - 10);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1000), "first 999") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1001), "second 0") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1000 + MANY_LINES), "second 4999") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1001 + MANY_LINES), "first 1010") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 2 * MANY_LINES - 10), "first 4999") == 0);
+
+  mu_check(ml_find_line_or_offset(curbuf, 7000, NULL) == bytesBefore(7000));
+
+  // Regular edits still work after the splice
+  vimInput("7000G");
+  vimInput("d");
+  vimInput("d");
+  mu_check(strcmp(vimBufferGetLine(curbuf, 7000), "first 2010") == 0);
+  vimInput("O");
+  vimInput("typed");
+  vimKey("<esc>");
+  mu_check(strcmp(vimBufferGetLine(curbuf, 7000), "typed") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 7001), "first 2010") == 0);
+  mu_check(ml_find_line_or_offset(curbuf, 9000, NULL) == bytesBefore(9000));
+}
+
+MU_TEST(test_delete_many_lines)
+{
+  makeManyLines("many");
+  vimBufferSetLines(curbuf, 0, -1, manyLines, MANY_LINES);
+
+  vimBufferSetLines(curbuf, 10, MANY_LINES - 10, NULL, 0);
+  mu_check(vimBufferGetLineCount(curbuf) == 20);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 10), "many 9") == 0);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 11), "many 4990") == 0);
+
+  makeManyLines("many");
+  vimBufferSetLines(curbuf, 0, -1, manyLines, MANY_LINES);
+  vimBufferSetLines(curbuf, 0, -1, NULL, 0);
+  mu_check(vimBufferGetLineCount(curbuf) == 1);
+  mu_check(strcmp(vimBufferGetLine(curbuf, 1), "") == 0);
+}
+
 MU_TEST_SUITE(test_suite)
 {
   MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
@@ -166,6 +256,9 @@ MU_TEST_SUITE(test_suite)
   MU_RUN_TEST(test_replace_entire_buffer_with_more_lines_again);
   MU_RUN_TEST(test_version_is_incremented);
   MU_RUN_TEST(test_modified_is_set);
+  MU_RUN_TEST(test_replace_entire_buffer_with_many_lines);
+  MU_RUN_TEST(test_splice_many_lines_in_middle);
+  MU_RUN_TEST(test_delete_many_lines);
 }
 
 int main(int argc, char **argv)
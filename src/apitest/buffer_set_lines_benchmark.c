@@ -0,0 +1,123 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+
+#define LINE_COUNT 200000
+
+static char_u *lines[LINE_COUNT];
+
+static double secondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// The strategy `vimBufferSetLines` used before `ml_splice_buf`:
+// append every line, then delete the old lines one-by-one.
+static void setLinesOneByOne(buf_T *buf, linenr_T start, linenr_T end)
+{
+  for (int i = LINE_COUNT - 1; i >= 0; i--)
+  {
+    ml_append_buf(buf, start, lines[i], 0, FALSE);
+  }
+
+  for (linenr_T i = start; i < end; i++)
+  {
+    ml_delete_buf(buf, start + LINE_COUNT + 1, FALSE);
+  }
+}
+
+static int buffersMatch(buf_T *a, buf_T *b)
+{
+  if (vimBufferGetLineCount(a) != vimBufferGetLineCount(b))
+  {
+    return FALSE;
+  }
+
+  for (linenr_T lnum = 1; lnum <= vimBufferGetLineCount(a); lnum++)
+  {
+    char_u *line = vim_strsave(vimBufferGetLine(a, lnum));
+    int equal = STRCMP(line, vimBufferGetLine(b, lnum)) == 0;
+    vim_free(line);
+
+    if (!equal)
+    {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+void test_setup(void) {}
+
+void test_teardown(void) {}
+
+MU_TEST(test_replace_entire_buffer)
+{
+  buf_T *loopBuf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  buf_T *spliceBuf = vimBufferOpen("collateral/lines_100.txt", 1, 0);
+
+  clock_t start = clock();
+  setLinesOneByOne(loopBuf, 0, vimBufferGetLineCount(loopBuf));
+  double loopTime = secondsSince(start);
+
+  start = clock();
+  vimBufferSetLines(spliceBuf, 0, -1, lines, LINE_COUNT);
+  double spliceTime = secondsSince(start);
+
+  printf("Replace %d lines - line-by-line: %fs splice: %fs\n", LINE_COUNT,
+         loopTime, spliceTime);
+
+  mu_check(vimBufferGetLineCount(spliceBuf) == LINE_COUNT);
+  mu_check(buffersMatch(loopBuf, spliceBuf));
+}
+
+MU_TEST(test_insert_in_middle)
+{
+  buf_T *loopBuf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  buf_T *spliceBuf = vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimBufferSetLines(spliceBuf, 0, -1, lines, LINE_COUNT);
+  vimBufferSetLines(loopBuf, 0, -1, lines, LINE_COUNT);
+
+  clock_t start = clock();
+  setLinesOneByOne(loopBuf, LINE_COUNT / 2, LINE_COUNT / 2);
+  double loopTime = secondsSince(start);
+
+  start = clock();
+  vimBufferSetLines(spliceBuf, LINE_COUNT / 2, LINE_COUNT / 2, lines, LINE_COUNT);
+  double spliceTime = secondsSince(start);
+
+  printf("Insert %d lines - line-by-line: %fs splice: %fs\n", LINE_COUNT,
+         loopTime, spliceTime);
+
+  mu_check(vimBufferGetLineCount(spliceBuf) == 2 * LINE_COUNT);
+  mu_check(buffersMatch(loopBuf, spliceBuf));
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_replace_entire_buffer);
+  MU_RUN_TEST(test_insert_in_middle);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  char buf[64];
+  for (int i = 0; i < LINE_COUNT; i++)
+  {
+    sprintf(buf, "Line %d of the benchmark buffer", i);
+    lines[i] = vim_strsave((char_u *)buf);
+  }
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
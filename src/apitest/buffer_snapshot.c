@@ -0,0 +1,237 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#ifdef UNIX
+#include <pthread.h>
+#endif
+
+#define READER_COUNT 4
+
+static buf_T *buf;
+static char_u **expected;
+static linenr_T lineCount;
+
+static void saveLines(void)
+{
+  lineCount = vimBufferGetLineCount(buf);
+  expected = ALLOC_MULT(char_u *, lineCount + 1);
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    expected[lnum] = vim_strsave(vimBufferGetLine(buf, lnum));
+  }
+}
+
+static void freeLines(void)
+{
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    vim_free(expected[lnum]);
+  }
+  VIM_CLEAR(expected);
+}
+
+static int snapshotMatches(snapshot_T *snapshot)
+{
+  if (vimSnapshotGetLineCount(snapshot) != lineCount)
+  {
+    return FALSE;
+  }
+
+  for (linenr_T lnum = 1; lnum <= lineCount; lnum++)
+  {
+    if (STRCMP(vimSnapshotGetLine(snapshot, lnum), expected[lnum]) != 0)
+    {
+      printf("line %ld: expected '%s' but got '%s'\n", (long)lnum,
+             expected[lnum], vimSnapshotGetLine(snapshot, lnum));
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static int checkLine(void *context, linenr_T lnum, char_u *line, size_t len)
+{
+  int *ok = (int *)context;
+
+  if (len != STRLEN(expected[lnum]) || memcmp(line, expected[lnum], len) != 0)
+  {
+    *ok = FALSE;
+  }
+  return *ok;
+}
+
+typedef struct
+{
+  snapshot_T *snapshot;
+  int ok;
+} reader_T;
+
+static void *readSnapshot(void *context)
+{
+  reader_T *reader = (reader_T *)context;
+
+  reader->ok = TRUE;
+  for (int i = 0; i < 20 && reader->ok; i++)
+  {
+    vimSnapshotIterLines(reader->snapshot, 1, lineCount, checkLine, &reader->ok);
+  }
+  return NULL;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("e!");
+  saveLines();
+}
+
+void test_teardown(void) { freeLines(); }
+
+MU_TEST(test_snapshot_does_not_change)
+{
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  mu_check(snapshotMatches(snapshot));
+
+  vimExecute("100,200d");
+  vimExecute("1");
+  vimInput("I");
+  vimInput("changed ");
+  vimKey("<esc>");
+  vimExecute("$");
+  vimInput("o");
+  vimInput("new last line");
+  vimKey("<esc>");
+
+  mu_check(vimBufferGetLineCount(buf) == lineCount - 100);
+  mu_check(snapshotMatches(snapshot));
+  mu_check(vimSnapshotGetLine(snapshot, 0) == NULL);
+  mu_check(vimSnapshotGetLine(snapshot, lineCount + 1) == NULL);
+
+  // A new snapshot has the changes
+  snapshot_T *changed = vimBufferSnapshot(buf);
+  mu_check(vimSnapshotGetLineCount(changed) == lineCount - 100);
+  mu_check(STRNCMP(vimSnapshotGetLine(changed, 1), "changed ", 8) == 0);
+  mu_check(STRCMP(vimSnapshotGetLine(changed, lineCount - 100), "new last line") == 0);
+
+  vimSnapshotRelease(snapshot);
+  vimSnapshotRelease(changed);
+}
+
+MU_TEST(test_unchanged_blocks_are_shared)
+{
+  snapshot_T *first = vimBufferSnapshot(buf);
+
+  vimExecute("5000");
+  vimInput("0");
+  vimInput("x");
+  snapshot_T *second = vimBufferSnapshot(buf);
+
+  int shared = 0;
+  mu_check(first->ss_block_count == second->ss_block_count);
+  for (int i = 0; i < first->ss_block_count; i++)
+  {
+    if (first->ss_blocks[i] == second->ss_blocks[i])
+    {
+      shared++;
+    }
+  }
+  printf("%d of %d blocks shared\n", shared, first->ss_block_count);
+  mu_check(shared == first->ss_block_count - 1);
+
+  mu_check(snapshotMatches(first));
+  mu_check(STRCMP(vimSnapshotGetLine(second, 5000), expected[5000] + 1) == 0);
+
+  vimSnapshotRelease(first);
+  vimSnapshotRelease(second);
+}
+
+MU_TEST(test_iter_range)
+{
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  int ok = TRUE;
+
+  vimSnapshotIterLines(snapshot, lineCount - 300, lineCount + 10, checkLine, &ok);
+  mu_check(ok);
+
+  vimSnapshotRelease(snapshot);
+}
+
+MU_TEST(test_snapshot_outlives_buffer)
+{
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  char cmd[64];
+
+  sprintf(cmd, "bunload! %d", vimBufferGetId(buf));
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute(cmd);
+  mu_check(buf->b_ml.ml_mfp == NULL);
+
+  mu_check(snapshotMatches(snapshot));
+  vimSnapshotRelease(snapshot);
+}
+
+MU_TEST(test_read_from_threads)
+{
+  snapshot_T *snapshot = vimBufferSnapshot(buf);
+  reader_T readers[READER_COUNT];
+
+  for (int i = 0; i < READER_COUNT; i++)
+  {
+    readers[i].snapshot = snapshot;
+  }
+
+#ifdef UNIX
+  pthread_t threads[READER_COUNT];
+  for (int i = 0; i < READER_COUNT; i++)
+  {
+    pthread_create(&threads[i], NULL, readSnapshot, &readers[i]);
+  }
+#endif
+
+  // Keep editing, and taking and releasing snapshots, while they read
+  for (int i = 0; i < 50; i++)
+  {
+    vimExecute("1000,1500d");
+    vimSnapshotRelease(vimBufferSnapshot(buf));
+    vimExecute("u");
+  }
+
+  for (int i = 0; i < READER_COUNT; i++)
+  {
+#ifdef UNIX
+    pthread_join(threads[i], NULL);
+#else
+    readSnapshot(&readers[i]);
+#endif
+    mu_check(readers[i].ok);
+  }
+
+  vimSnapshotRelease(snapshot);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_snapshot_does_not_change);
+  MU_RUN_TEST(test_unchanged_blocks_are_shared);
+  MU_RUN_TEST(test_iter_range);
+  MU_RUN_TEST(test_snapshot_outlives_buffer);
+  MU_RUN_TEST(test_read_from_threads);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
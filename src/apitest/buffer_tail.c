@@ -0,0 +1,220 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static char_u *fname;
+static buf_T *buf;
+
+static int updateCount;
+static bufferUpdate_T lastUpdate;
+
+static void onBufferUpdate(bufferUpdate_T update)
+{
+  updateCount++;
+  lastUpdate = update;
+}
+
+static void appendToFile(char *mode, int start, int count)
+{
+  FILE *fp = fopen((char *)fname, mode);
+  for (int i = start; i < start + count; i++)
+  {
+    fprintf(fp, "line %d\n", i);
+  }
+  fclose(fp);
+}
+
+static void appendText(char *text)
+{
+  FILE *fp = fopen((char *)fname, "ab");
+  fputs(text, fp);
+  fclose(fp);
+}
+
+static int linesMatch(linenr_T start, linenr_T end)
+{
+  char line[64];
+
+  for (linenr_T lnum = start; lnum <= end; lnum++)
+  {
+    sprintf(line, "line %ld", (long)lnum);
+    if (STRCMP(vimBufferGetLine(buf, lnum), line) != 0)
+    {
+      printf("line %ld: '%s'\n", (long)lnum, vimBufferGetLine(buf, lnum));
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('t', FALSE);
+  appendToFile("wb", 1, 100);
+  buf = vimBufferOpen(fname, 1, 0);
+  vimBufferSetTailMode(buf, TRUE);
+
+  updateCount = 0;
+}
+
+void test_teardown(void)
+{
+  mch_remove(fname);
+  vim_free(fname);
+}
+
+MU_TEST(test_append_lines)
+{
+  mu_check(vimBufferGetTailMode(buf) == TRUE);
+  mu_check(vimBufferCheckIfChanged(buf) == 0);
+
+  appendToFile("ab", 101, 50);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+
+  mu_check(vimBufferGetLineCount(buf) == 150);
+  mu_check(linesMatch(1, 150));
+  mu_check(vimBufferGetModified(buf) == FALSE);
+  mu_check(updateCount == 1);
+  mu_check(lastUpdate.buf == buf);
+  mu_check(lastUpdate.lnum == 101);
+  mu_check(lastUpdate.lnume == 101);
+  mu_check(lastUpdate.xtra == 50);
+
+  appendToFile("ab", 151, 1);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 151);
+  mu_check(linesMatch(1, 151));
+  mu_check(updateCount == 2);
+}
+
+MU_TEST(test_undo_and_marks_are_kept)
+{
+  // Change the first line, and add a line at the end
+  vimInput("x");
+  vimExecute("50");
+  vimInput("ma");
+  vimExecute("$");
+  vimInput("o");
+  vimInput("typed");
+  vimKey("<esc>");
+  mu_check(vimBufferGetLineCount(buf) == 101);
+
+  appendToFile("ab", 101, 10);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 111);
+  mu_check(STRCMP(vimBufferGetLine(buf, 101), "typed") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, 111), "line 110") == 0);
+  mu_check(buf->b_namedm[0].lnum == 50);
+
+  // Undo removes the typed line, not the lines appended below it
+  vimExecute("u");
+  mu_check(vimBufferGetLineCount(buf) == 110);
+  mu_check(STRCMP(vimBufferGetLine(buf, 101), "line 101") == 0);
+
+  vimExecute("u");
+  mu_check(linesMatch(1, 110));
+  mu_check(vimBufferGetModified(buf) == FALSE);
+
+  // And redo puts them back in the same place
+  vimExecute("redo");
+  vimExecute("redo");
+  mu_check(vimBufferGetLineCount(buf) == 111);
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "ine 1") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, 101), "typed") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, 111), "line 110") == 0);
+
+  vimExecute("e!");
+}
+
+MU_TEST(test_partial_last_line)
+{
+  appendText("partial");
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 101);
+  mu_check(STRCMP(vimBufferGetLine(buf, 101), "partial") == 0);
+  mu_check(buf->b_p_eol == FALSE);
+
+  // The rest of the line replaces it
+  appendText(" line\nnext\n");
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 102);
+  mu_check(STRCMP(vimBufferGetLine(buf, 101), "partial line") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, 102), "next") == 0);
+  mu_check(buf->b_p_eol == TRUE);
+  mu_check(lastUpdate.lnum == 101);
+  mu_check(lastUpdate.lnume == 102);
+  mu_check(lastUpdate.xtra == 1);
+}
+
+MU_TEST(test_truncated_file_is_reloaded)
+{
+  appendToFile("wb", 1, 5);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 5);
+  mu_check(linesMatch(1, 5));
+
+  // And tail mode continues from there
+  appendToFile("ab", 6, 5);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 10);
+  mu_check(linesMatch(1, 10));
+  mu_check(lastUpdate.xtra == 5);
+}
+
+MU_TEST(test_rotated_file_is_reloaded)
+{
+  char_u *rotated = vim_tempname('r', FALSE);
+
+  vim_rename(fname, rotated);
+  appendToFile("wb", 1, 3);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 3);
+  mu_check(linesMatch(1, 3));
+
+  mch_remove(rotated);
+  vim_free(rotated);
+}
+
+MU_TEST(test_rewritten_file_is_reloaded)
+{
+  // Same lines, but longer, so the old end is in the middle of a line
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 1; i <= 100; i++)
+  {
+    fprintf(fp, "line %d!!\n", i);
+  }
+  fclose(fp);
+
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 100);
+  mu_check(STRCMP(vimBufferGetLine(buf, 100), "line 100!!") == 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_append_lines);
+  MU_RUN_TEST(test_undo_and_marks_are_kept);
+  MU_RUN_TEST(test_partial_last_line);
+  MU_RUN_TEST(test_truncated_file_is_reloaded);
+  MU_RUN_TEST(test_rotated_file_is_reloaded);
+  MU_RUN_TEST(test_rewritten_file_is_reloaded);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  vimSetBufferUpdateCallback(&onBufferUpdate);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,237 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 1000
+
+static char_u *fname;
+static buf_T *buf;
+
+static int updateCount;
+static bufferUpdate_T lastUpdate;
+
+// Copy of the lines, NULL for a line that an update said was changed
+static char_u **mirror;
+static linenr_T mirrorCount;
+
+static void onBufferUpdate(bufferUpdate_T update)
+{
+  if (update.buf != buf)
+  {
+    return;
+  }
+  updateCount++;
+  lastUpdate = update;
+
+  // Lines "lnum" to "lnume" are replaced with "lnume - lnum + xtra" lines
+  linenr_T count = update.lnume - update.lnum + update.xtra;
+  linenr_T removed = update.lnume - update.lnum;
+  mu_check(update.lnum >= 1 && removed >= 0 && count >= 0);
+  mu_check(update.lnume - 1 <= mirrorCount);
+
+  mirror = realloc(mirror, (mirrorCount + count + 1) * sizeof(char_u *));
+  for (linenr_T i = update.lnum - 1; i < update.lnume - 1; i++)
+  {
+    vim_free(mirror[i]);
+  }
+  memmove(mirror + update.lnum - 1 + count, mirror + update.lnume - 1,
+          (mirrorCount - (update.lnume - 1)) * sizeof(char_u *));
+  for (linenr_T i = 0; i < count; i++)
+  {
+    mirror[update.lnum - 1 + i] = NULL;
+  }
+  mirrorCount += update.xtra;
+}
+
+static void readMirror(void)
+{
+  for (linenr_T i = 0; i < mirrorCount; i++)
+  {
+    vim_free(mirror[i]);
+  }
+  mirrorCount = vimBufferGetLineCount(buf);
+  mirror = realloc(mirror, (mirrorCount + 1) * sizeof(char_u *));
+  for (linenr_T i = 0; i < mirrorCount; i++)
+  {
+    mirror[i] = vim_strsave(vimBufferGetLine(buf, i + 1));
+  }
+}
+
+// The lines that were not updated are where the buffer has them
+static int mirrorMatches(void)
+{
+  if (mirrorCount != (linenr_T)vimBufferGetLineCount(buf))
+  {
+    printf("mirror has %ld lines, buffer %ld\n", (long)mirrorCount,
+           (long)vimBufferGetLineCount(buf));
+    return FALSE;
+  }
+  for (linenr_T i = 0; i < mirrorCount; i++)
+  {
+    if (mirror[i] != NULL && STRCMP(mirror[i], vimBufferGetLine(buf, i + 1)) != 0)
+    {
+      printf("line %ld: '%s' in mirror, '%s' in buffer\n", (long)i + 1,
+             mirror[i], vimBufferGetLine(buf, i + 1));
+      return FALSE;
+    }
+  }
+  readMirror();
+  return TRUE;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('b', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 1; i <= LINE_COUNT; i++)
+  {
+    fprintf(fp, "line %d\n", i);
+  }
+  fclose(fp);
+  buf = vimBufferOpen(fname, 1, 0);
+
+  readMirror();
+  updateCount = 0;
+  vimSetBufferUpdateBatching(TRUE);
+}
+
+void test_teardown(void)
+{
+  vimSetBufferUpdateBatching(FALSE);
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  mch_remove(fname);
+  VIM_CLEAR(fname);
+}
+
+MU_TEST(test_substitute_is_one_update)
+{
+  // ":s" for each line
+  vimSetBufferUpdateBatching(FALSE);
+  vimExecute("g/^/s/line/LINE/");
+  mu_check(updateCount == LINE_COUNT);
+  mu_check(mirrorMatches());
+
+  updateCount = 0;
+  vimSetBufferUpdateBatching(TRUE);
+  vimExecute("g/^/s/LINE/line/");
+  mu_check(updateCount == 1);
+  mu_check(lastUpdate.lnum == 1);
+  mu_check(lastUpdate.lnume == LINE_COUNT + 1);
+  mu_check(lastUpdate.xtra == 0);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_separate_ranges)
+{
+  // Far apart: two updates, the second after the lines added by the first
+  vimExecute("10t10|500d");
+  mu_check(updateCount == 2);
+  mu_check(mirrorMatches());
+
+  vimExecute("200");
+  vimInput("d");
+  vimInput("d");
+  vimInput("2");
+  vimInput("0");
+  vimInput("k");
+  vimInput("y");
+  vimInput("y");
+  vimInput("3");
+  vimInput("p");
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_global_delete)
+{
+  // Deleting every other line merges into fewer updates
+  vimExecute("g/[13579]$/d");
+  mu_check(updateCount >= 1 && updateCount <= 100);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT / 2);
+  mu_check(mirrorMatches());
+
+  updateCount = 0;
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(updateCount <= 100);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_macro)
+{
+  vimInput("q");
+  vimInput("a");
+  vimInput("A");
+  vimInput("!");
+  vimKey("<esc>");
+  vimInput("j");
+  vimInput("d");
+  vimInput("d");
+  vimInput("q");
+  mu_check(mirrorMatches());
+
+  updateCount = 0;
+  vimInput("5");
+  vimInput("0");
+  vimInput("@");
+  vimInput("a");
+  mu_check(updateCount == 1);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 51);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST(test_explicit_batch)
+{
+  vimSetBufferUpdateBatching(FALSE);
+  vimBufferUpdateBatchBegin();
+  vimInput("x");
+  vimInput("j");
+  vimInput("x");
+  vimBufferUpdateBatchBegin();
+  vimInput("j");
+  vimInput("x");
+  vimBufferUpdateBatchEnd();
+  mu_check(updateCount == 0);
+  vimBufferUpdateBatchEnd();
+
+  mu_check(updateCount == 1);
+  mu_check(lastUpdate.lnum == 1);
+  mu_check(lastUpdate.lnume == 4);
+  mu_check(mirrorMatches());
+
+  // Also for lines set from outside
+  char_u *lines[] = {(char_u *)"a", (char_u *)"b"};
+  vimBufferUpdateBatchBegin();
+  vimBufferSetLines(buf, 100, 101, lines, 2);
+  vimBufferSetLines(buf, 101, 102, lines, 2);
+  vimBufferUpdateBatchEnd();
+  mu_check(updateCount == 2);
+  mu_check(mirrorMatches());
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_substitute_is_one_update);
+  MU_RUN_TEST(test_separate_ranges);
+  MU_RUN_TEST(test_global_delete);
+  MU_RUN_TEST(test_macro);
+  MU_RUN_TEST(test_explicit_batch);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+  vimSetBufferUpdateCallback(&onBufferUpdate);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -0,0 +1,267 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 400000
+
+static char_u *inName;
+static char_u *outName;
+
+static double secondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Short lines, long lines, empty lines and lines with a NUL and CR in them.
+static void writeFile(char *eol, int lastEol)
+{
+  FILE *fp = fopen((char *)inName, "wb");
+  for (int i = 0; i < LINE_COUNT; i++)
+  {
+    switch (i % 5)
+    {
+    case 0:
+      fprintf(fp, "Line %d", i);
+      break;
+    case 1:
+      for (int j = 0; j < 40; j++)
+      {
+        fprintf(fp, "long line %d ", i);
+      }
+      break;
+    case 2:
+      break;
+    case 3:
+      fprintf(fp, "Line %d with a NUL", i);
+      fputc(NUL, fp);
+      fputs("in it", fp);
+      break;
+    case 4:
+      fprintf(fp, "Line %d of a file with some text on it", i);
+      break;
+    }
+    if (i < LINE_COUNT - 1 || lastEol)
+    {
+      fputs(eol, fp);
+    }
+  }
+  fclose(fp);
+}
+
+static char *readFile(char_u *fname, size_t *len)
+{
+  FILE *fp = fopen((char *)fname, "rb");
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *contents = malloc(*len + 1);
+  *len = fread(contents, 1, *len, fp);
+  fclose(fp);
+  return contents;
+}
+
+static int filesMatch(char_u *a, char_u *b)
+{
+  size_t aLen, bLen;
+  char *aText = readFile(a, &aLen);
+  char *bText = readFile(b, &bLen);
+  int equal = aLen == bLen && memcmp(aText, bText, aLen) == 0;
+
+  if (!equal)
+  {
+    printf("%s has %lu bytes, %s has %lu\n", a, (unsigned long)aLen, b,
+           (unsigned long)bLen);
+  }
+  free(aText);
+  free(bText);
+  return equal;
+}
+
+static double saveFile(char *what)
+{
+  char cmd[256];
+  size_t len;
+
+  sprintf(cmd, "w! %s", outName);
+  clock_t start = clock();
+  vimExecute(cmd);
+  double seconds = secondsSince(start);
+
+  free(readFile(outName, &len));
+  printf("Save %lu bytes (%s): %fs, %.0f MB/s\n", (unsigned long)len, what,
+         seconds, len / seconds / (1024 * 1024));
+  return seconds;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+  vimExecute("set fileformats=unix,dos,mac");
+
+  inName = vim_tempname('i', FALSE);
+  outName = vim_tempname('o', FALSE);
+}
+
+void test_teardown(void)
+{
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(inName);
+  mch_remove(outName);
+  VIM_CLEAR(inName);
+  VIM_CLEAR(outName);
+}
+
+MU_TEST(test_save_unix)
+{
+  writeFile("\n", TRUE);
+  vimBufferOpen(inName, 1, 0);
+
+  saveFile("unix");
+  mu_check(filesMatch(inName, outName));
+}
+
+MU_TEST(test_save_dos)
+{
+  writeFile("\r\n", TRUE);
+  buf_T *buf = vimBufferOpen(inName, 1, 0);
+  mu_check(vimBufferGetFileFormat(buf) == EOL_DOS);
+
+  saveFile("dos");
+  mu_check(filesMatch(inName, outName));
+}
+
+MU_TEST(test_save_mac)
+{
+  writeFile("\r", TRUE);
+  buf_T *buf = vimBufferOpen(inName, 1, 0);
+  mu_check(vimBufferGetFileFormat(buf) == EOL_MAC);
+
+  saveFile("mac");
+  mu_check(filesMatch(inName, outName));
+}
+
+MU_TEST(test_save_noeol)
+{
+  writeFile("\n", FALSE);
+  vimBufferOpen(inName, 1, 0);
+  vimExecute("set nofixeol");
+
+  saveFile("noeol");
+  mu_check(filesMatch(inName, outName));
+  vimExecute("set fixeol");
+}
+
+MU_TEST(test_save_changed)
+{
+  writeFile("\n", TRUE);
+  buf_T *buf = vimBufferOpen(inName, 1, 0);
+
+  // Changed lines and blocks split by inserting
+  vimExecute("1000,2000d");
+  for (int i = 0; i < 100; i++)
+  {
+    vimExecute("50000t50000");
+  }
+  vimExecute("3");
+  vimInput("I");
+  vimInput("changed ");
+  vimKey("<esc>");
+
+  saveFile("changed");
+
+  // Compare with the lines the buffer has
+  size_t len;
+  char *contents = readFile(outName, &len);
+  char *p = contents;
+  int ok = TRUE;
+  for (linenr_T lnum = 1; lnum <= vimBufferGetLineCount(buf) && ok; lnum++)
+  {
+    char_u *line = vimBufferGetLine(buf, lnum);
+    size_t lineLen = STRLEN(line);
+    char *eol = memchr(p, '\n', contents + len - p);
+
+    for (size_t i = 0; i < lineLen; i++)
+    {
+      // A NL in the buffer is a NUL in the file
+      ok = ok && (line[i] == NL ? p[i] == NUL : p[i] == (char)line[i]);
+    }
+    ok = ok && eol == p + lineLen;
+    p = eol + 1;
+  }
+  mu_check(ok);
+  mu_check(p == contents + len);
+  free(contents);
+}
+
+MU_TEST(test_save_with_conversion)
+{
+  writeFile("\n", TRUE);
+  vimBufferOpen(inName, 1, 0);
+
+  double gatherTime = saveFile("no conversion");
+
+  // All ASCII, so latin1 gives the same bytes, but goes through the buffer
+  vimExecute("set fileencoding=latin1");
+  double convertTime = saveFile("latin1 conversion");
+  mu_check(filesMatch(inName, outName));
+
+  printf("Save with writev: %fs through the write buffer: %fs\n", gatherTime,
+         convertTime);
+}
+
+MU_TEST(test_save_undo_file)
+{
+  char cmd[256];
+
+  writeFile("\n", TRUE);
+  vimBufferOpen(inName, 1, 0);
+
+  // The undo file has a hash of the text that is written
+  vimExecute("set undofile undodir=/tmp");
+  vimExecute("1000,2000d");
+  vimExecute("w");
+  vimExecute("e!");
+  mu_check(vimBufferGetLineCount(curbuf) == LINE_COUNT - 1001);
+  vimExecute("u");
+  mu_check(vimBufferGetLineCount(curbuf) == LINE_COUNT);
+
+  char_u *undoName = u_get_undo_file_name(curbuf->b_ffname, FALSE);
+  vimExecute("set noundofile undodir&");
+  if (undoName != NULL)
+  {
+    mch_remove(undoName);
+    vim_free(undoName);
+  }
+  sprintf(cmd, "w! %s", inName);
+  vimExecute(cmd);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_save_unix);
+  MU_RUN_TEST(test_save_dos);
+  MU_RUN_TEST(test_save_mac);
+  MU_RUN_TEST(test_save_noeol);
+  MU_RUN_TEST(test_save_changed);
+  MU_RUN_TEST(test_save_with_conversion);
+  MU_RUN_TEST(test_save_undo_file);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
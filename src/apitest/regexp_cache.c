@@ -0,0 +1,208 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static long hits;
+static long misses;
+
+static void getStats(void) { vimRegexpGetCacheStats(&hits, &misses); }
+
+static int matches(regprog_T *prog, char *str)
+{
+  regmatch_T regmatch;
+
+  regmatch.regprog = prog;
+  regmatch.rm_ic = FALSE;
+  return vim_regexec(&regmatch, (char_u *)str, 0);
+}
+
+// Hash of the text in the current buffer
+static unsigned long hashText(void)
+{
+  unsigned long hash = 5381;
+
+  for (linenr_T lnum = 1; lnum <= curbuf->b_ml.ml_line_count; lnum++)
+  {
+    for (char_u *p = ml_get(lnum); *p != NUL; p++)
+    {
+      hash = hash * 33 + *p;
+    }
+    hash = hash * 33 + '\n';
+  }
+  return hash;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  vimExecute("e! collateral/large-c-file.c");
+  vimExecute("set cpo& regexpengine&");
+  vimOptionSetRegexpCacheSize(32);
+}
+
+void test_teardown(void) { vimOptionSetRegexpCacheSize(32); }
+
+MU_TEST(test_shared_prog)
+{
+  regprog_T *first = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  getStats();
+  long hitsBefore = hits;
+  regprog_T *second = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  getStats();
+
+  mu_check(first != NULL && first == second);
+  mu_check(hits == hitsBefore + 1);
+
+  // Still usable after one of the users freed it
+  vim_regfree(first);
+  mu_check(matches(second, "xabbbc"));
+  mu_check(!matches(second, "xac"));
+  vim_regfree(second);
+
+  // Kept in the cache when not used
+  second = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  getStats();
+  mu_check(hits == hitsBefore + 2);
+  vim_regfree(second);
+}
+
+MU_TEST(test_not_shared)
+{
+  regprog_T *prog = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  regprog_T *other;
+
+  other = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC | RE_NOCACHE);
+  mu_check(other != NULL && other != prog);
+  vim_regfree(other);
+
+  other = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC | RE_STRING);
+  mu_check(other != NULL && other != prog);
+  vim_regfree(other);
+
+  // Compiling depends on the option values
+  vimExecute("set regexpengine=1");
+  other = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  mu_check(other != NULL && other != prog);
+  vim_regfree(other);
+  vimExecute("set regexpengine&");
+
+  vimExecute("set cpo+=l");
+  other = vim_regcomp((char_u *)"ab\\+c", RE_MAGIC);
+  mu_check(other != NULL && other != prog);
+  vim_regfree(other);
+  vimExecute("set cpo&");
+
+  // "~" is the previous substitute string, which may change
+  vimExecute("s/nomatch/xyz/e");
+  regprog_T *tilde = vim_regcomp((char_u *)"a~", RE_MAGIC);
+  other = vim_regcomp((char_u *)"a~", RE_MAGIC);
+  mu_check(tilde != NULL && other != NULL && other != tilde);
+  vim_regfree(tilde);
+  vim_regfree(other);
+
+  vim_regfree(prog);
+}
+
+MU_TEST(test_in_use_not_shared)
+{
+  regmatch_T regmatch;
+
+  // Getting the program while it is matching, e.g. from an expression in
+  // the substitute string, compiles it again
+  regmatch.regprog = vim_regcomp((char_u *)"xyz", RE_MAGIC);
+  regmatch.regprog->re_in_use = TRUE;
+  regprog_T *other = vim_regcomp((char_u *)"xyz", RE_MAGIC);
+  mu_check(other != NULL && other != regmatch.regprog);
+  regmatch.regprog->re_in_use = FALSE;
+  vim_regfree(other);
+  vim_regfree(regmatch.regprog);
+}
+
+MU_TEST(test_global_substitute)
+{
+  // ":s//" in each matching line compiles the pattern again
+  getStats();
+  long hitsBefore = hits;
+  long missesBefore = misses;
+  vimExecute("g/\\<int\\>/s//long/g");
+  getStats();
+  printf("hits: %ld misses: %ld\n", hits - hitsBefore, misses - missesBefore);
+  mu_check(hits - hitsBefore > 100);
+  mu_check(misses - missesBefore <= 2);
+  unsigned long expected = hashText();
+
+  // Same text without the cache
+  vimExecute("e!");
+  vimOptionSetRegexpCacheSize(0);
+  getStats();
+  hitsBefore = hits;
+  vimExecute("g/\\<int\\>/s//long/g");
+  getStats();
+  mu_check(hits == hitsBefore);
+  mu_check(hashText() == expected);
+}
+
+MU_TEST(test_eval_loop)
+{
+  getStats();
+  long hitsBefore = hits;
+  vimExecute("let g:n = 0 | for i in range(1000) | let g:n += match('abc' . i, 'c\\d*5$') >= 0 | endfor");
+  getStats();
+
+  char_u *result = vimEval("g:n");
+  mu_check(STRCMP(result, "100") == 0);
+  vim_free(result);
+  mu_check(hits - hitsBefore >= 999);
+}
+
+MU_TEST(test_least_recently_used_dropped)
+{
+  char pattern[20];
+  regprog_T *prog;
+
+  vimOptionSetRegexpCacheSize(4);
+  for (int i = 0; i < 10; i++)
+  {
+    vim_snprintf(pattern, sizeof(pattern), "pat%d", i);
+    vim_regfree(vim_regcomp((char_u *)pattern, RE_MAGIC));
+  }
+
+  // The last four are kept
+  getStats();
+  long missesBefore = misses;
+  prog = vim_regcomp((char_u *)"pat6", RE_MAGIC);
+  vim_regfree(prog);
+  getStats();
+  mu_check(misses == missesBefore);
+
+  prog = vim_regcomp((char_u *)"pat5", RE_MAGIC);
+  vim_regfree(prog);
+  getStats();
+  mu_check(misses == missesBefore + 1);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_shared_prog);
+  MU_RUN_TEST(test_not_shared);
+  MU_RUN_TEST(test_in_use_not_shared);
+  MU_RUN_TEST(test_global_substitute);
+  MU_RUN_TEST(test_eval_loop);
+  MU_RUN_TEST(test_least_recently_used_dropped);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
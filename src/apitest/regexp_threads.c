@@ -0,0 +1,226 @@
+#include <pthread.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define THREAD_COUNT 8
+#define ROUNDS 3
+
+static char *patterns[] = {
+    "\\<\\(int\\|char\\)\\>",
+    "\\%#=1\\<\\w\\+(",
+    "\\%#=2[a-z]\\+_[a-z]\\+",
+    "\\v(static|return)\\s+\\w+",
+    "\\c\\<FOR\\>",
+    "^\\s*}\\n\\s*$",
+    "\\(\\w\\+\\) \\1",
+    "\\%#=1\\(\\a\\+ \\)\\{2,3}\\w",
+};
+#define PATTERN_COUNT ((int)(sizeof(patterns) / sizeof(patterns[0])))
+
+static buf_T *buf;
+
+// Copy of the buffer text, used by the threads
+typedef struct
+{
+  char_u **lines;
+  linenr_T count;
+} textCopy_T;
+
+static textCopy_T snapshot;
+
+typedef struct
+{
+  regprog_T *progs[PATTERN_COUNT];
+  long sums[PATTERN_COUNT];
+  int failed;
+} worker_T;
+
+static char_u *getSnapshotLine(linenr_T lnum, void *cookie)
+{
+  textCopy_T *snap = (textCopy_T *)cookie;
+
+  return snap->lines[lnum - 1];
+}
+
+static void takeSnapshot(void)
+{
+  snapshot.count = buf->b_ml.ml_line_count;
+  snapshot.lines = ALLOC_MULT(char_u *, snapshot.count);
+  for (linenr_T lnum = 1; lnum <= snapshot.count; lnum++)
+  {
+    snapshot.lines[lnum - 1] = vim_strsave(ml_get_buf(buf, lnum, FALSE));
+  }
+}
+
+static void freeSnapshot(void)
+{
+  for (linenr_T lnum = 1; lnum <= snapshot.count; lnum++)
+  {
+    vim_free(snapshot.lines[lnum - 1]);
+  }
+  VIM_CLEAR(snapshot.lines);
+}
+
+// Match in every line, add up where the matches are.  With "rex" NULL
+// vim_regexec_multi() is used.
+static long matchAll(regexec_T *rex, regprog_T **prog)
+{
+  regmmatch_T regmatch;
+  long sum = 0;
+  long n;
+
+  regmatch.regprog = *prog;
+  regmatch.rmm_ic = FALSE;
+  regmatch.rmm_maxcol = 0;
+  for (linenr_T lnum = 1; lnum <= snapshot.count; lnum++)
+  {
+    if (rex == NULL)
+      n = vim_regexec_multi(&regmatch, NULL, buf, lnum, 0, NULL, NULL);
+    else
+      n = vim_regexec_ctx_multi(rex, &regmatch, buf, lnum, 0, NULL, NULL);
+    if (n < 0)
+    {
+      return -1;
+    }
+    if (n > 0)
+    {
+      sum += lnum * 7 + regmatch.startpos[0].col * 3 + regmatch.endpos[0].lnum * 5 + regmatch.endpos[0].col;
+    }
+  }
+  *prog = regmatch.regprog;
+  return sum;
+}
+
+static void *workerMain(void *arg)
+{
+  worker_T *worker = (worker_T *)arg;
+  regexec_T *rex = vim_regexec_ctx_alloc();
+
+  vim_regexec_ctx_set_getline(rex, getSnapshotLine, &snapshot, snapshot.count);
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+      long sum = matchAll(rex, &worker->progs[i]);
+      if (round > 0 && sum != worker->sums[i])
+      {
+        worker->failed = TRUE;
+      }
+      worker->sums[i] = sum;
+    }
+  }
+  vim_regexec_ctx_free(rex);
+  return NULL;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  takeSnapshot();
+}
+
+void test_teardown(void) { freeSnapshot(); }
+
+MU_TEST(test_parallel_matches)
+{
+  long expected[PATTERN_COUNT];
+  worker_T workers[THREAD_COUNT];
+  pthread_t threads[THREAD_COUNT];
+  regprog_T *progs[PATTERN_COUNT];
+
+  for (int i = 0; i < PATTERN_COUNT; i++)
+  {
+    progs[i] = vim_regcomp((char_u *)patterns[i], RE_MAGIC);
+    mu_check(progs[i] != NULL);
+    expected[i] = matchAll(NULL, &progs[i]);
+    mu_check(expected[i] > 0);
+  }
+
+  // Compiling is done in the main thread, each thread has its own progs
+  for (int t = 0; t < THREAD_COUNT; t++)
+  {
+    vim_memset(&workers[t], 0, sizeof(worker_T));
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+      workers[t].progs[i] = vim_regcomp((char_u *)patterns[i], RE_MAGIC | RE_NOCACHE);
+    }
+    mu_check(pthread_create(&threads[t], NULL, workerMain, &workers[t]) == 0);
+  }
+
+  // Matching in the main thread while the others run
+  for (int i = 0; i < PATTERN_COUNT; i++)
+  {
+    mu_check(matchAll(NULL, &progs[i]) == expected[i]);
+  }
+
+  for (int t = 0; t < THREAD_COUNT; t++)
+  {
+    pthread_join(threads[t], NULL);
+    mu_check(!workers[t].failed);
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+      if (workers[t].sums[i] != expected[i])
+      {
+        printf("thread %d pattern '%s': %ld, expected %ld\n", t, patterns[i],
+               workers[t].sums[i], expected[i]);
+      }
+      mu_check(workers[t].sums[i] == expected[i]);
+      vim_regfree(workers[t].progs[i]);
+    }
+  }
+
+  for (int i = 0; i < PATTERN_COUNT; i++)
+  {
+    vim_regfree(progs[i]);
+  }
+}
+
+MU_TEST(test_snapshot_used)
+{
+  regexec_T *rex = vim_regexec_ctx_alloc();
+  regmmatch_T regmatch;
+  char_u *saved = snapshot.lines[9];
+
+  // The text only exists in the snapshot, not in the buffer
+  snapshot.lines[9] = (char_u *)"only in the snapshot";
+  regmatch.regprog = vim_regcomp((char_u *)"the \\zssnap", RE_MAGIC);
+  regmatch.rmm_ic = FALSE;
+  regmatch.rmm_maxcol = 0;
+  vim_regexec_ctx_set_getline(rex, getSnapshotLine, &snapshot, snapshot.count);
+  mu_check(vim_regexec_ctx_multi(rex, &regmatch, buf, 10, 0, NULL, NULL) == 1);
+  mu_check(regmatch.startpos[0].lnum == 0 && regmatch.startpos[0].col == 12);
+
+  // Without the snapshot the buffer is used
+  vim_regexec_ctx_set_getline(rex, NULL, NULL, 0);
+  mu_check(vim_regexec_ctx_multi(rex, &regmatch, buf, 10, 0, NULL, NULL) == 0);
+  mu_check(vim_regexec_multi(&regmatch, NULL, buf, 10, 0, NULL, NULL) == 0);
+
+  snapshot.lines[9] = saved;
+  vim_regfree(regmatch.regprog);
+  vim_regexec_ctx_free(rex);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_parallel_matches);
+  MU_RUN_TEST(test_snapshot_used);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
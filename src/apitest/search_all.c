@@ -0,0 +1,190 @@
+#include <sys/time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static buf_T *buf;
+static searchHighlightList_T list;
+static searchHighlightList_T all;
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Compare the matches found with threads with searching in this thread only
+static int sameAsSerial(void)
+{
+  vimSearchSetThreadCount(1);
+  double start = now();
+  vimSearchAll(buf, &list);
+  double serial = now() - start;
+
+  vimSearchSetThreadCount(8);
+  start = now();
+  vimSearchAll(buf, &all);
+  double threaded = now() - start;
+
+  printf("pattern '%s': %d matches, %f seconds, with threads %f seconds\n",
+         get_search_pat(), all.count, serial, threaded);
+  if (list.count != all.count)
+  {
+    printf("%d matches, expected %d\n", all.count, list.count);
+    return FALSE;
+  }
+  for (int i = 0; i < list.count; i++)
+  {
+    searchHighlight_T *hl = all.highlights + i;
+    searchHighlight_T *ref = list.highlights + i;
+    if (!EQUAL_POS(hl->start, ref->start) || !EQUAL_POS(hl->end, ref->end))
+    {
+      printf("match %d: %ld:%d-%ld:%d, expected %ld:%d-%ld:%d\n", i,
+             (long)hl->start.lnum, hl->start.col, (long)hl->end.lnum,
+             hl->end.col, (long)ref->start.lnum, ref->start.col,
+             (long)ref->end.lnum, ref->end.col);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static void makeLarge(void)
+{
+  vimExecute("%y");
+  for (int i = 0; i < 3; i++)
+  {
+    vimInput("G");
+    vimInput("p");
+  }
+}
+
+static void search(char *pattern)
+{
+  vimInput("/");
+  vimInput(pattern);
+  vimKey("<cr>");
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("e!");
+  vimExecute("set cpo&");
+  makeLarge();
+}
+
+void test_teardown(void) { vimSearchSetThreadCount(0); }
+
+MU_TEST(test_same_as_serial)
+{
+  char *patterns[] = {"e", "\\<\\(int\\|char\\)\\>", "^$", "$", "x*",
+                      "\\cFOR", "\\d\\+\\ze;", "\\%>100lint"};
+
+  for (int i = 0; i < (int)(sizeof(patterns) / sizeof(patterns[0])); i++)
+  {
+    search(patterns[i]);
+    mu_check(sameAsSerial());
+  }
+
+  // Without the 'c' flag matches may overlap
+  vimExecute("set cpo-=c");
+  search("\\w\\+");
+  mu_check(sameAsSerial());
+  vimExecute("set cpo&");
+}
+
+MU_TEST(test_multi_line)
+{
+  char *patterns[] = {"{\\n", "\\n\\zs", "\\w\\+\\n\\s*\\w\\+",
+                      "/\\*\\_.\\{-}\\*/", "\\n\\n\\n"};
+
+  for (int i = 0; i < (int)(sizeof(patterns) / sizeof(patterns[0])); i++)
+  {
+    search(patterns[i]);
+    mu_check(sameAsSerial());
+  }
+}
+
+MU_TEST(test_matches_cross_parts)
+{
+  // Each match goes over thousands of lines, into the next part
+  vimExecute("%s/^/x/");
+  vimExecute("1000s/^/begin/");
+  vimExecute("3500s/^/end/");
+  vimExecute("9000s/^/begin/");
+  vimExecute("25000s/^/end/");
+  vimExecute("26000s/^/begin/");
+  search("^begin\\_.\\{-}\\nend");
+  mu_check(sameAsSerial());
+  mu_check(all.count == 2);
+
+  // Overlapping matches, each starting in the line before
+  search("\\n\\zsx\\_.\\{-}\\nx");
+  mu_check(sameAsSerial());
+}
+
+MU_TEST(test_count)
+{
+  pos_T pos = {0, 0, 0};
+  int current;
+
+  search("\\<\\(int\\|char\\)\\>");
+  vimSearchSetThreadCount(1);
+  vimSearchAll(buf, &list);
+  vimSearchSetThreadCount(4);
+  mu_check(vimSearchCount(buf, NULL, NULL) == list.count);
+
+  mu_check(vimSearchCount(buf, &pos, &current) == list.count);
+  mu_check(current == 0);
+  pos = list.highlights[10].start;
+  vimSearchCount(buf, &pos, &current);
+  mu_check(current == 11);
+  pos.col++;
+  vimSearchCount(buf, &pos, &current);
+  mu_check(current == 11);
+  pos.lnum = vimBufferGetLineCount(buf);
+  pos.col = MAXCOL;
+  vimSearchCount(buf, &pos, &current);
+  mu_check(current == list.count);
+}
+
+MU_TEST(test_matching_fails)
+{
+  // Matching fails in the threads, then the main thread gives the error
+  vimExecute("set maxmempattern=1");
+  search("\\%#=1\\(\\w\\|\\s\\)*;");
+  mu_check(sameAsSerial());
+  vimExecute("set maxmempattern&");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_same_as_serial);
+  MU_RUN_TEST(test_multi_line);
+  MU_RUN_TEST(test_matches_cross_parts);
+  MU_RUN_TEST(test_count);
+  MU_RUN_TEST(test_matching_fails);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  vimSearchHighlightListClear(&list);
+  vimSearchHighlightListClear(&all);
+  MU_RETURN();
+}
@@ -0,0 +1,344 @@
+#include <time.h>
+
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+static buf_T *buf;
+static searchHighlightList_T list;
+
+// The matches found with searchit(), the way they were found before the
+// index was kept
+static garray_T reference;
+
+static void findReference(linenr_T start, linenr_T end)
+{
+  pos_T pos, endPos, lastPos;
+
+  reference.ga_len = 0;
+  pos.lnum = start;
+  pos.col = 0;
+  pos.coladd = 0;
+  lastPos = pos;
+  while (searchit(NULL, buf, &pos, &endPos, FORWARD, get_search_pat(), 1,
+                  SEARCH_KEEP, RE_SEARCH, end, NULL, NULL) != FAIL)
+  {
+    if (LTOREQ_POS(pos, lastPos))
+    {
+      break;
+    }
+    ga_grow(&reference, 1);
+    searchHighlight_T *hl = (searchHighlight_T *)reference.ga_data + reference.ga_len++;
+    hl->start = pos;
+    hl->end = endPos;
+    lastPos = pos;
+    pos = endPos;
+    pos.col++;
+  }
+}
+
+static int sameAsReference(linenr_T start, linenr_T end)
+{
+  findReference(start, end);
+  vimSearchGetHighlightsList(buf, start, end, &list);
+  if (list.count != reference.ga_len)
+  {
+    printf("pattern '%s' lines %ld-%ld: %d highlights, expected %d\n",
+           get_search_pat(), (long)start, (long)end, list.count, reference.ga_len);
+    return FALSE;
+  }
+  for (int i = 0; i < list.count; i++)
+  {
+    searchHighlight_T *hl = list.highlights + i;
+    searchHighlight_T *ref = (searchHighlight_T *)reference.ga_data + i;
+    if (!EQUAL_POS(hl->start, ref->start) || !EQUAL_POS(hl->end, ref->end))
+    {
+      printf("pattern '%s' highlight %d: %ld:%d-%ld:%d, expected %ld:%d-%ld:%d\n",
+             get_search_pat(), i, (long)hl->start.lnum, hl->start.col,
+             (long)hl->end.lnum, hl->end.col, (long)ref->start.lnum,
+             ref->start.col, (long)ref->end.lnum, ref->end.col);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// For patterns that match nearly every character, searching the whole buffer
+// for the reference takes too long
+static int partialRangesSame(void)
+{
+  return sameAsReference(10, 50) && sameAsReference(100, 100) &&
+         sameAsReference(5000, 5100) && sameAsReference(10000, 0);
+}
+
+static int allRangesSame(void)
+{
+  return sameAsReference(0, 0) && sameAsReference(1, 0) &&
+         partialRangesSame();
+}
+
+// Get the highlights a part at a time, compare with getting them at once
+static int timedSameAsList(linenr_T start, linenr_T end, int *calls)
+{
+  searchHighlightList_T part = {NULL, 0, 0};
+  pos_T resume = {start, 0, 0};
+  int done = FALSE;
+  int count = 0;
+  int same = TRUE;
+
+  // Find the matches again
+  hl_index_clear(buf);
+  *calls = 0;
+  while (!done)
+  {
+    done = vimSearchGetHighlightsTimed(buf, &resume, end, 1, &part);
+    ++*calls;
+    for (int i = 0; i < part.count; i++)
+    {
+      searchHighlight_T *hl = part.highlights + i;
+      searchHighlight_T *ref = (searchHighlight_T *)reference.ga_data + count++;
+      if (count > reference.ga_len || !EQUAL_POS(hl->start, ref->start) ||
+          !EQUAL_POS(hl->end, ref->end))
+      {
+        same = FALSE;
+        break;
+      }
+    }
+  }
+  vimSearchHighlightListClear(&part);
+  printf("pattern '%s' lines %ld-%ld: %d highlights in %d calls, expected %d\n",
+         get_search_pat(), (long)start, (long)end, count, *calls,
+         reference.ga_len);
+  return same && count == reference.ga_len;
+}
+
+static void makeLarge(void)
+{
+  vimExecute("%y");
+  for (int i = 0; i < 5; i++)
+  {
+    vimInput("G");
+    vimInput("p");
+  }
+}
+
+static void search(char *pattern)
+{
+  vimInput("/");
+  vimInput(pattern);
+  vimKey("<cr>");
+}
+
+static double secondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  buf = vimBufferOpen("collateral/large-c-file.c", 1, 0);
+  vimExecute("e!");
+  vimExecute("set cpo&");
+}
+
+void test_teardown(void) {}
+
+MU_TEST(test_same_as_searching)
+{
+  char *patterns[] = {"e", "ee", "\\<\\w", "^", "$", "^$", "\\s\\+",
+                      "in\\|int", "\\d\\+\\ze;", "\\cFOR", "^\\s*}"};
+
+  for (int i = 0; i < (int)(sizeof(patterns) / sizeof(patterns[0])); i++)
+  {
+    search(patterns[i]);
+    mu_check(allRangesSame());
+  }
+  search("x*");
+  mu_check(partialRangesSame());
+
+  // Without the 'c' flag matches may overlap
+  vimExecute("set cpo-=c");
+  search("ee");
+  mu_check(allRangesSame());
+  search("\\w\\+");
+  mu_check(partialRangesSame());
+}
+
+MU_TEST(test_not_indexed)
+{
+  // Matching a line break, or depending on the line number
+  search("{\\n");
+  mu_check(buf->b_hlindex == NULL);
+  mu_check(allRangesSame());
+  search("\\%>100lint");
+  mu_check(buf->b_hlindex == NULL);
+  mu_check(allRangesSame());
+}
+
+MU_TEST(test_changes)
+{
+  search("in");
+  vimSearchGetHighlightsList(buf, 0, 0, &list);
+  mu_check(buf->b_hlindex != NULL);
+
+  vimExecute("100");
+  vimInput("i");
+  vimInput("inin");
+  vimKey("<esc>");
+  mu_check(allRangesSame());
+
+  vimExecute("200,300d");
+  mu_check(allRangesSame());
+  vimExecute("20");
+  vimInput("y");
+  vimInput("y");
+  vimInput("5");
+  vimInput("0");
+  vimInput("p");
+  mu_check(allRangesSame());
+  vimExecute("%s/int/in int/g");
+  mu_check(allRangesSame());
+  vimInput("u");
+  vimInput("u");
+  mu_check(allRangesSame());
+
+  char_u *lines[] = {(char_u *)"in one", (char_u *)"two in in"};
+  vimBufferSetLines(buf, 10, 12, lines, 2);
+  vimBufferSetLines(buf, 30, 30, lines, 2);
+  mu_check(allRangesSame());
+
+  vimExecute("e!");
+  mu_check(allRangesSame());
+}
+
+MU_TEST(test_quickfix_buffer)
+{
+  // The quickfix buffer is filled with ml_append() and ml_delete()
+  vimExecute("cexpr ['a.c:1:in one', 'a.c:2:two in in']");
+  vimExecute("copen");
+  buf = curbuf;
+  mu_check(bt_quickfix(buf));
+  search("in");
+  mu_check(allRangesSame());
+  mu_check(buf->b_hlindex != NULL);
+
+  vimExecute("caddexpr ['a.c:3:in', 'a.c:4:in in in']");
+  mu_check(vimBufferGetLineCount(buf) == 4);
+  mu_check(allRangesSame());
+
+  vimExecute("cexpr ['b.c:1:in']");
+  mu_check(vimBufferGetLineCount(buf) == 1);
+  mu_check(allRangesSame());
+
+  vimExecute("cclose");
+}
+
+MU_TEST(test_options_change_matches)
+{
+  search("if");
+  mu_check(allRangesSame());
+  vimExecute("set ignorecase");
+  mu_check(allRangesSame());
+  vimExecute("set ignorecase&");
+
+  search("\\<in\\>");
+  mu_check(allRangesSame());
+  vimExecute("setlocal iskeyword+=(");
+  mu_check(allRangesSame());
+  vimExecute("setlocal iskeyword&");
+}
+
+MU_TEST(test_multibyte)
+{
+  vimExecute("1");
+  vimInput("O");
+  vimInput("\xc3\xa9\xc3\xa9 \xc3\xa9x \xe2\x82\xac\xc3\xa9");
+  vimKey("<esc>");
+  search("\xc3\xa9");
+  mu_check(allRangesSame());
+  mu_check(sameAsReference(0, 0));
+  search(".");
+  mu_check(partialRangesSame() && sameAsReference(1, 5));
+}
+
+MU_TEST(test_only_changed_lines_searched)
+{
+  makeLarge();
+  search("\\<\\(int\\|char\\)\\>");
+
+  clock_t start = clock();
+  vimSearchGetHighlightsList(buf, 0, 0, &list);
+  double first = secondsSince(start);
+  int count = list.count;
+
+  vimExecute("1000");
+  vimInput("x");
+  start = clock();
+  vimSearchGetHighlightsList(buf, 0, 0, &list);
+  double again = secondsSince(start);
+  printf("%d highlights in %ld lines: %f seconds, after a change: %f seconds\n",
+         count, (long)vimBufferGetLineCount(buf), first, again);
+  mu_check(again * 4 < first);
+  mu_check(sameAsReference(0, 0));
+
+  // The array is reused
+  searchHighlight_T *highlights = list.highlights;
+  vimSearchGetHighlightsList(buf, 2000, 2100, &list);
+  mu_check(list.highlights == highlights);
+}
+
+MU_TEST(test_timed)
+{
+  int calls;
+
+  makeLarge();
+  search("\\<\\(int\\|char\\)\\>");
+  findReference(0, 0);
+  mu_check(timedSameAsList(0, 0, &calls));
+  mu_check(calls > 1);
+  findReference(100, 30000);
+  mu_check(timedSameAsList(100, 30000, &calls));
+
+  // Not using the index
+  search("{\\n");
+  findReference(0, 0);
+  mu_check(timedSameAsList(0, 0, &calls));
+  findReference(10, 20000);
+  mu_check(timedSameAsList(10, 20000, &calls));
+  search("\\%>100lint");
+  findReference(1, 0);
+  mu_check(timedSameAsList(1, 0, &calls));
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_same_as_searching);
+  MU_RUN_TEST(test_not_indexed);
+  MU_RUN_TEST(test_changes);
+  MU_RUN_TEST(test_quickfix_buffer);
+  MU_RUN_TEST(test_options_change_matches);
+  MU_RUN_TEST(test_multibyte);
+  MU_RUN_TEST(test_only_changed_lines_searched);
+  MU_RUN_TEST(test_timed);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  ga_init2(&reference, sizeof(searchHighlight_T), 1000);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  vimSearchHighlightListClear(&list);
+  ga_clear(&reference);
+  MU_RETURN();
+}
@@ -0,0 +1,277 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LONG_LINE_LEN 200000
+// Upper bound for a header with one small entry
+#define HEADER_BYTES 1000
+
+static char_u *fname;
+static char_u *undoName;
+static char *longLine;
+static buf_T *buf;
+
+static void writeFile(char_u *name)
+{
+  FILE *fp = fopen((char *)name, "wb");
+  fprintf(fp, "first line\n%s\nlast line\n", longLine);
+  fclose(fp);
+}
+
+static long_u undoBytes(void)
+{
+  memoryStats_T stats;
+
+  vimGetMemoryStats(buf, &stats);
+  // The running count matches what is found by going over the tree
+  mu_check(stats.undo == buf->b_u_mem_used +
+                             (buf->b_u_line_ptr.ul_line == NULL
+                                  ? 0
+                                  : buf->b_u_line_ptr.ul_len));
+  return buf->b_u_mem_used;
+}
+
+static int longLineIsOriginal(void)
+{
+  return vimBufferGetLineCount(buf) == 3 &&
+         STRCMP(vimBufferGetLine(buf, 2), longLine) == 0;
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('u', FALSE);
+  undoName = concat_str(fname, (char_u *)".un~");
+  writeFile(fname);
+  buf = vimBufferOpen(fname, 1, 0);
+  vimExecute("2");
+}
+
+void test_teardown(void)
+{
+  vimExecute("set undomemory& undolevels&");
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(fname);
+  mch_remove(undoName);
+  VIM_CLEAR(fname);
+  VIM_CLEAR(undoName);
+}
+
+MU_TEST(test_small_change_in_long_line)
+{
+  vimInput("0");
+  vimInput("x");
+  vimInput("$");
+  vimInput("x");
+
+  // The newest change is kept whole until the next one starts
+  long_u bytes = undoBytes();
+  mu_check(bytes > LONG_LINE_LEN);
+  vimInput("0");
+  vimInput("x");
+  bytes = undoBytes();
+  printf("undo for three changes in a %d byte line: %lu bytes\n",
+         LONG_LINE_LEN, bytes);
+  mu_check(bytes < LONG_LINE_LEN + 3 * HEADER_BYTES);
+
+  vimInput("u");
+
+  vimInput("u");
+  vimInput("u");
+  mu_check(longLineIsOriginal());
+
+  // Redo gets the changes back
+  vimKey("<c-r>");
+  vimKey("<c-r>");
+  mu_check(STRLEN(vimBufferGetLine(buf, 2)) == LONG_LINE_LEN - 2);
+  mu_check(STRNCMP(vimBufferGetLine(buf, 2), longLine + 1,
+                   LONG_LINE_LEN - 2) == 0);
+  mu_check(undoBytes() < 3 * HEADER_BYTES);
+}
+
+MU_TEST(test_many_changes)
+{
+  vimInput("0");
+  for (int i = 0; i < 100; i++)
+  {
+    vimInput("r");
+    vimInput("X");
+    vimInput("w");
+  }
+  mu_check(undoBytes() < LONG_LINE_LEN + 100 * HEADER_BYTES);
+
+  for (int i = 0; i < 100; i++)
+  {
+    vimInput("u");
+  }
+  mu_check(longLineIsOriginal());
+}
+
+MU_TEST(test_insert_in_long_line)
+{
+  vimInput("A");
+  vimInput("appended text");
+  vimKey("<esc>");
+  vimInput("0");
+  vimInput("i");
+  vimInput("inserted ");
+  vimKey("<esc>");
+  mu_check(undoBytes() < LONG_LINE_LEN + 2 * HEADER_BYTES);
+
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 2) + LONG_LINE_LEN,
+                  "appended text") == 0);
+  vimInput("u");
+  mu_check(longLineIsOriginal());
+}
+
+MU_TEST(test_changed_line_kept_whole)
+{
+  // Most of the line is replaced, a delta is not smaller
+  vimInput("0");
+  vimInput("d");
+  vimInput("$");
+  vimInput("k");
+  vimInput("x");
+  mu_check(undoBytes() > LONG_LINE_LEN);
+
+  vimInput("u");
+  vimInput("u");
+  mu_check(longLineIsOriginal());
+}
+
+MU_TEST(test_multiple_lines)
+{
+  // One entry with all lines
+  vimInput("g");
+  vimInput("g");
+  vimInput("V");
+  vimInput("G");
+  vimInput(">");
+  vimInput("g");
+  vimInput("g");
+  vimInput("x");
+  mu_check(undoBytes() < 2 * HEADER_BYTES);
+
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == 3);
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "\tfirst line") == 0);
+  mu_check(vimBufferGetLine(buf, 2)[0] == '\t');
+  mu_check(STRCMP(vimBufferGetLine(buf, 2) + 1, longLine) == 0);
+
+  vimInput("u");
+  mu_check(longLineIsOriginal());
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "first line") == 0);
+}
+
+MU_TEST(test_undo_file)
+{
+  char cmd[256];
+
+  vimInput("0");
+  vimInput("x");
+  vimInput("$");
+  vimInput("x");
+  vimExecute("w");
+  sprintf(cmd, "wundo %s", undoName);
+  vimExecute(cmd);
+
+  // The undo file uses the version with delta lines
+  FILE *fp = fopen((char *)undoName, "rb");
+  mu_check(fp != NULL);
+  char header[11];
+  mu_check(fread(header, 1, sizeof(header), fp) == sizeof(header));
+  fclose(fp);
+  mu_check(header[9] == 0 && header[10] == 5);
+
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  buf = vimBufferOpen(fname, 1, 0);
+  sprintf(cmd, "rundo %s", undoName);
+  vimExecute(cmd);
+  mu_check(undoBytes() < LONG_LINE_LEN + 2 * HEADER_BYTES);
+
+  vimExecute("2");
+  vimInput("u");
+  vimInput("u");
+  mu_check(longLineIsOriginal());
+}
+
+MU_TEST(test_budget)
+{
+  vimExecute("set undomemory=500000");
+  vimInput("y");
+  vimInput("y");
+  vimInput("5");
+  vimInput("p");
+
+  // Deleted lines are saved whole
+  for (int i = 0; i < 5; i++)
+  {
+    vimInput("d");
+    vimInput("d");
+  }
+  long_u bytes = undoBytes();
+  printf("undo with a budget of 500000: %lu bytes in %d headers\n", bytes,
+         buf->b_u_numhead);
+  mu_check(buf->b_u_numhead < 6);
+  // The newest change is always kept
+  mu_check(bytes <= 500000 + LONG_LINE_LEN + 3 * HEADER_BYTES);
+
+  // The oldest changes were dropped
+  vimExecute("undo 0");
+  mu_check(vimBufferGetLineCount(buf) > 3);
+}
+
+MU_TEST(test_budget_keeps_small_changes)
+{
+  vimExecute("set undomemory=300000");
+  vimInput("0");
+  for (int i = 0; i < 100; i++)
+  {
+    vimInput("x");
+    vimInput("l");
+  }
+  // Deltas are small, nothing is dropped
+  mu_check(buf->b_u_numhead == 100);
+  vimExecute("undo 0");
+  mu_check(longLineIsOriginal());
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_small_change_in_long_line);
+  MU_RUN_TEST(test_many_changes);
+  MU_RUN_TEST(test_insert_in_long_line);
+  MU_RUN_TEST(test_changed_line_kept_whole);
+  MU_RUN_TEST(test_multiple_lines);
+  MU_RUN_TEST(test_undo_file);
+  MU_RUN_TEST(test_budget);
+  MU_RUN_TEST(test_budget_keeps_small_changes);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  longLine = malloc(LONG_LINE_LEN + 1);
+  for (int i = 0; i < LONG_LINE_LEN; i++)
+  {
+    // Words, so that "w" moves through the line
+    longLine[i] = i % 8 == 7 ? ' ' : 'a' + i % 26;
+  }
+  longLine[LONG_LINE_LEN] = NUL;
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
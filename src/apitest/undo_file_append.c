@@ -0,0 +1,305 @@
+#include "libvim.h"
+#include "minunit.h"
+#include "vim.h"
+
+#define LINE_COUNT 1000
+
+static char_u *fname;
+static char_u *undoName;
+static buf_T *buf;
+
+static long fileSize(char_u *name)
+{
+  stat_T st;
+
+  if (mch_stat((char *)name, &st) < 0)
+  {
+    return -1;
+  }
+  return (long)st.st_size;
+}
+
+static void reload(void)
+{
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+  buf = vimBufferOpen(fname, 1, 0);
+}
+
+// Change the first word of line "lnum" and write the file.
+static void changeAndWrite(linenr_T lnum)
+{
+  char cmd[64];
+
+  sprintf(cmd, "%ld", (long)lnum);
+  vimExecute(cmd);
+  vimInput("c");
+  vimInput("w");
+  vimInput("changed");
+  vimKey("<esc>");
+  vimExecute("w");
+}
+
+void test_setup(void)
+{
+  vimKey("<esc>");
+  vimKey("<esc>");
+
+  fname = vim_tempname('a', FALSE);
+  FILE *fp = fopen((char *)fname, "wb");
+  for (int i = 1; i <= LINE_COUNT; i++)
+  {
+    fprintf(fp, "line %d with some text to make it longer\n", i);
+  }
+  fclose(fp);
+
+  vimExecute("set undofile");
+  buf = vimBufferOpen(fname, 1, 0);
+  undoName = u_get_undo_file_name(buf->b_ffname, FALSE);
+}
+
+void test_teardown(void)
+{
+  vimExecute("set undofile&");
+  vimBufferOpen("collateral/testfile.txt", 1, 0);
+  vimExecute("bwipe! #");
+
+  mch_remove(fname);
+  mch_remove(undoName);
+  VIM_CLEAR(fname);
+  VIM_CLEAR(undoName);
+}
+
+MU_TEST(test_append_small_change)
+{
+  vimExecute("100,600d");
+  vimExecute("w");
+  long full = fileSize(undoName);
+  mu_check(full > 20000);
+
+  // Only the new header and the one linking to it are appended, the deleted
+  // lines are not written again
+  changeAndWrite(1);
+  long appended = fileSize(undoName) - full;
+  printf("undo file %ld bytes, appended %ld bytes\n", full, appended);
+  mu_check(appended > 0);
+  mu_check(appended < 2000);
+}
+
+MU_TEST(test_reload_after_appending)
+{
+  changeAndWrite(1);
+  vimExecute("500,600d");
+  vimExecute("w");
+  changeAndWrite(2);
+  changeAndWrite(3);
+
+  reload();
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 101);
+  mu_check(STRCMP(vimBufferGetLine(buf, 3), "changed 3 with some text to make it longer") == 0);
+
+  vimInput("u");
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 2), "line 2 with some text to make it longer") == 0);
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "line 1 with some text to make it longer") == 0);
+
+  // Redo works for the headers that were appended
+  vimExecute("redo");
+  vimExecute("redo");
+  vimExecute("redo");
+  vimExecute("redo");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 101);
+  mu_check(STRCMP(vimBufferGetLine(buf, 3), "changed 3 with some text to make it longer") == 0);
+}
+
+MU_TEST(test_entries_read_lazily)
+{
+  vimExecute("100,600d");
+  vimExecute("w");
+  changeAndWrite(1);
+
+  // The deleted lines are only read when undoing the delete
+  reload();
+  printf("undo memory after loading %lu\n", buf->b_u_mem_used);
+  mu_check(buf->b_u_mem_used < 5000);
+  mu_check(buf->b_u_file != NULL && buf->b_u_file->uf_lazy == 2);
+
+  vimInput("u");
+  mu_check(buf->b_u_file->uf_lazy == 1);
+  vimInput("u");
+  mu_check(buf->b_u_file->uf_lazy == 0);
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(STRCMP(vimBufferGetLine(buf, 600), "line 600 with some text to make it longer") == 0);
+}
+
+// Delete up to the last line, write, and reload with the entries not read.
+// Then two lines are appended to the file and read in tail mode.
+static void appendWhileLazy(void)
+{
+  vimExecute("900,$d");
+  vimExecute("w");
+  changeAndWrite(1);
+  reload();
+
+  vimBufferSetTailMode(buf, TRUE);
+  FILE *fp = fopen((char *)fname, "ab");
+  fputs("appended 1\nappended 2\n", fp);
+  fclose(fp);
+  mu_check(vimBufferCheckIfChanged(buf) == 1);
+  mu_check(vimBufferGetLineCount(buf) == 901);
+}
+
+MU_TEST(test_tail_append_lazy)
+{
+  appendWhileLazy();
+
+  // The entries are not read for appending lines
+  mu_check(buf->b_u_file != NULL && buf->b_u_file->uf_lazy == 2);
+  vimInput("u");
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT + 2);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT), "line 1000 with some text to make it longer") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT + 1), "appended 1") == 0);
+}
+
+MU_TEST(test_tail_append_lazy_written)
+{
+  appendWhileLazy();
+
+  // The entries in the file don't know about the appended lines
+  vimExecute("w");
+  mu_check(buf->b_u_file != NULL && buf->b_u_file->uf_lazy == 0);
+  reload();
+  vimInput("u");
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT + 2);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT), "line 1000 with some text to make it longer") == 0);
+  mu_check(STRCMP(vimBufferGetLine(buf, LINE_COUNT + 2), "appended 2") == 0);
+}
+
+MU_TEST(test_compacted)
+{
+  long size = 0;
+  int shrunk = FALSE;
+
+  vimExecute("100,300d");
+  vimExecute("w");
+  for (int i = 1; i <= 100; i++)
+  {
+    changeAndWrite(i);
+    long newSize = fileSize(undoName);
+    if (newSize < size)
+    {
+      shrunk = TRUE;
+    }
+    size = newSize;
+  }
+  mu_check(shrunk);
+
+  reload();
+  vimExecute("undo 0");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+  mu_check(STRCMP(vimBufferGetLine(buf, 100), "line 100 with some text to make it longer") == 0);
+}
+
+MU_TEST(test_changed_file_rewritten)
+{
+  vimExecute("100,600d");
+  vimExecute("w");
+  long full = fileSize(undoName);
+
+  // Another program added to the undo file, it is not appended to
+  FILE *fp = fopen((char *)undoName, "ab");
+  fputs("garbage", fp);
+  fclose(fp);
+  changeAndWrite(1);
+  mu_check(fileSize(undoName) > full);
+  mu_check(fileSize(undoName) < full + 2000);
+
+  reload();
+  vimExecute("undo 0");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+}
+
+MU_TEST(test_incomplete_segment_ignored)
+{
+  vimExecute("100,600d");
+  vimExecute("w");
+  changeAndWrite(1);
+
+  // Appending a segment was interrupted after its first bytes
+  FILE *fp = fopen((char *)undoName, "ab");
+  fputc(0x94, fp);
+  fputc(0xc1, fp);
+  fputc(0, fp);
+  fclose(fp);
+
+  reload();
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "changed 1 with some text to make it longer") == 0);
+  vimInput("u");
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT);
+}
+
+MU_TEST(test_corrupt_entries)
+{
+  vimExecute("100,600d");
+  vimExecute("w");
+  changeAndWrite(1);
+
+  // Break the entries of the delete, they are only read when undoing it
+  reload();
+  mu_check(buf->b_u_oldhead != NULL && buf->b_u_oldhead->uh_file_off != 0);
+  long offset = (long)buf->b_u_oldhead->uh_file_off;
+  FILE *fp = fopen((char *)undoName, "r+b");
+  fseek(fp, offset, SEEK_SET);
+  fputc(0, fp);
+  fputc(0, fp);
+  fclose(fp);
+
+  reload();
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "line 1 with some text to make it longer") == 0);
+
+  // The undo tree is dropped, the text is not changed
+  vimInput("u");
+  mu_check(vimBufferGetLineCount(buf) == LINE_COUNT - 501);
+  mu_check(buf->b_u_oldhead == NULL && buf->b_u_numhead == 0);
+  mu_check(buf->b_u_file == NULL);
+
+  // New changes can be undone
+  vimInput("x");
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "ine 1 with some text to make it longer") == 0);
+  vimInput("u");
+  mu_check(STRCMP(vimBufferGetLine(buf, 1), "line 1 with some text to make it longer") == 0);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+  MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+  MU_RUN_TEST(test_append_small_change);
+  MU_RUN_TEST(test_reload_after_appending);
+  MU_RUN_TEST(test_entries_read_lazily);
+  MU_RUN_TEST(test_tail_append_lazy);
+  MU_RUN_TEST(test_tail_append_lazy_written);
+  MU_RUN_TEST(test_compacted);
+  MU_RUN_TEST(test_changed_file_rewritten);
+  MU_RUN_TEST(test_incomplete_segment_ignored);
+  MU_RUN_TEST(test_corrupt_entries);
+}
+
+int main(int argc, char **argv)
+{
+  vimInit(argc, argv);
+
+  win_setwidth(5);
+  win_setheight(100);
+
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  MU_RETURN();
+}
@@ -756,8 +756,13 @@ void buf_freeall(buf_T *buf, int flags)
   }
 #endif
 
+  if (buf->b_load != NULL)
+    bufload_detach(buf); /* stop appending lines */
   ml_close(buf, TRUE);         /* close and delete the memline/memfile */
   buf->b_ml.ml_line_count = 0; /* no lines in buffer */
+  buf_clear_changes(buf);
+  ga_clear(&buf->b_update_batch);
+  hl_index_clear(buf);
   if ((flags & BFA_KEEP_UNDO) == 0)
   {
     u_blockfree(buf); /* free the memory allocated for undo */
@@ -894,6 +899,72 @@ clear_wininfo(buf_T *buf)
   }
 }
 
+/*
+ * Set the total of the sizes in "stats".
+ */
+static void
+memory_stats_total(memoryStats_T *stats)
+{
+  stats->total = stats->buffer + stats->memline + stats->snapshots +
+                 stats->line_cache + stats->undo + stats->marks +
+                 stats->folds + stats->eval;
+}
+
+/*
+ * Add the memory used by buffer "buf" to "stats".
+ */
+void buf_memory_stats(buf_T *buf, memoryStats_T *stats)
+{
+  long_u marks = stats->marks;
+  wininfo_T *wip;
+#ifdef FEAT_FOLDING
+  tabpage_T *tp;
+  win_T *wp;
+#endif
+
+  ++stats->buffers;
+  ml_memory_stats(buf, stats);
+  u_memory_stats(buf, stats);
+
+  /* The marks are kept in the buf_T, don't count them twice. */
+  mark_memory_stats(buf, stats);
+  stats->buffer += sizeof(buf_T) - (stats->marks - marks);
+  for (wip = buf->b_wininfo; wip != NULL; wip = wip->wi_next)
+    stats->buffer += sizeof(wininfo_T);
+
+#ifdef FEAT_FOLDING
+  FOR_ALL_TAB_WINDOWS(tp, wp)
+  if (wp->w_buffer == buf)
+    stats->folds += foldMemorySize(&wp->w_folds);
+  for (wip = buf->b_wininfo; wip != NULL; wip = wip->wi_next)
+    if (wip->wi_optset)
+      stats->folds += foldMemorySize(&wip->wi_folds);
+#endif
+#ifdef FEAT_EVAL
+  if (buf->b_vars != NULL)
+    stats->eval += dict_memory_size(buf->b_vars);
+#endif
+  memory_stats_total(stats);
+}
+
+/*
+ * Get the memory used by all buffers in "stats", with the file marks,
+ * jumplists and global variables.
+ */
+void buf_memory_stats_all(memoryStats_T *stats)
+{
+  buf_T *buf;
+
+  vim_memset(stats, 0, sizeof(memoryStats_T));
+  FOR_ALL_BUFFERS(buf)
+  buf_memory_stats(buf, stats);
+  mark_memory_stats(NULL, stats);
+#ifdef FEAT_EVAL
+  stats->eval += dict_memory_size(&globvardict);
+#endif
+  memory_stats_total(stats);
+}
+
 /*
  * Go to another buffer.  Handles the result of the ATTENTION dialog.
  */
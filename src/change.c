@@ -13,6 +13,13 @@
 
 #include "vim.h"
 
+/* Open batches of buffer updates, see buf_update_batch_begin(). */
+static int update_batch_depth = 0;
+
+/* Updates for one buffer in a batch are merged into one when there are more
+ * than this. */
+#define UPDATE_BATCH_MAX 100
+
 /*
  * If the file is readonly, give a warning message with the first change.
  * Don't do this for autocommands.
@@ -386,6 +393,194 @@ void invoke_listeners(buf_T *buf)
 }
 #endif
 
+/*
+ * Record a change in "buf" for the bufferChangeCallback: "old_len" bytes at
+ * "offset", from "lnum" / "col" up to "end_lnum" / "end_col", are replaced
+ * with "len" bytes of "text".  "text" is allocated and taken over, it may be
+ * NULL when the whole text was replaced.
+ */
+void buf_record_change(
+    buf_T *buf,
+    linenr_T lnum,
+    colnr_T col,
+    linenr_T end_lnum,
+    colnr_T end_col,
+    long offset,
+    long old_len,
+    char_u *text,
+    long len)
+{
+  bufferChange_T *change;
+
+  if (buf->b_changes.ga_itemsize == 0)
+    ga_init2(&buf->b_changes, (int)sizeof(bufferChange_T), 20);
+  if (ga_grow(&buf->b_changes, 1) == FAIL)
+  {
+    vim_free(text);
+    return;
+  }
+  change = (bufferChange_T *)buf->b_changes.ga_data + buf->b_changes.ga_len++;
+  change->buf = buf;
+  change->changedtick = 0;
+  change->lnum = lnum;
+  change->col = col;
+  change->oldEndLnum = end_lnum;
+  change->oldEndCol = end_col;
+  change->byteOffset = offset;
+  change->oldLength = old_len;
+  change->newText = text;
+  change->newLength = len;
+}
+
+/*
+ * Drop the changes recorded for "buf" without invoking the callback.
+ */
+void buf_clear_changes(buf_T *buf)
+{
+  int i;
+
+  for (i = 0; i < buf->b_changes.ga_len; ++i)
+    vim_free(((bufferChange_T *)buf->b_changes.ga_data)[i].newText);
+  ga_clear(&buf->b_changes);
+}
+
+/*
+ * Called when a sequence of changes is done: pass the changes recorded for
+ * "buf" to the bufferChangeCallback, oldest first.
+ */
+void buf_invoke_changes(buf_T *buf)
+{
+  garray_T changes;
+  bufferChange_T *change;
+  int i;
+  static int recursive = FALSE;
+
+  if (recursive || update_batch_depth > 0)
+    return;
+  if (bufferChangeCallback == NULL)
+  {
+    buf_clear_changes(buf);
+    return;
+  }
+
+  // A changed line is only recorded when it is stored.
+  if (buf->b_ml.ml_flags & ML_LINE_DIRTY)
+    ml_flush_line(buf);
+  if (buf->b_changes.ga_len == 0)
+    return;
+  recursive = TRUE;
+
+  // The callback may make more changes, they are recorded for the next time.
+  changes = buf->b_changes;
+  ga_init2(&buf->b_changes, (int)sizeof(bufferChange_T), 20);
+  for (i = 0; i < changes.ga_len; ++i)
+  {
+    change = (bufferChange_T *)changes.ga_data + i;
+    change->changedtick = CHANGEDTICK(buf);
+    bufferChangeCallback(change);
+    vim_free(change->newText);
+  }
+  ga_clear(&changes);
+
+  recursive = FALSE;
+}
+
+/*
+ * Pass a change of lines "lnum" to "lnume" of "buf" to the
+ * bufferUpdateCallback.  While a batch is open it is merged with the updates
+ * for "buf" that are waiting.
+ */
+void buf_send_update(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra)
+{
+  bufferUpdate_T update;
+  bufferUpdate_T *last;
+  linenr_T old_end;
+  linenr_T new_end;
+
+  if (bufferUpdateCallback == NULL)
+    return;
+
+  update.buf = buf;
+  update.lnum = lnum;
+  update.lnume = lnume;
+  update.xtra = xtra;
+  if (update_batch_depth == 0)
+  {
+    bufferUpdateCallback(update);
+    return;
+  }
+
+  if (buf->b_update_batch.ga_itemsize == 0)
+    ga_init2(&buf->b_update_batch, (int)sizeof(bufferUpdate_T), 20);
+  if (buf->b_update_batch.ga_len > 0)
+  {
+    /* The lines of "update" are numbered after the "last" change.  Merge
+     * when they overlap or touch, or when the list gets too long; lines in
+     * between are then reported as changed too. */
+    last = (bufferUpdate_T *)buf->b_update_batch.ga_data + buf->b_update_batch.ga_len - 1;
+    if ((lnum <= last->lnume + last->xtra && lnume >= last->lnum) || buf->b_update_batch.ga_len >= UPDATE_BATCH_MAX)
+    {
+      old_end = MAX(last->lnume, lnume - last->xtra);
+      new_end = MAX(last->lnume + last->xtra, lnume) + xtra;
+      last->lnum = MIN(last->lnum, lnum);
+      last->lnume = old_end;
+      last->xtra = new_end - old_end;
+      return;
+    }
+  }
+  if (ga_grow(&buf->b_update_batch, 1) == OK)
+    ((bufferUpdate_T *)buf->b_update_batch.ga_data)[buf->b_update_batch.ga_len++] = update;
+}
+
+/*
+ * Start collecting buffer updates, until the matching
+ * buf_update_batch_end().  Calls can be nested.
+ */
+void buf_update_batch_begin(void)
+{
+  ++update_batch_depth;
+}
+
+/*
+ * End collecting buffer updates.  When the outer batch ends, pass the
+ * changes and merged updates of each buffer to the callbacks.
+ */
+void buf_update_batch_end(void)
+{
+  buf_T *buf;
+  garray_T updates;
+  int i;
+
+  if (update_batch_depth == 0 || --update_batch_depth > 0)
+    return;
+
+  FOR_ALL_BUFFERS(buf)
+  {
+    buf_invoke_changes(buf);
+    if (buf->b_update_batch.ga_len == 0)
+      continue;
+
+    // The callback may open another batch.
+    updates = buf->b_update_batch;
+    ga_init2(&buf->b_update_batch, (int)sizeof(bufferUpdate_T), 20);
+    for (i = 0; i < updates.ga_len && bufferUpdateCallback != NULL; ++i)
+      bufferUpdateCallback(((bufferUpdate_T *)updates.ga_data)[i]);
+    ga_clear(&updates);
+  }
+}
+
+/*
+ * Invoke the bufferChangeCallback for changes in all buffers.
+ */
+void invoke_all_buffer_changes(void)
+{
+  buf_T *buf;
+
+  FOR_ALL_BUFFERS(buf)
+  if (buf->b_changes.ga_len > 0 || (buf->b_ml.ml_flags & ML_LINE_DIRTY))
+    buf_invoke_changes(buf);
+}
+
 /*
  * Common code for when a change was made.
  * See changed_lines() for the arguments.
@@ -410,15 +605,9 @@ changed_common(
   // mark the buffer as modified
   changed();
 
-  if (bufferUpdateCallback != NULL)
-  {
-    bufferUpdate_T bufferUpdate;
-    bufferUpdate.buf = curbuf;
-    bufferUpdate.lnum = lnum;
-    bufferUpdate.lnume = lnume;
-    bufferUpdate.xtra = xtra;
-    bufferUpdateCallback(bufferUpdate);
-  }
+  hl_index_changed(curbuf, lnum, lnume, xtra);
+  buf_invoke_changes(curbuf);
+  buf_send_update(curbuf, lnum, lnume, xtra);
 
 #ifdef FEAT_EVAL
   may_record_change(lnum, col, lnume, xtra);
@@ -787,6 +976,22 @@ void changed_lines(
   changed_common(lnum, col, lnume, xtra);
 }
 
+/*
+ * Lines of "buf" were read from its file without changing the buffer, e.g.
+ * because the file grew.  The arguments are like for changed_lines().  The
+ * buffer is not marked modified and the caller takes care of undo.
+ */
+void file_lines_changed(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra)
+{
+  changed_lines_buf(buf, lnum, lnume, xtra);
+  ++CHANGEDTICK(buf);
+  redraw_buf_later(buf, NOT_VALID);
+
+  hl_index_changed(buf, lnum, lnume, xtra);
+  buf_invoke_changes(buf);
+  buf_send_update(buf, lnum, lnume, xtra);
+}
+
 /*
  * Called when the changed flag must be reset for buffer "buf".
  * When "ff" is TRUE also reset 'fileformat'.
@@ -1158,6 +1363,9 @@ int del_bytes(
   mch_memmove(newp + col, oldp + col + count, (size_t)movelen);
   if (alloc_newp)
     ml_replace(lnum, newp, FALSE);
+  else
+    // the line was changed in place, keep the length right for undo
+    curbuf->b_ml.ml_line_len -= count;
 
   // mark the buffer as changed and prepare for displaying
   inserted_bytes(lnum, curwin->w_cursor.col, -count);
@@ -257,6 +257,56 @@ void dictitem_free(dictitem_T *item)
     vim_free(item);
 }
 
+/*
+ * Return the number of bytes used by dict "d": its hashtable, items and
+ * their values.  Lists and dicts in it are counted without their items,
+ * they can be shared and contain themselves.
+ */
+long_u dict_memory_size(dict_T *d)
+{
+  long_u size = sizeof(dict_T);
+  int todo;
+  hashitem_T *hi;
+  dictitem_T *di;
+
+  if (d->dv_hashtab.ht_array != d->dv_hashtab.ht_smallarray)
+    size += (d->dv_hashtab.ht_mask + 1) * sizeof(hashitem_T);
+  todo = (int)d->dv_hashtab.ht_used;
+  for (hi = d->dv_hashtab.ht_array; todo > 0; ++hi)
+  {
+    if (HASHITEM_EMPTY(hi))
+      continue;
+    --todo;
+    di = HI2DI(hi);
+    if (di->di_flags & DI_FLAGS_ALLOC)
+      size += sizeof(dictitem_T) + STRLEN(di->di_key);
+    switch (di->di_tv.v_type)
+    {
+    case VAR_STRING:
+    case VAR_FUNC:
+      if (di->di_tv.vval.v_string != NULL)
+        size += STRLEN(di->di_tv.vval.v_string) + 1;
+      break;
+    case VAR_LIST:
+      if (di->di_tv.vval.v_list != NULL)
+        size += sizeof(list_T) +
+                di->di_tv.vval.v_list->lv_len * sizeof(listitem_T);
+      break;
+    case VAR_DICT:
+      if (di->di_tv.vval.v_dict != NULL)
+        size += sizeof(dict_T);
+      break;
+    case VAR_BLOB:
+      if (di->di_tv.vval.v_blob != NULL)
+        size += sizeof(blob_T) + di->di_tv.vval.v_blob->bv_ga.ga_maxlen;
+      break;
+    default:
+      break;
+    }
+  }
+  return size;
+}
+
 /*
  * Make a copy of dict "d".  Shallow if "deep" is FALSE.
  * The refcount of the new dict is set to 1.
@@ -772,6 +772,14 @@
 #define FEAT_PERSISTENT_UNDO
 #endif
 
+/*
+ * +mmap_file		Large files can be read through a read-only mapping,
+ *			blocks are only copied into the buffer when used.
+ */
+#if defined(FEAT_NORMAL) && defined(UNIX)
+#define FEAT_MMAP_FILE
+#endif
+
 /*
  * +filterpipe
  */
@@ -21,6 +21,23 @@
 #include <utime.h> /* for struct utimbuf */
 #endif
 
+#ifdef FEAT_MMAP_FILE
+#include <sys/mman.h>
+#endif
+
+#ifdef UNIX
+#include <pthread.h>
+#include <sys/uio.h> /* for writev() */
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h> /* for copy_file_range() */
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
 #define BUFSIZE 8192  /* size of normal write buffer */
 #define SMBUFSIZE 256 /* size of emergency write buffer */
 
@@ -39,6 +56,8 @@ static int msg_add_fileformat(int eol_type);
 static void msg_add_eol(void);
 static int check_mtime(buf_T *buf, stat_T *s);
 static int time_differs(long t1, long t2);
+static int copy_fd_fast(int fd_in, int fd_out, backupMethod_T *methodp);
+static void set_backup_stats(backupMethod_T method, off_T size, proftime_T *start);
 
 #define HAS_BW_FLAGS
 #define FIO_LATIN1 0x01 /* convert Latin1 */
@@ -94,7 +113,174 @@ struct bw_info
 
 static int buf_write_bytes(struct bw_info *ip);
 
+/*
+ * Writing without conversion gathers the lines from the memline data blocks
+ * into iovecs for writev(), instead of copying every byte into "buffer".
+ * Short lines and end-of-lines are copied, they would make the iovecs too
+ * small.  The first writev() is small and they double from there, so that
+ * small files and write errors are handled quickly.
+ */
+#ifdef UNIX
+#define BUF_WRITE_GATHER
+#endif
+
+#ifdef BUF_WRITE_GATHER
+#if defined(IOV_MAX) && IOV_MAX < 512
+#define GATHER_IOV_MAX IOV_MAX     /* iovecs for one writev() */
+#else
+#define GATHER_IOV_MAX 512
+#endif
+#define GATHER_COPY_LEN 256        /* shorter text is copied */
+#define GATHER_CHUNK_MIN 0x10000   /* bytes for the first writev() */
+#define GATHER_CHUNK_MAX 0x400000  /* bytes for the largest writev() */
+#define GATHER_MAX_BLOCKS 1024     /* data blocks kept locked */
+
+typedef struct
+{
+  int bg_fd;
+  int bg_fileformat;
+  linenr_T bg_end;  /* last line to write */
+  int bg_last_eol;  /* write an end-of-line after "bg_end" */
+  struct iovec bg_iov[GATHER_IOV_MAX];
+  int bg_iovcnt;
+  size_t bg_len;    /* bytes in bg_iov[] */
+  size_t bg_chunk;  /* write when this many bytes are gathered */
+  char_u *bg_copy;  /* short text is copied here */
+  size_t bg_copylen;
+  long bg_nchars;   /* bytes written */
+  int bg_error;     /* writing failed or interrupted */
+  int bg_breakcheck; /* check for CTRL-C, only in the main thread */
+} bufgather_T;
+
+static int buf_write_gather(buf_T *buf, int fd, linenr_T start, linenr_T end, int fileformat, int last_eol, long *ncharsp);
+#endif
+
+/*
+ * Saving a buffer in the background, for vimBufferSaveAsync().  A snapshot of
+ * the lines is written to a temp file next to the file by a worker thread,
+ * which syncs it and renames it over the file.  bufsave_poll() updates the
+ * buffer in the main thread when that is done.  Without threads, or when the
+ * file can't be replaced that way, buf_write() is used right away.
+ */
+#ifdef BUF_WRITE_GATHER
+#define BUFSAVE_THREAD
+#endif
+
+struct bufsave_S
+{
+  buf_T *bs_buf;
+  bufref_T bs_bufref;          /* to check "bs_buf" is still valid */
+  varnumber_T bs_changedtick;  /* b:changedtick of the snapshot */
+  saveState_T bs_state;        /* as seen by the main thread */
+  int bs_reported;             /* a failure was reported already */
+  SaveCompleteCallback bs_callback;
+  void *bs_context;
+
+#ifdef BUFSAVE_THREAD
+  /* Only used by the worker while it runs. */
+  snapshot_T *bs_snapshot;     /* the lines to write */
+  int bs_write_lines;          /* FALSE for an empty buffer */
+  bufgather_T *bs_gather;      /* writes to "bs_fd" */
+  char_u *bs_fname;            /* the file, symlinks resolved */
+  char_u *bs_tmpname;          /* written, then renamed to "bs_fname" */
+  int bs_fd;
+  char_u bs_bom[4];
+  int bs_bomlen;
+  int bs_fsync;                /* 'fsync' */
+
+  /* Set by the worker when it is done, protected by "bs_mutex". */
+  int bs_done;
+  char *bs_errmsg;             /* untranslated, NULL when written */
+  int bs_rename_errno;         /* errno when renaming failed */
+
+  int bs_thread_started;
+  pthread_t bs_thread;
+  pthread_mutex_t bs_mutex;
+#endif
+};
+
+/*
+ * Loading a buffer in the background, for vimBufferOpenAsync().
+ * A worker thread reads the file and splits it into lines.  readfile() only
+ * takes the first lines, bufload_poll() appends the rest in the main thread,
+ * the memline is never touched by the worker.  Without threads the file is
+ * read a block at a time by bufload_poll().
+ */
+#ifdef UNIX
+#define BUFLOAD_THREAD
+#endif
+
+#define BUFLOAD_READ_SIZE 0x10000 /* bytes read at a time */
+#define BUFLOAD_MAX_QUEUED 64     /* blocks read ahead of the buffer */
+
+typedef struct loadchunk_S loadchunk_T;
+struct loadchunk_S
+{
+  loadchunk_T *lc_next;
+  char_u *lc_text;   /* the lines, each one ending in a NUL */
+  linenr_T lc_lines; /* number of lines in lc_text */
+  long lc_len;       /* bytes of the file the lines came from */
+  int lc_illegal;    /* lc_text is not valid UTF-8 */
+};
+
+struct bufload_S
+{
+  buf_T *bl_target;                /* buffer opened by bufload_open() */
+  buf_T *bl_buf;                   /* buffer getting the lines, NULL until
+                                      readfile() takes the load and after
+                                      unloading the buffer */
+  loadState_T bl_state;
+  linenr_T bl_initial;             /* lines wanted before opening */
+  linenr_T bl_lines;               /* lines appended to bl_buf */
+  off_T bl_loaded;                 /* bytes appended to bl_buf */
+  off_T bl_size;                   /* size of the file */
+  int bl_fileformat;               /* EOL_UNIX or EOL_DOS */
+  int bl_save_ma;                  /* 'modifiable' before loading */
+  int bl_check_utf8;               /* read again when not valid UTF-8 */
+  LoadProgressCallback bl_callback;
+  void *bl_context;
+
+  /* Only used by the reader. */
+  int bl_fd;
+  char_u *bl_readbuf;              /* start of a line not read completely */
+  size_t bl_readsize;              /* allocated size of bl_readbuf */
+  size_t bl_rest;                  /* bytes of the line in bl_readbuf */
+
+  /* Shared with the reader, protected by bl_mutex. */
+  loadchunk_T *bl_first;           /* lines not appended yet */
+  loadchunk_T *bl_last;
+  int bl_queued;                   /* number of blocks in bl_first */
+  linenr_T bl_queued_lines;        /* number of lines in bl_first */
+  int bl_eof;                      /* reader is done */
+  int bl_error;                    /* reader stopped on an error */
+  long bl_no_eol_len;              /* length of a last line without NL */
+  int bl_cancel;                   /* reader must stop */
+#ifdef BUFLOAD_THREAD
+  int bl_thread_started;
+  pthread_t bl_thread;
+  pthread_mutex_t bl_mutex;
+  pthread_cond_t bl_ready;         /* signalled when a block is queued */
+  pthread_cond_t bl_space;         /* signalled when blocks are taken */
+#endif
+};
+
+#ifdef BUFLOAD_THREAD
+#define BUFLOAD_LOCK(load) pthread_mutex_lock(&(load)->bl_mutex)
+#define BUFLOAD_UNLOCK(load) pthread_mutex_unlock(&(load)->bl_mutex)
+#else
+#define BUFLOAD_LOCK(load)
+#define BUFLOAD_UNLOCK(load)
+#endif
+
+/* The load that readfile() may take the first lines from. */
+static bufload_T *pending_load = NULL;
+
 static linenr_T readfile_linenr(linenr_T linecnt, char_u *p, char_u *endp);
+#ifdef FEAT_MMAP_FILE
+static linenr_T readfile_mapped(int fd, int *ffp, int try_unix, int try_dos, int try_mac, int check_utf8, off_T *filesizep, int *no_eolp);
+#endif
+static linenr_T readfile_async(linenr_T from, int *ffp, int try_unix, int try_dos, int try_mac, int check_utf8, off_T *filesizep);
+static void buf_set_read_size(buf_T *buf, off_T size);
 static int ucs2bytes(unsigned c, char_u **pp, int flags);
 static int need_conversion(char_u *fenc);
 static int get_fio_flags(char_u *ptr);
@@ -174,7 +360,6 @@ int readfile(
   off_T filesize = 0;
   int skip_read = FALSE;
 #ifdef FEAT_PERSISTENT_UNDO
-  context_sha256_T sha_ctx;
   int read_undo_file = FALSE;
 #endif
   int split = 0;           /* number of split lines */
@@ -1062,11 +1247,70 @@ retry:
     conv_restlen = 0;
 #ifdef FEAT_PERSISTENT_UNDO
     read_undo_file = (newfile && (flags & READ_KEEP_UNDO) == 0 && curbuf->b_ffname != NULL && curbuf->b_p_udf && !filtering && !read_fifo && !read_stdin && !read_buffer);
-    if (read_undo_file)
-      sha256_start(&sha_ctx);
 #endif
   }
 
+#ifdef FEAT_MMAP_FILE
+  /*
+     * A large file that can be used as it is gets paged in from a read-only
+     * mapping, instead of copying all of it into the buffer now.
+     */
+  if (mmap_threshold > 0 && filesize == 0 && newfile && wasempty && !converted && tmpname == NULL && !filtering && !read_stdin && !read_fifo && !read_buffer && !recoverymode
+#ifdef FEAT_PERSISTENT_UNDO
+      && !read_undo_file
+#endif
+  )
+  {
+    int mapped_ff = fileformat;
+    int no_eol = FALSE;
+    linenr_T mapped_lines;
+
+    mapped_lines = readfile_mapped(fd, &mapped_ff, try_unix, try_dos, try_mac,
+                                   enc_utf8 && !curbuf->b_p_bin, &filesize, &no_eol);
+    if (mapped_lines > 0)
+    {
+      /* if editing a new file: may set p_tx and p_ff */
+      if (set_options && fileformat == EOL_UNKNOWN)
+        set_fileformat(mapped_ff, OPT_LOCAL);
+      fileformat = mapped_ff;
+      lnum += mapped_lines;
+      if (no_eol)
+      {
+        /* remember for when writing */
+        if (set_options)
+          curbuf->b_p_eol = FALSE;
+        read_no_eol_lnum = lnum;
+      }
+      goto failed;
+    }
+  }
+#endif
+
+  /*
+     * vimBufferOpenAsync(): the lines are read by a worker thread, only the
+     * first ones are appended now.
+     */
+  if (pending_load != NULL && pending_load->bl_target == curbuf && filesize == 0 && newfile && wasempty && !converted && fileformat == EOL_UNKNOWN && tmpname == NULL && !filtering && !read_stdin && !read_fifo && !read_buffer && !recoverymode && !curbuf->b_p_bin
+#ifdef FEAT_PERSISTENT_UNDO
+      && !read_undo_file
+#endif
+  )
+  {
+    int async_ff = EOL_UNKNOWN;
+    linenr_T async_lines;
+
+    async_lines = readfile_async(lnum, &async_ff, try_unix, try_dos, try_mac,
+                                 enc_utf8, &filesize);
+    if (async_lines > 0)
+    {
+      if (set_options)
+        set_fileformat(async_ff, OPT_LOCAL);
+      fileformat = async_ff;
+      lnum += async_lines;
+      goto failed;
+    }
+  }
+
   while (!error && !got_int)
   {
     /*
@@ -1819,9 +2063,12 @@ retry:
         /* Reading UTF-8: Check if the bytes are valid UTF-8. */
         for (p = ptr;; ++p)
         {
-          int todo = (int)((ptr + size) - p);
+          int todo;
           int l;
 
+          /* Skip over the valid characters in one go. */
+          p += utf_valid_len(p, (long)((ptr + size) - p));
+          todo = (int)((ptr + size) - p);
           if (todo <= 0)
             break;
           if (*p >= 0x80)
@@ -1913,19 +2160,16 @@ retry:
           if (try_mac)
             try_mac = 1;
 
-          for (p = ptr; p < ptr + size; ++p)
-          {
-            if (*p == NL)
-            {
-              if (!try_unix || (try_dos && p > ptr && p[-1] == CAR))
-                fileformat = EOL_DOS;
-              else
-                fileformat = EOL_UNIX;
-              break;
-            }
-            else if (*p == CAR && try_mac)
-              try_mac++;
-          }
+          p = vim_memchr3(ptr, (size_t)size, NL, NL, NL);
+          if (try_mac)
+            try_mac += (int)vim_memcount(
+                ptr, (size_t)((p == NULL ? ptr + size : p) - ptr), CAR);
+          if (p == NULL)
+            p = ptr + size;
+          else if (!try_unix || (try_dos && p > ptr && p[-1] == CAR))
+            fileformat = EOL_DOS;
+          else
+            fileformat = EOL_UNIX;
 
           /* Don't give in to EOL_UNIX if EOL_MAC is more likely */
           if (fileformat == EOL_UNIX && try_mac)
@@ -1937,13 +2181,8 @@ retry:
               ;
             if (p >= ptr)
             {
-              for (p = ptr; p < ptr + size; ++p)
-              {
-                if (*p == NL)
-                  try_unix++;
-                else if (*p == CAR)
-                  try_mac++;
-              }
+              try_unix += (int)vim_memcount(ptr, (size_t)size, NL);
+              try_mac += (int)vim_memcount(ptr, (size_t)size, CAR);
               if (try_mac > try_unix)
                 fileformat = EOL_MAC;
             }
@@ -1969,17 +2208,27 @@ retry:
     }
 
     /*
-	 * This loop is executed once for every character read.
-	 * Keep it fast!
+	 * This loop is executed once for every line read, the bytes in between
+	 * are skipped with vim_memchr3().  Keep it fast!
 	 */
     if (fileformat == EOL_MAC)
     {
       --ptr;
       while (++ptr, --size >= 0)
       {
-        /* catch most common case first */
+        /* catch most common case first: skip to the next special byte */
         if ((c = *ptr) != NUL && c != CAR && c != NL)
-          continue;
+        {
+          p = vim_memchr3(ptr, (size_t)size + 1, NUL, CAR, NL);
+          if (p == NULL)
+          {
+            ptr += size + 1;
+            break;
+          }
+          size -= (long)(p - ptr);
+          ptr = p;
+          c = *ptr;
+        }
         if (c == NUL)
           *ptr = NL; /* NULs are replaced by newlines! */
         else if (c == NL)
@@ -1995,10 +2244,6 @@ retry:
               error = TRUE;
               break;
             }
-#ifdef FEAT_PERSISTENT_UNDO
-            if (read_undo_file)
-              sha256_update(&sha_ctx, line_start, len);
-#endif
             ++lnum;
             if (--read_count == 0)
             {
@@ -2018,8 +2263,19 @@ retry:
       --ptr;
       while (++ptr, --size >= 0)
       {
-        if ((c = *ptr) != NUL && c != NL) /* catch most common case */
-          continue;
+        /* catch most common case: skip to the next NUL or NL */
+        if ((c = *ptr) != NUL && c != NL)
+        {
+          p = vim_memchr3(ptr, (size_t)size + 1, NUL, NL, NL);
+          if (p == NULL)
+          {
+            ptr += size + 1;
+            break;
+          }
+          size -= (long)(p - ptr);
+          ptr = p;
+          c = *ptr;
+        }
         if (c == NUL)
           *ptr = NL; /* NULs are replaced by newlines! */
         else
@@ -2061,10 +2317,6 @@ retry:
               error = TRUE;
               break;
             }
-#ifdef FEAT_PERSISTENT_UNDO
-            if (read_undo_file)
-              sha256_update(&sha_ctx, line_start, len);
-#endif
             ++lnum;
             if (--read_count == 0)
             {
@@ -2103,13 +2355,7 @@ failed:
     if (ml_append(lnum, line_start, len, newfile) == FAIL)
       error = TRUE;
     else
-    {
-#ifdef FEAT_PERSISTENT_UNDO
-      if (read_undo_file)
-        sha256_update(&sha_ctx, line_start, len);
-#endif
       read_no_eol_lnum = ++lnum;
-    }
   }
 
   if (set_options)
@@ -2166,6 +2412,16 @@ failed:
       ml_delete(curbuf->b_ml.ml_line_count, FALSE);
       --linecnt;
     }
+    /* The lines of a new file are not recorded one by one, tell the
+     * bufferChangeCallback that all the text was replaced. */
+    if (newfile)
+      hl_index_clear(curbuf);
+    if (newfile && bufferChangeCallback != NULL)
+    {
+      buf_clear_changes(curbuf);
+      buf_record_change(curbuf, (linenr_T)1, (colnr_T)0, (linenr_T)0,
+                        (colnr_T)0, 0L, -1L, NULL, -1L);
+    }
     linecnt = curbuf->b_ml.ml_line_count - linecnt;
     if (filesize == 0)
       linecnt = 0;
@@ -2361,6 +2617,11 @@ failed:
      */
   curbuf->b_no_eol_lnum = read_no_eol_lnum;
 
+  /* Tail mode continues reading where this ends, unless a background load
+     * still appends lines. */
+  if (newfile && curbuf->b_load == NULL)
+    buf_set_read_size(curbuf, filesize);
+
   /* When reloading a buffer put the cursor at the first line that is
      * different. */
   if (flags & READ_KEEP_UNDO)
@@ -2374,7 +2635,7 @@ failed:
   {
     char_u hash[UNDO_HASH_SIZE];
 
-    sha256_finish(&sha_ctx, hash);
+    u_compute_hash(hash);
     u_read_undo(NULL, hash, fname);
   }
 #endif
@@ -2421,23 +2682,794 @@ failed:
 #endif
   }
 
-  if (recoverymode && error)
-    return FAIL;
-  return OK;
-}
+  if (recoverymode && error)
+    return FAIL;
+  return OK;
+}
+
+#if defined(OPEN_CHR_FILES) || defined(PROTO)
+/*
+ * Returns TRUE if the file name argument is of the form "/dev/fd/\d\+",
+ * which is the name of files used for process substitution output by
+ * some shells on some operating systems, e.g., bash on SunOS.
+ * Do not accept "/dev/fd/[012]", opening these may hang Vim.
+ */
+int is_dev_fd_file(char_u *fname)
+{
+  return (STRNCMP(fname, "/dev/fd/", 8) == 0 && VIM_ISDIGIT(fname[8]) && *skipdigits(fname + 9) == NUL && (fname[9] != NUL || (fname[8] != '0' && fname[8] != '1' && fname[8] != '2')));
+}
+#endif
+
+#ifdef FEAT_MMAP_FILE
+/*
+ * Read file "fd" into the empty buffer "curbuf" through a read-only mapping,
+ * see ml_open_mapped().  Only done for a file of at least "mmap_threshold"
+ * bytes in a format the buffer can use without changing it.
+ * "*ffp" is EOL_UNKNOWN to detect the fileformat the way readfile() does,
+ * the format is returned in "*ffp".  "check_utf8" is TRUE when the file must
+ * be valid UTF-8.  Sets "*filesizep" and sets "*no_eolp" when the last line
+ * does not end in a NL.
+ * Returns the number of lines, zero when the file has to be read normally.
+ */
+static linenr_T
+readfile_mapped(
+    int fd,
+    int *ffp,
+    int try_unix,
+    int try_dos,
+    int try_mac,
+    int check_utf8,
+    off_T *filesizep,
+    int *no_eolp)
+{
+  stat_T st;
+  char_u *addr;
+  char_u *end;
+  char_u *p;
+  size_t size;
+  size_t head;
+  int bomlen;
+  int fileformat = *ffp;
+  linenr_T lnum;
+
+  if (mch_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < mmap_threshold || (off_T)(size_t)st.st_size != st.st_size)
+    return 0;
+  size = (size_t)st.st_size;
+  addr = (char_u *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+  if (addr == (char_u *)MAP_FAILED)
+    return 0;
+  end = addr + size;
+
+  /* Like readfile(): the first NL in the first 64 Kbyte decides the format.
+     * Mac format and mixed line endings are left to readfile(). */
+  head = size < 0x10000 ? size : 0x10000;
+  if (fileformat == EOL_UNKNOWN)
+  {
+    if ((!try_unix && !try_dos) || (p = memchr(addr, NL, head)) == NULL)
+      goto fail;
+    if (!try_unix || (try_dos && p > addr && p[-1] == CAR))
+      fileformat = EOL_DOS;
+    else
+    {
+      fileformat = EOL_UNIX;
+      if (try_mac && memchr(addr, CAR, head) != NULL)
+        goto fail;
+    }
+  }
+  if (fileformat != EOL_UNIX && fileformat != EOL_DOS)
+    goto fail;
+  /* A trailing CTRL-Z or CR in a DOS file is special. */
+  if (fileformat == EOL_DOS && (end[-1] == Ctrl_Z || end[-1] == CAR))
+    goto fail;
+
+  /* Removing a BOM and setting 'bomb', retrying with another
+     * 'fileencoding' or dropping illegal bytes is done by readfile(). */
+  if (!curbuf->b_p_bin && head >= 2 && check_for_bom(addr, (long)head, &bomlen, FIO_ALL) != NULL)
+    goto fail;
+  if (check_utf8 && utf_valid_len(addr, (long)size) != (long)size)
+    goto fail;
+
+  if ((lnum = ml_open_mapped(curbuf, addr, size, fileformat)) == 0)
+    goto fail;
+  *ffp = fileformat;
+  *filesizep = (off_T)size;
+  *no_eolp = (end[-1] != NL);
+  return lnum;
+
+fail:
+  munmap(addr, size);
+  return 0;
+}
+#endif
+
+
+/*
+ * Read the next block of the file for "load" and queue the complete lines in
+ * it.  A NL becomes a NUL and a NUL becomes a NL, like in the memline.
+ * Runs in the worker thread, only uses malloc() and free() for memory.
+ * Returns FALSE when the reader is done: at the end of the file, for an
+ * error or when the load was cancelled.
+ */
+static int
+bufload_read(bufload_T *load)
+{
+  loadchunk_T *chunk = NULL;
+  char_u *start;
+  char_u *end;
+  char_u *p;
+  size_t size;
+  long n;
+  long len = 0;
+  int no_eol = FALSE;
+  int error = FALSE;
+  int done = FALSE;
+
+  if (load->bl_rest + BUFLOAD_READ_SIZE > load->bl_readsize)
+  {
+    /* A long line makes the buffer grow. */
+    size = load->bl_readsize * 2;
+    if (size < load->bl_rest + BUFLOAD_READ_SIZE)
+      size = load->bl_rest + BUFLOAD_READ_SIZE;
+    p = realloc(load->bl_readbuf, size);
+    if (p == NULL)
+    {
+      n = -1;
+      goto queue;
+    }
+    load->bl_readbuf = p;
+    load->bl_readsize = size;
+  }
+
+  start = load->bl_readbuf + load->bl_rest;
+  n = read_eintr(load->bl_fd, start, BUFLOAD_READ_SIZE);
+  if (n > 0)
+  {
+    /* Lines up to the last NL are complete, the text before "start" has
+	 * no NL. */
+    for (p = start + n; p > start;)
+      if (*--p == NL)
+      {
+        len = (long)(p - load->bl_readbuf) + 1;
+        break;
+      }
+  }
+  else if (n == 0 && load->bl_rest > 0)
+  {
+    /* The last line does not end in a NL. */
+    len = (long)load->bl_rest;
+    no_eol = TRUE;
+  }
+
+  if (len > 0)
+  {
+    chunk = malloc(sizeof(loadchunk_T));
+    if (chunk == NULL || (chunk->lc_text = malloc(len + 1)) == NULL)
+    {
+      free(chunk);
+      chunk = NULL;
+      n = -1;
+      goto queue;
+    }
+    chunk->lc_next = NULL;
+    chunk->lc_len = len;
+    chunk->lc_lines = no_eol ? 1 : 0;
+    mch_memmove(chunk->lc_text, load->bl_readbuf, (size_t)len);
+    chunk->lc_text[len] = NUL;
+    /* A block ends at a NL, a character never continues in the next one. */
+    chunk->lc_illegal = utf_valid_len(chunk->lc_text, len) != len;
+    for (p = chunk->lc_text, end = p + len;
+         (p = vim_memchr3(p, (size_t)(end - p), NL, NUL, NUL)) != NULL; ++p)
+      if (*p == NL)
+      {
+        *p = NUL;
+        ++chunk->lc_lines;
+      }
+      else if (*p == NUL)
+        *p = NL;
+  }
+  if (n > 0)
+  {
+    load->bl_rest += n - len;
+    mch_memmove(load->bl_readbuf, load->bl_readbuf + len, load->bl_rest);
+  }
+
+queue:
+  if (n <= 0)
+  {
+    done = TRUE;
+    error = n < 0;
+  }
+
+  BUFLOAD_LOCK(load);
+#ifdef BUFLOAD_THREAD
+  /* Don't read too far ahead of the buffer. */
+  while (load->bl_queued >= BUFLOAD_MAX_QUEUED && !load->bl_cancel)
+    pthread_cond_wait(&load->bl_space, &load->bl_mutex);
+#endif
+  if (chunk != NULL)
+  {
+    if (load->bl_last == NULL)
+      load->bl_first = chunk;
+    else
+      load->bl_last->lc_next = chunk;
+    load->bl_last = chunk;
+    ++load->bl_queued;
+    load->bl_queued_lines += chunk->lc_lines;
+  }
+  if (done || load->bl_cancel)
+  {
+    load->bl_eof = TRUE;
+    load->bl_error = error;
+    load->bl_no_eol_len = no_eol ? len : 0;
+    done = TRUE;
+  }
+#ifdef BUFLOAD_THREAD
+  pthread_cond_signal(&load->bl_ready);
+#endif
+  BUFLOAD_UNLOCK(load);
+
+  return !done;
+}
+
+#ifdef BUFLOAD_THREAD
+static void *
+bufload_worker(void *arg)
+{
+  while (bufload_read((bufload_T *)arg))
+    ;
+  return NULL;
+}
+#endif
+
+/*
+ * Wait until at least "lines" lines of "load" are queued, or the reader is
+ * done.  Returns TRUE when the reader is done.
+ */
+static int
+bufload_wait(bufload_T *load, linenr_T lines)
+{
+  int eof;
+
+  BUFLOAD_LOCK(load);
+#ifdef BUFLOAD_THREAD
+  while (!load->bl_eof && load->bl_queued_lines < lines)
+    pthread_cond_wait(&load->bl_ready, &load->bl_mutex);
+#else
+  while (!load->bl_eof && load->bl_queued_lines < lines)
+    bufload_read(load);
+#endif
+  eof = load->bl_eof;
+  BUFLOAD_UNLOCK(load);
+  return eof;
+}
+
+/*
+ * Take all the blocks queued for "load".
+ */
+static loadchunk_T *
+bufload_take(bufload_T *load)
+{
+  loadchunk_T *chunk;
+
+  BUFLOAD_LOCK(load);
+  chunk = load->bl_first;
+  load->bl_first = NULL;
+  load->bl_last = NULL;
+  load->bl_queued = 0;
+  load->bl_queued_lines = 0;
+#ifdef BUFLOAD_THREAD
+  pthread_cond_signal(&load->bl_space);
+#endif
+  BUFLOAD_UNLOCK(load);
+  return chunk;
+}
+
+static void
+bufload_free_chunks(loadchunk_T *chunk)
+{
+  loadchunk_T *next;
+
+  for (; chunk != NULL; chunk = next)
+  {
+    next = chunk->lc_next;
+    free(chunk->lc_text);
+    free(chunk);
+  }
+}
+
+/*
+ * Append the lines in the list of blocks "chunk" to the buffer of "load"
+ * below line "lnum", and free the blocks.
+ * Returns the number of lines appended.
+ */
+static linenr_T
+bufload_append(bufload_T *load, loadchunk_T *chunk, linenr_T lnum)
+{
+  linenr_T start = lnum;
+  loadchunk_T *next;
+  char_u *p;
+  colnr_T len;
+  linenr_T i;
+
+  for (; chunk != NULL; chunk = next)
+  {
+    next = chunk->lc_next;
+    p = chunk->lc_text;
+    for (i = 0; i < chunk->lc_lines; ++i)
+    {
+      len = (colnr_T)STRLEN(p) + 1;
+      /* Like readfile(): the CR before the NL is dropped in DOS format. */
+      if (load->bl_fileformat == EOL_DOS && len > 1 && p[len - 2] == CAR)
+        p[len - 2] = NUL;
+      if (ml_append_buf(load->bl_buf, lnum, p, (colnr_T)STRLEN(p) + 1, TRUE) == OK)
+        ++lnum;
+      p += len;
+    }
+    load->bl_loaded += chunk->lc_len;
+    chunk->lc_next = NULL;
+    bufload_free_chunks(chunk);
+  }
+  ml_record_appended(load->bl_buf, start, lnum - start);
+  load->bl_lines += lnum - start;
+  return lnum - start;
+}
+
+/*
+ * Stop the reader of "load" and free what it read.
+ */
+static void
+bufload_stop(bufload_T *load)
+{
+  BUFLOAD_LOCK(load);
+  load->bl_cancel = TRUE;
+#ifdef BUFLOAD_THREAD
+  pthread_cond_signal(&load->bl_space);
+#endif
+  BUFLOAD_UNLOCK(load);
+#ifdef BUFLOAD_THREAD
+  if (load->bl_thread_started)
+  {
+    pthread_join(load->bl_thread, NULL);
+    load->bl_thread_started = FALSE;
+  }
+#endif
+  if (load->bl_fd >= 0)
+  {
+    close(load->bl_fd);
+    load->bl_fd = -1;
+  }
+  bufload_free_chunks(bufload_take(load));
+  free(load->bl_readbuf);
+  load->bl_readbuf = NULL;
+  load->bl_rest = 0;
+}
+
+static void
+bufload_progress(bufload_T *load)
+{
+  loadProgress_T progress;
+
+  if (load->bl_callback == NULL)
+    return;
+  progress.buf = load->bl_target;
+  progress.state = load->bl_state;
+  progress.lines = load->bl_lines;
+  progress.bytesRead = load->bl_loaded;
+  progress.totalBytes = load->bl_size;
+  load->bl_callback(&progress, load->bl_context);
+}
+
+/*
+ * Stop loading with "state" and restore the buffer options.
+ */
+static void
+bufload_finish(bufload_T *load, loadState_T state)
+{
+  buf_T *buf = load->bl_buf;
+
+  bufload_stop(load);
+  if (buf != NULL)
+  {
+    buf->b_load = NULL;
+    buf->b_p_ma = load->bl_save_ma;
+    if (state == LOAD_DONE && load->bl_no_eol_len > 0)
+    {
+      /* remember for when writing */
+      buf->b_p_eol = FALSE;
+      buf->b_no_eol_lnum = buf->b_ml.ml_line_count;
+    }
+    else if (state != LOAD_DONE)
+      buf->b_p_ro = TRUE; /* must use "w!" now */
+    buf_set_read_size(buf, load->bl_loaded);
+    load->bl_buf = NULL;
+  }
+  load->bl_state = state;
+  bufload_progress(load);
+}
+
+/*
+ * Take the first lines of the file for "curbuf" from "pending_load" and
+ * append them below line "from", the rest is appended by bufload_poll().
+ * Like readfile_mapped() the detected format is returned in "*ffp".
+ * Returns the number of lines, zero when the file has to be read normally:
+ * it is read completely already, or is not in a format the reader can use.
+ */
+static linenr_T
+readfile_async(
+    linenr_T from,
+    int *ffp,
+    int try_unix,
+    int try_dos,
+    int try_mac,
+    int check_utf8,
+    off_T *filesizep)
+{
+  bufload_T *load = pending_load;
+  loadchunk_T *chunks;
+  loadchunk_T *chunk;
+  char_u *p;
+  size_t len;
+  int fileformat = EOL_UNKNOWN;
+
+  if (bufload_wait(load, load->bl_initial))
+    goto fail;
+  chunks = bufload_take(load);
+
+  /* Like readfile(): the first line decides the format, Mac format is left
+     * to readfile(). */
+  p = chunks->lc_text;
+  len = STRLEN(p);
+  if (try_unix || try_dos)
+    fileformat = !try_unix || (try_dos && len > 0 && p[len - 1] == CAR)
+                     ? EOL_DOS
+                     : EOL_UNIX;
+  if (fileformat == EOL_UNKNOWN || (fileformat == EOL_UNIX && try_mac && memchr(p, CAR, chunks->lc_len) != NULL))
+    goto reject;
+
+  /* Retrying with another 'fileencoding' or dropping illegal bytes is done
+     * by readfile().  The reader checks each block for illegal bytes. */
+  if (check_utf8)
+  {
+    if (len >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf)
+      goto reject;
+    for (chunk = chunks; chunk != NULL; chunk = chunk->lc_next)
+      if (chunk->lc_illegal)
+        goto reject;
+  }
+
+  load->bl_buf = curbuf;
+  load->bl_fileformat = fileformat;
+  load->bl_check_utf8 = check_utf8;
+  load->bl_save_ma = curbuf->b_p_ma;
+  curbuf->b_p_ma = FALSE;
+  curbuf->b_load = load;
+  *ffp = fileformat;
+  *filesizep = load->bl_size;
+  return bufload_append(load, chunks, from);
+
+reject:
+  bufload_free_chunks(chunks);
+fail:
+  bufload_stop(load);
+  return 0;
+}
+
+static bufload_T *
+bufload_new(buf_T *buf)
+{
+  bufload_T *load;
+
+  load = ALLOC_CLEAR_ONE(bufload_T);
+  if (load == NULL)
+    return NULL;
+  load->bl_target = buf;
+  load->bl_state = LOAD_RUNNING;
+  load->bl_fd = -1;
+  load->bl_eof = TRUE;
+#ifdef BUFLOAD_THREAD
+  pthread_mutex_init(&load->bl_mutex, NULL);
+  pthread_cond_init(&load->bl_ready, NULL);
+  pthread_cond_init(&load->bl_space, NULL);
+#endif
+  return load;
+}
+
+/*
+ * Make "buf" the current buffer, reading its file like set_curbuf() does
+ * but only waiting for the first "initial_lines" lines.  The rest of the
+ * lines are read in the background, call bufload_poll() to append them.
+ * "callback" gets the progress after lines were appended and when done.
+ * Returns NULL when out of memory.
+ */
+bufload_T *
+bufload_open(
+    buf_T *buf,
+    linenr_T initial_lines,
+    LoadProgressCallback callback,
+    void *context)
+{
+  bufload_T *load;
+  bufref_T bufref;
+  stat_T st;
+
+  load = bufload_new(buf);
+  if (load == NULL)
+    return NULL;
+  load->bl_initial = initial_lines > 0 ? initial_lines : 1;
+  load->bl_callback = callback;
+  load->bl_context = context;
+
+  /* Only a regular file that isn't loaded yet is read in the background. */
+  if (buf->b_ml.ml_mfp == NULL && buf->b_ffname != NULL && (load->bl_fd = mch_open((char *)buf->b_ffname, O_RDONLY | O_EXTRA, 0)) >= 0 && mch_fstat(load->bl_fd, &st) >= 0 && S_ISREG(st.st_mode))
+  {
+    load->bl_size = (off_T)st.st_size;
+    load->bl_eof = FALSE;
+#ifdef BUFLOAD_THREAD
+    /* The reader may be done already, only set bl_eof when it didn't start. */
+    if (pthread_create(&load->bl_thread, NULL, bufload_worker, load) == 0)
+      load->bl_thread_started = TRUE;
+    else
+      load->bl_eof = TRUE;
+#endif
+  }
+
+  set_bufref(&bufref, buf);
+  pending_load = load;
+  set_curbuf(buf, DOBUF_SPLIT);
+  pending_load = NULL;
+
+  if (load->bl_buf == NULL)
+  {
+    /* readfile() read the whole file, or the buffer was loaded already. */
+    if (bufref_valid(&bufref))
+      load->bl_lines = buf->b_ml.ml_line_count;
+    load->bl_loaded = load->bl_size;
+    bufload_finish(load, LOAD_DONE);
+  }
+  else
+    bufload_progress(load);
+  return load;
+}
+
+/*
+ * A block read for "load" is not valid UTF-8 while the first lines already
+ * are in the buffer.  Stop the reader and read the whole file again with
+ * readfile(), which tries the next encoding in 'fileencodings'.
+ */
+static void
+bufload_reread(bufload_T *load)
+{
+  buf_T *buf = load->bl_buf;
+  aco_save_T aco;
+  linenr_T old_count;
+  int retval;
+
+  bufload_stop(load);
+  buf->b_load = NULL;
+  buf->b_p_ma = load->bl_save_ma;
+  load->bl_buf = NULL;
+
+  aucmd_prepbuf(&aco, buf);
+  old_count = curbuf->b_ml.ml_line_count;
+  while (!BUFEMPTY())
+    if (ml_delete(curbuf->b_ml.ml_line_count, FALSE) == FAIL)
+      break;
+  retval = readfile(curbuf->b_ffname, curbuf->b_fname, (linenr_T)0,
+                    (linenr_T)0, (linenr_T)MAXLNUM, NULL, READ_NEW);
+  if (retval == FAIL)
+    curbuf->b_p_ro = TRUE; /* must use "w!" now */
+  file_lines_changed(curbuf, 1, old_count + 1,
+                     (long)curbuf->b_ml.ml_line_count - old_count);
+  check_cursor();
+  aucmd_restbuf(&aco);
+
+  load->bl_lines = buf->b_ml.ml_line_count;
+  load->bl_loaded = load->bl_size;
+  load->bl_state = retval == OK ? LOAD_DONE : LOAD_FAILED;
+  bufload_progress(load);
+}
+
+/*
+ * Append the lines read for "load" since the last call.  When "wait" is TRUE
+ * wait for more lines if there are none yet.
+ * Returns the state of the load.
+ */
+loadState_T
+bufload_poll(bufload_T *load, int wait)
+{
+  buf_T *buf = load->bl_buf;
+  loadchunk_T *chunks;
+  loadchunk_T *chunk;
+  linenr_T lnum;
+  linenr_T lines;
+  int eof;
+
+  if (load->bl_state != LOAD_RUNNING)
+    return load->bl_state;
+
+#ifndef BUFLOAD_THREAD
+  /* Without a thread the next block is read now. */
+  wait = TRUE;
+#endif
+  eof = bufload_wait(load, wait ? 1 : 0);
+  chunks = bufload_take(load);
+  if (load->bl_check_utf8)
+    for (chunk = chunks; chunk != NULL; chunk = chunk->lc_next)
+      if (chunk->lc_illegal)
+      {
+        bufload_free_chunks(chunks);
+        bufload_reread(load);
+        return load->bl_state;
+      }
+  if (chunks != NULL)
+  {
+    lnum = buf->b_ml.ml_line_count;
+    lines = bufload_append(load, chunks, lnum);
+    if (lines > 0)
+      file_lines_changed(buf, lnum + 1, lnum + 1, lines);
+  }
+
+  if (eof)
+    bufload_finish(load, load->bl_error ? LOAD_FAILED : LOAD_DONE);
+  else if (chunks != NULL)
+    bufload_progress(load);
+  return load->bl_state;
+}
+
+/*
+ * Stop loading, the lines read so far stay in the buffer.
+ */
+void bufload_cancel(bufload_T *load)
+{
+  if (load->bl_state == LOAD_RUNNING)
+    bufload_finish(load, LOAD_CANCELLED);
+}
+
+/*
+ * Called when "buf" is unloaded while loading it.
+ */
+void bufload_detach(buf_T *buf)
+{
+  bufload_T *load = buf->b_load;
+
+  buf->b_load = NULL;
+  buf->b_p_ma = load->bl_save_ma;
+  load->bl_buf = NULL;
+  bufload_finish(load, LOAD_CANCELLED);
+}
+
+buf_T *
+bufload_buffer(bufload_T *load)
+{
+  return load->bl_target;
+}
+
+void bufload_free(bufload_T *load)
+{
+  bufload_cancel(load);
+  bufload_stop(load);
+#ifdef BUFLOAD_THREAD
+  pthread_mutex_destroy(&load->bl_mutex);
+  pthread_cond_destroy(&load->bl_ready);
+  pthread_cond_destroy(&load->bl_space);
+#endif
+  vim_free(load);
+}
+
+/*
+ * Remember that the first "size" bytes of the file of "buf" are in the
+ * buffer, for tail mode.  When the last line has no NL it is read again with
+ * the rest of the line.
+ */
+static void
+buf_set_read_size(buf_T *buf, off_T size)
+{
+  linenr_T lnum = buf->b_ml.ml_line_count;
+
+  buf->b_tail_offset = size;
+  buf->b_tail_partial = buf->b_no_eol_lnum != 0 && buf->b_no_eol_lnum == lnum;
+  if (buf->b_tail_partial)
+    buf->b_tail_offset -= (off_T)STRLEN(ml_get_buf(buf, lnum, FALSE));
+}
+
+/*
+ * Tail mode: append the lines added to the file of "buf" since it was read.
+ * "st" is the status of the file now.  The new lines are not saved for undo
+ * and the buffer is not marked modified.
+ * Returns FALSE when the file was not only appended to: it was truncated,
+ * replaced by another file or rewritten, or it can't be read this way.
+ */
+static int
+buf_tail_append(buf_T *buf, stat_T *st)
+{
+  off_T offset = buf->b_tail_offset;
+  int fileformat = get_fileformat(buf);
+  bufload_T *load;
+  aco_save_T aco;
+  linenr_T lnum;
+  linenr_T lines = 0;
+  int replace_last;
+  int more;
+  char_u c;
+  int fd;
+
+  /* Lines still being loaded are appended by bufload_poll(). */
+  if (buf->b_load != NULL)
+    return TRUE;
+  if (!S_ISREG(st->st_mode) || st->st_size < offset || need_conversion(buf->b_p_fenc) || (fileformat != EOL_UNIX && fileformat != EOL_DOS))
+    return FALSE;
+#ifdef UNIX
+  /* A rotated log is a new file with the same name. */
+  if (buf->b_dev_valid && (buf->b_dev != st->st_dev || buf->b_ino != st->st_ino))
+    return FALSE;
+#endif
+
+  fd = mch_open((char *)buf->b_ffname, O_RDONLY | O_EXTRA, 0);
+  if (fd < 0)
+    return FALSE;
+  /* The text that was read ends in a NL, otherwise the file was rewritten. */
+  if (offset > 0 && (vim_lseek(fd, offset - 1, SEEK_SET) != offset - 1 || read_eintr(fd, &c, 1) != 1 || c != NL))
+  {
+    close(fd);
+    return FALSE;
+  }
+  if (st->st_size == offset)
+  {
+    close(fd);
+    return TRUE;
+  }
+
+  load = bufload_new(buf);
+  if (load == NULL)
+  {
+    close(fd);
+    return TRUE;
+  }
+  load->bl_fd = fd;
+  load->bl_eof = FALSE;
+  load->bl_buf = buf;
+  load->bl_fileformat = fileformat;
+
+  aucmd_prepbuf(&aco, buf);
+
+  /* A last line without a NL, or the only line of an empty buffer, is
+     * replaced by the first line read. */
+  lnum = curbuf->b_ml.ml_line_count;
+  replace_last = buf->b_tail_partial || (curbuf->b_ml.ml_flags & ML_EMPTY);
+  u_sync(TRUE);
+  do
+  {
+    more = bufload_read(load);
+    lines += bufload_append(load, bufload_take(load), lnum + lines);
+  } while (more);
+
+  if (lines > 0)
+  {
+    if (replace_last)
+    {
+      ml_delete(lnum, FALSE);
+      --lines;
+    }
+    u_appended_last(lines);
+
+    buf->b_tail_offset = offset + load->bl_loaded - load->bl_no_eol_len;
+    buf->b_tail_partial = load->bl_no_eol_len > 0;
+    buf->b_p_eol = !buf->b_tail_partial;
+    buf->b_no_eol_lnum = buf->b_tail_partial ? curbuf->b_ml.ml_line_count : 0;
+
+    if (replace_last)
+      file_lines_changed(buf, lnum, lnum + 1, lines);
+    else
+      file_lines_changed(buf, lnum + 1, lnum + 1, lines);
+  }
+
+  aucmd_restbuf(&aco);
 
-#if defined(OPEN_CHR_FILES) || defined(PROTO)
-/*
- * Returns TRUE if the file name argument is of the form "/dev/fd/\d\+",
- * which is the name of files used for process substitution output by
- * some shells on some operating systems, e.g., bash on SunOS.
- * Do not accept "/dev/fd/[012]", opening these may hang Vim.
- */
-int is_dev_fd_file(char_u *fname)
-{
-  return (STRNCMP(fname, "/dev/fd/", 8) == 0 && VIM_ISDIGIT(fname[8]) && *skipdigits(fname + 9) == NUL && (fname[9] != NUL || (fname[8] != '0' && fname[8] != '1' && fname[8] != '2')));
+  load->bl_buf = NULL;
+  load->bl_state = LOAD_DONE;
+  bufload_free(load);
+  return TRUE;
 }
-#endif
 
 /*
  * From the current line count and characters read after that, estimate the
@@ -2779,9 +3811,10 @@ int buf_write(
 #endif
 #ifdef FEAT_PERSISTENT_UNDO
   int write_undo_file = FALSE;
-  context_sha256_T sha_ctx;
 #endif
   unsigned int bkc = get_bkc_value(buf);
+  backupMethod_T backup_method;
+  proftime_T backup_start;
 
   if (fname == NULL || *fname == NUL) /* safety check */
     return FAIL;
@@ -2793,6 +3826,11 @@ int buf_write(
     return FAIL;
   }
 
+  /* A save in the background must be done first, otherwise it may replace
+     * the file after this write. */
+  if (buf->b_save != NULL)
+    (void)bufsave_poll(buf->b_save, TRUE);
+
   /*
      * Disallow writing from .exrc and .vimrc in current directory for
      * security reasons.
@@ -2856,6 +3894,12 @@ int buf_write(
   else
     overwriting = FALSE;
 
+#ifdef FEAT_MMAP_FILE
+  /* The text of a mapped file must be copied before overwriting the file. */
+  if (overwriting && ml_unmap(buf) == FAIL)
+    return FAIL;
+#endif
+
   if (exiting)
     settmode(TMODE_COOK); /* when exiting allow typeahead now */
 
@@ -3230,12 +4274,19 @@ int buf_write(
      * Do not make any backup, if 'writebackup' and 'backup' are both switched
      * off.  This helps when editing large files on almost-full disks.
      */
+  backup_stats.bs_method = BACKUP_NONE;
+  backup_stats.bs_size = 0;
+  backup_stats.bs_usec = 0;
   if (!(append && *p_pm == NUL) && !filtering && perm >= 0 && dobackup)
   {
 #if defined(UNIX) || defined(MSWIN)
     stat_T st;
 #endif
 
+#ifdef FEAT_RELTIME
+    profile_start(&backup_start);
+#endif
+
     if ((bkc & BKC_YES) || append) /* "yes" */
       backup_copy = TRUE;
 #if defined(UNIX) || defined(MSWIN)
@@ -3360,6 +4411,7 @@ int buf_write(
     if (backup_copy && (fd = mch_open((char *)fname, O_RDONLY | O_EXTRA, 0)) >= 0)
     {
       int bfd;
+      int copied;
       char_u *copybuf, *wp;
       int some_error = FALSE;
       stat_T st_new;
@@ -3547,33 +4599,42 @@ int buf_write(
 #endif
 
             /*
-			 * copy the file.
+			 * copy the file, without going through "copybuf"
+			 * when the system can do that.
 			 */
             write_info.bw_fd = bfd;
             write_info.bw_buf = copybuf;
 #ifdef HAS_BW_FLAGS
             write_info.bw_flags = FIO_NOCONVERT;
 #endif
-            while ((write_info.bw_len = read_eintr(fd, copybuf,
-                                                   BUFSIZE)) > 0)
-            {
-              if (buf_write_bytes(&write_info) == FAIL)
+            write_info.bw_len = 0;
+            backup_method = BACKUP_COPY;
+            copied = copy_fd_fast(fd, bfd, &backup_method);
+            if (copied == FAIL)
+              errmsg = (char_u *)_(e_interr);
+            else if (copied == NOTDONE)
+              while ((write_info.bw_len = read_eintr(fd, copybuf,
+                                                     BUFSIZE)) > 0)
               {
-                errmsg = (char_u *)_("E506: Can't write to backup file (add ! to override)");
-                break;
-              }
-              ui_breakcheck();
-              if (got_int)
-              {
-                errmsg = (char_u *)_(e_interr);
-                break;
+                if (buf_write_bytes(&write_info) == FAIL)
+                {
+                  errmsg = (char_u *)_("E506: Can't write to backup file (add ! to override)");
+                  break;
+                }
+                ui_breakcheck();
+                if (got_int)
+                {
+                  errmsg = (char_u *)_(e_interr);
+                  break;
+                }
               }
-            }
 
             if (close(bfd) < 0 && errmsg == NULL)
               errmsg = (char_u *)_("E507: Close error for backup file (add ! to override)");
             if (write_info.bw_len < 0)
               errmsg = (char_u *)_("E508: Can't read file for backup (add ! to override)");
+            if (errmsg == NULL)
+              set_backup_stats(backup_method, st_old.st_size, &backup_start);
 #ifdef UNIX
             set_file_time(backup, st_old.st_atime, st_old.st_mtime);
 #endif
@@ -3693,7 +4754,10 @@ int buf_write(
 		     * works, quit here.
 		     */
           if (vim_rename(fname, backup) == 0)
+          {
+            set_backup_stats(BACKUP_RENAME, st_old.st_size, &backup_start);
             break;
+          }
 
           VIM_CLEAR(backup); /* don't do the rename below */
         }
@@ -4063,9 +5127,6 @@ int buf_write(
 
 #ifdef FEAT_PERSISTENT_UNDO
     write_undo_file = (buf->b_p_udf && overwriting && !append && !filtering && reset_changed && !checking_conversion);
-    if (write_undo_file)
-      /* Prepare for computing the hash value of the text. */
-      sha256_start(&sha_ctx);
 #endif
 
     write_info.bw_len = bufsize;
@@ -4073,6 +5134,21 @@ int buf_write(
     write_info.bw_flags = wb_flags;
 #endif
     fileformat = get_fileformat_force(buf, eap);
+#ifdef BUF_WRITE_GATHER
+    if (fd >= 0 && wb_flags == 0
+#ifdef USE_ICONV
+        && write_info.bw_iconv_fd == (iconv_t)-1
+#endif
+    )
+    {
+      /* No conversion: write the text from the data blocks. */
+      no_eol = (write_bin || !buf->b_p_fixeol) && (end == buf->b_no_eol_lnum || (end == buf->b_ml.ml_line_count && !buf->b_p_eol));
+      if (buf_write_gather(buf, fd, start, end, fileformat, !no_eol, &nchars) == FAIL)
+        end = 0; /* write error or interrupted */
+      lnum = end + 1;
+      break;
+    }
+#endif
     s = buffer;
     len = 0;
     for (lnum = start; lnum <= end; ++lnum)
@@ -4082,11 +5158,6 @@ int buf_write(
 	     * Keep it fast!
 	     */
       ptr = ml_get_buf(buf, lnum, FALSE) - 1;
-#ifdef FEAT_PERSISTENT_UNDO
-      if (write_undo_file)
-        sha256_update(&sha_ctx, ptr + 1,
-                      (UINT32_T)(STRLEN(ptr + 1) + 1));
-#endif
       while ((c = *++ptr) != NUL)
       {
         if (c == NL)
@@ -4614,7 +5685,8 @@ nofail:
   {
     char_u hash[UNDO_HASH_SIZE];
 
-    sha256_finish(&sha_ctx, hash);
+    /* Only the lines that changed since the last time are hashed. */
+    ml_content_hash(buf, hash);
     u_write_undo(NULL, FALSE, buf, hash);
   }
 #endif
@@ -4838,6 +5910,499 @@ time_differs(long t1, long t2)
 #endif
 }
 
+#ifdef BUF_WRITE_GATHER
+/*
+ * Write the gathered iovecs of "bg", continuing after a partial write.
+ * Return FALSE for an error or when interrupted.
+ */
+static int
+buf_gather_flush(bufgather_T *bg)
+{
+  struct iovec *iov = bg->bg_iov;
+  int iovcnt = bg->bg_iovcnt;
+  ssize_t n;
+
+  while (iovcnt > 0)
+  {
+    n = writev(bg->bg_fd, iov, iovcnt);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      bg->bg_error = TRUE;
+      return FALSE;
+    }
+    for (; iovcnt > 0 && (size_t)n >= iov->iov_len; ++iov, --iovcnt)
+      n -= iov->iov_len;
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  bg->bg_nchars += (long)bg->bg_len;
+  bg->bg_iovcnt = 0;
+  bg->bg_len = 0;
+  bg->bg_copylen = 0;
+  if (bg->bg_chunk < GATHER_CHUNK_MAX)
+    bg->bg_chunk *= 2;
+
+  if (bg->bg_breakcheck)
+  {
+    ui_breakcheck();
+    if (got_int)
+    {
+      bg->bg_error = TRUE;
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/*
+ * Add "len" bytes at "p" to the text to be written by "bg".  Long text is
+ * written from where it is, short text is copied.
+ * Return FALSE for an error.
+ */
+static int
+buf_gather_add(bufgather_T *bg, char_u *p, size_t len)
+{
+  struct iovec *last;
+
+  if (len == 0)
+    return TRUE;
+  if (len > GATHER_COPY_LEN)
+  {
+    if (bg->bg_iovcnt == GATHER_IOV_MAX && !buf_gather_flush(bg))
+      return FALSE;
+    bg->bg_iov[bg->bg_iovcnt].iov_base = p;
+    bg->bg_iov[bg->bg_iovcnt++].iov_len = len;
+  }
+  else
+  {
+    /* Extend the last iovec when it is for the copied text before. */
+    last = bg->bg_iovcnt > 0 ? &bg->bg_iov[bg->bg_iovcnt - 1] : NULL;
+    if (last == NULL || (char_u *)last->iov_base + last->iov_len != bg->bg_copy + bg->bg_copylen)
+    {
+      if (bg->bg_iovcnt == GATHER_IOV_MAX && !buf_gather_flush(bg))
+        return FALSE;
+      last = &bg->bg_iov[bg->bg_iovcnt++];
+      last->iov_base = bg->bg_copy + bg->bg_copylen;
+      last->iov_len = 0;
+    }
+    mch_memmove(bg->bg_copy + bg->bg_copylen, p, len);
+    bg->bg_copylen += len;
+    last->iov_len += len;
+  }
+  bg->bg_len += len;
+
+  if (bg->bg_len >= bg->bg_chunk)
+    return buf_gather_flush(bg);
+  return TRUE;
+}
+
+/*
+ * LineIterCallback for buf_write_gather().  A NL in the text is written as a
+ * NUL, for a Mac file a CR is written as a NL.
+ */
+static int
+buf_gather_line(void *context, linenr_T lnum, char_u *line, size_t len)
+{
+  bufgather_T *bg = (bufgather_T *)context;
+  int special = bg->bg_fileformat == EOL_MAC ? CAR : NL;
+  char_u *p;
+  size_t n;
+
+  /* The text so far is about to be released. */
+  if (line == NULL)
+    return buf_gather_flush(bg);
+
+  while ((p = vim_memchr3(line, len, NL, special, special)) != NULL)
+  {
+    n = (size_t)(p - line);
+    if (!buf_gather_add(bg, line, n) ||
+        !buf_gather_add(bg, (char_u *)(*p == NL ? "\000" : "\n"), 1))
+      return FALSE;
+    line = p + 1;
+    len -= n + 1;
+  }
+  if (!buf_gather_add(bg, line, len))
+    return FALSE;
+
+  if (lnum == bg->bg_end && !bg->bg_last_eol)
+    return TRUE;
+  if (bg->bg_fileformat == EOL_UNIX)
+    return buf_gather_add(bg, (char_u *)"\n", 1);
+  if (bg->bg_fileformat == EOL_MAC)
+    return buf_gather_add(bg, (char_u *)"\r", 1);
+  return buf_gather_add(bg, (char_u *)"\r\n", 2);
+}
+
+/*
+ * Create a bufgather_T for writing to "fd", the end-of-line after line "end"
+ * is only written when "last_eol" is TRUE.
+ * Returns NULL when out of memory.
+ */
+static bufgather_T *
+bufgather_new(int fd, int fileformat, linenr_T end, int last_eol)
+{
+  bufgather_T *bg;
+
+  bg = ALLOC_CLEAR_ONE(bufgather_T);
+  if (bg == NULL)
+    return NULL;
+  /* Room for a chunk of copied text, plus what was added last. */
+  bg->bg_copy = alloc(GATHER_CHUNK_MAX + GATHER_COPY_LEN);
+  if (bg->bg_copy == NULL)
+  {
+    vim_free(bg);
+    return NULL;
+  }
+  bg->bg_fd = fd;
+  bg->bg_fileformat = fileformat;
+  bg->bg_end = end;
+  bg->bg_last_eol = last_eol;
+  bg->bg_chunk = GATHER_CHUNK_MIN;
+  return bg;
+}
+
+static void
+bufgather_free(bufgather_T *bg)
+{
+  vim_free(bg->bg_copy);
+  vim_free(bg);
+}
+
+/*
+ * Write lines "start" to "end" of "buf" to "fd" without conversion, with
+ * writev() from the memline data blocks.  No end-of-line is written after
+ * the last line when "last_eol" is FALSE.  The number of bytes written is
+ * added to "*ncharsp".
+ * Return FAIL for a write error or when interrupted.
+ */
+static int
+buf_write_gather(
+    buf_T *buf,
+    int fd,
+    linenr_T start,
+    linenr_T end,
+    int fileformat,
+    int last_eol,
+    long *ncharsp)
+{
+  bufgather_T *bg;
+  int retval;
+
+  bg = bufgather_new(fd, fileformat, end, last_eol);
+  if (bg == NULL)
+    return FAIL;
+  bg->bg_breakcheck = TRUE;
+
+  retval = ml_gather_lines(buf, start, end, GATHER_MAX_BLOCKS, buf_gather_line, bg);
+  if (bg->bg_error)
+    retval = FAIL;
+  *ncharsp += bg->bg_nchars;
+
+  bufgather_free(bg);
+  return retval;
+}
+#endif
+
+#ifdef BUFSAVE_THREAD
+/*
+ * Find out how to write the file of "save" in the background and prepare for
+ * it: take a snapshot and create the temp file.
+ * Returns FAIL when it has to be written by buf_write() instead, NOTDONE when
+ * the file was changed since it was read, OK otherwise.
+ */
+static int
+bufsave_prepare(bufsave_T *save)
+{
+  buf_T *buf = save->bs_buf;
+  char_u *fenc = *buf->b_p_fenc == NUL ? p_enc : buf->b_p_fenc;
+  char resolved[MAXPATHL];
+  stat_T st;
+  mode_t perm;
+  int exists;
+  int fileformat;
+  int last_eol;
+
+  if (buf->b_p_ro || buf->b_load != NULL || need_conversion(fenc))
+    return FAIL;
+
+  /* Replace the file a symlink points to, not the symlink. */
+  if (realpath((char *)buf->b_ffname, resolved) != NULL)
+    save->bs_fname = vim_strsave((char_u *)resolved);
+  else if (errno == ENOENT)
+    save->bs_fname = vim_strsave(buf->b_ffname);
+  if (save->bs_fname == NULL)
+    return FAIL;
+
+  exists = mch_stat((char *)save->bs_fname, &st) >= 0;
+  if (exists)
+  {
+    /* Renaming would break a hard link. */
+    if (!S_ISREG(st.st_mode) || st.st_nlink > 1)
+      return FAIL;
+    if (check_mtime(buf, &st) == FAIL)
+      return NOTDONE;
+    perm = st.st_mode & 07777;
+  }
+  else
+  {
+    perm = umask(0);
+    (void)umask(perm);
+    perm = 0666 & ~perm;
+  }
+
+  save->bs_tmpname = concat_str(save->bs_fname, (char_u *)".XXXXXX");
+  if (save->bs_tmpname == NULL)
+    return FAIL;
+  save->bs_fd = mkstemp((char *)save->bs_tmpname);
+  if (save->bs_fd < 0)
+    return FAIL;
+  (void)fchmod(save->bs_fd, perm);
+#ifdef HAVE_FCHOWN
+  if (exists)
+    vim_ignored = fchown(save->bs_fd, st.st_uid, st.st_gid);
+#endif
+
+  fileformat = get_fileformat(buf);
+  last_eol = !((buf->b_p_bin || !buf->b_p_fixeol) && (buf->b_no_eol_lnum == buf->b_ml.ml_line_count || !buf->b_p_eol));
+  if (buf->b_p_bomb && !buf->b_p_bin)
+    save->bs_bomlen = make_bom(save->bs_bom, fenc);
+  save->bs_fsync = p_fs;
+  save->bs_write_lines = !(buf->b_ml.ml_flags & ML_EMPTY);
+  save->bs_snapshot = ml_snapshot(buf);
+  save->bs_changedtick = CHANGEDTICK(buf);
+  save->bs_gather = bufgather_new(save->bs_fd, fileformat, buf->b_ml.ml_line_count, last_eol);
+  if (save->bs_snapshot == NULL || save->bs_gather == NULL)
+    return FAIL;
+  return OK;
+}
+
+/*
+ * The worker thread: write the snapshot, sync and rename.  Doesn't use
+ * anything but the fields of "save" that are only for the worker.
+ */
+static void *
+bufsave_worker(void *arg)
+{
+  bufsave_T *save = (bufsave_T *)arg;
+  bufgather_T *bg = save->bs_gather;
+  char *errmsg = NULL;
+  int rename_errno = 0;
+
+  if (save->bs_bomlen > 0)
+    buf_gather_add(bg, save->bs_bom, (size_t)save->bs_bomlen);
+  if (save->bs_write_lines && !bg->bg_error)
+    ml_snapshot_iter_lines(save->bs_snapshot, 1, save->bs_snapshot->ss_line_count, buf_gather_line, bg);
+  if (!bg->bg_error)
+    buf_gather_flush(bg);
+
+  if (bg->bg_error)
+    errmsg = N_("E514: write error (file system full?)");
+  else if (save->bs_fsync && vim_fsync(save->bs_fd) != 0)
+    errmsg = e_fsync;
+  if (close(save->bs_fd) != 0 && errmsg == NULL)
+    errmsg = N_("E512: Close failed");
+  save->bs_fd = -1;
+  if (errmsg == NULL && rename((char *)save->bs_tmpname, (char *)save->bs_fname) != 0)
+  {
+    rename_errno = errno;
+    errmsg = N_("E993: Can't rename %s to %s: %s");
+  }
+  if (errmsg != NULL)
+    unlink((char *)save->bs_tmpname);
+
+  pthread_mutex_lock(&save->bs_mutex);
+  save->bs_errmsg = errmsg;
+  save->bs_rename_errno = rename_errno;
+  save->bs_done = TRUE;
+  pthread_mutex_unlock(&save->bs_mutex);
+  return NULL;
+}
+
+/*
+ * Free what the worker used, after it finished or when it could not be
+ * started.
+ */
+static void
+bufsave_cleanup(bufsave_T *save)
+{
+  if (save->bs_thread_started)
+  {
+    pthread_join(save->bs_thread, NULL);
+    save->bs_thread_started = FALSE;
+  }
+  if (save->bs_fd >= 0)
+  {
+    close(save->bs_fd);
+    save->bs_fd = -1;
+    mch_remove(save->bs_tmpname);
+  }
+  if (save->bs_snapshot != NULL)
+    ml_snapshot_free(save->bs_snapshot);
+  save->bs_snapshot = NULL;
+  if (save->bs_gather != NULL)
+    bufgather_free(save->bs_gather);
+  save->bs_gather = NULL;
+  VIM_CLEAR(save->bs_fname);
+  VIM_CLEAR(save->bs_tmpname);
+}
+#endif
+
+/*
+ * Called in the main thread when the file of "save" was written or writing
+ * failed.  Update the buffer and call the callback.
+ */
+static void
+bufsave_finish(bufsave_T *save, saveState_T state, char *errmsg)
+{
+  buf_T *buf = bufref_valid(&save->bs_bufref) ? save->bs_buf : NULL;
+
+  save->bs_state = state;
+  if (buf != NULL && buf->b_save == save)
+    buf->b_save = NULL;
+  if (buf != NULL && state == SAVE_DONE && !save->bs_reported)
+  {
+    /* Only unmodified when not changed since the snapshot. */
+    if (CHANGEDTICK(buf) == save->bs_changedtick)
+    {
+      unchanged(buf, TRUE);
+      if (buf->b_last_changedtick + 1 == CHANGEDTICK(buf))
+        buf->b_last_changedtick = CHANGEDTICK(buf);
+      u_unchanged(buf);
+      u_update_save_nr(buf);
+    }
+    /* The file is a new one now, remember its timestamp and inode. */
+    ml_timestamp(buf);
+    buf_setino(buf);
+    buf->b_flags &= ~BF_WRITE_MASK;
+  }
+  else if (state == SAVE_FAILED && !save->bs_reported)
+  {
+    if (errmsg != NULL)
+      semsg("\"%s\" %s", buf == NULL ? "" : (char *)buf->b_fname, _(errmsg));
+    if (buf != NULL && fileWriteFailureCallback != NULL)
+      fileWriteFailureCallback(FILE_WRITE_FAILED, buf);
+  }
+
+  if (save->bs_callback != NULL)
+    save->bs_callback(buf, state, save->bs_context);
+}
+
+/*
+ * Write "buf" to its file in the background.  Call bufsave_poll() to find
+ * out when it is done, "callback" is called then.
+ * Returns NULL when the buffer has no file name or isn't loaded.
+ */
+bufsave_T *
+bufsave_start(buf_T *buf, SaveCompleteCallback callback, void *context)
+{
+  bufsave_T *save;
+  int res;
+
+  if (buf->b_ffname == NULL || buf->b_ml.ml_mfp == NULL)
+    return NULL;
+  /* Only one save at a time, otherwise the older one may rename its file
+     * over the newer one. */
+  if (buf->b_save != NULL)
+    (void)bufsave_poll(buf->b_save, TRUE);
+  save = ALLOC_CLEAR_ONE(bufsave_T);
+  if (save == NULL)
+    return NULL;
+  save->bs_buf = buf;
+  set_bufref(&save->bs_bufref, buf);
+  save->bs_state = SAVE_RUNNING;
+  save->bs_callback = callback;
+  save->bs_context = context;
+
+#ifdef BUFSAVE_THREAD
+  save->bs_fd = -1;
+  pthread_mutex_init(&save->bs_mutex, NULL);
+  res = bufsave_prepare(save);
+  if (res == OK)
+    save->bs_thread_started = pthread_create(&save->bs_thread, NULL, bufsave_worker, save) == 0;
+  if (res == OK && save->bs_thread_started)
+  {
+    buf->b_save = save;
+    return save;
+  }
+  bufsave_cleanup(save);
+  if (res == NOTDONE)
+  {
+    /* check_mtime() reported it. */
+    save->bs_reported = TRUE;
+    bufsave_finish(save, SAVE_FAILED, NULL);
+    return save;
+  }
+#endif
+
+  /* Write it like ":w" does, it gives the messages. */
+  res = buf_write(buf, buf->b_ffname, buf->b_fname, (linenr_T)1, buf->b_ml.ml_line_count, NULL, FALSE, FALSE, TRUE, FALSE);
+  save->bs_reported = TRUE;
+  bufsave_finish(save, res == OK ? SAVE_DONE : SAVE_FAILED, NULL);
+  return save;
+}
+
+/*
+ * Check if the save is done, when "wait" is TRUE wait for it.
+ * Returns the state of the save.
+ */
+saveState_T
+bufsave_poll(bufsave_T *save, int wait)
+{
+#ifdef BUFSAVE_THREAD
+  int done;
+  char *errmsg;
+  int rename_errno;
+  char_u *rename_msg = NULL;
+
+  if (save->bs_state != SAVE_RUNNING)
+    return save->bs_state;
+
+  if (wait)
+    pthread_join(save->bs_thread, NULL);
+  pthread_mutex_lock(&save->bs_mutex);
+  done = save->bs_done;
+  errmsg = save->bs_errmsg;
+  rename_errno = save->bs_rename_errno;
+  pthread_mutex_unlock(&save->bs_mutex);
+  if (wait)
+    save->bs_thread_started = FALSE;
+
+  if (done)
+  {
+    /* Put in the file names before they are freed. */
+    if (rename_errno != 0)
+    {
+      vim_snprintf((char *)IObuff, IOSIZE, _(errmsg), save->bs_tmpname, save->bs_fname, strerror(rename_errno));
+      rename_msg = vim_strsave(IObuff);
+      if (rename_msg != NULL)
+        errmsg = (char *)rename_msg;
+    }
+    bufsave_cleanup(save);
+    bufsave_finish(save, errmsg == NULL ? SAVE_DONE : SAVE_FAILED, errmsg);
+    vim_free(rename_msg);
+  }
+#endif
+  return save->bs_state;
+}
+
+/*
+ * Wait for the save to be done and free it.
+ */
+void bufsave_free(bufsave_T *save)
+{
+  bufsave_poll(save, TRUE);
+#ifdef BUFSAVE_THREAD
+  pthread_mutex_destroy(&save->bs_mutex);
+#endif
+  vim_free(save);
+}
+
 /*
  * Call write() to write a number of bytes to the file.
  * Handles encryption and 'encoding' conversion.
@@ -5856,6 +7421,72 @@ int vim_fgets(char_u *buf, int size, FILE *fp)
   return (eof == NULL);
 }
 
+/*
+ * Copy file "fd_in" to the empty file "fd_out" without reading it into a
+ * buffer.  On Linux the copy shares the blocks of the file with FICLONE when
+ * the file system can do that, otherwise copy_file_range() copies it in the
+ * kernel.
+ * Returns OK when the file was copied, with how it was done in "*methodp".
+ * Returns NOTDONE when the rest has to be copied with read() and write(),
+ * starting at the current file offsets.  Returns FAIL when interrupted.
+ */
+static int
+copy_fd_fast(int fd_in, int fd_out, backupMethod_T *methodp)
+{
+#ifdef __linux__
+  if (ioctl(fd_out, FICLONE, fd_in) == 0)
+  {
+    *methodp = BACKUP_CLONE;
+    return OK;
+  }
+
+#ifdef SYS_copy_file_range
+  {
+    off_T done = 0;
+    long n;
+
+    for (;;)
+    {
+      n = syscall(SYS_copy_file_range, fd_in, NULL, fd_out, NULL,
+                  (size_t)0x1000000, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+      ui_breakcheck();
+      if (got_int)
+        return FAIL;
+    }
+
+    /* Some file systems return zero for a file they can't copy this way,
+     * that is the same as the end of the file when nothing was copied. */
+    if (n == 0 && done > 0)
+    {
+      *methodp = BACKUP_COPY_RANGE;
+      return OK;
+    }
+  }
+#endif
+#endif
+  return NOTDONE;
+}
+
+/*
+ * Remember how the backup file for a write was made and how long that took,
+ * for vimGetBackupStats().
+ */
+static void
+set_backup_stats(backupMethod_T method, off_T size, proftime_T *start)
+{
+  backup_stats.bs_method = method;
+  backup_stats.bs_size = size;
+#if defined(FEAT_RELTIME) && defined(FEAT_FLOAT)
+  profile_end(start);
+  backup_stats.bs_usec = (long)(profile_float(start) * 1000000.0);
+#endif
+}
+
 /*
  * rename() only works if both files are on the same file system, this
  * function will (attempts to?) copy the file across if rename fails -- webb
@@ -5866,6 +7497,8 @@ int vim_rename(char_u *from, char_u *to)
   int fd_in;
   int fd_out;
   int n;
+  int copied;
+  backupMethod_T method;
   char *errmsg = NULL;
   char *buffer;
   stat_T st;
@@ -6004,16 +7637,21 @@ int vim_rename(char_u *from, char_u *to)
     return -1;
   }
 
-  while ((n = read_eintr(fd_in, buffer, BUFSIZE)) > 0)
-    if (write_eintr(fd_out, buffer, n) != n)
-    {
-      errmsg = _("E208: Error writing to \"%s\"");
-      break;
-    }
+  n = 0;
+  copied = copy_fd_fast(fd_in, fd_out, &method);
+  if (copied == FAIL)
+    errmsg = _(e_interr);
+  else if (copied == NOTDONE)
+    while ((n = read_eintr(fd_in, buffer, BUFSIZE)) > 0)
+      if (write_eintr(fd_out, buffer, n) != n)
+      {
+        errmsg = _("E208: Error writing to \"%s\"");
+        break;
+      }
 
   vim_free(buffer);
   close(fd_in);
-  if (close(fd_out) < 0)
+  if (close(fd_out) < 0 && errmsg == NULL)
     errmsg = _("E209: Error closing \"%s\"");
   if (n < 0)
   {
@@ -6032,6 +7670,9 @@ int vim_rename(char_u *from, char_u *to)
 #endif
   if (errmsg != NULL)
   {
+    /* Don't leave half a copy behind, "from" is still there. */
+    if (copied == FAIL)
+      mch_remove(to);
     semsg(errmsg, to);
     return -1;
   }
@@ -6222,6 +7863,13 @@ int buf_check_timestamp(
     if (mch_isdir(buf->b_fname))
       ;
 
+    /* In tail mode only the lines added to the file are read.  When the
+	 * file was truncated or rotated it is read again. */
+    else if (buf->b_tail && stat_res >= 0 && buf_tail_append(buf, &st))
+      ;
+    else if (buf->b_tail && stat_res >= 0 && !bufIsChanged(buf))
+      reload = TRUE;
+
     /*
 	 * If 'autoread' is set, the buffer has no changes and the file still
 	 * exists, reload the buffer.  Use the buffer-local option value if it
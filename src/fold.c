@@ -1418,6 +1418,21 @@ void deleteFoldRecurse(garray_T *gap)
   ga_clear(gap);
 }
 
+/* foldMemorySize() {{{2 */
+/*
+ * Return the number of bytes used for the folds in "gap" and the folds
+ * nested in them.
+ */
+long_u foldMemorySize(garray_T *gap)
+{
+  long_u size = gap->ga_maxlen * sizeof(fold_T);
+  int i;
+
+  for (i = 0; i < gap->ga_len; ++i)
+    size += foldMemorySize(&(((fold_T *)(gap->ga_data))[i].fd_nested));
+  return size;
+}
+
 /* foldMarkAdjust() {{{2 */
 /*
  * Update line numbers of folds for inserted/deleted lines.
@@ -47,6 +47,7 @@ EXTERN char_u *LineWraps INIT(= NULL); /* line wraps to next line */
 /* libvim API callbacks */
 EXTERN AutoCommandCallback autoCommandCallback INIT(= NULL);
 EXTERN BufferUpdateCallback bufferUpdateCallback INIT(= NULL);
+EXTERN BufferChangeCallback bufferChangeCallback INIT(= NULL);
 EXTERN ClearCallback clearCallback INIT(= NULL);
 EXTERN ClipboardGetCallback clipboardGetCallback INIT(= NULL);
 EXTERN CursorAddCallback cursorAddCallback INIT(= NULL);
@@ -490,6 +491,16 @@ EXTERN buf_T *curbuf INIT(= NULL);   /* currently active buffer */
  * are to be loaded into memory.  Shouldn't be global... */
 EXTERN int mf_dont_release INIT(= FALSE); /* don't release blocks */
 
+/* Blocks of a memfile that were not used for this many seconds are
+ * compressed, zero to never compress them. */
+EXTERN long mf_compress_after INIT(= 0);
+
+#ifdef FEAT_MMAP_FILE
+/* Files of at least this many bytes are read through a read-only mapping,
+ * zero to always copy the file into the buffer. */
+EXTERN off_T mmap_threshold INIT(= 0);
+#endif
+
 /*
  * List of files being edited (global argument list).  curwin->w_alist points
  * to this when the window is using the global argument list.
@@ -1265,6 +1276,9 @@ EXTERN int did_echo_string_emsg INIT(= FALSE);
 EXTERN int *eval_lavars_used INIT(= NULL);
 #endif
 
+/* How the backup file was made by the last buf_write(). */
+EXTERN backupStats_T backup_stats;
+
 #ifdef MSWIN
 #ifdef PROTO
 typedef int HINSTANCE;
@@ -27,14 +27,63 @@ buf_T *vimBufferOpen(char_u *ffname_arg, linenr_T lnum, int flags)
 {
   buf_T *buffer = vimBufferLoad(ffname_arg, lnum, flags);
   set_curbuf(buffer, DOBUF_SPLIT);
+  invoke_all_buffer_changes();
   return buffer;
 }
 
+bufload_T *vimBufferOpenAsync(char_u *ffname_arg, linenr_T lnum, int flags, linenr_T initialLines, LoadProgressCallback callback, void *context)
+{
+  buf_T *buffer = vimBufferLoad(ffname_arg, lnum, flags);
+  if (buffer == NULL)
+  {
+    return NULL;
+  }
+  bufload_T *load = bufload_open(buffer, initialLines, callback, context);
+  invoke_all_buffer_changes();
+  return load;
+}
+
+buf_T *vimBufferLoadGetBuffer(bufload_T *load) { return bufload_buffer(load); }
+
+loadState_T vimBufferLoadPoll(bufload_T *load) { return bufload_poll(load, FALSE); }
+
+loadState_T vimBufferLoadWait(bufload_T *load)
+{
+  loadState_T state;
+
+  while ((state = bufload_poll(load, TRUE)) == LOAD_RUNNING)
+    ;
+  return state;
+}
+
+void vimBufferLoadCancel(bufload_T *load) { bufload_cancel(load); }
+
+void vimBufferLoadFree(bufload_T *load) { bufload_free(load); }
+
+bufsave_T *vimBufferSaveAsync(buf_T *buf, SaveCompleteCallback callback, void *context)
+{
+  return bufsave_start(buf, callback, context);
+}
+
+saveState_T vimBufferSavePoll(bufsave_T *save) { return bufsave_poll(save, FALSE); }
+
+saveState_T vimBufferSaveWait(bufsave_T *save) { return bufsave_poll(save, TRUE); }
+
+void vimBufferSaveFree(bufsave_T *save) { bufsave_free(save); }
+
+void vimGetBackupStats(backupStats_T *stats) { *stats = backup_stats; }
+
 int vimBufferCheckIfChanged(buf_T *buf)
 {
-  return buf_check_timestamp(buf, 0);
+  int ret = buf_check_timestamp(buf, 0);
+
+  invoke_all_buffer_changes();
+  return ret;
 }
 
+void vimBufferSetTailMode(buf_T *buf, int tail) { buf->b_tail = tail; }
+int vimBufferGetTailMode(buf_T *buf) { return buf->b_tail; }
+
 buf_T *vimBufferGetCurrent(void) { return curbuf; }
 
 buf_T *vimBufferGetById(int id) { return buflist_findnr(id); }
@@ -59,6 +108,44 @@ void vimBufferSetFileFormat(buf_T *buf, int fileformat) { return set_fileformat_
 int vimBufferGetReadOnly(buf_T *buf) { return buf->b_p_ro; }
 void vimBufferSetReadOnly(buf_T *buf, int readonly) { buf->b_p_ro = readonly; }
 
+int vimBufferIsMapped(buf_T *buf)
+{
+#ifdef FEAT_MMAP_FILE
+  return buf->b_ml.ml_mfp != NULL && buf->b_ml.ml_mfp->mf_map != NULL;
+#else
+  return FALSE;
+#endif
+}
+
+void vimBufferGetLineCacheStats(buf_T *buf, long *hits, long *misses)
+{
+  *hits = buf->b_ml.ml_cache_hits;
+  *misses = buf->b_ml.ml_cache_misses;
+}
+
+void vimBufferGetBlockPoolStats(buf_T *buf, blockPoolStats_T *stats)
+{
+  if (buf->b_ml.ml_mfp == NULL)
+  {
+    vim_memset(stats, 0, sizeof(blockPoolStats_T));
+    return;
+  }
+  mf_pool_stats(buf->b_ml.ml_mfp, stats);
+}
+
+void vimGetMemoryStats(buf_T *buf, memoryStats_T *stats)
+{
+  vim_memset(stats, 0, sizeof(memoryStats_T));
+  buf_memory_stats(buf, stats);
+}
+
+void vimGetGlobalMemoryStats(memoryStats_T *stats)
+{
+  buf_memory_stats_all(stats);
+}
+
+long vimCompressColdBlocks(void) { return mf_compress_cold(TRUE); }
+
 char_u *vimBufferGetLine(buf_T *buf, linenr_T lnum)
 {
   char_u *result = ml_get_buf(buf, lnum, FALSE);
@@ -67,51 +154,173 @@ char_u *vimBufferGetLine(buf_T *buf, linenr_T lnum)
 
 size_t vimBufferGetLineCount(buf_T *buf) { return buf->b_ml.ml_line_count; }
 
-void vimBufferSetLines(buf_T *buf, linenr_T start, linenr_T end, char_u **lines, int count)
+snapshot_T *vimBufferSnapshot(buf_T *buf) { return ml_snapshot(buf); }
+
+void vimSnapshotRelease(snapshot_T *snapshot) { ml_snapshot_free(snapshot); }
+
+size_t vimSnapshotGetLineCount(snapshot_T *snapshot) { return snapshot->ss_line_count; }
+
+char_u *vimSnapshotGetLine(snapshot_T *snapshot, linenr_T lnum)
 {
-  int originalLineCount = vimBufferGetLineCount(buf);
-  if (end == -1)
+  return ml_snapshot_get_line(snapshot, lnum, NULL);
+}
+
+void vimSnapshotIterLines(snapshot_T *snapshot, linenr_T start, linenr_T end, LineIterCallback callback, void *context)
+{
+  ml_snapshot_iter_lines(snapshot, start, end, callback, context);
+}
+
+long vimBufferGetByteOffset(buf_T *buf, linenr_T lnum)
+{
+#ifdef FEAT_BYTEOFF
+  if (lnum < 1 || lnum > buf->b_ml.ml_line_count + 1)
   {
-    end = originalLineCount;
+    return -1;
+  }
+  return ml_find_line_or_offset(buf, lnum, NULL);
+#else
+  return -1;
+#endif
+}
+
+linenr_T vimBufferGetLineFromOffset(buf_T *buf, long offset)
+{
+#ifdef FEAT_BYTEOFF
+  if (offset < 0)
+  {
+    return -1;
   }
+  return ml_find_line_or_offset(buf, (linenr_T)0, &offset);
+#else
+  return -1;
+#endif
+}
 
-  // Append in reverse order... find more efficient strategy though
-  // We append first, because `ml_delete_buf` can't delete the last line,
-  // for replacing entire an buffer contents
-  for (int i = count - 1; i >= 0; i--)
+int vimBufferGetContentHash(buf_T *buf, char_u *hash)
+{
+#ifdef FEAT_PERSISTENT_UNDO
+  if (buf->b_ml.ml_mfp == NULL)
   {
-    ml_append_buf(buf, start, lines[i], 0, FALSE);
+    return FALSE;
   }
+  ml_content_hash(buf, hash);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
 
-  int deleteCount = end - start;
-  int deleteStart = start + count + 1;
-  int deleteEnd = deleteStart + deleteCount;
+int vimBufferIterLines(buf_T *buf, linenr_T start, linenr_T end, LineIterCallback callback, void *context)
+{
+  return ml_iter_lines(buf, start, end, callback, context) == OK;
+}
 
-  // Delete from end to start
-  for (int i = deleteStart; i < deleteEnd; i++)
+typedef struct
+{
+  char_u *dest;
+  size_t size;
+  size_t len;
+  char_u *eol;
+  size_t eol_len;
+  int mac;
+  linenr_T noeol_lnum;
+} serialize_T;
+
+static void serializeAdd(serialize_T *ser, char_u *text, size_t len)
+{
+  if (ser->len < ser->size)
   {
-    ml_delete_buf(buf, deleteStart, FALSE);
+    mch_memmove(ser->dest + ser->len, text, MIN(len, ser->size - ser->len));
   }
+  ser->len += len;
+}
+
+static int serializeLine(void *context, linenr_T lnum, char_u *line, size_t len)
+{
+  serialize_T *ser = (serialize_T *)context;
+  size_t offset = ser->len;
+
+  serializeAdd(ser, line, len);
+
+  // A NUL in the file is stored as a NL in the buffer, and for a Mac file a
+  // NL is stored as a CR
+  if (offset < ser->size)
+  {
+    char_u *start = ser->dest + offset;
+    char_u *end = ser->dest + MIN(ser->len, ser->size);
+    char_u *p = start;
+    while ((p = memchr(p, NL, end - p)) != NULL)
+    {
+      *p++ = NUL;
+    }
+    for (p = start; ser->mac && (p = memchr(p, CAR, end - p)) != NULL;)
+    {
+      *p++ = NL;
+    }
+  }
+
+  if (lnum != ser->noeol_lnum)
+  {
+    serializeAdd(ser, ser->eol, ser->eol_len);
+  }
+  return TRUE;
+}
+
+size_t vimBufferSerialize(buf_T *buf, int eol, char_u *dest, size_t size)
+{
+  serialize_T ser;
+
+  if (buf->b_ml.ml_flags & ML_EMPTY)
+  {
+    return 0;
+  }
+
+  if (eol == EOL_UNKNOWN)
+  {
+    eol = get_fileformat(buf);
+  }
+
+  ser.dest = dest;
+  ser.size = dest == NULL ? 0 : size;
+  ser.len = 0;
+  ser.eol = (char_u *)(eol == EOL_DOS ? "\r\n" : eol == EOL_MAC ? "\r" : "\n");
+  ser.eol_len = STRLEN(ser.eol);
+  ser.mac = eol == EOL_MAC;
+  ser.noeol_lnum = 0;
+  if (!buf->b_p_eol && (buf->b_p_bin || !buf->b_p_fixeol))
+  {
+    ser.noeol_lnum = buf->b_ml.ml_line_count;
+  }
+
+  ml_iter_lines(buf, 1, buf->b_ml.ml_line_count, serializeLine, &ser);
+  return ser.len;
+}
+
+void vimBufferSetLines(buf_T *buf, linenr_T start, linenr_T end, char_u **lines, int count)
+{
+  int originalLineCount = vimBufferGetLineCount(buf);
+  if (end == -1)
+  {
+    end = originalLineCount;
+  }
+
+  // Large replacements are spliced into the memline a block at a time,
+  // rather than appending and deleting line-by-line
+  ml_splice_buf(buf, start, end, lines, count);
 
   changed_lines_buf(buf, start, end, (end - start) - count);
 
   ++CHANGEDTICK(buf);
   buf->b_changed = TRUE;
 
-  if (bufferUpdateCallback != NULL)
-  {
+  hl_index_changed(buf, start + 1, end + 1, count - (end - start));
+  buf_invoke_changes(buf);
 
-    int newLineCount = vimBufferGetLineCount(buf);
-    int lnum = start == 0 ? 1 : start;
-    int lnume = end == 0 ? 1 : end + 1;
-    int xtra = newLineCount - originalLineCount;
-    bufferUpdate_T bufferUpdate;
-    bufferUpdate.buf = buf;
-    bufferUpdate.lnum = lnum;
-    bufferUpdate.lnume = lnume;
-    bufferUpdate.xtra = xtra;
-    bufferUpdateCallback(bufferUpdate);
-  }
+  int newLineCount = vimBufferGetLineCount(buf);
+  int lnum = start == 0 ? 1 : start;
+  int lnume = end == 0 ? 1 : end + 1;
+  int xtra = newLineCount - originalLineCount;
+  buf_send_update(buf, lnum, lnume, xtra);
 }
 
 void vimColorSchemeSetChangedCallback(ColorSchemeChangedCallback callback)
@@ -129,6 +338,20 @@ void vimSetBufferUpdateCallback(BufferUpdateCallback f)
   bufferUpdateCallback = f;
 }
 
+void vimSetBufferChangeCallback(BufferChangeCallback f)
+{
+  bufferChangeCallback = f;
+}
+
+// When set each vimInput, vimKey and vimExecute call is a batch of updates
+static int batchEachCall = FALSE;
+
+void vimSetBufferUpdateBatching(int batch) { batchEachCall = batch; }
+
+void vimBufferUpdateBatchBegin(void) { buf_update_batch_begin(); }
+
+void vimBufferUpdateBatchEnd(void) { buf_update_batch_end(); }
+
 void vimSetAutoCommandCallback(AutoCommandCallback f)
 {
   autoCommandCallback = f;
@@ -257,6 +480,13 @@ colnr_T vimCursorGetColumnWant(void)
 
 void vimInputCore(int should_replace_termcodes, char_u *input)
 {
+  int batch = batchEachCall;
+
+  if (batch)
+  {
+    buf_update_batch_begin();
+  }
+
   if (should_replace_termcodes)
   {
     char_u *ptr = NULL;
@@ -295,6 +525,13 @@ void vimInputCore(int should_replace_termcodes, char_u *input)
 
   update_curswant();
   curs_columns(TRUE);
+
+  if (batch)
+  {
+    buf_update_batch_end();
+  }
+  invoke_all_buffer_changes();
+  mf_compress_cold(FALSE);
 }
 
 void vimInput(char_u *input)
@@ -357,97 +594,117 @@ void vimVisualSetType(int visualType)
 
 pos_T *vimSearchGetMatchingPair(int initc) { return findmatch(NULL, initc); }
 
-typedef struct shlNode_elem shlNode_T;
-struct shlNode_elem
-{
-  searchHighlight_T highlight;
-  shlNode_T *next;
-};
-
 void vimSearchGetHighlights(buf_T *buf, linenr_T start_lnum, linenr_T end_lnum,
                             int *num_highlights,
                             searchHighlight_T **highlights)
 {
+  garray_T ga;
 
-  int v = 1;
-  int count = 0;
-
-  pos_T lastPos;
-  pos_T startPos;
-  pos_T endPos;
-
-  startPos.lnum = start_lnum;
-  startPos.col = 0;
-  lastPos = startPos;
+  ga_init2(&ga, (int)sizeof(searchHighlight_T), 100);
+  search_get_highlights(buf, start_lnum, end_lnum, &ga);
 
-  char_u *pattern = get_search_pat();
-
-  *num_highlights = 0;
-  *highlights = NULL;
-  if (pattern == NULL)
+  *num_highlights = ga.ga_len;
+  *highlights = ga.ga_len == 0 ? NULL : (searchHighlight_T *)ga.ga_data;
+  if (ga.ga_len == 0)
   {
-    return;
+    ga_clear(&ga);
   }
+}
 
-  shlNode_T *head = ALLOC_CLEAR_ONE(shlNode_T);
-  shlNode_T *cur = head;
+void vimSearchGetHighlightsList(buf_T *buf, linenr_T start_lnum,
+                                linenr_T end_lnum,
+                                searchHighlightList_T *list)
+{
+  garray_T ga;
 
-  while (v == 1)
-  {
-    v = searchit(NULL, buf, &startPos, &endPos, FORWARD, pattern, 1,
-                 SEARCH_KEEP, RE_SEARCH, end_lnum, NULL, NULL);
+  // Grow the array of the list, it is kept for the next call
+  ga_init2(&ga, (int)sizeof(searchHighlight_T), 100);
+  ga.ga_data = list->highlights;
+  ga.ga_maxlen = list->size;
+  search_get_highlights(buf, start_lnum, end_lnum, &ga);
 
-    if (v == 0)
-    {
-      break;
-    }
+  list->highlights = (searchHighlight_T *)ga.ga_data;
+  list->size = ga.ga_maxlen;
+  list->count = ga.ga_len;
+}
 
-    if (startPos.lnum < lastPos.lnum ||
-        (startPos.lnum == lastPos.lnum && startPos.col <= lastPos.col))
-    {
-      break;
-    }
+int vimSearchGetHighlightsTimed(buf_T *buf, pos_T *resume, linenr_T end_lnum,
+                                long msec, searchHighlightList_T *list)
+{
+  garray_T ga;
+  int done;
 
-    shlNode_T *new = ALLOC_CLEAR_ONE(shlNode_T);
-    cur->next = new;
-    cur = new;
+  ga_init2(&ga, (int)sizeof(searchHighlight_T), 100);
+  ga.ga_data = list->highlights;
+  ga.ga_maxlen = list->size;
+  done = search_get_highlights_timed(buf, resume, end_lnum, msec, &ga);
 
-    cur->highlight.start.lnum = startPos.lnum;
-    cur->highlight.start.col = startPos.col;
-    cur->highlight.end.lnum = endPos.lnum;
-    cur->highlight.end.col = endPos.col;
+  list->highlights = (searchHighlight_T *)ga.ga_data;
+  list->size = ga.ga_maxlen;
+  list->count = ga.ga_len;
+  return done;
+}
 
-    lastPos = startPos;
-    startPos = endPos;
-    startPos.col = startPos.col + 1;
-    count++;
-  }
+void vimSearchHighlightListClear(searchHighlightList_T *list)
+{
+  VIM_CLEAR(list->highlights);
+  list->size = 0;
+  list->count = 0;
+}
 
-  if (count == 0)
-  {
-    vim_free(head);
-    return;
-  }
+void vimSearchAll(buf_T *buf, searchHighlightList_T *list)
+{
+  garray_T ga;
 
-  searchHighlight_T *ret = alloc(sizeof(searchHighlight_T) * count);
+  ga_init2(&ga, (int)sizeof(searchHighlight_T), 100);
+  ga.ga_data = list->highlights;
+  ga.ga_maxlen = list->size;
+  search_all(buf, &ga);
 
-  cur = head->next;
-  vim_free(head);
+  list->highlights = (searchHighlight_T *)ga.ga_data;
+  list->size = ga.ga_maxlen;
+  list->count = ga.ga_len;
+}
 
-  int i = 0;
-  while (cur != NULL)
+int vimSearchCount(buf_T *buf, pos_T *pos, int *current)
+{
+  garray_T ga;
+  searchHighlight_T *highlights;
+  int count;
+  int lo = 0;
+  int hi;
+  int mid;
+
+  ga_init2(&ga, (int)sizeof(searchHighlight_T), 100);
+  search_all(buf, &ga);
+  highlights = (searchHighlight_T *)ga.ga_data;
+
+  // The matches are in order, find the first one after "pos"
+  hi = ga.ga_len;
+  while (pos != NULL && lo < hi)
   {
-    ret[i] = cur->highlight;
-    shlNode_T *prev = cur;
-    cur = cur->next;
-    vim_free(prev);
-    i++;
+    mid = (lo + hi) / 2;
+    if (LTOREQ_POS(highlights[mid].start, *pos))
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  if (pos != NULL && current != NULL)
+  {
+    *current = lo;
   }
 
-  *num_highlights = i;
-  *highlights = ret;
+  count = ga.ga_len;
+  ga_clear(&ga);
+  return count;
 }
 
+void vimSearchSetThreadCount(int count) { search_all_set_threads(count); }
+
 char_u *vimSearchGetPattern(void) { return get_search_pat(); }
 
 void vimSetStopSearchHighlightCallback(VoidCallback callback)
@@ -490,11 +747,22 @@ void vimExecuteLines(char_u **lines, int lineCount)
   cookie.lineCount = lineCount;
   cookie.nextLine = 0;
 
+  int batch = batchEachCall;
+  if (batch)
+  {
+    buf_update_batch_begin();
+  }
+
   do_cmdline(
       NULL,
       &vimExecute_getLine,
       &cookie,
       DOCMD_VERBOSE | DOCMD_REPEAT | DOCMD_NOWAIT | DOCMD_KEYTYPED);
+
+  if (batch)
+  {
+    buf_update_batch_end();
+  }
 }
 
 void vimExecute(char_u *cmd)
@@ -503,6 +771,8 @@ void vimExecute(char_u *cmd)
   char_u *lines[] = {cmd};
 
   vimExecuteLines(lines, 1);
+  invoke_all_buffer_changes();
+  mf_compress_cold(FALSE);
 };
 
 void vimOptionSetTabSize(int tabSize)
@@ -512,6 +782,39 @@ void vimOptionSetTabSize(int tabSize)
   curbuf->b_p_sw = tabSize;
 }
 
+void vimOptionSetMmapThreshold(off_T bytes)
+{
+#ifdef FEAT_MMAP_FILE
+  mmap_threshold = bytes;
+#endif
+}
+
+off_T vimOptionGetMmapThreshold(void)
+{
+#ifdef FEAT_MMAP_FILE
+  return mmap_threshold;
+#else
+  return 0;
+#endif
+}
+
+void vimOptionSetCompressAfter(int seconds)
+{
+  mf_compress_after = seconds;
+}
+
+int vimOptionGetCompressAfter(void)
+{
+  return (int)mf_compress_after;
+}
+
+void vimOptionSetRegexpCacheSize(int size) { vim_regcomp_cache_set_size(size); }
+
+void vimRegexpGetCacheStats(long *hits, long *misses)
+{
+  vim_regcomp_cache_stats(hits, misses);
+}
+
 void vimMacroSetStartRecordCallback(MacroStartRecordCallback callback)
 {
   macroStartRecordCallback = callback;
@@ -39,6 +39,121 @@ buf_T *vimBufferLoad(char_u *ffname_arg, linenr_T lnum, int flags);
  */
 buf_T *vimBufferNew(int flags);
 
+/*
+ * vimBufferOpenAsync
+ *
+ * Open a buffer and set as current, like vimBufferOpen, but only wait for
+ * the first `initialLines` lines of the file. The rest is read on a worker
+ * thread, and appended to the buffer by vimBufferLoadPoll. The buffer is not
+ * modifiable until all lines are in. When a later part of the file is not
+ * valid UTF-8 the whole file is read again with the next encoding in
+ * 'fileencodings', replacing all the lines.
+ *
+ * `callback` gets the progress each time lines are appended, and when the
+ * load is done, cancelled or failed. A small file is read right away, and
+ * the load is done when this returns.
+ *
+ * Free the returned load with vimBufferLoadFree.
+ */
+bufload_T *vimBufferOpenAsync(char_u *ffname_arg, linenr_T lnum, int flags, linenr_T initialLines, LoadProgressCallback callback, void *context);
+
+/*
+ * vimBufferLoadGetBuffer
+ *
+ * Get the buffer opened by vimBufferOpenAsync.
+ */
+buf_T *vimBufferLoadGetBuffer(bufload_T *load);
+
+/*
+ * vimBufferLoadPoll
+ *
+ * Append the lines read since the last call to the buffer, without
+ * waiting. Buffer update callbacks are called for the appended lines.
+ * This must be called from the thread using libvim, for example once per
+ * frame, until it returns something other than LOAD_RUNNING.
+ */
+loadState_T vimBufferLoadPoll(bufload_T *load);
+
+/*
+ * vimBufferLoadWait
+ *
+ * Append lines until the whole file is in the buffer.
+ */
+loadState_T vimBufferLoadWait(bufload_T *load);
+
+/*
+ * vimBufferLoadCancel
+ *
+ * Stop loading. The lines appended so far stay in the buffer, which is set
+ * read-only because writing it would lose the rest of the file.
+ */
+void vimBufferLoadCancel(bufload_T *load);
+
+/*
+ * vimBufferLoadFree
+ *
+ * Cancel the load if it is still running, and free it.
+ */
+void vimBufferLoadFree(bufload_T *load);
+
+/*
+ * vimBufferSaveAsync
+ *
+ * Write a buffer to its file without waiting for it. A snapshot of the lines
+ * is written to a temporary file next to the file on a worker thread, synced
+ * when 'fsync' is set, and renamed over the file, so the file is never half
+ * written. The buffer can be edited in the meantime. When done it is marked
+ * unmodified, unless it was changed since the save started. Another save of
+ * the buffer, or writing it with `:w`, waits for this one to be done first.
+ *
+ * `callback` is called by vimBufferSavePoll when the save is done or failed.
+ * A failure is also reported to the FileWriteFailureCallback, with
+ * FILE_WRITE_FAILED, or FILE_CHANGED when the file was changed since it was
+ * read. Autocommands and the undo file are not written.
+ *
+ * A file that can't be replaced this way is written right away like `:w`,
+ * for example with 'fileencoding' conversion, or when it is a hard link or
+ * the directory isn't writable.
+ *
+ * Returns NULL if the buffer has no file name. Free the returned save with
+ * vimBufferSaveFree.
+ */
+bufsave_T *vimBufferSaveAsync(buf_T *buf, SaveCompleteCallback callback, void *context);
+
+/*
+ * vimBufferSavePoll
+ *
+ * Check if the save is done, without waiting. This must be called from the
+ * thread using libvim, until it returns something other than SAVE_RUNNING.
+ */
+saveState_T vimBufferSavePoll(bufsave_T *save);
+
+/*
+ * vimBufferSaveWait
+ *
+ * Wait for the save to be done.
+ */
+saveState_T vimBufferSaveWait(bufsave_T *save);
+
+/*
+ * vimBufferSaveFree
+ *
+ * Wait for the save to be done if it is still running, and free it.
+ */
+void vimBufferSaveFree(bufsave_T *save);
+
+/*
+ * vimGetBackupStats
+ *
+ * Get how the backup file was made by the last write, with the size of the
+ * file and how long it took. With 'backupcopy' "auto" the file is renamed
+ * when that is possible. A copy shares the blocks of the file (FICLONE) or
+ * is copied by the kernel (copy_file_range()) when the file system can do
+ * that, and is only read and written through a buffer otherwise.
+ * The method is BACKUP_NONE when no backup was made.
+ */
+void vimGetBackupStats(backupStats_T *stats);
+
 /*
  * vimBufferCheckIfChanged
  *
@@ -48,6 +163,18 @@ buf_T *vimBufferNew(int flags);
  * Returns 0 otherwise
  */
 int vimBufferCheckIfChanged(buf_T *buf);
+
+/*
+ * vimBufferSetTailMode / vimBufferGetTailMode
+ *
+ * In tail mode, when vimBufferCheckIfChanged finds that the file grew, only
+ * the new lines are read and appended to the buffer, like `tail -f`. Undo
+ * history and marks are kept, the buffer is not marked modified, and there
+ * is one buffer update for each append. When the file was truncated or
+ * rotated, the buffer is reloaded if it has no changes.
+ */
+void vimBufferSetTailMode(buf_T *buf, int tail);
+int vimBufferGetTailMode(buf_T *buf);
 buf_T *vimBufferGetById(int id);
 buf_T *vimBufferGetCurrent(void);
 void vimBufferSetCurrent(buf_T *buf);
@@ -86,8 +213,207 @@ void vimBufferSetFileFormat(buf_T *buf, int fileformat);
 int vimBufferGetReadOnly(buf_T *buf);
 void vimBufferSetReadOnly(buf_T *buf, int modifiable);
 
+/*
+ * vimBufferIsMapped
+ *
+ * Returns 1 if the buffer's lines are read from a memory-mapped file,
+ * see vimOptionSetMmapThreshold.
+ */
+int vimBufferIsMapped(buf_T *buf);
+
+/*
+ * vimBufferGetLineCacheStats
+ *
+ * Get the number of line lookups that were found in the buffer's cache of
+ * recently used blocks (`hits`) and the number that had to search the block
+ * tree (`misses`). Lookups in the block of the previous lookup are not counted.
+ */
+void vimBufferGetLineCacheStats(buf_T *buf, long *hits, long *misses);
+
+/*
+ * vimBufferGetBlockPoolStats
+ *
+ * Get the memory used for the blocks that hold the buffer's text: the bytes
+ * in use, and the bytes kept free for reuse which make up the fragmentation.
+ * The memory is given back when the buffer is unloaded.
+ */
+void vimBufferGetBlockPoolStats(buf_T *buf, blockPoolStats_T *stats);
+
+/*
+ * vimGetMemoryStats
+ *
+ * Get the memory used by a buffer, in bytes per part: the memline blocks,
+ * copies kept for snapshots, the line cache, undo, marks, folds and b:
+ * variables. Also gives the number of blocks in memory, of cached blocks and
+ * of undo headers, entries and saved lines.
+ * The sizes are computed when called, by going over the buffer's structures.
+ */
+void vimGetMemoryStats(buf_T *buf, memoryStats_T *stats);
+
+/*
+ * vimGetGlobalMemoryStats
+ *
+ * Like vimGetMemoryStats, summed over all buffers, with the file marks,
+ * jumplists and g: variables added.
+ */
+void vimGetGlobalMemoryStats(memoryStats_T *stats);
+
+/*
+ * vimCompressColdBlocks
+ *
+ * Compress the blocks of text that were not used for the time set with
+ * vimOptionSetCompressAfter, in all buffers. This is also done after input
+ * and commands, at most once a second. Returns the number of blocks that were
+ * compressed. The saved memory is reported in `compress_saved` by
+ * vimGetMemoryStats.
+ */
+long vimCompressColdBlocks(void);
+
+/*
+ * vimBufferGetByteOffset
+ *
+ * Get the zero-based byte offset of the start of line `lnum`, counting the
+ * end-of-line of each line before it as written for the buffer's
+ * 'fileformat'. Line count + 1 gives the size of the whole buffer.
+ *
+ * Returns -1 if `lnum` is out of range or the offsets are not available.
+ */
+long vimBufferGetByteOffset(buf_T *buf, linenr_T lnum);
+
+/*
+ * vimBufferGetLineFromOffset
+ *
+ * Get the line that contains the zero-based byte offset `offset`, the
+ * inverse of vimBufferGetByteOffset.
+ *
+ * Returns -1 if `offset` is beyond the end of the buffer or the offsets are
+ * not available.
+ */
+linenr_T vimBufferGetLineFromOffset(buf_T *buf, long offset);
+
+/*
+ * vimBufferGetContentHash
+ *
+ * Get the 32 byte hash of the text of a buffer that undo files are checked
+ * with. Buffers with the same lines have the same hash, no matter how they
+ * were edited. The hash of a chunk of lines is kept until a line in it
+ * changes, thus after a small change getting the hash again is quick.
+ *
+ * Returns 0 if the buffer is not loaded, 1 otherwise.
+ */
+int vimBufferGetContentHash(buf_T *buf, char_u *hash);
+
+/*
+ * vimBufferIterLines
+ *
+ * Call `callback` for each line from `start` to `end` (one-based, inclusive)
+ * with a pointer to the line text and its length, walking the buffer's blocks
+ * in order without copying the lines. The text is not NUL terminated for the
+ * callback and is only valid until it returns; the callback must not get or
+ * change lines of the buffer. Returning 0 from the callback stops the walk.
+ *
+ * Returns 0 if the buffer's blocks could not be read, 1 otherwise.
+ */
+int vimBufferIterLines(buf_T *buf, linenr_T start, linenr_T end, LineIterCallback callback, void *context);
+
+/*
+ * vimBufferSerialize
+ *
+ * Write the contents of the buffer to `dest` as they would be written to a
+ * file: each line followed by the `eol` style (EOL_UNIX, EOL_DOS or EOL_MAC,
+ * or EOL_UNKNOWN for the buffer's 'fileformat'), without an end-of-line after
+ * the last line for a 'noeol' buffer. At most `size` bytes are written and
+ * the result is not NUL terminated.
+ *
+ * Returns the number of bytes the contents need, call with a `size` of 0 to
+ * find the size of `dest` to allocate.
+ */
+size_t vimBufferSerialize(buf_T *buf, int eol, char_u *dest, size_t size);
+
+/***
+ * Snapshots
+ ***/
+
+/*
+ * vimBufferSnapshot
+ *
+ * Take an immutable snapshot of the lines of the buffer. Editing the buffer
+ * later does not change the snapshot, and the snapshot can be read from any
+ * thread. Taking a snapshot must happen on the thread that uses libvim; only
+ * the blocks of lines that changed since the previous snapshot are copied.
+ *
+ * Returns NULL when out of memory. Release the snapshot with
+ * vimSnapshotRelease.
+ */
+snapshot_T *vimBufferSnapshot(buf_T *buf);
+
+/*
+ * vimSnapshotRelease
+ *
+ * Release a snapshot taken with vimBufferSnapshot. May be called from any
+ * thread, once for each snapshot.
+ */
+void vimSnapshotRelease(snapshot_T *snapshot);
+
+/*
+ * vimSnapshotGetLineCount / vimSnapshotGetLine
+ *
+ * Get the number of lines, or a line, of a snapshot. The returned line is NUL
+ * terminated and stays valid until the snapshot is released. Returns NULL
+ * for a line number that is out of range.
+ */
+size_t vimSnapshotGetLineCount(snapshot_T *snapshot);
+char_u *vimSnapshotGetLine(snapshot_T *snapshot, linenr_T lnum);
+
+/*
+ * vimSnapshotIterLines
+ *
+ * Like vimBufferIterLines, for a snapshot. The callback may be called from
+ * any thread and may use libvim only if that is its thread.
+ */
+void vimSnapshotIterLines(snapshot_T *snapshot, linenr_T start, linenr_T end, LineIterCallback callback, void *context);
+
 void vimSetBufferUpdateCallback(BufferUpdateCallback bufferUpdate);
 
+/*
+ * vimSetBufferChangeCallback
+ *
+ * Get each change of the text as a bufferChange_T: where it starts, the byte
+ * offset, the range and length of the text that was replaced and the new
+ * text. Passing the changes on in order keeps a copy of the text up to date
+ * without reading lines. The changes are collected while a command runs and
+ * passed on before the bufferUpdateCallback, or when vimInput, vimKey or
+ * vimExecute returns. "changedtick" is the value at that time.
+ *
+ * When a file is read into a buffer "newText" is NULL, the whole text must be
+ * read again. The new text is only valid during the callback. Changes are
+ * only collected while a callback is set.
+ */
+void vimSetBufferChangeCallback(BufferChangeCallback bufferChange);
+
+/*
+ * vimSetBufferUpdateBatching
+ *
+ * When TRUE, the buffer updates made by one vimInput, vimKey or vimExecute
+ * call are collected and passed to the bufferUpdateCallback when the call
+ * returns. Updates of a buffer whose line ranges overlap or touch are merged
+ * into one, so a ":%s" gives one update instead of one for each line. The
+ * updates of a buffer are passed in the order they were made, the line
+ * numbers of each are those after the updates before it. The changes for
+ * the bufferChangeCallback are held back until then as well. Default FALSE.
+ */
+void vimSetBufferUpdateBatching(int batch);
+
+/*
+ * vimBufferUpdateBatchBegin / vimBufferUpdateBatchEnd
+ *
+ * Collect and merge buffer updates like vimSetBufferUpdateBatching, for the
+ * calls between Begin and End. Batches can be nested, the updates are passed
+ * on when the outer batch ends.
+ */
+void vimBufferUpdateBatchBegin(void);
+void vimBufferUpdateBatchEnd(void);
+
 /***
  * Autocommands
  ***/
@@ -299,6 +625,52 @@ void vimOptionSetInsertSpaces(int insertSpaces);
 int vimOptionGetInsertSpaces(void);
 int vimOptionGetTabSize(void);
 
+/*
+ * vimOptionSetMmapThreshold
+ *
+ * Files of at least `bytes` bytes are loaded through a read-only memory map,
+ * instead of being copied into the buffer: a block of lines is only copied
+ * when it is used, and unchanged blocks are dropped again when the buffer
+ * uses more than 'maxmem'. Only applies to files that need no encoding
+ * conversion. The file must not be truncated by another program while the
+ * buffer is loaded. Writing the buffer to its own file copies it first.
+ *
+ * 0, the default, disables mapping. Not available on all platforms.
+ */
+void vimOptionSetMmapThreshold(off_T bytes);
+off_T vimOptionGetMmapThreshold(void);
+
+/*
+ * vimOptionSetCompressAfter
+ *
+ * Blocks of text that were not used for `seconds` seconds are compressed in
+ * memory, they are uncompressed again when a line in them is used. This
+ * mostly applies to buffers that are not displayed.
+ *
+ * 0, the default, disables compression.
+ */
+void vimOptionSetCompressAfter(int seconds);
+int vimOptionGetCompressAfter(void);
+
+/*
+ * vimOptionSetRegexpCacheSize
+ *
+ * Set how many compiled patterns that are not in use are kept, so that
+ * searching, substituting and matching with a pattern that was used before
+ * doesn't compile it again. The least recently used are dropped first.
+ *
+ * 0 disables the cache. The default is 32.
+ */
+void vimOptionSetRegexpCacheSize(int size);
+
+/*
+ * vimRegexpGetCacheStats
+ *
+ * Get the number of times a compiled pattern was found in the cache, `hits`,
+ * and the number of times a pattern had to be compiled, `misses`.
+ */
+void vimRegexpGetCacheStats(long *hits, long *misses);
+
 /***
  * Registers
  ***/
@@ -370,6 +742,70 @@ void vimSearchGetHighlights(buf_T *buf, linenr_T start_lnum, linenr_T end_lnum,
                             int *num_highlights,
                             searchHighlight_T **highlights);
 
+/*
+ * vimSearchGetHighlightsList
+ *
+ * Like vimSearchGetHighlights, but the highlights are put in "list", which
+ * is reused for the next call. Initialize "list" with zeros and free it with
+ * vimSearchHighlightListClear.
+ *
+ * The matches are kept for each line of the buffer and only found again for
+ * lines that changed, so getting the highlights for the lines in view takes
+ * time for those lines only. This does not work for a pattern that can match
+ * a line break or depends on the line number or cursor, those are searched
+ * for every time.
+ */
+void vimSearchGetHighlightsList(buf_T *buf, linenr_T start_lnum,
+                                linenr_T end_lnum,
+                                searchHighlightList_T *list);
+
+/*
+ * vimSearchGetHighlightsTimed
+ *
+ * Like vimSearchGetHighlightsList, but stops after about "msec" milliseconds,
+ * so that the matches in a large buffer can be found a part at a time, for
+ * example while idle. "list" gets the matches found in this call.
+ *
+ * "resume" is where searching continues. Set it to line "start_lnum", column
+ * zero, for the first call and pass it unchanged to the next call. Returns
+ * TRUE when the matches up to "end_lnum" were all found, FALSE when there are
+ * more to find. Every call makes some progress, even when one line takes
+ * longer than "msec" to search.
+ */
+int vimSearchGetHighlightsTimed(buf_T *buf, pos_T *resume, linenr_T end_lnum,
+                                long msec, searchHighlightList_T *list);
+void vimSearchHighlightListClear(searchHighlightList_T *list);
+
+/*
+ * vimSearchAll
+ *
+ * Get all matches of the current search pattern in the buffer, the same as
+ * vimSearchGetHighlightsList for the whole buffer. A large buffer is searched
+ * on several threads: a snapshot of the lines is split into ranges of whole
+ * blocks that are searched at the same time, and the matches are joined in
+ * order. A pattern that depends on the line number, cursor, marks or Visual
+ * area is searched for on this thread only.
+ */
+void vimSearchAll(buf_T *buf, searchHighlightList_T *list);
+
+/*
+ * vimSearchCount
+ *
+ * Count the matches of the current search pattern in the buffer, for showing
+ * "[current/total]", like vimSearchAll finds them. Returns the total. When
+ * `pos` is not NULL, `current` is set to the number of matches that start at
+ * or before `pos`, zero when there is none.
+ */
+int vimSearchCount(buf_T *buf, pos_T *pos, int *current);
+
+/*
+ * vimSearchSetThreadCount
+ *
+ * Set the number of threads vimSearchAll and vimSearchCount use. The default,
+ * 0, is one for each processor. With 1 no threads are started.
+ */
+void vimSearchSetThreadCount(int count);
+
 /*
  * vimSearchGetPattern
  *
@@ -680,6 +680,7 @@ int vim_main2(void)
  */
 void common_init(mparm_T *paramp)
 {
+  vim_scan_init(); /* pick the memchr3/memcount kernels for this CPU */
   cmdline_init();
 
   (void)mb_init(); /* init mb_bytelen_tab[] to ones */
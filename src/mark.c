@@ -1382,6 +1382,42 @@ void set_last_cursor(win_T *win)
     win->w_buffer->b_last_cursor = win->w_cursor;
 }
 
+/*
+ * Add the memory used for marks to "stats": the marks of buffer "buf", or
+ * when "buf" is NULL the file marks and the jumplists of all windows.
+ */
+void mark_memory_stats(buf_T *buf, memoryStats_T *stats)
+{
+  int i;
+#ifdef FEAT_JUMPLIST
+  tabpage_T *tp;
+  win_T *wp;
+#endif
+
+  if (buf != NULL)
+  {
+    stats->marks += sizeof(buf->b_namedm) + sizeof(buf->b_visual) +
+                    sizeof(buf->b_last_cursor) + sizeof(buf->b_last_insert) +
+                    sizeof(buf->b_last_change) + sizeof(buf->b_changelist);
+    return;
+  }
+
+  stats->marks += sizeof(namedfm);
+  for (i = 0; i < NMARKS + EXTRA_MARKS; i++)
+    if (namedfm[i].fname != NULL)
+      stats->marks += STRLEN(namedfm[i].fname) + 1;
+
+#ifdef FEAT_JUMPLIST
+  FOR_ALL_TAB_WINDOWS(tp, wp)
+  {
+    stats->marks += sizeof(wp->w_jumplist);
+    for (i = 0; i < wp->w_jumplistlen; ++i)
+      if (wp->w_jumplist[i].fname != NULL)
+        stats->marks += STRLEN(wp->w_jumplist[i].fname) + 1;
+  }
+#endif
+}
+
 #if defined(EXITFREE) || defined(PROTO)
 void free_all_marks(void)
 {
@@ -1243,6 +1243,9 @@ mb_init(void)
   /* The cell width depends on the type of multi-byte characters. */
   (void)init_chartab();
 
+  /* Compiled patterns depend on the encoding. */
+  vim_regcomp_cache_clear();
+
   /* When enc_utf8 is set or reset, (de)allocate ScreenLinesUC[] */
   screenalloc(FALSE);
 
@@ -4356,6 +4359,36 @@ int mb_tail_off(char_u *base, char_u *p)
   return 1 - dbcs_head_off(base, p);
 }
 
+/*
+ * Return the number of bytes at the start of "p[len]" that are complete and
+ * valid UTF-8 characters, the same as utf_ptr2len_len() accepts.  Runs of
+ * ASCII are skipped with vim_ascii_len().
+ */
+long utf_valid_len(char_u *p, long len)
+{
+  char_u *s = p;
+  char_u *end = p + len;
+  int l;
+  int i;
+
+  while (s < end)
+  {
+    if (*s < 0x80)
+    {
+      s += vim_ascii_len(s, (size_t)(end - s));
+      continue;
+    }
+    l = utf8len_tab_zero[*s];
+    if (l == 0 || l > end - s)
+      break; /* illegal lead byte or incomplete sequence */
+    for (i = 1; i < l; ++i)
+      if ((s[i] & 0xc0) != 0x80)
+        return (long)(s - p); /* illegal trail byte */
+    s += l;
+  }
+  return (long)(s - p);
+}
+
 /*
  * Find the next illegal byte sequence.
  */
@@ -4363,6 +4396,7 @@ void utf_find_illegal(void)
 {
   pos_T pos = curwin->w_cursor;
   char_u *p;
+  char_u *end;
   int len;
   vimconv_T vimconv;
   char_u *tofree = NULL;
@@ -4389,8 +4423,14 @@ void utf_find_illegal(void)
       p = tofree;
     }
 
+    end = p + STRLEN(p);
     while (*p != NUL)
     {
+      if (*p < 0x80)
+      {
+        p += vim_ascii_len(p, (size_t)(end - p));
+        continue;
+      }
       /* Illegal means that there are not enough trail bytes (checked by
 	     * utf_ptr2len()) or too many of them (overlong sequence). */
       len = utf_ptr2len(p);
@@ -4436,22 +4476,9 @@ theend:
  */
 int utf_valid_string(char_u *s, char_u *end)
 {
-  int l;
-  char_u *p = s;
-
-  while (end == NULL ? *p != NUL : p < end)
-  {
-    l = utf8len_tab_zero[*p];
-    if (l == 0)
-      return FALSE; /* invalid lead byte */
-    if (end != NULL && p + l > end)
-      return FALSE; /* incomplete byte sequence */
-    ++p;
-    while (--l > 0)
-      if ((*p++ & 0xc0) != 0x80)
-        return FALSE; /* invalid trail byte */
-  }
-  return TRUE;
+  if (end == NULL)
+    end = s + STRLEN(s);
+  return utf_valid_len(s, (long)(end - s)) == (long)(end - s);
 }
 #endif
 
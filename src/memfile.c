@@ -30,10 +30,27 @@
  * Under normal operation the file is created when opening the memory file and
  * deleted when closing the memory file. Only with recovery an existing memory
  * file is opened.
+ *
+ * The blocks of a file that is read through a read-only mapping also have
+ * negative numbers.  They are created from the mapped text when they are used
+ * and may be released again without writing them, as long as they have not
+ * been changed.
+ *
+ * The memory for blocks of one page and for the block headers is taken from
+ * a pool kept for each memfile, see mf_pool_T.
+ *
+ * When "mf_compress_after" is set, blocks that were not used for that many
+ * seconds are compressed in memory by mf_compress_cold(), with a simple LZ77
+ * codec.  A compressed block stays in the used list and the hash table, it is
+ * uncompressed again by mf_get().
  */
 
 #include "vim.h"
 
+#ifdef FEAT_MMAP_FILE
+#include <sys/mman.h>
+#endif
+
 /*
  * Some systems have the page size in statfs.f_bsize, some in stat.st_blksize
  */
@@ -67,13 +84,32 @@ static void mf_ins_used(memfile_T *, bhdr_T *);
 static void mf_rem_used(memfile_T *, bhdr_T *);
 static bhdr_T *mf_release(memfile_T *, int);
 static bhdr_T *mf_alloc_bhdr(memfile_T *, int);
-static void mf_free_bhdr(bhdr_T *);
+static void mf_free_bhdr(memfile_T *, bhdr_T *);
+static bhdr_T *mf_alloc_hdr(memfile_T *);
+static void mf_free_hdr(memfile_T *, bhdr_T *);
+static int mf_alloc_data(memfile_T *, bhdr_T *, int);
+static void mf_free_data(memfile_T *, bhdr_T *);
+static void mf_pool_free(memfile_T *);
+static void mf_drop_snap(bhdr_T *);
+static int mf_pool_trim(memfile_T *);
+static long mf_compress_blocks(memfile_T *, time_T);
+static int mf_compress(memfile_T *, bhdr_T *);
+static int mf_uncompress(memfile_T *, bhdr_T *);
+static void mf_drop_compressed(memfile_T *, bhdr_T *);
+static char_u *mf_lz_scratch(size_t);
+static size_t mf_lz_compress(char_u *, size_t, char_u *, size_t);
+static int mf_lz_decompress(char_u *, size_t, char_u *, size_t);
+static char_u *mf_lz_put_len(char_u *, char_u *, size_t);
+static int mf_lz_get_len(char_u **, char_u *, size_t *);
 static void mf_ins_free(memfile_T *, bhdr_T *);
 static bhdr_T *mf_rem_free(memfile_T *);
 static int mf_read(memfile_T *, bhdr_T *);
 static int mf_write(memfile_T *, bhdr_T *);
 static int mf_write_block(memfile_T *mfp, bhdr_T *hp, off_T offset, unsigned size);
 static int mf_trans_add(memfile_T *, bhdr_T *);
+#ifdef FEAT_MMAP_FILE
+static int mf_in_map(memfile_T *, blocknr_T);
+#endif
 static void mf_do_open(memfile_T *, char_u *, int);
 static void mf_hash_init(mf_hashtab_T *);
 static void mf_hash_free(mf_hashtab_T *);
@@ -96,7 +132,11 @@ static int mf_hash_grow(mf_hashtab_T *);
  * mf_sync()	    sync changed parts of memfile to disk
  * mf_release_all() release as much memory as possible
  * mf_trans_del()   may translate negative to positive block number
+ * mf_trans_find()  idem, keeping the translation
  * mf_fullname()    make file name full path (use before first :cd)
+ * mf_map_file()    use the blocks of a mapped file
+ * mf_unmap()	    stop using the mapped file
+ * mf_compress_cold() compress blocks that were not used for a while
  */
 
 /*
@@ -147,6 +187,14 @@ mf_open(char_u *fname, int flags)
   mfp->mf_used_last = NULL;
   mfp->mf_dirty = FALSE;
   mfp->mf_used_count = 0;
+#ifdef FEAT_MMAP_FILE
+  mfp->mf_map = NULL;
+#endif
+  vim_memset(&mfp->mf_pool, 0, sizeof(mf_pool_T));
+  mfp->mf_all_compressed = FALSE;
+  mfp->mf_compressed_count = 0;
+  mfp->mf_compressed_bytes = 0;
+  mfp->mf_compressed_size = 0;
   mf_hash_init(&mfp->mf_hash);
   mf_hash_init(&mfp->mf_trans);
   mfp->mf_page_size = MEMFILE_PAGE_SIZE;
@@ -235,12 +283,16 @@ void mf_close(memfile_T *mfp, int del_file)
   {
     total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
     nextp = hp->bh_next;
-    mf_free_bhdr(hp);
+    mf_free_bhdr(mfp, hp);
   }
   while (mfp->mf_free_first != NULL) /* free entries in free list */
-    vim_free(mf_rem_free(mfp));
+    mf_free_hdr(mfp, mf_rem_free(mfp));
   mf_hash_free(&mfp->mf_hash);
   mf_hash_free_all(&mfp->mf_trans); /* free hashtable and its items */
+#ifdef FEAT_MMAP_FILE
+  mf_unmap(mfp);
+#endif
+  mf_pool_free(mfp); /* give the memory of the blocks back */
   vim_free(mfp->mf_fname);
   vim_free(mfp->mf_ffname);
   vim_free(mfp);
@@ -304,7 +356,6 @@ mf_new(memfile_T *mfp, int negative, int page_count)
 {
   bhdr_T *hp;    /* new bhdr_T */
   bhdr_T *freep; /* first block in free list */
-  char_u *p;
 
   /*
      * If we reached the maximum size for the used memory blocks, release one
@@ -341,16 +392,15 @@ mf_new(memfile_T *mfp, int negative, int page_count)
     }
     else if (hp == NULL) /* need to allocate memory for this block */
     {
-      if ((p = alloc(mfp->mf_page_size * page_count)) == NULL)
+      if (mf_alloc_data(mfp, freep, page_count) == FAIL)
         return NULL;
       hp = mf_rem_free(mfp);
-      hp->bh_data = p;
     }
     else /* use the number, remove entry from free list */
     {
       freep = mf_rem_free(mfp);
       hp->bh_bnum = freep->bh_bnum;
-      vim_free(freep);
+      mf_free_hdr(mfp, freep);
     }
   }
   else /* get a new number */
@@ -371,6 +421,8 @@ mf_new(memfile_T *mfp, int negative, int page_count)
   hp->bh_flags = BH_LOCKED | BH_DIRTY; /* new block is always dirty */
   mfp->mf_dirty = TRUE;
   hp->bh_page_count = page_count;
+  hp->bh_used = vim_time();
+  mfp->mf_all_compressed = FALSE;
   mf_ins_used(mfp, hp);
   mf_ins_hash(mfp, hp);
 
@@ -403,7 +455,11 @@ mf_get(memfile_T *mfp, blocknr_T nr, int page_count)
   hp = mf_find_hash(mfp, nr);
   if (hp == NULL) /* not in the hash list */
   {
-    if (nr < 0 || nr >= mfp->mf_infile_count) /* can't be in the file */
+    if ((nr < 0 || nr >= mfp->mf_infile_count) /* can't be in the file */
+#ifdef FEAT_MMAP_FILE
+        && !mf_in_map(mfp, nr)
+#endif
+    )
       return NULL;
 
     /* could check here if the block is in the free list */
@@ -420,19 +476,28 @@ mf_get(memfile_T *mfp, blocknr_T nr, int page_count)
     hp->bh_bnum = nr;
     hp->bh_flags = 0;
     hp->bh_page_count = page_count;
+#ifdef FEAT_MMAP_FILE
+    if (nr < 0)
+      ml_fill_mapped(mfp, hp); /* copy the text from the mapped file */
+    else
+#endif
     if (mf_read(mfp, hp) == FAIL) /* cannot read the block! */
     {
-      mf_free_bhdr(hp);
+      mf_free_bhdr(mfp, hp);
       return NULL;
     }
   }
   else
   {
+    if (hp->bh_compressed != NULL && mf_uncompress(mfp, hp) == FAIL)
+      return NULL;
     mf_rem_used(mfp, hp); /* remove from list, insert in front below */
     mf_rem_hash(mfp, hp);
   }
 
   hp->bh_flags |= BH_LOCKED;
+  hp->bh_used = vim_time();
+  mfp->mf_all_compressed = FALSE;
   mf_ins_used(mfp, hp); /* put in front of used list */
   mf_ins_hash(mfp, hp); /* put in front of hash list */
 
@@ -466,6 +531,8 @@ void mf_put(
     mfp->mf_dirty = TRUE;
   }
   hp->bh_flags = flags;
+  if (dirty)
+    mf_drop_snap(hp); /* copy for snapshots is outdated */
   if (infile)
     mf_trans_add(mfp, hp); /* may translate negative in positive nr */
 }
@@ -475,12 +542,13 @@ void mf_put(
  */
 void mf_free(memfile_T *mfp, bhdr_T *hp)
 {
-  vim_free(hp->bh_data); /* free the memory */
+  mf_drop_snap(hp);
+  mf_free_data(mfp, hp); /* free the memory */
   mf_rem_hash(mfp, hp);  /* get *hp out of the hash list */
   mf_rem_used(mfp, hp);  /* get *hp out of the used list */
   if (hp->bh_bnum < 0)
   {
-    vim_free(hp); /* don't want negative numbers in free list */
+    mf_free_hdr(mfp, hp); /* don't want negative numbers in free list */
     mfp->mf_neg_count--;
   }
   else
@@ -724,17 +792,23 @@ mf_release(memfile_T *mfp, int page_count)
 
   /*
      * don't release a block if
-     *	there is no file for this memfile
+     *	there is no file for this memfile and no mapped file
      * or
      *	the number of blocks for this memfile is lower than the maximum
      *	  and
      *	total memory used is not up to 'maxmemtot'
      */
-  if (mfp->mf_fd < 0 || !need_release)
+  if (!need_release || (mfp->mf_fd < 0
+#ifdef FEAT_MMAP_FILE
+                        && mfp->mf_map == NULL
+#endif
+                        ))
     return NULL;
 
+  /* Without a file only unchanged blocks of the mapped file can be released,
+     * they can be created again from the mapped text. */
   for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
-    if (!(hp->bh_flags & BH_LOCKED))
+    if (!(hp->bh_flags & BH_LOCKED) && (mfp->mf_fd >= 0 || !(hp->bh_flags & BH_DIRTY)))
       break;
   if (hp == NULL) /* not a single one that can be released */
     return NULL;
@@ -748,17 +822,18 @@ mf_release(memfile_T *mfp, int page_count)
 
   mf_rem_used(mfp, hp);
   mf_rem_hash(mfp, hp);
+  mf_drop_snap(hp);
 
   /*
      * If a bhdr_T is returned, make sure that the page_count of bh_data is
-     * right
+     * right.  A compressed block has no bh_data.
      */
-  if (hp->bh_page_count != page_count)
+  if (hp->bh_page_count != page_count || hp->bh_compressed != NULL)
   {
-    vim_free(hp->bh_data);
-    if ((hp->bh_data = alloc(mfp->mf_page_size * page_count)) == NULL)
+    mf_free_data(mfp, hp);
+    if (mf_alloc_data(mfp, hp, page_count) == FAIL)
     {
-      vim_free(hp);
+      mf_free_hdr(mfp, hp);
       return NULL;
     }
     hp->bh_page_count = page_count;
@@ -788,8 +863,12 @@ int mf_release_all(void)
       if (mfp->mf_fd < 0 && buf->b_may_swap)
         ml_open_file(buf);
 
-      /* only if there is a swapfile */
-      if (mfp->mf_fd >= 0)
+      /* only if there is a swapfile or a mapped file */
+      if (mfp->mf_fd >= 0
+#ifdef FEAT_MMAP_FILE
+          || mfp->mf_map != NULL
+#endif
+      )
       {
         for (hp = mfp->mf_used_last; hp != NULL;)
         {
@@ -797,7 +876,7 @@ int mf_release_all(void)
           {
             mf_rem_used(mfp, hp);
             mf_rem_hash(mfp, hp);
-            mf_free_bhdr(hp);
+            mf_free_bhdr(mfp, hp);
             hp = mfp->mf_used_last; /* re-start, list was changed */
             retval = TRUE;
           }
@@ -805,6 +884,10 @@ int mf_release_all(void)
             hp = hp->bh_prev;
         }
       }
+
+      /* give back slabs of pages that are not used */
+      if (mf_pool_trim(mfp))
+        retval = TRUE;
     }
   }
   return retval;
@@ -818,11 +901,11 @@ mf_alloc_bhdr(memfile_T *mfp, int page_count)
 {
   bhdr_T *hp;
 
-  if ((hp = ALLOC_ONE(bhdr_T)) != NULL)
+  if ((hp = mf_alloc_hdr(mfp)) != NULL)
   {
-    if ((hp->bh_data = alloc(mfp->mf_page_size * page_count)) == NULL)
+    if (mf_alloc_data(mfp, hp, page_count) == FAIL)
     {
-      vim_free(hp); /* not enough memory */
+      mf_free_hdr(mfp, hp); /* not enough memory */
       return NULL;
     }
     hp->bh_page_count = page_count;
@@ -834,10 +917,719 @@ mf_alloc_bhdr(memfile_T *mfp, int page_count)
  * Free a block header and the block of memory for it
  */
 static void
-mf_free_bhdr(bhdr_T *hp)
+mf_free_bhdr(memfile_T *mfp, bhdr_T *hp)
+{
+  mf_drop_snap(hp);
+  mf_free_data(mfp, hp);
+  mf_free_hdr(mfp, hp);
+}
+
+/*
+ * Let go of the copy of block "hp" kept for snapshots, if there is one.
+ */
+static void
+mf_drop_snap(bhdr_T *hp)
+{
+  if (hp->bh_snap != NULL)
+  {
+    ml_snapblock_unref(hp->bh_snap);
+    hp->bh_snap = NULL;
+  }
+}
+
+/*
+ * Get a block header from the pool of "mfp", without memory for the block.
+ */
+static bhdr_T *
+mf_alloc_hdr(memfile_T *mfp)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+  bhdr_T *hp;
+
+  if (pool->mp_free_hdrs != NULL)
+  {
+    hp = pool->mp_free_hdrs;
+    pool->mp_free_hdrs = hp->bh_next;
+    --pool->mp_free_hdr_count;
+  }
+  else if ((hp = ALLOC_ONE(bhdr_T)) != NULL)
+    ++pool->mp_hdr_count;
+  if (hp != NULL)
+  {
+    hp->bh_snap = NULL;
+    hp->bh_used = 0;
+    hp->bh_compressed = NULL;
+  }
+  return hp;
+}
+
+/*
+ * Put block header "hp" back in the pool of "mfp" for reuse.
+ */
+static void
+mf_free_hdr(memfile_T *mfp, bhdr_T *hp)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+
+  hp->bh_next = pool->mp_free_hdrs;
+  pool->mp_free_hdrs = hp;
+  ++pool->mp_free_hdr_count;
+}
+
+/*
+ * Allocate the memory for a block of "page_count" pages and set it in
+ * hp->bh_data.  A single page is taken from the pool of "mfp", from a freed
+ * page or else from a slab.
+ * Return FAIL when out of memory, "hp" is not changed then.
+ */
+static int
+mf_alloc_data(memfile_T *mfp, bhdr_T *hp, int page_count)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+  mf_slab_T *slab;
+  char_u *p;
+
+  if (pool->mp_slab_count == 0)
+    pool->mp_page_size = mfp->mf_page_size;
+
+  if (page_count != 1 || mfp->mf_page_size != pool->mp_page_size)
+  {
+    /* A line that does not fit in one page, or the page size was changed
+	 * while recovering. */
+    if ((p = alloc(mfp->mf_page_size * page_count)) == NULL)
+      return FAIL;
+    pool->mp_other_bytes += mfp->mf_page_size * page_count;
+    hp->bh_data = p;
+    hp->bh_pooled = FALSE;
+    return OK;
+  }
+
+  if (pool->mp_free_pages != NULL)
+  {
+    p = pool->mp_free_pages;
+    pool->mp_free_pages = *(char_u **)p;
+    --pool->mp_free_count;
+  }
+  else
+  {
+    if (pool->mp_fresh == 0)
+    {
+      /* The first slabs are small, a buffer with a few lines doesn't need
+	     * many pages. */
+      if ((slab = ALLOC_ONE(mf_slab_T)) == NULL)
+        return FAIL;
+      slab->ms_pages = pool->mp_slab_count == 0 ? MF_SLAB_MIN_PAGES
+                                                : MIN(pool->mp_slabs->ms_pages * 2,
+                                                      MF_SLAB_MAX_PAGES);
+      slab->ms_data = alloc(pool->mp_page_size * slab->ms_pages);
+      if (slab->ms_data == NULL)
+      {
+        vim_free(slab);
+        return FAIL;
+      }
+      slab->ms_next = pool->mp_slabs;
+      pool->mp_slabs = slab;
+      ++pool->mp_slab_count;
+      pool->mp_slab_pages += slab->ms_pages;
+      pool->mp_fresh = slab->ms_pages;
+    }
+    slab = pool->mp_slabs;
+    p = slab->ms_data +
+        (size_t)pool->mp_page_size * (slab->ms_pages - pool->mp_fresh);
+    --pool->mp_fresh;
+  }
+  hp->bh_data = p;
+  hp->bh_pooled = TRUE;
+  return OK;
+}
+
+/*
+ * Free the memory of block "hp", a page goes back to the pool of "mfp".
+ */
+static void
+mf_free_data(memfile_T *mfp, bhdr_T *hp)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+
+  if (hp->bh_compressed != NULL)
+    mf_drop_compressed(mfp, hp);
+  else if (hp->bh_pooled)
+  {
+    *(char_u **)hp->bh_data = pool->mp_free_pages;
+    pool->mp_free_pages = hp->bh_data;
+    ++pool->mp_free_count;
+  }
+  else
+  {
+    vim_free(hp->bh_data);
+    pool->mp_other_bytes -= mfp->mf_page_size * hp->bh_page_count;
+  }
+  hp->bh_data = NULL;
+}
+
+/*
+ * Give the memory of block "hp" the current page size of "mfp", keeping the
+ * first "old_size" bytes.  Used for block 0 when recovering and the page size
+ * of the swap file differs from what was guessed.
+ * Return FAIL when out of memory, "hp" is not changed then.
+ */
+int mf_resize_data(memfile_T *mfp, bhdr_T *hp, unsigned old_size)
+{
+  bhdr_T old = *hp;
+
+  if (mf_alloc_data(mfp, hp, 1) == FAIL)
+    return FAIL;
+  mch_memmove(hp->bh_data, old.bh_data, MIN(old_size, mfp->mf_page_size));
+  if (!old.bh_pooled)
+  {
+    /* was allocated with the old page size */
+    vim_free(old.bh_data);
+    mfp->mf_pool.mp_other_bytes -= old_size;
+  }
+  else
+    mf_free_data(mfp, &old);
+  return OK;
+}
+
+/*
+ * Free all the memory of the pool of "mfp", when the memfile is closed.
+ */
+static void
+mf_pool_free(memfile_T *mfp)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+  mf_slab_T *slab;
+  bhdr_T *hp;
+
+  while (pool->mp_slabs != NULL)
+  {
+    slab = pool->mp_slabs;
+    pool->mp_slabs = slab->ms_next;
+    vim_free(slab->ms_data);
+    vim_free(slab);
+  }
+  while (pool->mp_free_hdrs != NULL)
+  {
+    hp = pool->mp_free_hdrs;
+    pool->mp_free_hdrs = hp->bh_next;
+    vim_free(hp);
+  }
+  vim_memset(pool, 0, sizeof(mf_pool_T));
+}
+
+static int
+mf_slab_compare(const void *s1, const void *s2)
+{
+  char_u *p1 = (*(mf_slab_T **)s1)->ms_data;
+  char_u *p2 = (*(mf_slab_T **)s2)->ms_data;
+
+  return p1 == p2 ? 0 : p1 < p2 ? -1 : 1;
+}
+
+/*
+ * Return the index in "slabs", "n" slabs sorted on address, of the slab that
+ * page "p" is in.
+ */
+static int
+mf_slab_index(mf_slab_T **slabs, int n, char_u *p)
+{
+  int lo = 0;
+  int hi = n - 1;
+  int mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi + 1) / 2;
+    if (p < slabs[mid]->ms_data)
+      hi = mid - 1;
+    else
+      lo = mid;
+  }
+  return lo;
+}
+
+/*
+ * Free the slabs of the pool of "mfp" of which all pages are free, and the
+ * block headers kept for reuse.  Used when memory runs low.
+ * Return TRUE if any memory was freed.
+ */
+static int
+mf_pool_trim(memfile_T *mfp)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+  mf_slab_T **slabs;
+  mf_slab_T **slabp;
+  mf_slab_T *slab;
+  int *free_count;
+  char_u *p;
+  char_u *next;
+  char_u **pagep;
+  int n = pool->mp_slab_count;
+  int i;
+  bhdr_T *hp;
+  int retval = FALSE;
+
+  while (pool->mp_free_hdrs != NULL)
+  {
+    hp = pool->mp_free_hdrs;
+    pool->mp_free_hdrs = hp->bh_next;
+    vim_free(hp);
+    --pool->mp_hdr_count;
+    retval = TRUE;
+  }
+  pool->mp_free_hdr_count = 0;
+
+  if (n == 0 || pool->mp_free_count + pool->mp_fresh < MF_SLAB_MIN_PAGES)
+    return retval; /* no slab can be completely free */
+
+  /* Count the free pages in each slab, finding the slab of a page by
+     * binary search in the slabs sorted on address. */
+  slabs = ALLOC_MULT(mf_slab_T *, n);
+  free_count = ALLOC_CLEAR_MULT(int, n);
+  if (slabs == NULL || free_count == NULL)
+  {
+    vim_free(slabs);
+    vim_free(free_count);
+    return retval;
+  }
+  for (i = 0, slab = pool->mp_slabs; slab != NULL; slab = slab->ms_next)
+    slabs[i++] = slab;
+  qsort((void *)slabs, (size_t)n, sizeof(mf_slab_T *), mf_slab_compare);
+
+  for (p = pool->mp_free_pages; p != NULL; p = *(char_u **)p)
+    ++free_count[mf_slab_index(slabs, n, p)];
+  if (pool->mp_fresh > 0)
+    free_count[mf_slab_index(slabs, n, pool->mp_slabs->ms_data)] += pool->mp_fresh;
+
+  /* Drop the pages of free slabs from the list of free pages. */
+  pagep = &pool->mp_free_pages;
+  for (p = pool->mp_free_pages; p != NULL; p = next)
+  {
+    next = *(char_u **)p;
+    i = mf_slab_index(slabs, n, p);
+    if (free_count[i] == slabs[i]->ms_pages)
+    {
+      *pagep = next;
+      --pool->mp_free_count;
+    }
+    else
+      pagep = (char_u **)p;
+  }
+
+  /* Free the slabs themselves. */
+  for (i = 0; i < n; ++i)
+    if (free_count[i] == slabs[i]->ms_pages)
+      VIM_CLEAR(slabs[i]->ms_data);
+  for (slabp = &pool->mp_slabs; *slabp != NULL;)
+  {
+    slab = *slabp;
+    if (slab->ms_data == NULL)
+    {
+      if (slab == pool->mp_slabs)
+        pool->mp_fresh = 0;
+      *slabp = slab->ms_next;
+      pool->mp_slab_pages -= slab->ms_pages;
+      vim_free(slab);
+      --pool->mp_slab_count;
+      retval = TRUE;
+    }
+    else
+      slabp = &slab->ms_next;
+  }
+  vim_free(slabs);
+  vim_free(free_count);
+  return retval;
+}
+
+/*
+ * Get the memory used for the blocks of "mfp".
+ */
+void mf_pool_stats(memfile_T *mfp, blockPoolStats_T *stats)
+{
+  mf_pool_T *pool = &mfp->mf_pool;
+  long pages = pool->mp_slab_pages;
+  long free_pages = pool->mp_free_count + pool->mp_fresh;
+
+  stats->used = (pages - free_pages) * pool->mp_page_size +
+                pool->mp_other_bytes +
+                (pool->mp_hdr_count - pool->mp_free_hdr_count) * sizeof(bhdr_T);
+  stats->free = free_pages * pool->mp_page_size +
+                pool->mp_free_hdr_count * sizeof(bhdr_T);
+  stats->slabs = pool->mp_slab_count;
+}
+
+/*
+ * Add the memory used by "mfp" to "stats": the blocks in memory, including
+ * the ones shared with snapshots, and the hash tables.
+ */
+void mf_memory_stats(memfile_T *mfp, memoryStats_T *stats)
+{
+  blockPoolStats_T pool_stats;
+  bhdr_T *hp;
+
+  mf_pool_stats(mfp, &pool_stats);
+  stats->memline += pool_stats.used + pool_stats.free +
+                    mfp->mf_compressed_bytes;
+  stats->compressed += mfp->mf_compressed_bytes;
+  stats->compress_saved += mfp->mf_compressed_size - mfp->mf_compressed_bytes;
+  stats->compressed_blocks += mfp->mf_compressed_count;
+  if (mfp->mf_hash.mht_buckets != mfp->mf_hash.mht_small_buckets)
+    stats->memline += (mfp->mf_hash.mht_mask + 1) * sizeof(mf_hashitem_T *);
+  if (mfp->mf_trans.mht_buckets != mfp->mf_trans.mht_small_buckets)
+    stats->memline += (mfp->mf_trans.mht_mask + 1) * sizeof(mf_hashitem_T *);
+  stats->memline += mfp->mf_trans.mht_count * sizeof(NR_TRANS);
+
+  for (hp = mfp->mf_used_first; hp != NULL; hp = hp->bh_next)
+  {
+    ++stats->blocks;
+    if (hp->bh_snap != NULL)
+      stats->snapshots += sizeof(snapblock_T) + hp->bh_snap->sb_text_len +
+                          hp->bh_snap->sb_line_count * sizeof(unsigned);
+  }
+}
+
+/*
+ * Compress the blocks of all buffers that were not used for
+ * "mf_compress_after" seconds.  Unless "force" is TRUE this is done at most
+ * once a second.
+ * Returns the number of blocks that were compressed.
+ */
+long mf_compress_cold(int force)
+{
+  static time_T last_sweep = 0;
+  time_T now;
+  buf_T *buf;
+  long count = 0;
+
+  if (mf_compress_after <= 0)
+    return 0;
+  now = vim_time();
+  if (!force && now == last_sweep)
+    return 0;
+  last_sweep = now;
+
+  FOR_ALL_BUFFERS(buf)
+  {
+    if (buf->b_ml.ml_mfp != NULL && !buf->b_ml.ml_mfp->mf_all_compressed)
+      count += mf_compress_blocks(buf->b_ml.ml_mfp, now - mf_compress_after);
+  }
+  return count;
+}
+
+/*
+ * Compress the blocks of "mfp" that were last used before "cutoff".
+ */
+static long
+mf_compress_blocks(memfile_T *mfp, time_T cutoff)
+{
+  bhdr_T *hp;
+  long count = 0;
+  int all = TRUE;
+
+  /* The used list is in order of use, the oldest blocks are at the end. */
+  for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+  {
+    if (hp->bh_used > cutoff)
+    {
+      all = FALSE;
+      break;
+    }
+    if (hp->bh_compressed != NULL)
+      continue;
+    /* Block zero is changed without getting it, see ml_setflags(). */
+    if ((hp->bh_flags & BH_LOCKED) || hp->bh_bnum == 0)
+    {
+      all = FALSE;
+      continue;
+    }
+    if (mf_compress(mfp, hp) == OK)
+      ++count;
+  }
+
+  if (count > 0)
+    mf_pool_trim(mfp);
+  mfp->mf_all_compressed = all;
+  return count;
+}
+
+/*
+ * Replace the data of block "hp" with a compressed copy.
+ * Returns FAIL when it does not compress well.
+ */
+static int
+mf_compress(memfile_T *mfp, bhdr_T *hp)
+{
+  size_t size = (size_t)mfp->mf_page_size * hp->bh_page_count;
+  size_t len;
+  char_u *scratch;
+  char_u *p;
+
+  scratch = mf_lz_scratch(size);
+  if (scratch == NULL)
+    return FAIL;
+  /* Not worth it when less than a quarter is saved. */
+  len = mf_lz_compress(hp->bh_data, size, scratch, size - size / 4);
+  if (len == 0 || (p = alloc(len)) == NULL)
+    return FAIL;
+  mch_memmove(p, scratch, len);
+
+  mf_free_data(mfp, hp);
+  hp->bh_compressed = p;
+  hp->bh_compressed_len = (unsigned)len;
+  ++mfp->mf_compressed_count;
+  mfp->mf_compressed_bytes += len;
+  mfp->mf_compressed_size += size;
+  return OK;
+}
+
+/*
+ * Uncompress block "hp" into newly allocated data.
+ */
+static int
+mf_uncompress(memfile_T *mfp, bhdr_T *hp)
+{
+  char_u *compressed = hp->bh_compressed;
+
+  /* mf_free_data() must not drop the compressed data on failure */
+  hp->bh_compressed = NULL;
+  if (mf_alloc_data(mfp, hp, hp->bh_page_count) == FAIL)
+  {
+    hp->bh_compressed = compressed;
+    return FAIL;
+  }
+  if (mf_lz_decompress(compressed, hp->bh_compressed_len, hp->bh_data,
+                       (size_t)mfp->mf_page_size * hp->bh_page_count) == FAIL)
+  {
+    siemsg(_(e_intern2), "mf_uncompress()");
+    mf_free_data(mfp, hp);
+    hp->bh_compressed = compressed;
+    return FAIL;
+  }
+  hp->bh_compressed = compressed;
+  mf_drop_compressed(mfp, hp);
+  return OK;
+}
+
+/*
+ * Free the compressed data of block "hp".
+ */
+static void
+mf_drop_compressed(memfile_T *mfp, bhdr_T *hp)
+{
+  --mfp->mf_compressed_count;
+  mfp->mf_compressed_bytes -= hp->bh_compressed_len;
+  mfp->mf_compressed_size -= (long_u)mfp->mf_page_size * hp->bh_page_count;
+  VIM_CLEAR(hp->bh_compressed);
+  hp->bh_compressed_len = 0;
+}
+
+/*
+ * Return a buffer of at least "size" bytes to compress into.  It is kept
+ * for the next call.
+ */
+static char_u *
+mf_lz_scratch(size_t size)
+{
+  static char_u *scratch = NULL;
+  static size_t scratch_size = 0;
+
+  if (size > scratch_size)
+  {
+    vim_free(scratch);
+    scratch = alloc(size);
+    scratch_size = scratch == NULL ? 0 : size;
+  }
+  return scratch;
+}
+
+/*
+ * The codec is a plain LZ77 in the style of LZ4: a token byte with the
+ * number of literals in the high nibble and the match length minus
+ * MF_LZ_MINMATCH in the low nibble, each extended with 255 bytes when it is
+ * 15.  The literals follow, then a two byte offset back to the match.  The
+ * last sequence has only literals.
+ */
+#define MF_LZ_MINMATCH 4
+#define MF_LZ_HASH_BITS 12
+#define MF_LZ_LAST_LITERALS 5 /* the last bytes are always literals */
+#define MF_LZ_MFLIMIT 12      /* no match starts in the last bytes */
+#define MF_LZ_MAX_OFFSET 0xffff
+
+#define MF_LZ_READ32(p) ((unsigned)(p)[0] | ((unsigned)(p)[1] << 8) | \
+                         ((unsigned)(p)[2] << 16) | ((unsigned)(p)[3] << 24))
+#define MF_LZ_HASH(v) (((v)*2654435761U) >> (32 - MF_LZ_HASH_BITS))
+
+/*
+ * Store a length of "len" after the nibble in the token, at "op".
+ * Returns the new "op", NULL when it does not fit before "oend".
+ */
+static char_u *
+mf_lz_put_len(char_u *op, char_u *oend, size_t len)
 {
-  vim_free(hp->bh_data);
-  vim_free(hp);
+  for (; len >= 255; len -= 255)
+  {
+    if (op >= oend)
+      return NULL;
+    *op++ = 255;
+  }
+  if (op >= oend)
+    return NULL;
+  *op++ = (char_u)len;
+  return op;
+}
+
+/*
+ * Compress "len" bytes at "src" into "dst", using at most "dst_len" bytes.
+ * Returns the compressed size, zero when it does not fit.
+ */
+static size_t
+mf_lz_compress(char_u *src, size_t len, char_u *dst, size_t dst_len)
+{
+  unsigned table[1 << MF_LZ_HASH_BITS];
+  char_u *ip = src;
+  char_u *anchor = src;
+  char_u *iend = src + len;
+  char_u *op = dst;
+  char_u *oend = dst + dst_len;
+  size_t lit_len;
+  char_u *token;
+
+  vim_memset(table, 0, sizeof(table));
+  if (len >= MF_LZ_MFLIMIT)
+  {
+    char_u *mflimit = iend - MF_LZ_MFLIMIT;
+    char_u *matchlimit = iend - MF_LZ_LAST_LITERALS;
+
+    ++ip;
+    while (ip < mflimit)
+    {
+      unsigned h = MF_LZ_HASH(MF_LZ_READ32(ip));
+      char_u *ref = src + table[h];
+      size_t match_len;
+
+      table[h] = (unsigned)(ip - src);
+      if (ref >= ip || ip - ref > MF_LZ_MAX_OFFSET ||
+          MF_LZ_READ32(ref) != MF_LZ_READ32(ip))
+      {
+        ++ip;
+        continue;
+      }
+
+      /* extend the match backwards over the pending literals */
+      while (ip > anchor && ref > src && ip[-1] == ref[-1])
+      {
+        --ip;
+        --ref;
+      }
+      match_len = MF_LZ_MINMATCH;
+      while (ip + match_len < matchlimit && ip[match_len] == ref[match_len])
+        ++match_len;
+
+      lit_len = ip - anchor;
+      if (op + 1 + lit_len + lit_len / 255 + 2 > oend)
+        return 0;
+      token = op++;
+      *token = (char_u)((lit_len >= 15 ? 15 : lit_len) << 4);
+      if (lit_len >= 15 && (op = mf_lz_put_len(op, oend, lit_len - 15)) == NULL)
+        return 0;
+      mch_memmove(op, anchor, lit_len);
+      op += lit_len;
+      *op++ = (char_u)((ip - ref) & 0xff);
+      *op++ = (char_u)((ip - ref) >> 8);
+      if (match_len - MF_LZ_MINMATCH >= 15)
+      {
+        *token |= 15;
+        if ((op = mf_lz_put_len(op, oend,
+                                match_len - MF_LZ_MINMATCH - 15)) == NULL)
+          return 0;
+      }
+      else
+        *token |= (char_u)(match_len - MF_LZ_MINMATCH);
+
+      ip += match_len;
+      anchor = ip;
+    }
+  }
+
+  /* the last literals */
+  lit_len = iend - anchor;
+  if (op + 1 + lit_len + lit_len / 255 > oend)
+    return 0;
+  token = op++;
+  *token = (char_u)((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15 && (op = mf_lz_put_len(op, oend, lit_len - 15)) == NULL)
+    return 0;
+  if (op + lit_len > oend)
+    return 0;
+  mch_memmove(op, anchor, lit_len);
+  op += lit_len;
+  return op - dst;
+}
+
+/*
+ * Get a length that was extended after the token.
+ * Returns FAIL when the input ends.
+ */
+static int
+mf_lz_get_len(char_u **ipp, char_u *iend, size_t *lenp)
+{
+  int c;
+
+  do
+  {
+    if (*ipp >= iend)
+      return FAIL;
+    c = *(*ipp)++;
+    *lenp += c;
+  } while (c == 255);
+  return OK;
+}
+
+/*
+ * Decompress "len" bytes at "src" into "dst", which must fill exactly
+ * "dst_len" bytes.
+ */
+static int
+mf_lz_decompress(char_u *src, size_t len, char_u *dst, size_t dst_len)
+{
+  char_u *ip = src;
+  char_u *iend = src + len;
+  char_u *op = dst;
+  char_u *oend = dst + dst_len;
+
+  while (ip < iend)
+  {
+    int token = *ip++;
+    size_t lit_len = token >> 4;
+    size_t match_len = token & 15;
+    size_t offset;
+    char_u *ref;
+
+    if (lit_len == 15 && mf_lz_get_len(&ip, iend, &lit_len) == FAIL)
+      return FAIL;
+    if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+      return FAIL;
+    mch_memmove(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == iend)
+      break; /* the last sequence has no match */
+
+    if (iend - ip < 2)
+      return FAIL;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (match_len == 15 && mf_lz_get_len(&ip, iend, &match_len) == FAIL)
+      return FAIL;
+    match_len += MF_LZ_MINMATCH;
+    if (offset == 0 || offset > (size_t)(op - dst) ||
+        match_len > (size_t)(oend - op))
+      return FAIL;
+    /* the match may overlap with what is being copied */
+    for (ref = op - offset; match_len > 0; --match_len)
+      *op++ = *ref++;
+  }
+  return op == oend ? OK : FAIL;
 }
 
 /*
@@ -1008,7 +1800,19 @@ mf_write_block(
     off_T offset UNUSED,
     unsigned size)
 {
-  if ((unsigned)write_eintr(mfp->mf_fd, hp->bh_data, size) != size)
+  char_u *data = hp->bh_data;
+  unsigned block_size = mfp->mf_page_size * hp->bh_page_count;
+
+  /* A compressed block is written without keeping it uncompressed. */
+  if (hp->bh_compressed != NULL)
+  {
+    data = mf_lz_scratch(block_size);
+    if (data == NULL || mf_lz_decompress(hp->bh_compressed,
+                                         hp->bh_compressed_len, data,
+                                         block_size) == FAIL)
+      return FAIL;
+  }
+  if ((unsigned)write_eintr(mfp->mf_fd, data, size) != size)
     return FAIL;
 
   return OK;
@@ -1055,7 +1859,7 @@ mf_trans_add(memfile_T *mfp, bhdr_T *hp)
     else
     {
       freep = mf_rem_free(mfp);
-      vim_free(freep);
+      mf_free_hdr(mfp, freep);
     }
   }
   else
@@ -1104,6 +1908,19 @@ mf_trans_del(memfile_T *mfp, blocknr_T old_nr)
   return new_bnum;
 }
 
+/*
+ * Lookup the translation of "old_nr" like mf_trans_del(), but keep it for
+ * the pointer block that still uses "old_nr".
+ */
+blocknr_T
+mf_trans_find(memfile_T *mfp, blocknr_T old_nr)
+{
+  NR_TRANS *np;
+
+  np = (NR_TRANS *)mf_hash_find(&mfp->mf_trans, old_nr);
+  return np == NULL ? old_nr : np->nt_new_bnum;
+}
+
 /*
  * Set mfp->mf_ffname according to mfp->mf_fname and some other things.
  * Only called when creating or renaming the swapfile.	Either way it's a new
@@ -1128,6 +1945,62 @@ void mf_fullname(memfile_T *mfp)
   }
 }
 
+#ifdef FEAT_MMAP_FILE
+/*
+ * Use the blocks of mapped file "map" in memfile "mfp".  The memfile takes
+ * over "map" and unmaps the file when it is closed.  Sets "map->mm_first",
+ * the following blocks get decreasing numbers.
+ */
+void mf_map_file(memfile_T *mfp, mf_map_T *map)
+{
+  mf_unmap(mfp);
+  map->mm_first = mfp->mf_blocknr_min;
+  mfp->mf_blocknr_min -= map->mm_count;
+  mfp->mf_neg_count += map->mm_count;
+  mfp->mf_map = map;
+}
+
+/*
+ * Stop using the mapped file of memfile "mfp".  The caller must make sure
+ * that all its blocks are in memory and dirty, see ml_unmap().
+ */
+void mf_unmap(memfile_T *mfp)
+{
+  mf_map_T *map = mfp->mf_map;
+
+  if (map == NULL)
+    return;
+  munmap(map->mm_addr, map->mm_size);
+  vim_free(map->mm_offsets);
+  VIM_CLEAR(mfp->mf_map);
+}
+
+/*
+ * Return TRUE if block "nr" is a block of the mapped file.
+ */
+static int
+mf_in_map(memfile_T *mfp, blocknr_T nr)
+{
+  mf_map_T *map = mfp->mf_map;
+
+  return map != NULL && nr <= map->mm_first && nr > map->mm_first - map->mm_count;
+}
+
+/*
+ * Return TRUE if block "nr" is a block of the mapped file that was not
+ * changed, its text can be found in the mapped file without getting it.
+ */
+int mf_is_mapped(memfile_T *mfp, blocknr_T nr)
+{
+  bhdr_T *hp;
+
+  if (!mf_in_map(mfp, nr))
+    return FALSE;
+  hp = mf_find_hash(mfp, nr);
+  return hp == NULL || !(hp->bh_flags & BH_DIRTY);
+}
+#endif
+
 /*
  * return TRUE if there are any translations pending for 'mfp'
  */
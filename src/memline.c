@@ -241,12 +241,18 @@ static int recov_file_names(char_u **, char_u *, int prepend_dot);
 static int ml_append_int(buf_T *, linenr_T, char_u *, colnr_T, int, int);
 static int ml_delete_int(buf_T *, linenr_T, int);
 static char_u *findswapname(buf_T *, char_u **, char_u *);
-static void ml_flush_line(buf_T *);
 static bhdr_T *ml_new_data(memfile_T *, int, int);
 static bhdr_T *ml_new_ptr(memfile_T *);
 static bhdr_T *ml_find_line(buf_T *, linenr_T, int);
+static bhdr_T *ml_cache_find(buf_T *, linenr_T);
+static void ml_cache_add(buf_T *, bhdr_T *);
 static int ml_add_stack(buf_T *);
 static void ml_lineadd(buf_T *, int);
+static int ml_splice_collect(memfile_T *, blocknr_T, garray_T *, garray_T *);
+static long ml_change_offset(buf_T *buf, linenr_T lnum);
+static long ml_lines_len(buf_T *buf, linenr_T first, linenr_T last);
+static void ml_record_lines(buf_T *buf, linenr_T start, linenr_T end, char_u **lines, int count);
+static void ml_record_replace(buf_T *buf, linenr_T lnum, char_u *old_line, char_u *new_line, long offset);
 static int b0_magic_wrong(ZERO_BL *);
 #ifdef CHECK_INODE
 static int fnamecmp_ino(char_u *, char_u *, long);
@@ -255,8 +261,16 @@ static void long_to_char(long, char_u *);
 static long char_to_long(char_u *);
 #ifdef FEAT_BYTEOFF
 static void ml_updatechunk(buf_T *buf, long line, long len, int updtype);
+static void ml_rebuild_chunks(buf_T *buf);
 #endif
 
+/*
+ * Changes are recorded for the bufferChangeCallback, except while
+ * ml_flush_line() moves a line to another block.
+ */
+static int ml_hold_changes = 0;
+#define ML_RECORD_CHANGES() (bufferChangeCallback != NULL && ml_hold_changes == 0)
+
 /*
  * Open a new memline for "buf".
  *
@@ -276,10 +290,13 @@ int ml_open(buf_T *buf)
   buf->b_ml.ml_stack_size = 0; /* no stack yet */
   buf->b_ml.ml_stack = NULL;   /* no stack yet */
   buf->b_ml.ml_stack_top = 0;  /* nothing in the stack */
+  buf->b_ml.ml_cache_len = 0;  /* no blocks found yet */
   buf->b_ml.ml_locked = NULL;  /* no cached block */
   buf->b_ml.ml_line_lnum = 0;  /* no cached line */
 #ifdef FEAT_BYTEOFF
   buf->b_ml.ml_chunksize = NULL;
+  buf->b_ml.ml_chunktree = NULL;
+  buf->b_ml.ml_chunktree_len = 0;
 #endif
 
   if (cmdmod.noswapfile)
@@ -470,6 +487,7 @@ void ml_set_crypt_key(
     buf->b_ml.ml_stack_top = 0;
     VIM_CLEAR(buf->b_ml.ml_stack);
     buf->b_ml.ml_stack_size = 0; /* no stack yet */
+    buf->b_ml.ml_cache_len = 0;
 
     for (; !got_int; line_breakcheck())
     {
@@ -771,6 +789,8 @@ void ml_close(buf_T *buf, int del_file)
   vim_free(buf->b_ml.ml_stack);
 #ifdef FEAT_BYTEOFF
   VIM_CLEAR(buf->b_ml.ml_chunksize);
+  VIM_CLEAR(buf->b_ml.ml_chunktree);
+  buf->b_ml.ml_chunktree_len = 0;
 #endif
   buf->b_ml.ml_mfp = NULL;
 
@@ -1085,6 +1105,7 @@ void ml_recover(int checkext)
   buf->b_ml.ml_stack_size = 0; /* no stack yet */
   buf->b_ml.ml_stack = NULL;   /* no stack yet */
   buf->b_ml.ml_stack_top = 0;  /* nothing in the stack */
+  buf->b_ml.ml_cache_len = 0;  /* no blocks found yet */
   buf->b_ml.ml_line_lnum = 0;  /* no cached line */
   buf->b_ml.ml_locked = NULL;  /* no locked block */
   buf->b_ml.ml_flags = 0;
@@ -1193,12 +1214,8 @@ void ml_recover(int checkext)
     mfp->mf_infile_count = mfp->mf_blocknr_max;
 
     /* need to reallocate the memory used to store the data */
-    p = alloc(mfp->mf_page_size);
-    if (p == NULL)
+    if (mf_resize_data(mfp, hp, previous_page_size) == FAIL)
       goto theend;
-    mch_memmove(p, hp->bh_data, previous_page_size);
-    vim_free(hp->bh_data);
-    hp->bh_data = p;
     b0p = (ZERO_BL *)(hp->bh_data);
   }
 
@@ -1278,6 +1295,7 @@ void ml_recover(int checkext)
   buf->b_ml.ml_stack_top = 0;
   buf->b_ml.ml_stack = NULL;
   buf->b_ml.ml_stack_size = 0; /* no stack yet */
+  buf->b_ml.ml_cache_len = 0;
 
   if (curbuf->b_ffname == NULL)
     cannot_open = TRUE;
@@ -2254,8 +2272,9 @@ void ml_preserve(buf_T *buf, int message)
   (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH); /* flush locked block */
   status = mf_sync(mfp, MFS_ALL | MFS_FLUSH);
 
-  /* stack is invalid after mf_sync(.., MFS_ALL) */
+  /* stack and cached blocks are invalid after mf_sync(.., MFS_ALL) */
   buf->b_ml.ml_stack_top = 0;
+  buf->b_ml.ml_cache_len = 0;
 
   /*
      * Some of the data blocks may have been changed from negative to
@@ -2288,6 +2307,7 @@ void ml_preserve(buf_T *buf, int message)
     if (mf_sync(mfp, MFS_ALL | MFS_FLUSH) == FAIL)
       status = FAIL;
     buf->b_ml.ml_stack_top = 0; /* stack is invalid now */
+    buf->b_ml.ml_cache_len = 0;
   }
 theend:
   got_int |= got_int_save;
@@ -2438,7 +2458,27 @@ ml_get_buf(
     buf->b_ml.ml_flags &= ~ML_LINE_DIRTY;
   }
   if (will_change)
+  {
     buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    /* The text is changed in place.  Change a copy, so that ml_flush_line()
+	 * can record the change when it puts it back. */
+    if (ML_RECORD_CHANGES() && !(buf->b_ml.ml_flags & ML_LINE_DIRTY))
+    {
+      char_u *copy = alloc(buf->b_ml.ml_line_len);
+
+      if (copy != NULL)
+      {
+        mch_memmove(copy, buf->b_ml.ml_line_ptr, (size_t)buf->b_ml.ml_line_len);
+        buf->b_ml.ml_line_ptr = copy;
+        buf->b_ml.ml_flags |= ML_LINE_DIRTY;
+      }
+    }
+#ifdef FEAT_BYTEOFF
+    /* The text is changed in place, the content hash of its chunk must be
+	 * computed again. */
+    ml_updatechunk(buf, buf->b_ml.ml_line_lnum, 0L, ML_CHNK_UPDLINE);
+#endif
+  }
 
   return buf->b_ml.ml_line_ptr;
 }
@@ -2452,6 +2492,631 @@ int ml_line_alloced(void)
   return (curbuf->b_ml.ml_flags & ML_LINE_DIRTY);
 }
 
+/*
+ * Call "func" for each line from "start" to "end" in "buf", in order, with a
+ * pointer to the text in the data block and its length without the NUL.
+ * Walks the data blocks one after the other instead of looking up every line.
+ * The text may not be changed and is only valid until "func" returns, "func"
+ * must not get or change lines of "buf".  Stops when "func" returns FALSE.
+ * Return FAIL when a block could not be found, OK otherwise.
+ */
+int ml_iter_lines(
+    buf_T *buf,
+    linenr_T start,
+    linenr_T end,
+    LineIterCallback func,
+    void *context)
+{
+  bhdr_T *hp;
+  DATA_BL *dp;
+  linenr_T lnum;
+  linenr_T last;
+  unsigned txt_start, txt_end;
+  int idx;
+
+  if (start < 1)
+    start = 1;
+  if (end > buf->b_ml.ml_line_count)
+    end = buf->b_ml.ml_line_count;
+
+  if (buf->b_ml.ml_mfp == NULL) // there are no lines
+  {
+    if (start <= end)
+      func(context, 1, (char_u *)"", 0);
+    return OK;
+  }
+
+  // A changed line may still be in allocated memory
+  ml_flush_line(buf);
+
+  for (lnum = start; lnum <= end;)
+  {
+    if ((hp = ml_find_line(buf, lnum, ML_FIND)) == NULL)
+    {
+      siemsg(_("E316: ml_get: cannot find line %ld"), lnum);
+      return FAIL;
+    }
+    dp = (DATA_BL *)(hp->bh_data);
+
+    last = buf->b_ml.ml_locked_high;
+    if (last > end)
+      last = end;
+    for (idx = lnum - buf->b_ml.ml_locked_low; lnum <= last; ++lnum, ++idx)
+    {
+      txt_start = (dp->db_index[idx] & DB_INDEX_MASK);
+      if (idx == 0)
+        txt_end = dp->db_txt_end;
+      else
+        txt_end = (dp->db_index[idx - 1] & DB_INDEX_MASK);
+
+      if (!func(context, lnum, (char_u *)dp + txt_start,
+                (size_t)(txt_end - txt_start - 1)))
+        return OK;
+    }
+  }
+  return OK;
+}
+
+/*
+ * Like ml_iter_lines(), but the data blocks stay locked in memory after
+ * "func" returns, so that the text can still be used, e.g. for writev().
+ * When "max_blocks" blocks are locked, and at the end, "func" is called with
+ * "lnum" zero and "line" NULL, after that the text it got before is no longer
+ * valid.  That call is not made when "func" stopped the walk, when it returns
+ * FALSE the walk stops.
+ * Return FAIL when a block could not be found or "func" returned FALSE for
+ * the call with "lnum" zero, OK otherwise.
+ */
+int ml_gather_lines(
+    buf_T *buf,
+    linenr_T start,
+    linenr_T end,
+    int max_blocks,
+    LineIterCallback func,
+    void *context)
+{
+  bhdr_T **locked;
+  int *locked_flags;
+  int locked_count = 0;
+  bhdr_T *hp;
+  DATA_BL *dp;
+  linenr_T lnum;
+  linenr_T last;
+  unsigned txt_start, txt_end;
+  int idx;
+  int i;
+  int stopped = FALSE;
+  int retval = OK;
+
+  if (start < 1)
+    start = 1;
+  if (end > buf->b_ml.ml_line_count)
+    end = buf->b_ml.ml_line_count;
+
+  if (buf->b_ml.ml_mfp == NULL) // there are no lines
+  {
+    if (start <= end && func(context, 1, (char_u *)"", 0) && !func(context, 0, NULL, 0))
+      return FAIL;
+    return OK;
+  }
+
+  locked = ALLOC_MULT(bhdr_T *, max_blocks);
+  locked_flags = ALLOC_MULT(int, max_blocks);
+  if (locked == NULL || locked_flags == NULL)
+  {
+    vim_free(locked);
+    vim_free(locked_flags);
+    return FAIL;
+  }
+
+  // A changed line may still be in allocated memory
+  ml_flush_line(buf);
+
+  for (lnum = start; lnum <= end && !stopped;)
+  {
+    if ((hp = ml_find_line(buf, lnum, ML_FIND)) == NULL)
+    {
+      siemsg(_("E316: ml_get: cannot find line %ld"), lnum);
+      retval = FAIL;
+      break;
+    }
+    dp = (DATA_BL *)(hp->bh_data);
+
+    last = buf->b_ml.ml_locked_high;
+    if (last > end)
+      last = end;
+    for (idx = lnum - buf->b_ml.ml_locked_low; lnum <= last; ++lnum, ++idx)
+    {
+      txt_start = (dp->db_index[idx] & DB_INDEX_MASK);
+      if (idx == 0)
+        txt_end = dp->db_txt_end;
+      else
+        txt_end = (dp->db_index[idx - 1] & DB_INDEX_MASK);
+
+      if (!func(context, lnum, (char_u *)dp + txt_start,
+                (size_t)(txt_end - txt_start - 1)))
+      {
+        stopped = TRUE;
+        break;
+      }
+    }
+
+    // Take over the lock from the memline, like ml_find_line() does when
+    // releasing the block, so that finding the next block keeps it.
+    locked[locked_count] = hp;
+    locked_flags[locked_count++] = buf->b_ml.ml_flags & (ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    buf->b_ml.ml_locked = NULL;
+    buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    if (buf->b_ml.ml_locked_lineadd != 0)
+      ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
+
+    if (locked_count == max_blocks || lnum > end || stopped)
+    {
+      if (!stopped && !func(context, 0, NULL, 0))
+      {
+        stopped = TRUE;
+        retval = FAIL;
+      }
+      for (i = 0; i < locked_count; ++i)
+        mf_put(buf->b_ml.ml_mfp, locked[i], locked_flags[i] & ML_LOCKED_DIRTY,
+               locked_flags[i] & ML_LOCKED_POS);
+      locked_count = 0;
+    }
+  }
+
+  // After a block was not found
+  for (i = 0; i < locked_count; ++i)
+    mf_put(buf->b_ml.ml_mfp, locked[i], locked_flags[i] & ML_LOCKED_DIRTY,
+           locked_flags[i] & ML_LOCKED_POS);
+  vim_free(locked);
+  vim_free(locked_flags);
+  return retval;
+}
+
+/*
+ * The reference count of a snapshot block is changed by the thread that edits
+ * the buffer and by threads that release snapshots.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SNAP_REF_ADD(sb, n) __atomic_add_fetch(&(sb)->sb_refcount, (n), __ATOMIC_ACQ_REL)
+#elif defined(MSWIN)
+#define SNAP_REF_ADD(sb, n) (InterlockedExchangeAdd((volatile LONG *)&(sb)->sb_refcount, (n)) + (n))
+#else
+#define SNAP_REF_ADD(sb, n) ((sb)->sb_refcount += (n))
+#endif
+
+/*
+ * Make a read-only copy of the text of data block "dp".
+ */
+static snapblock_T *
+ml_snapblock_new(DATA_BL *dp)
+{
+  snapblock_T *sb;
+  int count = dp->db_line_count;
+  unsigned text_len = dp->db_txt_end - dp->db_txt_start;
+  int i;
+
+  sb = (snapblock_T *)alloc(sizeof(snapblock_T) + count * sizeof(unsigned) + text_len);
+  if (sb == NULL)
+    return NULL;
+  sb->sb_refcount = 1;
+  sb->sb_line_count = count;
+  sb->sb_index = (unsigned *)(sb + 1);
+  sb->sb_text = (char_u *)(sb->sb_index + count);
+  sb->sb_text_len = text_len;
+  for (i = 0; i < count; ++i)
+    sb->sb_index[i] = (dp->db_index[i] & DB_INDEX_MASK) - dp->db_txt_start;
+  mch_memmove(sb->sb_text, (char_u *)dp + dp->db_txt_start, text_len);
+  return sb;
+}
+
+/*
+ * Let go of snapshot block "sb", free it when nothing else uses it.  May be
+ * called from any thread.
+ */
+void ml_snapblock_unref(snapblock_T *sb)
+{
+  if (SNAP_REF_ADD(sb, -1) == 0)
+    vim_free(sb);
+}
+
+/*
+ * Take a snapshot of the lines of "buf".  Blocks that did not change since
+ * the previous snapshot are shared with it, others are copied.  Must be
+ * called from the thread that edits the buffer, the snapshot can then be
+ * read from any thread until ml_snapshot_free() is called.
+ * Returns NULL when out of memory or a block could not be read.
+ */
+snapshot_T *
+ml_snapshot(buf_T *buf)
+{
+  memfile_T *mfp = buf->b_ml.ml_mfp;
+  snapshot_T *ss;
+  garray_T leaves;
+  garray_T ptrs;
+  PTR_EN *pe;
+  bhdr_T *hp;
+  linenr_T lnum = 0;
+  int idx;
+
+  if ((ss = ALLOC_CLEAR_ONE(snapshot_T)) == NULL)
+    return NULL;
+  ss->ss_line_count = buf->b_ml.ml_line_count;
+  if (mfp == NULL) /* there are no lines */
+  {
+    ss->ss_line_count = 1;
+    return ss;
+  }
+
+  /* Changes to the cached line and the locked block must be in the blocks,
+     * this also clears the copies of the blocks that changed. */
+  ml_flush_line(buf);
+  ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+  buf->b_ml.ml_cache_len = 0; /* block numbers may be translated */
+
+  ga_init2(&leaves, (int)sizeof(PTR_EN), 100);
+  ga_init2(&ptrs, (int)sizeof(blocknr_T), 20);
+  if (ml_splice_collect(mfp, (blocknr_T)1, &leaves, &ptrs) == FAIL)
+    goto fail;
+
+  ss->ss_blocks = ALLOC_CLEAR_MULT(snapblock_T *, leaves.ga_len);
+  ss->ss_last = ALLOC_MULT(linenr_T, leaves.ga_len);
+  if (ss->ss_blocks == NULL || ss->ss_last == NULL)
+    goto fail;
+
+  for (idx = 0; idx < leaves.ga_len; ++idx)
+  {
+    pe = (PTR_EN *)leaves.ga_data + idx;
+    if ((hp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+      goto fail;
+    if (hp->bh_snap == NULL)
+      hp->bh_snap = ml_snapblock_new((DATA_BL *)(hp->bh_data));
+    if (hp->bh_snap != NULL)
+      SNAP_REF_ADD(hp->bh_snap, 1);
+    ss->ss_blocks[idx] = hp->bh_snap;
+    mf_put(mfp, hp, FALSE, FALSE);
+    if (ss->ss_blocks[idx] == NULL)
+      goto fail;
+    ++ss->ss_block_count;
+
+    lnum += ss->ss_blocks[idx]->sb_line_count;
+    ss->ss_last[idx] = lnum;
+  }
+  ga_clear(&leaves);
+  ga_clear(&ptrs);
+  return ss;
+
+fail:
+  ga_clear(&leaves);
+  ga_clear(&ptrs);
+  ml_snapshot_free(ss);
+  return NULL;
+}
+
+/*
+ * Free snapshot "ss".  May be called from any thread.
+ */
+void ml_snapshot_free(snapshot_T *ss)
+{
+  int idx;
+
+  if (ss == NULL)
+    return;
+  for (idx = 0; idx < ss->ss_block_count; ++idx)
+    ml_snapblock_unref(ss->ss_blocks[idx]);
+  vim_free(ss->ss_blocks);
+  vim_free(ss->ss_last);
+  vim_free(ss);
+}
+
+/*
+ * Return the index of the block of snapshot "ss" with line "lnum".
+ */
+static int
+ml_snapshot_find_block(snapshot_T *ss, linenr_T lnum)
+{
+  int lo = 0;
+  int hi = ss->ss_block_count - 1;
+  int mid;
+
+  /* find the first block that ends at or after "lnum" */
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (ss->ss_last[mid] < lnum)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * Get line "lnum" of snapshot "ss" and its length without the NUL in
+ * "*lenp", when not NULL.  May be called from any thread.
+ * Returns NULL when "lnum" is invalid.
+ */
+char_u *
+ml_snapshot_get_line(snapshot_T *ss, linenr_T lnum, size_t *lenp)
+{
+  snapblock_T *sb;
+  int block;
+  int idx;
+  unsigned end;
+
+  if (lnum < 1 || lnum > ss->ss_line_count)
+    return NULL;
+  if (ss->ss_block_count == 0)
+  {
+    if (lenp != NULL)
+      *lenp = 0;
+    return (char_u *)"";
+  }
+
+  block = ml_snapshot_find_block(ss, lnum);
+  sb = ss->ss_blocks[block];
+  idx = lnum - (ss->ss_last[block] - sb->sb_line_count) - 1;
+  end = idx == 0 ? sb->sb_text_len : sb->sb_index[idx - 1];
+  if (lenp != NULL)
+    *lenp = end - sb->sb_index[idx] - 1;
+  return sb->sb_text + sb->sb_index[idx];
+}
+
+/*
+ * Like ml_iter_lines() for snapshot "ss".  May be called from any thread.
+ */
+void ml_snapshot_iter_lines(
+    snapshot_T *ss,
+    linenr_T start,
+    linenr_T end,
+    LineIterCallback func,
+    void *context)
+{
+  snapblock_T *sb;
+  linenr_T lnum;
+  int block;
+  int idx;
+  unsigned txt_end;
+
+  if (start < 1)
+    start = 1;
+  if (end > ss->ss_line_count)
+    end = ss->ss_line_count;
+  if (start > end)
+    return;
+
+  if (ss->ss_block_count == 0)
+  {
+    func(context, 1, (char_u *)"", 0);
+    return;
+  }
+
+  /* Find the block of the first line, then go through the blocks in order */
+  block = ml_snapshot_find_block(ss, start);
+  for (lnum = start; lnum <= end; ++block)
+  {
+    sb = ss->ss_blocks[block];
+    for (idx = lnum - (ss->ss_last[block] - sb->sb_line_count) - 1;
+         idx < sb->sb_line_count && lnum <= end; ++idx, ++lnum)
+    {
+      txt_end = idx == 0 ? sb->sb_text_len : sb->sb_index[idx - 1];
+      if (!func(context, lnum, sb->sb_text + sb->sb_index[idx],
+                (size_t)(txt_end - sb->sb_index[idx] - 1)))
+        return;
+    }
+  }
+}
+
+/*
+ * Return the byte offset of line "lnum" in "buf", counting one byte for a
+ * line break.  "lnum" must be a valid line number.
+ * Returns -1 when not available.
+ */
+static long
+ml_change_offset(buf_T *buf, linenr_T lnum)
+{
+  long offset;
+
+  if (lnum <= 1)
+    return 0L;
+  offset = ml_find_line_or_offset(buf, lnum, NULL);
+  if (offset > 0 && get_fileformat(buf) == EOL_DOS)
+    offset -= lnum - 1;
+  return offset;
+}
+
+/*
+ * Return the number of bytes in lines "first" to "last", each with a line
+ * break.
+ */
+static long
+ml_lines_len(buf_T *buf, linenr_T first, linenr_T last)
+{
+  long start;
+  long end = -1;
+  long len = 0;
+  linenr_T lnum;
+
+  if (first > last)
+    return 0L;
+  start = ml_change_offset(buf, first);
+  if (last < buf->b_ml.ml_line_count)
+    end = ml_change_offset(buf, last + 1);
+  else if ((end = ml_change_offset(buf, last)) >= 0)
+    end += (long)STRLEN(ml_get_buf(buf, last, FALSE)) + 1;
+  if (start >= 0 && end >= 0)
+    return end - start;
+
+  for (lnum = first; lnum <= last; ++lnum)
+    len += (long)STRLEN(ml_get_buf(buf, lnum, FALSE)) + 1;
+  return len;
+}
+
+/*
+ * Record that lines "start + 1" to "end" of "buf" are about to be replaced
+ * with the "count" lines in "lines".  Must be called before changing the
+ * text.
+ */
+static void
+ml_record_lines(
+    buf_T *buf,
+    linenr_T start,
+    linenr_T end,
+    char_u **lines,
+    int count)
+{
+  linenr_T line_count = buf->b_ml.ml_line_count;
+  linenr_T lnum;
+  linenr_T end_lnum;
+  colnr_T col;
+  colnr_T end_col;
+  long offset;
+  long old_len;
+  garray_T ga;
+  int i;
+
+  ga_init2(&ga, 1, 200);
+  if (end < line_count)
+  {
+    /* The text up to the start of line "end + 1" is replaced, each new line
+     * ends in a line break. */
+    lnum = start + 1;
+    col = 0;
+    end_lnum = end + 1;
+    end_col = 0;
+    offset = ml_change_offset(buf, lnum);
+    old_len = ml_lines_len(buf, start + 1, end);
+    for (i = 0; i < count; ++i)
+    {
+      ga_concat(&ga, lines[i]);
+      ga_append(&ga, NL);
+    }
+  }
+  else if (start > 0)
+  {
+    /* The text after line "start" is replaced, each new line starts with a
+     * line break. */
+    lnum = start;
+    col = (colnr_T)STRLEN(ml_get_buf(buf, start, FALSE));
+    end_lnum = end;
+    end_col = (colnr_T)STRLEN(ml_get_buf(buf, end, FALSE));
+    offset = ml_change_offset(buf, lnum);
+    if (offset >= 0)
+      offset += col;
+    old_len = ml_lines_len(buf, start + 1, end);
+    for (i = 0; i < count; ++i)
+    {
+      ga_append(&ga, NL);
+      ga_concat(&ga, lines[i]);
+    }
+  }
+  else
+  {
+    /* All the text is replaced, there is no line break after the last
+     * line. */
+    lnum = 1;
+    col = 0;
+    end_lnum = line_count;
+    end_col = (colnr_T)STRLEN(ml_get_buf(buf, line_count, FALSE));
+    offset = 0;
+    old_len = ml_lines_len(buf, 1, line_count) - 1;
+    for (i = 0; i < count; ++i)
+    {
+      if (i > 0)
+        ga_append(&ga, NL);
+      ga_concat(&ga, lines[i]);
+    }
+  }
+  ga_append(&ga, NUL);
+
+  buf_record_change(buf, lnum, col, end_lnum, end_col, offset, old_len,
+                    (char_u *)ga.ga_data, (long)ga.ga_len - 1);
+}
+
+/*
+ * Record that "count" lines were appended below line "lnum" of "buf" without
+ * recording them, e.g. when more of the file was read.
+ */
+void ml_record_appended(buf_T *buf, linenr_T lnum, linenr_T count)
+{
+  int at_end = lnum + count >= buf->b_ml.ml_line_count && lnum > 0;
+  colnr_T col = 0;
+  long offset;
+  garray_T ga;
+  linenr_T i;
+
+  if (!ML_RECORD_CHANGES() || count <= 0)
+    return;
+
+  ga_init2(&ga, 1, 200);
+  for (i = 1; i <= count; ++i)
+  {
+    if (at_end)
+      ga_append(&ga, NL);
+    ga_concat(&ga, ml_get_buf(buf, lnum + i, FALSE));
+    if (!at_end)
+      ga_append(&ga, NL);
+  }
+  ga_append(&ga, NUL);
+
+  if (at_end)
+  {
+    /* Appended after the last line: starts with a line break. */
+    col = (colnr_T)STRLEN(ml_get_buf(buf, lnum, FALSE));
+    offset = ml_change_offset(buf, lnum);
+  }
+  else
+  {
+    ++lnum;
+    offset = ml_change_offset(buf, lnum);
+  }
+  if (offset >= 0)
+    offset += col;
+  buf_record_change(buf, lnum, col, lnum, col, offset, 0L,
+                    (char_u *)ga.ga_data, (long)ga.ga_len - 1);
+}
+
+/*
+ * Record that line "lnum" of "buf" changes from "old_line" to "new_line".
+ * Only the part that differs is recorded.  "offset" is the byte offset of the
+ * line or -1.
+ */
+static void
+ml_record_replace(
+    buf_T *buf,
+    linenr_T lnum,
+    char_u *old_line,
+    char_u *new_line,
+    long offset)
+{
+  size_t old_len = STRLEN(old_line);
+  size_t new_len = STRLEN(new_line);
+  size_t pre = 0;
+  size_t suf = 0;
+  size_t len;
+
+  while (pre < old_len && pre < new_len && old_line[pre] == new_line[pre])
+    ++pre;
+  if (pre == old_len && pre == new_len)
+    return; /* not changed */
+  while (suf < old_len - pre && suf < new_len - pre && old_line[old_len - 1 - suf] == new_line[new_len - 1 - suf])
+    ++suf;
+
+  /* Don't split a multi-byte character. */
+  if (has_mbyte)
+  {
+    pre -= (*mb_head_off)(old_line, old_line + pre);
+    while (suf > 0 && ((*mb_head_off)(old_line, old_line + old_len - suf) != 0 || (*mb_head_off)(new_line, new_line + new_len - suf) != 0))
+      --suf;
+  }
+
+  len = new_len - pre - suf;
+  buf_record_change(buf, lnum, (colnr_T)pre, lnum, (colnr_T)(old_len - suf),
+                    offset < 0 ? -1L : offset + (long)pre,
+                    (long)(old_len - pre - suf),
+                    vim_strnsave(new_line + pre, (int)len), (long)len);
+}
+
 /*
  * Append a line after lnum (may be 0 to insert a line in front of the file).
  * "line" does not need to be allocated, but can't be another line in a
@@ -2540,6 +3205,8 @@ ml_append_int(
   // the text.
   may_invoke_listeners(buf, lnum + 1, lnum + 1, 1);
 #endif
+  if (!newfile && ML_RECORD_CHANGES())
+    ml_record_lines(buf, lnum, lnum, &line, 1);
 
   space_needed = len + INDEX_SIZE; // space needed for text + index
 
@@ -3138,6 +3805,8 @@ ml_delete_int(buf_T *buf, linenr_T lnum, int message)
 
     return i;
   }
+  if (ML_RECORD_CHANGES())
+    ml_record_lines(buf, lnum - 1, lnum, NULL, 0);
 
   /*
  * Find the data block containing the line.
@@ -3253,10 +3922,616 @@ theend:
 }
 
 /*
- * set the DB_MARKED flag for line 'lnum'
+ * Below this number of appended plus deleted lines ml_splice_buf() works line
+ * by line, walking the whole tree is more expensive then.
  */
-void ml_setmarked(linenr_T lnum)
-{
+#define ML_SPLICE_MIN 100
+
+/*
+ * State used by ml_splice_buf() to pack lines into new data blocks.
+ */
+typedef struct
+{
+  memfile_T *sp_mfp;
+  garray_T sp_leaves; /* PTR_EN for every data block, in line order */
+  bhdr_T *sp_hp;      /* data block being filled, NULL if none */
+  linenr_T sp_lnum;   /* line number the next line will get */
+} splice_T;
+
+/*
+ * Release the data block that is being filled by ml_splice_buf() and add it
+ * to the list of data blocks.
+ */
+static int
+ml_splice_close(splice_T *sp)
+{
+  DATA_BL *dp;
+  PTR_EN *pe;
+
+  if (sp->sp_hp == NULL)
+    return OK;
+  if (ga_grow(&sp->sp_leaves, 1) == FAIL)
+    return FAIL;
+  dp = (DATA_BL *)(sp->sp_hp->bh_data);
+  pe = (PTR_EN *)sp->sp_leaves.ga_data + sp->sp_leaves.ga_len++;
+  pe->pe_bnum = sp->sp_hp->bh_bnum;
+  pe->pe_line_count = dp->db_line_count;
+  pe->pe_old_lnum = sp->sp_lnum - dp->db_line_count;
+  pe->pe_page_count = sp->sp_hp->bh_page_count;
+  mf_put(sp->sp_mfp, sp->sp_hp, TRUE, FALSE);
+  sp->sp_hp = NULL;
+  return OK;
+}
+
+/*
+ * Add an existing data block, that is not changed, to the list of data blocks
+ * of ml_splice_buf().
+ */
+static int
+ml_splice_keep(splice_T *sp, PTR_EN *old)
+{
+  if (ml_splice_close(sp) == FAIL || ga_grow(&sp->sp_leaves, 1) == FAIL)
+    return FAIL;
+  ((PTR_EN *)sp->sp_leaves.ga_data)[sp->sp_leaves.ga_len++] = *old;
+  sp->sp_lnum += old->pe_line_count;
+  return OK;
+}
+
+/*
+ * Append line "line" with length "len" (including NUL) at the end of the
+ * data block that ml_splice_buf() is filling.  Starts a new data block when
+ * it does not fit.  "mark" is the DB_MARKED flag to keep.
+ */
+static int
+ml_splice_add(splice_T *sp, char_u *line, colnr_T len, unsigned mark)
+{
+  DATA_BL *dp;
+  int page_size = sp->sp_mfp->mf_page_size;
+
+  if (sp->sp_hp != NULL && (int)((DATA_BL *)(sp->sp_hp->bh_data))->db_free < len + (int)INDEX_SIZE)
+    if (ml_splice_close(sp) == FAIL)
+      return FAIL;
+  if (sp->sp_hp == NULL)
+  {
+    sp->sp_hp = ml_new_data(sp->sp_mfp, FALSE,
+                            (len + INDEX_SIZE + HEADER_SIZE + page_size - 1) / page_size);
+    if (sp->sp_hp == NULL)
+      return FAIL;
+  }
+
+  dp = (DATA_BL *)(sp->sp_hp->bh_data);
+  dp->db_txt_start -= len;
+  dp->db_free -= len + INDEX_SIZE;
+  dp->db_index[dp->db_line_count++] = dp->db_txt_start | mark;
+  mch_memmove((char *)dp + dp->db_txt_start, line, (size_t)len);
+  ++sp->sp_lnum;
+  return OK;
+}
+
+/*
+ * Append the "count" new lines in "lines" for ml_splice_buf().
+ */
+static int
+ml_splice_add_lines(splice_T *sp, char_u **lines, int count)
+{
+  int i;
+
+  for (i = 0; i < count; ++i)
+    if (ml_splice_add(sp, lines[i], (colnr_T)STRLEN(lines[i]) + 1, 0) == FAIL)
+      return FAIL;
+  return OK;
+}
+
+/*
+ * Collect the data blocks below pointer block "bnum" into "leaves" and the
+ * pointer blocks, other than the root, into "ptrs".
+ */
+static int
+ml_splice_collect(memfile_T *mfp, blocknr_T bnum, garray_T *leaves, garray_T *ptrs)
+{
+  bhdr_T *hp;
+  bhdr_T *child;
+  PTR_BL *pp;
+  PTR_EN *pe;
+  int idx;
+  int ret = OK;
+  int dirty = FALSE;
+
+  if ((hp = mf_get(mfp, bnum, 1)) == NULL)
+    return FAIL;
+  pp = (PTR_BL *)(hp->bh_data);
+  if (pp->pb_id != PTR_ID)
+  {
+    iemsg(_("E317: pointer block id wrong"));
+    mf_put(mfp, hp, FALSE, FALSE);
+    return FAIL;
+  }
+  if (bnum != 1)
+  {
+    if (ga_grow(ptrs, 1) == FAIL)
+      ret = FAIL;
+    else
+      ((blocknr_T *)ptrs->ga_data)[ptrs->ga_len++] = bnum;
+  }
+
+  for (idx = 0; ret == OK && idx < (int)pp->pb_count; ++idx)
+  {
+    pe = &pp->pb_pointer[idx];
+    if (pe->pe_bnum < 0)
+    {
+      /* The translation is gone, the pointer block must be written */
+      blocknr_T bnum = mf_trans_del(mfp, pe->pe_bnum);
+
+      if (bnum != pe->pe_bnum)
+      {
+        pe->pe_bnum = bnum;
+        dirty = TRUE;
+      }
+    }
+#ifdef FEAT_MMAP_FILE
+    /* A block of the mapped file is a data block, don't copy it now. */
+    if (mf_is_mapped(mfp, pe->pe_bnum))
+    {
+      if (ga_grow(leaves, 1) == FAIL)
+        ret = FAIL;
+      else
+        ((PTR_EN *)leaves->ga_data)[leaves->ga_len++] = *pe;
+      continue;
+    }
+#endif
+    if ((child = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+    {
+      ret = FAIL;
+      break;
+    }
+    if (((DATA_BL *)(child->bh_data))->db_id == DATA_ID)
+    {
+      mf_put(mfp, child, FALSE, FALSE);
+      if (ga_grow(leaves, 1) == FAIL)
+        ret = FAIL;
+      else
+        ((PTR_EN *)leaves->ga_data)[leaves->ga_len++] = *pe;
+    }
+    else
+    {
+      mf_put(mfp, child, FALSE, FALSE);
+      ret = ml_splice_collect(mfp, pe->pe_bnum, leaves, ptrs);
+    }
+  }
+  mf_put(mfp, hp, dirty, FALSE);
+  return ret;
+}
+
+/*
+ * Build the pointer blocks on top of the data blocks in "leaves" and put the
+ * top level in the root pointer block.
+ */
+static int
+ml_splice_tree(memfile_T *mfp, garray_T *leaves)
+{
+  garray_T level;
+  garray_T upper;
+  bhdr_T *hp;
+  PTR_BL *pp;
+  PTR_EN *pe;
+  int max;
+  int idx;
+  int i;
+
+  if ((hp = mf_get(mfp, 1, 1)) == NULL)
+    return FAIL;
+  pp = (PTR_BL *)(hp->bh_data);
+  max = pp->pb_count_max;
+
+  level = *leaves;
+  ga_init2(leaves, (int)sizeof(PTR_EN), 100);
+  while (level.ga_len > max)
+  {
+    /* Not all entries fit in the root: add a level of pointer blocks. */
+    ga_init2(&upper, (int)sizeof(PTR_EN), 100);
+    for (idx = 0; idx < level.ga_len; idx += max)
+    {
+      bhdr_T *hp_new;
+      PTR_BL *pp_new;
+
+      if ((hp_new = ml_new_ptr(mfp)) == NULL || ga_grow(&upper, 1) == FAIL)
+      {
+        if (hp_new != NULL)
+          mf_put(mfp, hp_new, TRUE, FALSE);
+        ga_clear(&upper);
+        ga_clear(&level);
+        mf_put(mfp, hp, FALSE, FALSE);
+        return FAIL;
+      }
+      pp_new = (PTR_BL *)(hp_new->bh_data);
+      pp_new->pb_count = level.ga_len - idx < max ? level.ga_len - idx : max;
+      mch_memmove(pp_new->pb_pointer, (PTR_EN *)level.ga_data + idx,
+                  (size_t)pp_new->pb_count * sizeof(PTR_EN));
+
+      pe = (PTR_EN *)upper.ga_data + upper.ga_len++;
+      pe->pe_bnum = hp_new->bh_bnum;
+      pe->pe_old_lnum = pp_new->pb_pointer[0].pe_old_lnum;
+      pe->pe_page_count = 1;
+      pe->pe_line_count = 0;
+      for (i = 0; i < (int)pp_new->pb_count; ++i)
+        pe->pe_line_count += pp_new->pb_pointer[i].pe_line_count;
+      mf_put(mfp, hp_new, TRUE, FALSE);
+    }
+    ga_clear(&level);
+    level = upper;
+  }
+
+  pp->pb_count = level.ga_len;
+  mch_memmove(pp->pb_pointer, level.ga_data,
+              (size_t)level.ga_len * sizeof(PTR_EN));
+  mf_put(mfp, hp, TRUE, FALSE);
+  ga_clear(&level);
+  return OK;
+}
+
+/*
+ * Replace lines "start + 1" to "end" in buffer "buf" with the "count" lines
+ * in "lines".  "start" may be 0 to insert in front of the first line and
+ * "end" may be equal to "start" to only insert, an "end" past the last line
+ * is the last line.
+ *
+ * For many lines this does not append and delete the lines one by one: the
+ * new lines are packed into new data blocks, data blocks outside of the
+ * changed lines are kept as they are and the pointer blocks are rebuilt once.
+ *
+ * Check: The caller of this function should probably also call
+ * changed_lines_buf().
+ *
+ * return FAIL for failure, OK otherwise
+ */
+int ml_splice_buf(
+    buf_T *buf,
+    linenr_T start,
+    linenr_T end,
+    char_u **lines,
+    int count)
+{
+  memfile_T *mfp = buf->b_ml.ml_mfp;
+  splice_T sp;
+  garray_T old_leaves;
+  garray_T old_ptrs;
+  PTR_EN *pe;
+  bhdr_T *hp;
+  DATA_BL *dp;
+  linenr_T low;
+  linenr_T lnum;
+  int inserted = FALSE;
+  int idx;
+  int i;
+  unsigned from, to;
+  int ret = FAIL;
+
+  if (end > buf->b_ml.ml_line_count)
+    end = buf->b_ml.ml_line_count;
+  if (mfp == NULL || start < 0 || start > buf->b_ml.ml_line_count)
+    return FAIL;
+  if (end < start)
+    end = start;
+
+  if (count + (end - start) < ML_SPLICE_MIN)
+  {
+    /* Append first, because ml_delete_int() cannot delete the last line. */
+    ml_flush_line(buf);
+    for (i = count - 1; i >= 0; --i)
+      if (ml_append_int(buf, start, lines[i], (colnr_T)0, FALSE, FALSE) == FAIL)
+        return FAIL;
+    for (lnum = start; lnum < end; ++lnum)
+      if (ml_delete_int(buf, start + count + 1, FALSE) == FAIL)
+        return FAIL;
+    return OK;
+  }
+
+#ifdef FEAT_EVAL
+  may_invoke_listeners(buf, start + 1, end + 1, count - (end - start));
+#endif
+  if (ML_RECORD_CHANGES())
+    ml_record_lines(buf, start, end, lines, count);
+  if (lowest_marked && lowest_marked > start)
+    lowest_marked = start + 1;
+
+  /* Flush the cached line and release the locked block. */
+  ml_flush_line(buf);
+  ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+  buf->b_ml.ml_stack_top = 0;
+  buf->b_ml.ml_cache_len = 0;
+
+  ga_init2(&old_leaves, (int)sizeof(PTR_EN), 100);
+  ga_init2(&old_ptrs, (int)sizeof(blocknr_T), 20);
+  sp.sp_mfp = mfp;
+  ga_init2(&sp.sp_leaves, (int)sizeof(PTR_EN), 100);
+  sp.sp_hp = NULL;
+  sp.sp_lnum = 1;
+
+  if (ml_splice_collect(mfp, (blocknr_T)1, &old_leaves, &old_ptrs) == FAIL)
+    goto theend;
+
+  low = 1;
+  for (idx = 0; idx < old_leaves.ga_len; ++idx)
+  {
+    pe = (PTR_EN *)old_leaves.ga_data + idx;
+
+    if (!inserted && low > start)
+    {
+      if (ml_splice_add_lines(&sp, lines, count) == FAIL)
+        goto theend;
+      inserted = TRUE;
+    }
+
+    /* Data blocks before and after the changed lines are kept. */
+    if (low + pe->pe_line_count - 1 <= start || (inserted && low > end))
+    {
+      if (ml_splice_keep(&sp, pe) == FAIL)
+        goto theend;
+      low += pe->pe_line_count;
+      continue;
+    }
+
+    /* Copy the lines that remain in this block and drop the block. */
+    if ((hp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+      goto theend;
+    dp = (DATA_BL *)(hp->bh_data);
+    for (i = 0; i < (int)dp->db_line_count; ++i)
+    {
+      lnum = low + i;
+      if (!inserted && lnum > start)
+      {
+        if (ml_splice_add_lines(&sp, lines, count) == FAIL)
+        {
+          mf_put(mfp, hp, FALSE, FALSE);
+          goto theend;
+        }
+        inserted = TRUE;
+      }
+      if (lnum <= start || lnum > end)
+      {
+        from = dp->db_index[i] & DB_INDEX_MASK;
+        to = i == 0 ? dp->db_txt_end : (dp->db_index[i - 1] & DB_INDEX_MASK);
+        if (ml_splice_add(&sp, (char_u *)dp + from, (colnr_T)(to - from),
+                          dp->db_index[i] & DB_MARKED) == FAIL)
+        {
+          mf_put(mfp, hp, FALSE, FALSE);
+          goto theend;
+        }
+      }
+    }
+    low += pe->pe_line_count;
+    mf_free(mfp, hp);
+  }
+
+  /* Appending after the last line, or the buffer becomes empty. */
+  if (!inserted && ml_splice_add_lines(&sp, lines, count) == FAIL)
+    goto theend;
+  if (sp.sp_lnum == 1)
+  {
+    if (ml_splice_add(&sp, (char_u *)"", (colnr_T)1, 0) == FAIL)
+      goto theend;
+    buf->b_ml.ml_flags |= ML_EMPTY;
+  }
+  else if (count > 0)
+    buf->b_ml.ml_flags &= ~ML_EMPTY;
+  if (ml_splice_close(&sp) == FAIL)
+    goto theend;
+  buf->b_ml.ml_line_count = sp.sp_lnum - 1;
+
+  if (ml_splice_tree(mfp, &sp.sp_leaves) == FAIL)
+    goto theend;
+  for (idx = 0; idx < old_ptrs.ga_len; ++idx)
+    if ((hp = mf_get(mfp, ((blocknr_T *)old_ptrs.ga_data)[idx], 1)) != NULL)
+      mf_free(mfp, hp);
+
+#ifdef FEAT_BYTEOFF
+  ml_rebuild_chunks(buf);
+#endif
+#ifdef FEAT_JOB_CHANNEL
+  if (buf->b_write_to_channel)
+    channel_write_new_lines(buf);
+#endif
+  ret = OK;
+
+theend:
+  if (sp.sp_hp != NULL)
+    mf_put(mfp, sp.sp_hp, TRUE, FALSE);
+  ga_clear(&sp.sp_leaves);
+  ga_clear(&old_leaves);
+  ga_clear(&old_ptrs);
+  return ret;
+}
+
+#ifdef FEAT_MMAP_FILE
+/*
+ * Use the text of the file mapped at "addr" with "size" bytes for the lines
+ * of the empty buffer "buf", in front of its empty line.  The text in
+ * "fileformat" is only scanned to count the lines that go into each data
+ * block, the blocks are filled by ml_fill_mapped() when they are used.
+ *
+ * On success the memfile takes over the mapping.  Returns the number of
+ * lines, zero when the text can't be used: a line without a CR in a DOS
+ * file, a very long line or out of memory.
+ */
+linenr_T
+ml_open_mapped(buf_T *buf, char_u *addr, size_t size, int fileformat)
+{
+  memfile_T *mfp = buf->b_ml.ml_mfp;
+  mf_map_T *map = NULL;
+  garray_T offsets;
+  garray_T leaves;
+  garray_T old_ptrs;
+  PTR_EN *pe;
+  char_u *p = addr;
+  char_u *end = addr + size;
+  char_u *nl;
+  long_u used;
+  long_u len;
+  linenr_T lnum = 0;
+
+  if (mfp == NULL || !(buf->b_ml.ml_flags & ML_EMPTY))
+    return 0;
+
+  ga_init2(&offsets, (int)sizeof(size_t), 1000);
+  ga_init2(&leaves, (int)sizeof(PTR_EN), 1000);
+  ga_init2(&old_ptrs, (int)sizeof(blocknr_T), 1);
+
+  /* Fit as many lines in a block as ml_fill_mapped() can put in it. */
+  while (p < end)
+  {
+    if (ga_grow(&offsets, 2) == FAIL || ga_grow(&leaves, 1) == FAIL)
+      goto fail;
+    ((size_t *)offsets.ga_data)[offsets.ga_len++] = p - addr;
+    pe = (PTR_EN *)leaves.ga_data + leaves.ga_len;
+    pe->pe_bnum = mfp->mf_blocknr_min - leaves.ga_len++;
+    pe->pe_line_count = 0;
+    pe->pe_old_lnum = lnum + 1;
+    used = HEADER_SIZE;
+    while (p < end)
+    {
+      nl = memchr(p, NL, end - p);
+      len = (nl == NULL ? end : nl) - p;
+      if (fileformat == EOL_DOS && nl != NULL)
+      {
+        if (len == 0 || nl[-1] != CAR)
+          goto fail;
+        --len;
+      }
+      if (len >= MAXCOL)
+        goto fail;
+      len += 1 + INDEX_SIZE;
+      if (pe->pe_line_count > 0 && used + len > mfp->mf_page_size)
+        break;
+      used += len;
+      ++pe->pe_line_count;
+      p = nl == NULL ? end : nl + 1;
+    }
+    pe->pe_page_count = (int)((used + mfp->mf_page_size - 1) / mfp->mf_page_size);
+    lnum += pe->pe_line_count;
+  }
+  ((size_t *)offsets.ga_data)[offsets.ga_len] = size;
+
+  if (lnum == 0 || (map = ALLOC_ONE(mf_map_T)) == NULL)
+    goto fail;
+
+  /* Flush the cached line and release the locked block, then put the empty
+     * line after the mapped lines. */
+  ml_flush_line(buf);
+  ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+  buf->b_ml.ml_stack_top = 0;
+  buf->b_ml.ml_cache_len = 0;
+  if (ml_splice_collect(mfp, (blocknr_T)1, &leaves, &old_ptrs) == FAIL || ml_splice_tree(mfp, &leaves) == FAIL)
+    goto fail;
+
+  map->mm_addr = addr;
+  map->mm_size = size;
+  map->mm_fileformat = fileformat;
+  map->mm_count = offsets.ga_len;
+  map->mm_offsets = (size_t *)offsets.ga_data;
+  mf_map_file(mfp, map);
+
+  buf->b_ml.ml_line_count = lnum + 1;
+  buf->b_ml.ml_flags &= ~ML_EMPTY;
+#ifdef FEAT_BYTEOFF
+  ml_rebuild_chunks(buf);
+#endif
+  ga_clear(&old_ptrs);
+  return lnum;
+
+fail:
+  vim_free(map);
+  ga_clear(&offsets);
+  ga_clear(&leaves);
+  ga_clear(&old_ptrs);
+  return 0;
+}
+
+/*
+ * Fill block "hp" of the mapped file of "mfp" with its lines, for mf_get().
+ * Like readfile() a NUL in the text is stored as a NL.
+ */
+void ml_fill_mapped(memfile_T *mfp, bhdr_T *hp)
+{
+  mf_map_T *map = mfp->mf_map;
+  blocknr_T idx = map->mm_first - hp->bh_bnum;
+  char_u *p = map->mm_addr + map->mm_offsets[idx];
+  char_u *end = map->mm_addr + map->mm_offsets[idx + 1];
+  DATA_BL *dp = (DATA_BL *)(hp->bh_data);
+  char_u *nl;
+  char_u *text;
+  char_u *s;
+  colnr_T len;
+
+  vim_memset(dp, 0, (size_t)hp->bh_page_count * mfp->mf_page_size);
+  dp->db_id = DATA_ID;
+  dp->db_txt_start = dp->db_txt_end = hp->bh_page_count * mfp->mf_page_size;
+  dp->db_free = dp->db_txt_start - HEADER_SIZE;
+  while (p < end)
+  {
+    nl = memchr(p, NL, end - p);
+    len = (colnr_T)((nl == NULL ? end : nl) - p);
+    if (map->mm_fileformat == EOL_DOS && nl != NULL)
+      --len;
+    dp->db_txt_start -= len + 1;
+    dp->db_free -= len + 1 + INDEX_SIZE;
+    dp->db_index[dp->db_line_count++] = dp->db_txt_start;
+    text = (char_u *)dp + dp->db_txt_start;
+    mch_memmove(text, p, (size_t)len);
+    for (s = text; (s = memchr(s, NUL, text + len - s)) != NULL; ++s)
+      *s = NL;
+    p = nl == NULL ? end : nl + 1;
+  }
+}
+
+/*
+ * Copy all blocks of the mapped file of "buf" into memory and stop using the
+ * mapped file.  Must be done before the file is overwritten.
+ * Return FAIL for failure, OK otherwise
+ */
+int ml_unmap(buf_T *buf)
+{
+  memfile_T *mfp = buf->b_ml.ml_mfp;
+  garray_T leaves;
+  garray_T ptrs;
+  PTR_EN *pe;
+  bhdr_T *hp;
+  int idx;
+  int ret = OK;
+
+  if (mfp == NULL || mfp->mf_map == NULL)
+    return OK;
+
+  ml_flush_line(buf);
+  ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+  buf->b_ml.ml_cache_len = 0; /* block numbers may be translated */
+  ga_init2(&leaves, (int)sizeof(PTR_EN), 100);
+  ga_init2(&ptrs, (int)sizeof(blocknr_T), 20);
+  if (ml_splice_collect(mfp, (blocknr_T)1, &leaves, &ptrs) == FAIL)
+    ret = FAIL;
+  for (idx = 0; ret == OK && idx < leaves.ga_len; ++idx)
+  {
+    pe = (PTR_EN *)leaves.ga_data + idx;
+    if (!mf_is_mapped(mfp, pe->pe_bnum))
+      continue;
+    /* A dirty block can't be released without a swap file. */
+    if ((hp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+      ret = FAIL;
+    else
+      mf_put(mfp, hp, TRUE, FALSE);
+  }
+  if (ret == OK)
+    mf_unmap(mfp);
+  ga_clear(&leaves);
+  ga_clear(&ptrs);
+  return ret;
+}
+#endif
+
+/*
+ * set the DB_MARKED flag for line 'lnum'
+ */
+void ml_setmarked(linenr_T lnum)
+{
   bhdr_T *hp;
   DATA_BL *dp;
   /* invalid line number */
@@ -3364,11 +4639,34 @@ void ml_clearmarked(void)
   return;
 }
 
+/*
+ * Add the memory used for the text of "buf" to "stats".
+ */
+void ml_memory_stats(buf_T *buf, memoryStats_T *stats)
+{
+  memline_T *ml = &buf->b_ml;
+
+  if (ml->ml_mfp == NULL)
+    return;
+
+  mf_memory_stats(ml->ml_mfp, stats);
+#ifdef FEAT_BYTEOFF
+  if (ml->ml_chunksize != NULL)
+    stats->memline += ml->ml_numchunks * sizeof(chunksize_T);
+  if (ml->ml_chunktree != NULL)
+    stats->memline += (ml->ml_numchunks + 1) * sizeof(chunksize_T);
+#endif
+
+  if (ml->ml_flags & ML_LINE_DIRTY)
+    stats->line_cache += ml->ml_line_len;
+  stats->line_cache += ml->ml_stack_size * sizeof(infoptr_T);
+  stats->cached_blocks += ml->ml_cache_len;
+}
+
 /*
  * flush ml_line if necessary
  */
-static void
-ml_flush_line(buf_T *buf)
+void ml_flush_line(buf_T *buf)
 {
   bhdr_T *hp;
   DATA_BL *dp;
@@ -3382,6 +4680,7 @@ ml_flush_line(buf_T *buf)
   int start;
   int count;
   int i;
+  long line_offset = -1;
   static int entered = FALSE;
 
   if (buf->b_ml.ml_line_lnum == 0 || buf->b_ml.ml_mfp == NULL)
@@ -3397,6 +4696,8 @@ ml_flush_line(buf_T *buf)
 
     lnum = buf->b_ml.ml_line_lnum;
     new_line = buf->b_ml.ml_line_ptr;
+    if (ML_RECORD_CHANGES())
+      line_offset = ml_change_offset(buf, lnum);
 
     hp = ml_find_line(buf, lnum, ML_FIND);
     if (hp == NULL)
@@ -3413,6 +4714,8 @@ ml_flush_line(buf_T *buf)
         old_len = (dp->db_index[idx - 1] & DB_INDEX_MASK) - start;
       new_len = buf->b_ml.ml_line_len;
       extra = new_len - old_len; /* negative if lines gets smaller */
+      if (ML_RECORD_CHANGES())
+        ml_record_replace(buf, lnum, old_line, new_line, line_offset);
 
       /*
 	     * if new line fits in data block, replace directly
@@ -3456,9 +4759,11 @@ ml_flush_line(buf_T *buf)
 		 * Don't forget to copy the mark!
 		 */
         /* How about handling errors??? */
+        ++ml_hold_changes;
         (void)ml_append_int(buf, lnum, new_line, new_len, FALSE,
                             (dp->db_index[idx] & DB_MARKED));
         (void)ml_delete_int(buf, lnum, FALSE);
+        --ml_hold_changes;
       }
     }
     vim_free(new_line);
@@ -3540,9 +4845,15 @@ ml_find_line(buf_T *buf, linenr_T lnum, int action)
   int top;
   int page_count;
   int idx;
+  int i;
 
   mfp = buf->b_ml.ml_mfp;
 
+  /* Inserting or deleting a line changes the line numbers of the cached
+     * blocks. */
+  if (action == ML_INSERT || action == ML_DELETE)
+    buf->b_ml.ml_cache_len = 0;
+
   /*
      * If there is a locked block check if the wanted line is in it.
      * If not, flush and release the locked block.
@@ -3583,6 +4894,15 @@ ml_find_line(buf_T *buf, linenr_T lnum, int action)
   if (action == ML_FLUSH) /* nothing else to do */
     return NULL;
 
+  /* Try the recently found data blocks.  Not when 'swapfile' is reset, the
+     * pointer blocks need to be loaded too. */
+  if (action == ML_FIND && !mf_dont_release)
+  {
+    if ((hp = ml_cache_find(buf, lnum)) != NULL)
+      return hp;
+    ++buf->b_ml.ml_cache_misses;
+  }
+
   bnum = 1; /* start at the root of the tree */
   page_count = 1;
   low = 1;
@@ -3632,6 +4952,8 @@ ml_find_line(buf_T *buf, linenr_T lnum, int action)
       buf->b_ml.ml_locked_high = high;
       buf->b_ml.ml_locked_lineadd = 0;
       buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+      if (action == ML_FIND)
+        ml_cache_add(buf, hp);
       return hp;
     }
 
@@ -3671,6 +4993,9 @@ ml_find_line(buf_T *buf, linenr_T lnum, int action)
           bnum2 = mf_trans_del(mfp, bnum);
           if (bnum != bnum2)
           {
+            for (i = 0; i < buf->b_ml.ml_cache_len; ++i)
+              if (buf->b_ml.ml_cache[i].mc_bnum == bnum)
+                buf->b_ml.ml_cache[i].mc_bnum = bnum2;
             bnum = bnum2;
             pp->pb_pointer[idx].pe_bnum = bnum;
             dirty = TRUE;
@@ -3716,9 +5041,90 @@ error_noblock:
   else if (action == ML_INSERT)
     ml_lineadd(buf, -1);
   buf->b_ml.ml_stack_top = 0;
+  buf->b_ml.ml_cache_len = 0;
   return NULL;
 }
 
+/*
+ * Find line "lnum" in the data blocks that ml_find_line() found recently.
+ * When found the block is locked and put in ml_locked, and the stack is set
+ * to lead to it, like ml_find_line() does.
+ *
+ * return: NULL when not found, pointer to block header otherwise
+ */
+static bhdr_T *
+ml_cache_find(buf_T *buf, linenr_T lnum)
+{
+  memline_T *ml = &buf->b_ml;
+  mlcache_T found;
+  bhdr_T *hp;
+  blocknr_T bnum;
+  int idx;
+
+  for (idx = 0; idx < ml->ml_cache_len; ++idx)
+    if (ml->ml_cache[idx].mc_low <= lnum && ml->ml_cache[idx].mc_high >= lnum)
+      break;
+  if (idx == ml->ml_cache_len)
+    return NULL;
+
+  /* Move the entry to the front, it is the most recently used one now. */
+  found = ml->ml_cache[idx];
+  mch_memmove(ml->ml_cache + 1, ml->ml_cache, (size_t)idx * sizeof(mlcache_T));
+  ml->ml_cache[0] = found;
+
+  /* The block may have been written to the swap file and got a positive
+     * number.  Keep the translation, the pointer block still needs it. */
+  bnum = found.mc_bnum;
+  if (bnum < 0)
+    bnum = mf_trans_find(ml->ml_mfp, bnum);
+  if (found.mc_stack_top > ml->ml_stack_size || (hp = mf_get(ml->ml_mfp, bnum, found.mc_page_count)) == NULL)
+  {
+    mch_memmove(ml->ml_cache, ml->ml_cache + 1, (size_t)--ml->ml_cache_len * sizeof(mlcache_T));
+    return NULL;
+  }
+  if (((DATA_BL *)(hp->bh_data))->db_id != DATA_ID)
+  {
+    mf_put(ml->ml_mfp, hp, FALSE, FALSE);
+    ml->ml_cache_len = 0;
+    return NULL;
+  }
+
+  mch_memmove(ml->ml_stack, found.mc_stack, (size_t)found.mc_stack_top * sizeof(infoptr_T));
+  ml->ml_stack_top = found.mc_stack_top;
+  ml->ml_locked = hp;
+  ml->ml_locked_low = found.mc_low;
+  ml->ml_locked_high = found.mc_high;
+  ml->ml_locked_lineadd = 0;
+  ml->ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+  ++ml->ml_cache_hits;
+  return hp;
+}
+
+/*
+ * Remember data block "hp" that ml_find_line() just found, with the stack
+ * leading to it.
+ */
+static void
+ml_cache_add(buf_T *buf, bhdr_T *hp)
+{
+  memline_T *ml = &buf->b_ml;
+  mlcache_T *mc;
+
+  if (ml->ml_stack_top > MLC_MAXDEPTH)
+    return;
+  if (ml->ml_cache_len < MLC_SIZE)
+    ++ml->ml_cache_len;
+  mch_memmove(ml->ml_cache + 1, ml->ml_cache, (size_t)(ml->ml_cache_len - 1) * sizeof(mlcache_T));
+
+  mc = &ml->ml_cache[0];
+  mc->mc_bnum = hp->bh_bnum;
+  mc->mc_page_count = hp->bh_page_count;
+  mc->mc_low = ml->ml_locked_low;
+  mc->mc_high = ml->ml_locked_high;
+  mc->mc_stack_top = ml->ml_stack_top;
+  mch_memmove(mc->mc_stack, ml->ml_stack, (size_t)ml->ml_stack_top * sizeof(infoptr_T));
+}
+
 /*
  * add an entry to the info pointer stack
  *
@@ -4666,6 +6072,74 @@ void ml_setflags(buf_T *buf)
 #define MLCS_MAXL 800 /* max no of lines in chunk */
 #define MLCS_MINL 400 /* should be half of MLCS_MAXL */
 
+static buf_T *ml_upd_lastbuf = NULL; /* buffer of the cached chunk position */
+
+/* The lines of a chunk changed, its content hash must be computed again. */
+#ifdef FEAT_PERSISTENT_UNDO
+#define ML_CHUNK_CHANGED(chnk) ((chnk)->mlcs_hashed = FALSE)
+#else
+#define ML_CHUNK_CHANGED(chnk)
+#endif
+
+/*
+ * The chunk sizes are also kept in a Fenwick tree, so that the chunk of a
+ * line or byte offset is found by adding O(log n) entries instead of all the
+ * chunks before it.  Entry "i" of ml_chunktree (one based) holds the sums of
+ * the chunks from "i - (i & -i)" up to "i - 1".  Changing the size of one
+ * chunk updates the tree, when chunks are split, joined or computed again
+ * ml_chunktree_len is set to zero and the tree is built again when needed.
+ */
+static int
+ml_chunktree_build(buf_T *buf)
+{
+  chunksize_T *tree;
+  int n = buf->b_ml.ml_usedchunks;
+  int i, j;
+
+  if (buf->b_ml.ml_chunktree == NULL)
+  {
+    /* Freed when ml_chunksize is reallocated, can't have more entries */
+    buf->b_ml.ml_chunktree = ALLOC_MULT(chunksize_T, buf->b_ml.ml_numchunks + 1);
+    if (buf->b_ml.ml_chunktree == NULL)
+      return FAIL;
+  }
+  tree = buf->b_ml.ml_chunktree;
+  for (i = 1; i <= n; ++i)
+    tree[i] = buf->b_ml.ml_chunksize[i - 1];
+  for (i = 1; i <= n; ++i)
+  {
+    j = i + (i & -i);
+    if (j <= n)
+    {
+      tree[j].mlcs_numlines += tree[i].mlcs_numlines;
+      tree[j].mlcs_totalsize += tree[i].mlcs_totalsize;
+    }
+  }
+  buf->b_ml.ml_chunktree_len = n;
+  return OK;
+}
+
+/*
+ * Add "lines" and "size" to chunk "curix" in the tree of chunk sizes.
+ */
+static void
+ml_chunktree_add(buf_T *buf, int curix, int lines, long size)
+{
+  chunksize_T *tree = buf->b_ml.ml_chunktree;
+  int i;
+
+  if (curix >= buf->b_ml.ml_chunktree_len)
+  {
+    buf->b_ml.ml_chunktree_len = 0;
+    return;
+  }
+  for (i = curix + 1; i <= buf->b_ml.ml_chunktree_len; i += i & -i)
+  {
+    tree[i].mlcs_numlines += lines;
+    tree[i].mlcs_totalsize += size;
+  }
+}
+
 /*
  * Keep information for finding byte offset of a line, updtype may be one of:
  * ML_CHNK_ADDLINE: Add len to parent chunk, possibly splitting it
@@ -4680,7 +6154,6 @@ ml_updatechunk(
     long len,
     int updtype)
 {
-  static buf_T *ml_upd_lastbuf = NULL;
   static linenr_T ml_upd_lastline;
   static linenr_T ml_upd_lastcurline;
   static int ml_upd_lastcurix;
@@ -4693,7 +6166,8 @@ ml_updatechunk(
   bhdr_T *hp;
   DATA_BL *dp;
 
-  if (buf->b_ml.ml_usedchunks == -1 || len == 0)
+  /* A line replaced by one of the same length still changes the hash. */
+  if (buf->b_ml.ml_usedchunks == -1 || (len == 0 && updtype != ML_CHNK_UPDLINE))
     return;
   if (buf->b_ml.ml_chunksize == NULL)
   {
@@ -4707,6 +6181,9 @@ ml_updatechunk(
     buf->b_ml.ml_usedchunks = 1;
     buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
     buf->b_ml.ml_chunksize[0].mlcs_totalsize = 1;
+    ML_CHUNK_CHANGED(buf->b_ml.ml_chunksize);
+    VIM_CLEAR(buf->b_ml.ml_chunktree);
+    buf->b_ml.ml_chunktree_len = 0;
   }
 
   if (updtype == ML_CHNK_UPDLINE && buf->b_ml.ml_line_count == 1)
@@ -4717,6 +6194,8 @@ ml_updatechunk(
     buf->b_ml.ml_usedchunks = 1;
     buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
     buf->b_ml.ml_chunksize[0].mlcs_totalsize = (long)buf->b_ml.ml_line_len;
+    ML_CHUNK_CHANGED(buf->b_ml.ml_chunksize);
+    buf->b_ml.ml_chunktree_len = 0;
     return;
   }
 
@@ -4742,9 +6221,13 @@ ml_updatechunk(
   if (updtype == ML_CHNK_DELLINE)
     len = -len;
   curchnk->mlcs_totalsize += len;
+  ML_CHUNK_CHANGED(curchnk);
+  if (updtype == ML_CHNK_UPDLINE)
+    ml_chunktree_add(buf, curix, 0, len);
   if (updtype == ML_CHNK_ADDLINE)
   {
     curchnk->mlcs_numlines++;
+    ml_chunktree_add(buf, curix, 1, len);
 
     /* May resize here so we don't have to do it in both cases below */
     if (buf->b_ml.ml_usedchunks + 1 >= buf->b_ml.ml_numchunks)
@@ -4752,6 +6235,8 @@ ml_updatechunk(
       chunksize_T *t_chunksize = buf->b_ml.ml_chunksize;
 
       buf->b_ml.ml_numchunks = buf->b_ml.ml_numchunks * 3 / 2;
+      VIM_CLEAR(buf->b_ml.ml_chunktree);
+      buf->b_ml.ml_chunktree_len = 0;
       buf->b_ml.ml_chunksize = (chunksize_T *)
           vim_realloc(buf->b_ml.ml_chunksize,
                       sizeof(chunksize_T) * buf->b_ml.ml_numchunks);
@@ -4772,6 +6257,7 @@ ml_updatechunk(
       int text_end;
       int linecnt;
 
+      buf->b_ml.ml_chunktree_len = 0;
       mch_memmove(buf->b_ml.ml_chunksize + curix + 1,
                   buf->b_ml.ml_chunksize + curix,
                   (buf->b_ml.ml_usedchunks - curix) *
@@ -4827,7 +6313,9 @@ ml_updatechunk(
 	     * after this. Do it now to avoid the loop above later on
 	     */
       curchnk = buf->b_ml.ml_chunksize + curix + 1;
+      ML_CHUNK_CHANGED(curchnk);
       buf->b_ml.ml_usedchunks++;
+      buf->b_ml.ml_chunktree_len = 0;
       if (line == buf->b_ml.ml_line_count)
       {
         curchnk->mlcs_numlines = 0;
@@ -4861,6 +6349,7 @@ ml_updatechunk(
   else if (updtype == ML_CHNK_DELLINE)
   {
     curchnk->mlcs_numlines--;
+    ml_chunktree_add(buf, curix, -1, len);
     ml_upd_lastbuf = NULL; /* Force recalc of curix & curline */
     if (curix < (buf->b_ml.ml_usedchunks - 1) && (curchnk->mlcs_numlines + curchnk[1].mlcs_numlines) <= MLCS_MINL)
     {
@@ -4869,6 +6358,7 @@ ml_updatechunk(
     }
     else if (curix == 0 && curchnk->mlcs_numlines <= 0)
     {
+      buf->b_ml.ml_chunktree_len = 0;
       buf->b_ml.ml_usedchunks--;
       mch_memmove(buf->b_ml.ml_chunksize, buf->b_ml.ml_chunksize + 1,
                   buf->b_ml.ml_usedchunks * sizeof(chunksize_T));
@@ -4880,8 +6370,10 @@ ml_updatechunk(
     }
 
     /* Collapse chunks */
+    buf->b_ml.ml_chunktree_len = 0;
     curchnk[-1].mlcs_numlines += curchnk->mlcs_numlines;
     curchnk[-1].mlcs_totalsize += curchnk->mlcs_totalsize;
+    ML_CHUNK_CHANGED(curchnk - 1);
     buf->b_ml.ml_usedchunks--;
     if (curix < buf->b_ml.ml_usedchunks)
     {
@@ -4898,6 +6390,116 @@ ml_updatechunk(
   ml_upd_lastcurix = curix;
 }
 
+/*
+ * Return the number of text bytes in data block "pe", for the chunk sizes.
+ * Returns -1 for failure.
+ */
+static long
+ml_leaf_size(memfile_T *mfp, PTR_EN *pe)
+{
+  bhdr_T *hp;
+  DATA_BL *dp;
+  long size;
+#ifdef FEAT_MMAP_FILE
+  mf_map_T *map = mfp->mf_map;
+
+  /* A block of the mapped file has a NUL instead of each NL or CR-NL, and
+     * a NUL after a last line without a NL. */
+  if (mf_is_mapped(mfp, pe->pe_bnum))
+  {
+    blocknr_T idx = map->mm_first - pe->pe_bnum;
+    int no_eol = (idx == map->mm_count - 1 && map->mm_addr[map->mm_size - 1] != NL);
+
+    size = (long)(map->mm_offsets[idx + 1] - map->mm_offsets[idx]) + no_eol;
+    if (map->mm_fileformat == EOL_DOS)
+      size -= pe->pe_line_count - no_eol;
+    return size;
+  }
+#endif
+  if ((hp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+    return -1;
+  dp = (DATA_BL *)(hp->bh_data);
+  size = dp->db_txt_end - dp->db_txt_start;
+  mf_put(mfp, hp, FALSE, FALSE);
+  return size;
+}
+
+/*
+ * Compute the chunk sizes of "buf" again from the data blocks.  Used after
+ * many lines were changed at once, where updating them line by line would be
+ * slow.
+ */
+static void
+ml_rebuild_chunks(buf_T *buf)
+{
+  garray_T leaves;
+  garray_T ptrs;
+  PTR_EN *pe;
+  chunksize_T *curchnk;
+  long size;
+  int idx;
+  int numchunks;
+
+  if (buf->b_ml.ml_usedchunks == -1)
+    return;
+
+  numchunks = buf->b_ml.ml_line_count / MLCS_MINL + 2;
+  if (numchunks < 100)
+    numchunks = 100;
+  if (buf->b_ml.ml_chunksize == NULL || buf->b_ml.ml_numchunks < numchunks)
+  {
+    vim_free(buf->b_ml.ml_chunksize);
+    VIM_CLEAR(buf->b_ml.ml_chunktree);
+    buf->b_ml.ml_chunksize = ALLOC_MULT(chunksize_T, numchunks);
+    if (buf->b_ml.ml_chunksize == NULL)
+    {
+      buf->b_ml.ml_usedchunks = -1;
+      return;
+    }
+    buf->b_ml.ml_numchunks = numchunks;
+  }
+  ml_upd_lastbuf = NULL; /* Force recalc of curix & curline */
+  buf->b_ml.ml_chunktree_len = 0;
+
+  /* Walk the data blocks without going through the lines, a block of a
+     * mapped file is not copied into memory for this. */
+  ml_flush_line(buf);
+  ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+  buf->b_ml.ml_cache_len = 0; /* block numbers may be translated */
+  ga_init2(&leaves, (int)sizeof(PTR_EN), 100);
+  ga_init2(&ptrs, (int)sizeof(blocknr_T), 20);
+  if (ml_splice_collect(buf->b_ml.ml_mfp, (blocknr_T)1, &leaves, &ptrs) == FAIL)
+    buf->b_ml.ml_usedchunks = -1;
+
+  curchnk = buf->b_ml.ml_chunksize;
+  curchnk->mlcs_numlines = 0;
+  curchnk->mlcs_totalsize = 0;
+  ML_CHUNK_CHANGED(curchnk);
+  if (buf->b_ml.ml_usedchunks != -1)
+    buf->b_ml.ml_usedchunks = 1;
+  for (idx = 0; buf->b_ml.ml_usedchunks != -1 && idx < leaves.ga_len; ++idx)
+  {
+    pe = (PTR_EN *)leaves.ga_data + idx;
+    if ((size = ml_leaf_size(buf->b_ml.ml_mfp, pe)) < 0)
+    {
+      buf->b_ml.ml_usedchunks = -1;
+      break;
+    }
+    if (curchnk->mlcs_numlines >= MLCS_MINL)
+    {
+      ++curchnk;
+      curchnk->mlcs_numlines = 0;
+      curchnk->mlcs_totalsize = 0;
+      ML_CHUNK_CHANGED(curchnk);
+      ++buf->b_ml.ml_usedchunks;
+    }
+    curchnk->mlcs_numlines += pe->pe_line_count;
+    curchnk->mlcs_totalsize += size;
+  }
+  ga_clear(&leaves);
+  ga_clear(&ptrs);
+}
+
 /*
  * Find offset for line or line with offset.
  * Find line with offset if "lnum" is 0; return remaining offset in offp
@@ -4919,12 +6521,16 @@ long ml_find_line_or_offset(buf_T *buf, linenr_T lnum, long *offp)
   int len;
   int ffdos = (get_fileformat(buf) == EOL_DOS);
   int extra = 0;
+  int step;
+  chunksize_T *node;
 
   /* take care of cached line first */
-  ml_flush_line(curbuf);
+  ml_flush_line(buf);
 
   if (buf->b_ml.ml_usedchunks == -1 || buf->b_ml.ml_chunksize == NULL || lnum < 0)
     return -1;
+  if (buf->b_ml.ml_chunktree_len != buf->b_ml.ml_usedchunks && ml_chunktree_build(buf) == FAIL)
+    return -1;
 
   if (offp == NULL)
     offset = 0;
@@ -4934,17 +6540,26 @@ long ml_find_line_or_offset(buf_T *buf, linenr_T lnum, long *offp)
     return 1; /* Not a "find offset" and offset 0 _must_ be in line 1 */
   /*
      * Find the last chunk before the one containing our line. Last chunk is
-     * special because it will never qualify
+     * special because it will never qualify.  Goes down the tree of chunk
+     * sizes, skipping the largest run of chunks that comes before the line.
      */
   curline = 1;
   curix = size = 0;
-  while (curix < buf->b_ml.ml_usedchunks - 1 && ((lnum != 0 && lnum >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines) || (offset != 0 && offset > size + buf->b_ml.ml_chunksize[curix].mlcs_totalsize + ffdos * buf->b_ml.ml_chunksize[curix].mlcs_numlines)))
+  for (step = 1; step * 2 <= buf->b_ml.ml_usedchunks; step *= 2)
+    ;
+  for (; step > 0; step /= 2)
   {
-    curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-    size += buf->b_ml.ml_chunksize[curix].mlcs_totalsize;
-    if (offset && ffdos)
-      size += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-    curix++;
+    if (curix + step > buf->b_ml.ml_usedchunks - 1)
+      continue;
+    node = buf->b_ml.ml_chunktree + curix + step;
+    if ((lnum != 0 && lnum >= curline + node->mlcs_numlines) || (offset != 0 && offset > size + node->mlcs_totalsize + ffdos * node->mlcs_numlines))
+    {
+      curline += node->mlcs_numlines;
+      size += node->mlcs_totalsize;
+      if (offset && ffdos)
+        size += node->mlcs_numlines;
+      curix += step;
+    }
   }
 
   while ((lnum != 0 && curline < lnum) || (offset != 0 && size < offset))
@@ -5048,3 +6663,149 @@ void goto_byte(long cnt)
     mb_adjust_cursor();
 }
 #endif
+
+#if defined(FEAT_PERSISTENT_UNDO) || defined(PROTO)
+
+/*
+ * The content hash of a buffer is used to check that an undo file belongs to
+ * the text.  Each line is hashed with SHA-256, the line hashes are the digits
+ * of a number in base ml_hash_base[] modulo 2^31 - 1, in ML_HASH_LANES lanes.
+ * The number for a range of lines does not depend on how they are split into
+ * chunks.  The number of each chunk of ml_chunksize is kept until a line in
+ * it changes, thus only the chunks with changes are hashed again.
+ */
+#define ML_HASH_MOD 0x7fffffffUL
+
+static const UINT32_T ml_hash_base[ML_HASH_LANES] = {
+    0x000f4243, 0x2545f491, 0x3b9aca07, 0x6c078965};
+
+/*
+ * Return "a" * "b" modulo ML_HASH_MOD.
+ */
+static UINT32_T
+ml_hash_mul(UINT32_T a, UINT32_T b)
+{
+  unsigned long long x = (unsigned long long)a * b;
+
+  x = (x & ML_HASH_MOD) + (x >> 31);
+  x = (x & ML_HASH_MOD) + (x >> 31);
+  return (UINT32_T)(x >= ML_HASH_MOD ? x - ML_HASH_MOD : x);
+}
+
+/*
+ * Add the hashes of "count" lines of "buf" from "lnum" as digits to "value".
+ */
+static void
+ml_hash_lines(buf_T *buf, linenr_T lnum, linenr_T count, UINT32_T *value)
+{
+  context_sha256_T ctx;
+  char_u digest[32];
+  char_u *line;
+  UINT32_T digit;
+  int i;
+
+  for (; count > 0; --count, ++lnum)
+  {
+    line = ml_get_buf(buf, lnum, FALSE);
+    sha256_start(&ctx);
+    sha256_update(&ctx, line, (UINT32_T)(STRLEN(line) + 1));
+    sha256_finish(&ctx, digest);
+    for (i = 0; i < ML_HASH_LANES; ++i)
+    {
+      digit = (((UINT32_T)digest[i * 4] << 24) | ((UINT32_T)digest[i * 4 + 1] << 16) | ((UINT32_T)digest[i * 4 + 2] << 8) | digest[i * 4 + 3]) % ML_HASH_MOD;
+      value[i] = ml_hash_mul(value[i], ml_hash_base[i]) + digit;
+      if (value[i] >= ML_HASH_MOD)
+        value[i] -= ML_HASH_MOD;
+    }
+  }
+}
+
+#ifdef FEAT_BYTEOFF
+/*
+ * Append the lines with hash "chunk" to "value": shift "value" by "count"
+ * digits and add.
+ */
+static void
+ml_hash_append(UINT32_T *value, UINT32_T *chunk, linenr_T count)
+{
+  UINT32_T pow, base;
+  linenr_T n;
+  int i;
+
+  for (i = 0; i < ML_HASH_LANES; ++i)
+  {
+    pow = 1;
+    base = ml_hash_base[i];
+    for (n = count; n > 0; n >>= 1)
+    {
+      if (n & 1)
+        pow = ml_hash_mul(pow, base);
+      base = ml_hash_mul(base, base);
+    }
+    value[i] = ml_hash_mul(value[i], pow) + chunk[i];
+    if (value[i] >= ML_HASH_MOD)
+      value[i] -= ML_HASH_MOD;
+  }
+}
+#endif
+
+/*
+ * Compute the content hash of the text of "buf" into "hash[UNDO_HASH_SIZE]".
+ * Only the chunks of lines that changed since the last time are hashed.
+ */
+void ml_content_hash(buf_T *buf, char_u *hash)
+{
+  UINT32_T value[ML_HASH_LANES];
+  char_u bytes[4 + ML_HASH_LANES * 4];
+  context_sha256_T ctx;
+  int i;
+#ifdef FEAT_BYTEOFF
+  chunksize_T *chnk;
+  linenr_T lnum = 1;
+#endif
+
+  vim_memset(value, 0, sizeof(value));
+  ml_flush_line(buf);
+#ifdef FEAT_BYTEOFF
+  if (buf->b_ml.ml_usedchunks > 0 && buf->b_ml.ml_chunksize != NULL)
+  {
+    for (i = 0; i < buf->b_ml.ml_usedchunks; ++i)
+      lnum += buf->b_ml.ml_chunksize[i].mlcs_numlines;
+  }
+  if (lnum == buf->b_ml.ml_line_count + 1)
+  {
+    lnum = 1;
+    for (i = 0; i < buf->b_ml.ml_usedchunks; ++i)
+    {
+      chnk = buf->b_ml.ml_chunksize + i;
+      if (!chnk->mlcs_hashed)
+      {
+        vim_memset(chnk->mlcs_hash, 0, sizeof(chnk->mlcs_hash));
+        ml_hash_lines(buf, lnum, chnk->mlcs_numlines, chnk->mlcs_hash);
+        chnk->mlcs_hashed = TRUE;
+      }
+      ml_hash_append(value, chnk->mlcs_hash, chnk->mlcs_numlines);
+      lnum += chnk->mlcs_numlines;
+    }
+  }
+  else
+#endif
+    ml_hash_lines(buf, 1, buf->b_ml.ml_line_count, value);
+
+  /* The line count and the numbers make up the hash. */
+  bytes[0] = (char_u)(buf->b_ml.ml_line_count >> 24);
+  bytes[1] = (char_u)(buf->b_ml.ml_line_count >> 16);
+  bytes[2] = (char_u)(buf->b_ml.ml_line_count >> 8);
+  bytes[3] = (char_u)buf->b_ml.ml_line_count;
+  for (i = 0; i < ML_HASH_LANES; ++i)
+  {
+    bytes[4 + i * 4] = (char_u)(value[i] >> 24);
+    bytes[5 + i * 4] = (char_u)(value[i] >> 16);
+    bytes[6 + i * 4] = (char_u)(value[i] >> 8);
+    bytes[7 + i * 4] = (char_u)value[i];
+  }
+  sha256_start(&ctx);
+  sha256_update(&ctx, bytes, (UINT32_T)sizeof(bytes));
+  sha256_finish(&ctx, hash);
+}
+#endif
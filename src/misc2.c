@@ -1860,6 +1860,255 @@ vim_strbyte(char_u *string, int c)
   return NULL;
 }
 
+/*
+ * Byte scanning kernels, used on large blocks of text such as what is read
+ * from a file.  On x86 there are SSE2 versions and, when the compiler
+ * supports them, AVX2 versions that are used when the CPU has AVX2.  Other
+ * systems use the plain loops.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define SCAN_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ >= 5
+#define SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+static char_u *memchr3_plain(char_u *p, size_t len, int c1, int c2, int c3)
+{
+  char_u *end = p + len;
+
+  for (; p < end; ++p)
+    if (*p == c1 || *p == c2 || *p == c3)
+      return p;
+  return NULL;
+}
+
+static size_t memcount_plain(char_u *p, size_t len, int c)
+{
+  char_u *end = p + len;
+  size_t count = 0;
+
+  for (; p < end; ++p)
+    if (*p == c)
+      ++count;
+  return count;
+}
+
+static size_t ascii_len_plain(char_u *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    if (p[i] >= 0x80)
+      break;
+  return i;
+}
+
+#ifdef SCAN_SSE2
+static char_u *memchr3_sse2(char_u *p, size_t len, int c1, int c2, int c3)
+{
+  __m128i v1 = _mm_set1_epi8((char)c1);
+  __m128i v2 = _mm_set1_epi8((char)c2);
+  __m128i v3 = _mm_set1_epi8((char)c3);
+  __m128i b;
+  int mask;
+
+  for (; len >= 16; p += 16, len -= 16)
+  {
+    b = _mm_loadu_si128((__m128i *)p);
+    mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)),
+        _mm_cmpeq_epi8(b, v3)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return memchr3_plain(p, len, c1, c2, c3);
+}
+
+static size_t memcount_sse2(char_u *p, size_t len, int c)
+{
+  __m128i v = _mm_set1_epi8((char)c);
+  __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  __m128i counts;
+  unsigned long long lanes[2];
+  int i;
+
+  while (len >= 16)
+  {
+    /* Count in bytes for at most 255 blocks, then add to the sums. */
+    counts = zero;
+    for (i = 0; i < 255 && len >= 16; ++i, p += 16, len -= 16)
+      counts = _mm_sub_epi8(counts,
+                            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)p), v));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+  }
+  _mm_storeu_si128((__m128i *)lanes, sums);
+  return (size_t)(lanes[0] + lanes[1]) + memcount_plain(p, len, c);
+}
+
+static size_t ascii_len_sse2(char_u *p, size_t len)
+{
+  size_t i;
+  int mask;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i *)(p + i)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + ascii_len_plain(p + i, len - i);
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2"))) static char_u *
+memchr3_avx2(char_u *p, size_t len, int c1, int c2, int c3)
+{
+  __m256i v1 = _mm256_set1_epi8((char)c1);
+  __m256i v2 = _mm256_set1_epi8((char)c2);
+  __m256i v3 = _mm256_set1_epi8((char)c3);
+  __m256i b;
+  unsigned int mask;
+
+  for (; len >= 32; p += 32, len -= 32)
+  {
+    b = _mm256_loadu_si256((__m256i *)p);
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(b, v1), _mm256_cmpeq_epi8(b, v2)),
+        _mm256_cmpeq_epi8(b, v3)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return memchr3_sse2(p, len, c1, c2, c3);
+}
+
+__attribute__((target("avx2"))) static size_t
+memcount_avx2(char_u *p, size_t len, int c)
+{
+  __m256i v = _mm256_set1_epi8((char)c);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sums = zero;
+  __m256i counts;
+  unsigned long long lanes[4];
+  int i;
+
+  while (len >= 32)
+  {
+    counts = zero;
+    for (i = 0; i < 255 && len >= 32; ++i, p += 32, len -= 32)
+      counts = _mm256_sub_epi8(
+          counts, _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)p), v));
+    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, zero));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, sums);
+  return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) +
+         memcount_sse2(p, len, c);
+}
+
+__attribute__((target("avx2"))) static size_t
+ascii_len_avx2(char_u *p, size_t len)
+{
+  size_t i;
+  unsigned int mask;
+
+  for (i = 0; i + 32 <= len; i += 32)
+  {
+    mask = (unsigned int)_mm256_movemask_epi8(
+        _mm256_loadu_si256((__m256i *)(p + i)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + ascii_len_sse2(p + i, len - i);
+}
+#endif
+
+static char_u *memchr3_select(char_u *p, size_t len, int c1, int c2, int c3);
+static size_t memcount_select(char_u *p, size_t len, int c);
+static size_t ascii_len_select(char_u *p, size_t len);
+
+static char_u *(*memchr3_fn)(char_u *p, size_t len, int c1, int c2,
+                             int c3) = memchr3_select;
+static size_t (*memcount_fn)(char_u *p, size_t len, int c) = memcount_select;
+static size_t (*ascii_len_fn)(char_u *p, size_t len) = ascii_len_select;
+
+/*
+ * Pick the kernels for this CPU.  Called by common_init(), before a worker
+ * thread can scan text.  The *_select() functions only do it for a scan
+ * before that.
+ */
+void vim_scan_init(void)
+{
+#ifdef SCAN_AVX2
+  if (__builtin_cpu_supports("avx2"))
+  {
+    memchr3_fn = memchr3_avx2;
+    memcount_fn = memcount_avx2;
+    ascii_len_fn = ascii_len_avx2;
+    return;
+  }
+#endif
+#ifdef SCAN_SSE2
+  memchr3_fn = memchr3_sse2;
+  memcount_fn = memcount_sse2;
+  ascii_len_fn = ascii_len_sse2;
+#else
+  memchr3_fn = memchr3_plain;
+  memcount_fn = memcount_plain;
+  ascii_len_fn = ascii_len_plain;
+#endif
+}
+
+static char_u *memchr3_select(char_u *p, size_t len, int c1, int c2, int c3)
+{
+  vim_scan_init();
+  return memchr3_fn(p, len, c1, c2, c3);
+}
+
+static size_t memcount_select(char_u *p, size_t len, int c)
+{
+  vim_scan_init();
+  return memcount_fn(p, len, c);
+}
+
+static size_t ascii_len_select(char_u *p, size_t len)
+{
+  vim_scan_init();
+  return ascii_len_fn(p, len);
+}
+
+/*
+ * Find the first byte in "p[len]" that is "c1", "c2" or "c3".  Pass the same
+ * byte more than once to look for fewer.  NUL is not special.
+ * Return NULL if there is none.
+ */
+char_u *
+vim_memchr3(char_u *p, size_t len, int c1, int c2, int c3)
+{
+  return memchr3_fn(p, len, c1, c2, c3);
+}
+
+/*
+ * Return the number of bytes in "p[len]" that are "c".
+ */
+size_t
+vim_memcount(char_u *p, size_t len, int c)
+{
+  return memcount_fn(p, len, c);
+}
+
+/*
+ * Return the number of bytes at the start of "p[len]" that are below 0x80.
+ */
+size_t
+vim_ascii_len(char_u *p, size_t len)
+{
+  return ascii_len_fn(p, len);
+}
+
 /*
  * Search for last occurrence of "c" in "string".
  * Return NULL if not found.
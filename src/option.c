@@ -1995,6 +1995,7 @@ static struct vimoption options[] =
                                                                            (char_u *)100L,
 #endif
                                                                            (char_u *)0L} SCTX_INIT},
+        {"undomemory", "um", P_NUM | P_VI_DEF, (char_u *)&p_um, PV_NONE, {(char_u *)0L, (char_u *)0L} SCTX_INIT},
         {"undoreload", "ur", P_NUM | P_VI_DEF, (char_u *)&p_ur, PV_NONE, {(char_u *)10000L, (char_u *)0L} SCTX_INIT},
         {"updatecount", "uc", P_NUM | P_VI_DEF, (char_u *)&p_uc, PV_NONE, {(char_u *)200L, (char_u *)0L} SCTX_INIT},
         {"updatetime", "ut", P_NUM | P_VI_DEF, (char_u *)&p_ut, PV_NONE, {(char_u *)4000L, (char_u *)0L} SCTX_INIT},
@@ -6804,6 +6805,15 @@ set_num_option(
       command_height();
   }
 
+  else if (pp == &p_um)
+  {
+    if (p_um < 0)
+    {
+      errmsg = e_positive;
+      p_um = 0;
+    }
+  }
+
   /* when 'updatecount' changes from zero to non-zero, open swap files */
   else if (pp == &p_uc)
   {
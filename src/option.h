@@ -727,6 +727,7 @@ static char *(p_toolbar_values[]) = {"text", "icons", "tooltips", "horiz", NULL}
 EXTERN long p_ttyscroll; /* 'ttyscroll' */
 EXTERN char_u *p_udir;   /* 'undodir' */
 EXTERN long p_ul;        /* 'undolevels' */
+EXTERN long p_um;        /* 'undomemory' */
 EXTERN long p_ur;        /* 'undoreload' */
 EXTERN long p_uc;        /* 'updatecount' */
 EXTERN long p_ut;        /* 'updatetime' */
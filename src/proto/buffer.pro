@@ -6,6 +6,8 @@ int buf_valid(buf_T *buf);
 void close_buffer(win_T *win, buf_T *buf, int action, int abort_if_last);
 void buf_clear_file(buf_T *buf);
 void buf_freeall(buf_T *buf, int flags);
+void buf_memory_stats(buf_T *buf, memoryStats_T *stats);
+void buf_memory_stats_all(memoryStats_T *stats);
 void goto_buffer(exarg_T *eap, int start, int dir, int count);
 void handle_swap_exists(bufref_T *old_curbuf);
 char *do_bufdel(int command, char_u *arg, int addr_count, int start_bnr,
@@ -7,6 +7,13 @@ void f_listener_flush(typval_T *argvars, typval_T *rettv);
 void f_listener_remove(typval_T *argvars, typval_T *rettv);
 void may_invoke_listeners(buf_T *buf, linenr_T lnum, linenr_T lnume, int added);
 void invoke_listeners(buf_T *buf);
+void buf_record_change(buf_T *buf, linenr_T lnum, colnr_T col, linenr_T end_lnum, colnr_T end_col, long offset, long old_len, char_u *text, long len);
+void buf_clear_changes(buf_T *buf);
+void buf_invoke_changes(buf_T *buf);
+void buf_send_update(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra);
+void buf_update_batch_begin(void);
+void buf_update_batch_end(void);
+void invoke_all_buffer_changes(void);
 void changed_bytes(linenr_T lnum, colnr_T col);
 void inserted_bytes(linenr_T lnum, colnr_T col, int added);
 void appended_lines(linenr_T lnum, long count);
@@ -15,6 +22,7 @@ void deleted_lines(linenr_T lnum, long count);
 void deleted_lines_mark(linenr_T lnum, long count);
 void changed_lines(linenr_T lnum, colnr_T col, linenr_T lnume, long xtra);
 void changed_lines_buf(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra);
+void file_lines_changed(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra);
 void unchanged(buf_T *buf, int ff);
 void ins_bytes(char_u *p);
 void ins_bytes_len(char_u *p, int len);
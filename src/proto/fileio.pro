@@ -4,6 +4,16 @@ int readfile(char_u *fname, char_u *sfname, linenr_T from,
              linenr_T lines_to_skip, linenr_T lines_to_read, exarg_T *eap,
              int flags);
 int is_dev_fd_file(char_u *fname);
+bufload_T *bufload_open(buf_T *buf, linenr_T initial_lines,
+                        LoadProgressCallback callback, void *context);
+loadState_T bufload_poll(bufload_T *load, int wait);
+void bufload_cancel(bufload_T *load);
+void bufload_detach(buf_T *buf);
+buf_T *bufload_buffer(bufload_T *load);
+void bufload_free(bufload_T *load);
+bufsave_T *bufsave_start(buf_T *buf, SaveCompleteCallback callback, void *context);
+saveState_T bufsave_poll(bufsave_T *save, int wait);
+void bufsave_free(bufsave_T *save);
 int prep_exarg(exarg_T *eap, buf_T *buf);
 void set_file_options(int set_options, exarg_T *eap);
 void set_forced_fenc(exarg_T *eap);
@@ -35,6 +35,7 @@ void foldAdjustVisual(void);
 void foldAdjustCursor(void);
 void cloneFoldGrowArray(garray_T *from, garray_T *to);
 void deleteFoldRecurse(garray_T *gap);
+long_u foldMemorySize(garray_T *gap);
 void foldMarkAdjust(win_T *wp, linenr_T line1, linenr_T line2, long amount,
                     long amount_after);
 int getDeepestNesting(void);
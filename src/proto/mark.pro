@@ -29,6 +29,7 @@ void cleanup_jumplist(win_T *wp, int loadfiles);
 void copy_jumplist(win_T *from, win_T *to);
 void free_jumplist(win_T *wp);
 void set_last_cursor(win_T *win);
+void mark_memory_stats(buf_T *buf, memoryStats_T *stats);
 void free_all_marks(void);
 int read_viminfo_filemark(vir_T *virp, int force);
 void prepare_viminfo_marks(void);
@@ -56,6 +56,7 @@ int utf_head_off(char_u *base, char_u *p);
 void mb_copy_char(char_u **fp, char_u **tp);
 int mb_off_next(char_u *base, char_u *p);
 int mb_tail_off(char_u *base, char_u *p);
+long utf_valid_len(char_u *p, long len);
 void utf_find_illegal(void);
 int utf_valid_string(char_u *s, char_u *end);
 int dbcs_screen_tail_off(char_u *base, char_u *p);
@@ -11,8 +11,16 @@ void mf_free(memfile_T *mfp, bhdr_T *hp);
 int mf_sync(memfile_T *mfp, int flags);
 void mf_set_dirty(memfile_T *mfp);
 int mf_release_all(void);
+int mf_resize_data(memfile_T *mfp, bhdr_T *hp, unsigned old_size);
+void mf_pool_stats(memfile_T *mfp, blockPoolStats_T *stats);
+void mf_memory_stats(memfile_T *mfp, memoryStats_T *stats);
+long mf_compress_cold(int force);
 blocknr_T mf_trans_del(memfile_T *mfp, blocknr_T old_nr);
+blocknr_T mf_trans_find(memfile_T *mfp, blocknr_T old_nr);
 void mf_set_ffname(memfile_T *mfp);
 void mf_fullname(memfile_T *mfp);
+void mf_map_file(memfile_T *mfp, mf_map_T *map);
+void mf_unmap(memfile_T *mfp);
+int mf_is_mapped(memfile_T *mfp, blocknr_T nr);
 int mf_need_trans(memfile_T *mfp);
 /* vim: set ft=c : */
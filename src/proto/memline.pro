@@ -21,6 +21,13 @@ char_u *ml_get_curline(void);
 char_u *ml_get_cursor(void);
 char_u *ml_get_buf(buf_T *buf, linenr_T lnum, int will_change);
 int ml_line_alloced(void);
+int ml_iter_lines(buf_T *buf, linenr_T start, linenr_T end, LineIterCallback func, void *context);
+int ml_gather_lines(buf_T *buf, linenr_T start, linenr_T end, int max_blocks, LineIterCallback func, void *context);
+void ml_snapblock_unref(snapblock_T *sb);
+snapshot_T *ml_snapshot(buf_T *buf);
+void ml_snapshot_free(snapshot_T *ss);
+char_u *ml_snapshot_get_line(snapshot_T *ss, linenr_T lnum, size_t *lenp);
+void ml_snapshot_iter_lines(snapshot_T *ss, linenr_T start, linenr_T end, LineIterCallback func, void *context);
 int ml_append(linenr_T lnum, char_u *line, colnr_T len, int newfile);
 int ml_append_buf(buf_T *buf, linenr_T lnum, char_u *line, colnr_T len,
                   int newfile);
@@ -29,9 +36,18 @@ int ml_replace_len(linenr_T lnum, char_u *line_arg, colnr_T len_arg,
                    int has_props, int copy);
 int ml_delete(linenr_T lnum, int message);
 int ml_delete_buf(buf_T *buf, linenr_T lnum, int message);
+void ml_flush_line(buf_T *buf);
+void ml_record_appended(buf_T *buf, linenr_T lnum, linenr_T count);
+int ml_splice_buf(buf_T *buf, linenr_T start, linenr_T end, char_u **lines,
+                  int count);
+linenr_T ml_open_mapped(buf_T *buf, char_u *addr, size_t size,
+                        int fileformat);
+void ml_fill_mapped(memfile_T *mfp, bhdr_T *hp);
+int ml_unmap(buf_T *buf);
 void ml_setmarked(linenr_T lnum);
 linenr_T ml_firstmarked(void);
 void ml_clearmarked(void);
+void ml_memory_stats(buf_T *buf, memoryStats_T *stats);
 int resolve_symlink(char_u *fname, char_u *buf);
 char_u *makeswapname(char_u *fname, char_u *ffname, buf_T *buf,
                      char_u *dir_name);
@@ -39,4 +55,5 @@ char_u *get_file_in_dir(char_u *fname, char_u *dname);
 void ml_setflags(buf_T *buf);
 long ml_find_line_or_offset(buf_T *buf, linenr_T lnum, long *offp);
 void goto_byte(long cnt);
+void ml_content_hash(buf_T *buf, char_u *hash);
 /* vim: set ft=c : */
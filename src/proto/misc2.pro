@@ -53,6 +53,10 @@ int vim_stricmp(char *s1, char *s2);
 int vim_strnicmp(char *s1, char *s2, size_t len);
 char_u *vim_strchr(char_u *string, int c);
 char_u *vim_strbyte(char_u *string, int c);
+void vim_scan_init(void);
+char_u *vim_memchr3(char_u *p, size_t len, int c1, int c2, int c3);
+size_t vim_memcount(char_u *p, size_t len, int c);
+size_t vim_ascii_len(char_u *p, size_t len);
 char_u *vim_strrchr(char_u *string, int c);
 int vim_isspace(int x);
 void ga_clear(garray_T *gap);
@@ -12,6 +12,9 @@ int vim_regsub_multi(regmmatch_T *rmp, linenr_T lnum, char_u *source,
                      char_u *dest, int copy, int magic, int backslash);
 char_u *reg_submatch(int no);
 list_T *reg_submatch_list(int no);
+void vim_regcomp_cache_clear(void);
+void vim_regcomp_cache_set_size(int size);
+void vim_regcomp_cache_stats(long *hits, long *misses);
 regprog_T *vim_regcomp(char_u *expr_arg, int re_flags);
 void vim_regfree(regprog_T *prog);
 int regprog_in_use(regprog_T *prog);
@@ -21,4 +24,12 @@ int vim_regexec(regmatch_T *rmp, char_u *line, colnr_T col);
 int vim_regexec_nl(regmatch_T *rmp, char_u *line, colnr_T col);
 long vim_regexec_multi(regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum,
                        colnr_T col, proftime_T *tm, int *timed_out);
+regexec_T *vim_regexec_ctx_alloc(void);
+void vim_regexec_ctx_free(regexec_T *rex);
+void vim_regexec_ctx_set_getline(regexec_T *rex,
+                                 char_u *(*getline)(linenr_T lnum, void *cookie),
+                                 void *cookie, linenr_T line_count);
+long vim_regexec_ctx_multi(regexec_T *rex, regmmatch_T *rmp, buf_T *buf,
+                           linenr_T lnum, colnr_T col, proftime_T *tm,
+                           int *timed_out);
 /* vim: set ft=c : */
@@ -54,4 +54,10 @@ void find_pattern_in_path(char_u *ptr, int dir, int len, int whole,
                           linenr_T start_lnum, linenr_T end_lnum);
 int read_viminfo_search_pattern(vir_T *virp, int force);
 void write_viminfo_search_pattern(FILE *fp);
+void hl_index_clear(buf_T *buf);
+void hl_index_changed(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra);
+void search_get_highlights(buf_T *buf, linenr_T start_lnum, linenr_T end_lnum, garray_T *gap);
+int search_get_highlights_timed(buf_T *buf, pos_T *resume, linenr_T end_lnum, long msec, garray_T *gap);
+void search_all_set_threads(int count);
+void search_all(buf_T *buf, garray_T *gap);
 /* vim: set ft=c : */
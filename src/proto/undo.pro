@@ -18,12 +18,14 @@ void ex_undolist(exarg_T *eap);
 void ex_undojoin(exarg_T *eap);
 void u_unchanged(buf_T *buf);
 void u_find_first_changed(void);
+void u_appended_last(linenr_T count);
 void u_update_save_nr(buf_T *buf);
 void u_clearall(buf_T *buf);
 void u_saveline(linenr_T lnum);
 void u_clearline(void);
 void u_undoline(void);
 void u_blockfree(buf_T *buf);
+void u_memory_stats(buf_T *buf, memoryStats_T *stats);
 int bufIsChanged(buf_T *buf);
 int anyBufIsChanged(void);
 int bufIsChangedNotTerm(buf_T *buf);
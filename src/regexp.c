@@ -341,8 +341,8 @@ toggle_Magic(int x)
 
 #define MAX_LIMIT (32767L << 16L)
 
-static int cstrncmp(char_u *s1, char_u *s2, int *n);
-static char_u *cstrchr(char_u *, int);
+static int cstrncmp(regexec_T *rex, char_u *s1, char_u *s2, int *n);
+static char_u *cstrchr(regexec_T *rex, char_u *, int);
 
 #ifdef BT_REGEXP_DUMP
 static void regdump(char_u *, bt_regprog_T *);
@@ -589,9 +589,6 @@ static long regsize;                 /* Code size. */
 static int reg_toolong;              /* TRUE when offset out of range */
 static char_u had_endbrace[NSUBEXP]; /* flags, TRUE if end of () found */
 static unsigned regflags;            /* RF_ flags for prog */
-static long brace_min[10];           /* Minimums for complex brace repeats */
-static long brace_max[10];           /* Maximums for complex brace repeats */
-static int brace_count[10];          /* Current counts for complex brace repeats */
 static int one_exactly = FALSE;      /* only do one char for EXACTLY */
 
 static int reg_magic; /* magicness of the pattern: */
@@ -677,8 +674,9 @@ static char_u *regpiece(int *);
 static char_u *regatom(int *);
 static char_u *regnode(int);
 static int use_multibytecode(int c);
-static int prog_magic_wrong(void);
+static int prog_magic_wrong(regexec_T *rex);
 static char_u *regnext(char_u *);
+static char_u *regnext_prog(char_u *p);
 static void regc(int b);
 static void regmbc(int c);
 #define REGMBC(x) regmbc(x);
@@ -690,7 +688,7 @@ static char_u *re_put_long(char_u *pr, long_u val);
 static int read_limits(long *, long *);
 static void regtail(char_u *, char_u *);
 static void regoptail(char_u *, char_u *);
-static int reg_iswordc(int);
+static int reg_iswordc(regexec_T *rex, int);
 
 static regengine_T bt_regengine;
 static regengine_T nfa_regengine;
@@ -2913,7 +2911,7 @@ regatom(int *flagp)
             break;
           case CLASS_KEYWORD:
             for (cu = 1; cu <= 255; cu++)
-              if (reg_iswordc(cu))
+              if (vim_iswordc(cu))
                 regmbc(cu);
             break;
           case CLASS_FNAME:
@@ -3732,21 +3730,21 @@ typedef struct regbehind_S
   save_se_T save_end[NSUBEXP];
 } regbehind_T;
 
-static long bt_regexec_both(char_u *line, colnr_T col, proftime_T *tm, int *timed_out);
-static long regtry(bt_regprog_T *prog, colnr_T col, proftime_T *tm, int *timed_out);
-static void cleanup_subexpr(void);
-static void save_subexpr(regbehind_T *bp);
-static void restore_subexpr(regbehind_T *bp);
-static void reg_nextline(void);
-static void reg_save(regsave_T *save, garray_T *gap);
-static void reg_restore(regsave_T *save, garray_T *gap);
-static int reg_save_equal(regsave_T *save);
-static void save_se_multi(save_se_T *savep, lpos_T *posp);
-static void save_se_one(save_se_T *savep, char_u **pp);
+static long bt_regexec_both(regexec_T *rex, char_u *line, colnr_T col, proftime_T *tm, int *timed_out);
+static long regtry(regexec_T *rex, bt_regprog_T *prog, colnr_T col, proftime_T *tm, int *timed_out);
+static void cleanup_subexpr(regexec_T *rex);
+static void save_subexpr(regexec_T *rex, regbehind_T *bp);
+static void restore_subexpr(regexec_T *rex, regbehind_T *bp);
+static void reg_nextline(regexec_T *rex);
+static void reg_save(regexec_T *rex, regsave_T *save, garray_T *gap);
+static void reg_restore(regexec_T *rex, regsave_T *save, garray_T *gap);
+static int reg_save_equal(regexec_T *rex, regsave_T *save);
+static void save_se_multi(regexec_T *rex, save_se_T *savep, lpos_T *posp);
+static void save_se_one(regexec_T *rex, save_se_T *savep, char_u **pp);
 
 /* Save the sub-expressions before attempting a match. */
 #define save_se(savep, posp, pp) \
-  REG_MULTI ? save_se_multi((savep), (posp)) : save_se_one((savep), (pp))
+  REG_MULTI ? save_se_multi(rex, (savep), (posp)) : save_se_one(rex, (savep), (pp))
 
 /* After a failed match restore the sub-expressions. */
 #define restore_se(savep, posp, pp) \
@@ -3758,22 +3756,14 @@ static void save_se_one(save_se_T *savep, char_u **pp);
   }
 
 static int re_num_cmp(long_u val, char_u *scan);
-static int match_with_backref(linenr_T start_lnum, colnr_T start_col, linenr_T end_lnum, colnr_T end_col, int *bytelen);
-static int regmatch(char_u *prog, proftime_T *tm, int *timed_out);
-static int regrepeat(char_u *p, long maxcount);
+static int match_with_backref(regexec_T *rex, linenr_T start_lnum, colnr_T start_col, linenr_T end_lnum, colnr_T end_col, int *bytelen);
+static int regmatch(regexec_T *rex, char_u *prog, proftime_T *tm, int *timed_out);
+static int regrepeat(regexec_T *rex, char_u *p, long maxcount);
 
 #ifdef DEBUG
 int regnarrate = 0;
 #endif
 
-/*
- * Sometimes need to save a copy of a line.  Since alloc()/free() is very
- * slow, we keep one allocated piece of memory and only re-allocate it when
- * it's too small.  It's freed in bt_regexec_both() when finished.
- */
-static char_u *reg_tofree = NULL;
-static unsigned reg_tofreelen;
-
 /*
  * Structure used to store the execution state of the regex engine.
  * Which ones are set depends on whether a single-line or multi-line match is
@@ -3791,7 +3781,7 @@ static unsigned reg_tofreelen;
  * reg_maxline		0			last line nr
  * reg_line_lbr		FALSE or TRUE		FALSE
  */
-typedef struct
+struct regexec_S
 {
   regmatch_T *reg_match;
   regmmatch_T *reg_mmatch;
@@ -3836,12 +3826,117 @@ typedef struct
   // all the states.
   int nfa_listid;
   int nfa_alt_listid;
+  int nfa_match; // whether a match has been found
+#ifdef FEAT_RELTIME
+  proftime_T *nfa_time_limit;
+  int *nfa_timed_out;
+  int nfa_time_count;
+#endif
+  save_se_T *nfa_endp; // if not NULL match must end at this position
+  int nfa_ll_index;    // 0 for first call to nfa_regmatch(), 1 for
+                       // recursive call
+  int nfa_addstate_depth; // recursion depth of addstate()
+  struct regsubs_S *nfa_temp_subs; // used by addstate()
+
+  // Sometimes need to save a copy of a line.  Since alloc()/free() is very
+  // slow, we keep one allocated piece of memory and only re-allocate it when
+  // it's too small.  It's freed in bt_regexec_both() when finished.
+  char_u *reg_tofree;
+  unsigned reg_tofreelen;
+
+  // Used by regmatch(), see below.
+  garray_T regstack;
+  garray_T backpos;
+  regsave_T behind_pos;
+
+  // The arguments from BRACE_LIMITS.  They are actually local to regmatch(),
+  // but they are here to reduce the amount of stack space used (it can be
+  // called recursively many times).
+  long bl_minval;
+  long bl_maxval;
+
+  // Minimums, maximums and current counts for complex brace repeats.
+  long brace_min[10];
+  long brace_max[10];
+  int brace_count[10];
+
+  // When not NULL lines are obtained with this function instead of from
+  // "reg_buf", see vim_regexec_ctx_set_getline().
+  char_u *(*reg_getline_func)(linenr_T lnum, void *cookie);
+  void *reg_getline_cookie;
+  linenr_T reg_getline_count; // number of lines "reg_getline_func" has
+
+  // The match may be running in another thread: don't check for typed keys
+  // and don't give messages.
+  int reg_no_ui;
+  int reg_error; // a message was not given because of "reg_no_ui"
+};
 
-} regexec_T;
-
-static regexec_T rex;
+// Used for matching in the main thread, vim_regexec_ctx_alloc() creates
+// another one.
+static regexec_T rex_main;
 static int rex_in_use = FALSE;
 
+/*
+ * Get the regexec_T for matching in the main thread.  When it is already in
+ * use, e.g. when evaluating "\=" in a substitute, "local" is cleared and used
+ * instead.  Call rex_release() when done.
+ */
+static regexec_T *
+rex_get(regexec_T *local)
+{
+  if (!rex_in_use)
+  {
+    rex_in_use = TRUE;
+    return &rex_main;
+  }
+  vim_memset(local, 0, sizeof(regexec_T));
+  return local;
+}
+
+/*
+ * Free the memory kept in "rex" for the next match.
+ */
+static void
+rex_clear(regexec_T *rex)
+{
+  ga_clear(&rex->regstack);
+  ga_clear(&rex->backpos);
+  VIM_CLEAR(rex->reg_tofree);
+  VIM_CLEAR(rex->nfa_temp_subs);
+}
+
+static void
+rex_release(regexec_T *rex)
+{
+  if (rex == &rex_main)
+    rex_in_use = FALSE;
+  else
+    rex_clear(rex);
+}
+
+/*
+ * Give error message "msg", unless matching in another thread.
+ */
+static void
+rex_emsg(regexec_T *rex, char *msg)
+{
+  if (rex->reg_no_ui)
+    rex->reg_error = TRUE;
+  else
+    emsg(msg);
+}
+
+/*
+ * Allow interrupting with CTRL-C, unless matching in another thread.
+ */
+static void
+reg_breakcheck(regexec_T *rex)
+{
+  if (!rex->reg_no_ui)
+    fast_breakcheck();
+}
+
 /* Values for rs_state in regitem_T. */
 typedef enum regstate_E
 {
@@ -3885,11 +3980,11 @@ typedef struct regitem_S
   {
     save_se_T sesave;
     regsave_T regsave;
-  } rs_un; // room for saving rex.input
+  } rs_un; // room for saving rex->input
 } regitem_T;
 
-static regitem_T *regstack_push(regstate_T state, char_u *scan);
-static void regstack_pop(char_u **scan);
+static regitem_T *regstack_push(regexec_T *rex, regstate_T state, char_u *scan);
+static void regstack_pop(regexec_T *rex, char_u **scan);
 
 /* used for STAR, PLUS and BRACE_SIMPLE matching */
 typedef struct regstar_S
@@ -3910,14 +4005,12 @@ typedef struct backpos_S
 } backpos_T;
 
 /*
- * "regstack" and "backpos" are used by regmatch().  They are kept over calls
- * to avoid invoking malloc() and free() often.
+ * "regstack" and "backpos" in regexec_T are used by regmatch().  They are
+ * kept over calls to avoid invoking malloc() and free() often.
  * "regstack" is a stack with regitem_T items, sometimes preceded by regstar_T
  * or regbehind_T.
  * "backpos_T" is a table with backpos_T for BACK
  */
-static garray_T regstack = {0, 0, 0, 0, NULL};
-static garray_T backpos = {0, 0, 0, 0, NULL};
 
 /*
  * Both for regstack and backpos tables we use the following strategy of
@@ -3936,9 +4029,8 @@ static garray_T backpos = {0, 0, 0, 0, NULL};
 #if defined(EXITFREE) || defined(PROTO)
 void free_regexp_stuff(void)
 {
-  ga_clear(&regstack);
-  ga_clear(&backpos);
-  vim_free(reg_tofree);
+  vim_regcomp_cache_clear();
+  rex_clear(&rex_main);
   vim_free(reg_prev_sub);
 }
 #endif
@@ -3948,31 +4040,43 @@ void free_regexp_stuff(void)
  * "reg_buf" buffer.
  */
 static int
-reg_iswordc(int c)
+reg_iswordc(regexec_T *rex, int c)
 {
-  return vim_iswordc_buf(c, rex.reg_buf);
+  return vim_iswordc_buf(c, rex->reg_buf);
 }
 
 /*
  * Get pointer to the line "lnum", which is relative to "reg_firstlnum".
  */
 static char_u *
-reg_getline(linenr_T lnum)
+reg_getline(regexec_T *rex, linenr_T lnum)
 {
   /* when looking behind for a match/no-match lnum is negative.  But we
      * can't go before line 1 */
-  if (rex.reg_firstlnum + lnum < 1)
+  if (rex->reg_firstlnum + lnum < 1)
     return NULL;
-  if (lnum > rex.reg_maxline)
+  if (lnum > rex->reg_maxline)
     /* Must have matched the "\n" in the last line. */
     return (char_u *)"";
-  return ml_get_buf(rex.reg_buf, rex.reg_firstlnum + lnum, FALSE);
+  if (rex->reg_getline_func != NULL)
+    return rex->reg_getline_func(rex->reg_firstlnum + lnum,
+                                 rex->reg_getline_cookie);
+  return ml_get_buf(rex->reg_buf, rex->reg_firstlnum + lnum, FALSE);
 }
 
-static regsave_T behind_pos;
+/*
+ * Get the number of lines of the text being matched.
+ */
+static linenr_T
+reg_line_count(regexec_T *rex)
+{
+  if (rex->reg_getline_func != NULL)
+    return rex->reg_getline_count;
+  return rex->reg_buf->b_ml.ml_line_count;
+}
 
 /* TRUE if using multi-line regexp. */
-#define REG_MULTI (rex.reg_match == NULL)
+#define REG_MULTI (rex->reg_match == NULL)
 
 /*
  * Match a regexp against a string.
@@ -3984,22 +4088,23 @@ static regsave_T behind_pos;
  */
 static int
 bt_regexec_nl(
+    regexec_T *rex,
     regmatch_T *rmp,
     char_u *line, /* string to match against */
     colnr_T col,  /* column to start looking for match */
     int line_lbr)
 {
-  rex.reg_match = rmp;
-  rex.reg_mmatch = NULL;
-  rex.reg_maxline = 0;
-  rex.reg_line_lbr = line_lbr;
-  rex.reg_buf = curbuf;
-  rex.reg_win = NULL;
-  rex.reg_ic = rmp->rm_ic;
-  rex.reg_icombine = FALSE;
-  rex.reg_maxcol = 0;
-
-  return bt_regexec_both(line, col, NULL, NULL);
+  rex->reg_match = rmp;
+  rex->reg_mmatch = NULL;
+  rex->reg_maxline = 0;
+  rex->reg_line_lbr = line_lbr;
+  rex->reg_buf = curbuf;
+  rex->reg_win = NULL;
+  rex->reg_ic = rmp->rm_ic;
+  rex->reg_icombine = FALSE;
+  rex->reg_maxcol = 0;
+
+  return bt_regexec_both(rex, line, col, NULL, NULL);
 }
 
 /*
@@ -4012,6 +4117,7 @@ bt_regexec_nl(
  */
 static long
 bt_regexec_multi(
+    regexec_T *rex,
     regmmatch_T *rmp,
     win_T *win,     /* window in which to search or NULL */
     buf_T *buf,     /* buffer in which to search */
@@ -4020,18 +4126,18 @@ bt_regexec_multi(
     proftime_T *tm, /* timeout limit or NULL */
     int *timed_out) /* flag set on timeout or NULL */
 {
-  rex.reg_match = NULL;
-  rex.reg_mmatch = rmp;
-  rex.reg_buf = buf;
-  rex.reg_win = win;
-  rex.reg_firstlnum = lnum;
-  rex.reg_maxline = rex.reg_buf->b_ml.ml_line_count - lnum;
-  rex.reg_line_lbr = FALSE;
-  rex.reg_ic = rmp->rmm_ic;
-  rex.reg_icombine = FALSE;
-  rex.reg_maxcol = rmp->rmm_maxcol;
-
-  return bt_regexec_both(NULL, col, tm, timed_out);
+  rex->reg_match = NULL;
+  rex->reg_mmatch = rmp;
+  rex->reg_buf = buf;
+  rex->reg_win = win;
+  rex->reg_firstlnum = lnum;
+  rex->reg_maxline = reg_line_count(rex) - lnum;
+  rex->reg_line_lbr = FALSE;
+  rex->reg_ic = rmp->rmm_ic;
+  rex->reg_icombine = FALSE;
+  rex->reg_maxcol = rmp->rmm_maxcol;
+
+  return bt_regexec_both(rex, NULL, col, tm, timed_out);
 }
 
 /*
@@ -4041,6 +4147,7 @@ bt_regexec_multi(
  */
 static long
 bt_regexec_both(
+    regexec_T *rex,
     char_u *line,
     colnr_T col,    /* column to start looking for match */
     proftime_T *tm, /* timeout limit or NULL */
@@ -4054,60 +4161,60 @@ bt_regexec_both(
      * We allocate *_INITIAL amount of bytes first and then set the grow size
      * to much bigger value to avoid many malloc calls in case of deep regular
      * expressions.  */
-  if (regstack.ga_data == NULL)
+  if (rex->regstack.ga_data == NULL)
   {
     /* Use an item size of 1 byte, since we push different things
 	 * onto the regstack. */
-    ga_init2(&regstack, 1, REGSTACK_INITIAL);
-    (void)ga_grow(&regstack, REGSTACK_INITIAL);
-    regstack.ga_growsize = REGSTACK_INITIAL * 8;
+    ga_init2(&rex->regstack, 1, REGSTACK_INITIAL);
+    (void)ga_grow(&rex->regstack, REGSTACK_INITIAL);
+    rex->regstack.ga_growsize = REGSTACK_INITIAL * 8;
   }
 
-  if (backpos.ga_data == NULL)
+  if (rex->backpos.ga_data == NULL)
   {
-    ga_init2(&backpos, sizeof(backpos_T), BACKPOS_INITIAL);
-    (void)ga_grow(&backpos, BACKPOS_INITIAL);
-    backpos.ga_growsize = BACKPOS_INITIAL * 8;
+    ga_init2(&rex->backpos, sizeof(backpos_T), BACKPOS_INITIAL);
+    (void)ga_grow(&rex->backpos, BACKPOS_INITIAL);
+    rex->backpos.ga_growsize = BACKPOS_INITIAL * 8;
   }
 
   if (REG_MULTI)
   {
-    prog = (bt_regprog_T *)rex.reg_mmatch->regprog;
-    line = reg_getline((linenr_T)0);
-    rex.reg_startpos = rex.reg_mmatch->startpos;
-    rex.reg_endpos = rex.reg_mmatch->endpos;
+    prog = (bt_regprog_T *)rex->reg_mmatch->regprog;
+    line = reg_getline(rex, (linenr_T)0);
+    rex->reg_startpos = rex->reg_mmatch->startpos;
+    rex->reg_endpos = rex->reg_mmatch->endpos;
   }
   else
   {
-    prog = (bt_regprog_T *)rex.reg_match->regprog;
-    rex.reg_startp = rex.reg_match->startp;
-    rex.reg_endp = rex.reg_match->endp;
+    prog = (bt_regprog_T *)rex->reg_match->regprog;
+    rex->reg_startp = rex->reg_match->startp;
+    rex->reg_endp = rex->reg_match->endp;
   }
 
   /* Be paranoid... */
   if (prog == NULL || line == NULL)
   {
-    emsg(_(e_null));
+    rex_emsg(rex, _(e_null));
     goto theend;
   }
 
   /* Check validity of program. */
-  if (prog_magic_wrong())
+  if (prog_magic_wrong(rex))
     goto theend;
 
   /* If the start column is past the maximum column: no need to try. */
-  if (rex.reg_maxcol > 0 && col >= rex.reg_maxcol)
+  if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
     goto theend;
 
   /* If pattern contains "\c" or "\C": overrule value of rex.reg_ic */
   if (prog->regflags & RF_ICASE)
-    rex.reg_ic = TRUE;
+    rex->reg_ic = TRUE;
   else if (prog->regflags & RF_NOICASE)
-    rex.reg_ic = FALSE;
+    rex->reg_ic = FALSE;
 
   /* If pattern contains "\Z" overrule value of rex.reg_icombine */
   if (prog->regflags & RF_ICOMBINE)
-    rex.reg_icombine = TRUE;
+    rex->reg_icombine = TRUE;
 
   /* If there is a "must appear" string, look for it. */
   if (prog->regmust != NULL)
@@ -4124,24 +4231,24 @@ bt_regexec_both(
 	 * This is used very often, esp. for ":global".  Use three versions of
 	 * the loop to avoid overhead of conditions.
 	 */
-    if (!rex.reg_ic && !has_mbyte)
+    if (!rex->reg_ic && !has_mbyte)
       while ((s = vim_strbyte(s, c)) != NULL)
       {
-        if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
+        if (cstrncmp(rex, s, prog->regmust, &prog->regmlen) == 0)
           break; /* Found it. */
         ++s;
       }
-    else if (!rex.reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
+    else if (!rex->reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
       while ((s = vim_strchr(s, c)) != NULL)
       {
-        if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
+        if (cstrncmp(rex, s, prog->regmust, &prog->regmlen) == 0)
           break; /* Found it. */
         MB_PTR_ADV(s);
       }
     else
-      while ((s = cstrchr(s, c)) != NULL)
+      while ((s = cstrchr(rex, s, c)) != NULL)
       {
-        if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
+        if (cstrncmp(rex, s, prog->regmust, &prog->regmlen) == 0)
           break; /* Found it. */
         MB_PTR_ADV(s);
       }
@@ -4149,9 +4256,8 @@ bt_regexec_both(
       goto theend;
   }
 
-  rex.line = line;
-  rex.lnum = 0;
-  reg_toolong = FALSE;
+  rex->line = line;
+  rex->lnum = 0;
 
   /* Simplest case: Anchored match need be tried only once. */
   if (prog->reganch)
@@ -4159,11 +4265,11 @@ bt_regexec_both(
     int c;
 
     if (has_mbyte)
-      c = (*mb_ptr2char)(rex.line + col);
+      c = (*mb_ptr2char)(rex->line + col);
     else
-      c = rex.line[col];
-    if (prog->regstart == NUL || prog->regstart == c || (rex.reg_ic && (((enc_utf8 && utf_fold(prog->regstart) == utf_fold(c))) || (c < 255 && prog->regstart < 255 && MB_TOLOWER(prog->regstart) == MB_TOLOWER(c)))))
-      retval = regtry(prog, col, tm, timed_out);
+      c = rex->line[col];
+    if (prog->regstart == NUL || prog->regstart == c || (rex->reg_ic && (((enc_utf8 && utf_fold(prog->regstart) == utf_fold(c))) || (c < 255 && prog->regstart < 255 && MB_TOLOWER(prog->regstart) == MB_TOLOWER(c)))))
+      retval = regtry(rex, prog, col, tm, timed_out);
     else
       retval = 0;
   }
@@ -4179,39 +4285,39 @@ bt_regexec_both(
       {
         /* Skip until the char we know it must start with.
 		 * Used often, do some work to avoid call overhead. */
-        if (!rex.reg_ic && !has_mbyte)
-          s = vim_strbyte(rex.line + col, prog->regstart);
+        if (!rex->reg_ic && !has_mbyte)
+          s = vim_strbyte(rex->line + col, prog->regstart);
         else
-          s = cstrchr(rex.line + col, prog->regstart);
+          s = cstrchr(rex, rex->line + col, prog->regstart);
         if (s == NULL)
         {
           retval = 0;
           break;
         }
-        col = (int)(s - rex.line);
+        col = (int)(s - rex->line);
       }
 
       /* Check for maximum column to try. */
-      if (rex.reg_maxcol > 0 && col >= rex.reg_maxcol)
+      if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
       {
         retval = 0;
         break;
       }
 
-      retval = regtry(prog, col, tm, timed_out);
+      retval = regtry(rex, prog, col, tm, timed_out);
       if (retval > 0)
         break;
 
       /* if not currently on the first line, get it again */
-      if (rex.lnum != 0)
+      if (rex->lnum != 0)
       {
-        rex.lnum = 0;
-        rex.line = reg_getline((linenr_T)0);
+        rex->lnum = 0;
+        rex->line = reg_getline(rex, (linenr_T)0);
       }
-      if (rex.line[col] == NUL)
+      if (rex->line[col] == NUL)
         break;
       if (has_mbyte)
-        col += (*mb_ptr2len)(rex.line + col);
+        col += (*mb_ptr2len)(rex->line + col);
       else
         ++col;
 #ifdef FEAT_RELTIME
@@ -4233,12 +4339,12 @@ bt_regexec_both(
 theend:
   /* Free "reg_tofree" when it's a bit big.
      * Free regstack and backpos if they are bigger than their initial size. */
-  if (reg_tofreelen > 400)
-    VIM_CLEAR(reg_tofree);
-  if (regstack.ga_maxlen > REGSTACK_INITIAL)
-    ga_clear(&regstack);
-  if (backpos.ga_maxlen > BACKPOS_INITIAL)
-    ga_clear(&backpos);
+  if (rex->reg_tofreelen > 400)
+    VIM_CLEAR(rex->reg_tofree);
+  if (rex->regstack.ga_maxlen > REGSTACK_INITIAL)
+    ga_clear(&rex->regstack);
+  if (rex->backpos.ga_maxlen > BACKPOS_INITIAL)
+    ga_clear(&rex->backpos);
 
   return retval;
 }
@@ -4249,52 +4355,53 @@ theend:
  */
 static long
 regtry(
+    regexec_T *rex,
     bt_regprog_T *prog,
     colnr_T col,
     proftime_T *tm, /* timeout limit or NULL */
     int *timed_out) /* flag set on timeout or NULL */
 {
-  rex.input = rex.line + col;
-  rex.need_clear_subexpr = TRUE;
+  rex->input = rex->line + col;
+  rex->need_clear_subexpr = TRUE;
 
-  if (regmatch(prog->program + 1, tm, timed_out) == 0)
+  if (regmatch(rex, prog->program + 1, tm, timed_out) == 0)
     return 0;
 
-  cleanup_subexpr();
+  cleanup_subexpr(rex);
   if (REG_MULTI)
   {
-    if (rex.reg_startpos[0].lnum < 0)
+    if (rex->reg_startpos[0].lnum < 0)
     {
-      rex.reg_startpos[0].lnum = 0;
-      rex.reg_startpos[0].col = col;
+      rex->reg_startpos[0].lnum = 0;
+      rex->reg_startpos[0].col = col;
     }
-    if (rex.reg_endpos[0].lnum < 0)
+    if (rex->reg_endpos[0].lnum < 0)
     {
-      rex.reg_endpos[0].lnum = rex.lnum;
-      rex.reg_endpos[0].col = (int)(rex.input - rex.line);
+      rex->reg_endpos[0].lnum = rex->lnum;
+      rex->reg_endpos[0].col = (int)(rex->input - rex->line);
     }
     else
       /* Use line number of "\ze". */
-      rex.lnum = rex.reg_endpos[0].lnum;
+      rex->lnum = rex->reg_endpos[0].lnum;
   }
   else
   {
-    if (rex.reg_startp[0] == NULL)
-      rex.reg_startp[0] = rex.line + col;
-    if (rex.reg_endp[0] == NULL)
-      rex.reg_endp[0] = rex.input;
+    if (rex->reg_startp[0] == NULL)
+      rex->reg_startp[0] = rex->line + col;
+    if (rex->reg_endp[0] == NULL)
+      rex->reg_endp[0] = rex->input;
   }
-  return 1 + rex.lnum;
+  return 1 + rex->lnum;
 }
 
 /*
  * Get class of previous character.
  */
 static int
-reg_prev_class(void)
+reg_prev_class(regexec_T *rex)
 {
-  if (rex.input > rex.line)
-    return mb_get_class_buf(rex.input - 1 - (*mb_head_off)(rex.line, rex.input - 1), rex.reg_buf);
+  if (rex->input > rex->line)
+    return mb_get_class_buf(rex->input - 1 - (*mb_head_off)(rex->line, rex->input - 1), rex->reg_buf);
   return -1;
 }
 
@@ -4302,19 +4409,19 @@ reg_prev_class(void)
  * Return TRUE if the current rex.input position matches the Visual area.
  */
 static int
-reg_match_visual(void)
+reg_match_visual(regexec_T *rex)
 {
   pos_T top, bot;
   linenr_T lnum;
   colnr_T col;
-  win_T *wp = rex.reg_win == NULL ? curwin : rex.reg_win;
+  win_T *wp = rex->reg_win == NULL ? curwin : rex->reg_win;
   int mode;
   colnr_T start, end;
   colnr_T start2, end2;
   colnr_T cols;
 
   /* Check if the buffer is the current buffer. */
-  if (rex.reg_buf != curbuf || VIsual.lnum == 0)
+  if (rex->reg_buf != curbuf || VIsual.lnum == 0)
     return FALSE;
 
   if (VIsual_active)
@@ -4345,13 +4452,13 @@ reg_match_visual(void)
     }
     mode = curbuf->b_visual.vi_mode;
   }
-  lnum = rex.lnum + rex.reg_firstlnum;
+  lnum = rex->lnum + rex->reg_firstlnum;
   if (lnum < top.lnum || lnum > bot.lnum)
     return FALSE;
 
   if (mode == 'v')
   {
-    col = (colnr_T)(rex.input - rex.line);
+    col = (colnr_T)(rex->input - rex->line);
     if ((lnum == top.lnum && col < top.col) || (lnum == bot.lnum && col >= bot.col + (*p_sel != 'e')))
       return FALSE;
   }
@@ -4365,22 +4472,14 @@ reg_match_visual(void)
       end = end2;
     if (top.col == MAXCOL || bot.col == MAXCOL)
       end = MAXCOL;
-    cols = win_linetabsize(wp, rex.line, (colnr_T)(rex.input - rex.line));
+    cols = win_linetabsize(wp, rex->line, (colnr_T)(rex->input - rex->line));
     if (cols < start || cols > end - (*p_sel == 'e'))
       return FALSE;
   }
   return TRUE;
 }
 
-#define ADVANCE_REGINPUT() MB_PTR_ADV(rex.input)
-
-/*
- * The arguments from BRACE_LIMITS are stored here.  They are actually local
- * to regmatch(), but they are here to reduce the amount of stack space used
- * (it can be called recursively many times).
- */
-static long bl_minval;
-static long bl_maxval;
+#define ADVANCE_REGINPUT() MB_PTR_ADV(rex->input)
 
 /*
  * regmatch - main matching routine
@@ -4399,6 +4498,7 @@ static long bl_maxval;
  */
 static int
 regmatch(
+    regexec_T *rex,
     char_u *scan,          /* Current node. */
     proftime_T *tm UNUSED, /* timeout limit or NULL */
     int *timed_out UNUSED) /* flag set on timeout or NULL */
@@ -4420,8 +4520,8 @@ regmatch(
 
   /* Make "regstack" and "backpos" empty.  They are allocated and freed in
    * bt_regexec_both() to reduce malloc()/free() calls. */
-  regstack.ga_len = 0;
-  backpos.ga_len = 0;
+  rex->regstack.ga_len = 0;
+  rex->backpos.ga_len = 0;
 
   /*
    * Repeat until "regstack" is empty.
@@ -4430,7 +4530,7 @@ regmatch(
   {
     /* Some patterns may take a long time to match, e.g., "\([a-z]\+\)\+Q".
      * Allow interrupting them with CTRL-C. */
-    fast_breakcheck();
+    reg_breakcheck(rex);
 
 #ifdef DEBUG
     if (scan != NULL && regnarrate)
@@ -4474,15 +4574,15 @@ regmatch(
         mch_errmsg("...\n");
       }
 #endif
-      next = regnext(scan);
+      next = regnext_prog(scan);
 
       op = OP(scan);
       /* Check for character class with NL added. */
-      if (!rex.reg_line_lbr && WITH_NL(op) && REG_MULTI && *rex.input == NUL && rex.lnum <= rex.reg_maxline)
+      if (!rex->reg_line_lbr && WITH_NL(op) && REG_MULTI && *rex->input == NUL && rex->lnum <= rex->reg_maxline)
       {
-        reg_nextline();
+        reg_nextline(rex);
       }
-      else if (rex.reg_line_lbr && WITH_NL(op) && *rex.input == '\n')
+      else if (rex->reg_line_lbr && WITH_NL(op) && *rex->input == '\n')
       {
         ADVANCE_REGINPUT();
       }
@@ -4491,13 +4591,13 @@ regmatch(
         if (WITH_NL(op))
           op -= ADD_NL;
         if (has_mbyte)
-          c = (*mb_ptr2char)(rex.input);
+          c = (*mb_ptr2char)(rex->input);
         else
-          c = *rex.input;
+          c = *rex->input;
         switch (op)
         {
         case BOL:
-          if (rex.input != rex.line)
+          if (rex->input != rex->line)
             status = RA_NOMATCH;
           break;
 
@@ -4510,19 +4610,19 @@ regmatch(
           /* We're not at the beginning of the file when below the first
 	     * line where we started, not at the start of the line or we
 	     * didn't start at the first line of the buffer. */
-          if (rex.lnum != 0 || rex.input != rex.line || (REG_MULTI && rex.reg_firstlnum > 1))
+          if (rex->lnum != 0 || rex->input != rex->line || (REG_MULTI && rex->reg_firstlnum > 1))
             status = RA_NOMATCH;
           break;
 
         case RE_EOF:
-          if (rex.lnum != rex.reg_maxline || c != NUL)
+          if (rex->lnum != rex->reg_maxline || c != NUL)
             status = RA_NOMATCH;
           break;
 
         case CURSOR:
           /* Check if the buffer is in a window and compare the
 	     * rex.reg_win->w_cursor position to the match position. */
-          if (rex.reg_win == NULL || (rex.lnum + rex.reg_firstlnum != rex.reg_win->w_cursor.lnum) || ((colnr_T)(rex.input - rex.line) != rex.reg_win->w_cursor.col))
+          if (rex->reg_win == NULL || (rex->lnum + rex->reg_firstlnum != rex->reg_win->w_cursor.lnum) || ((colnr_T)(rex->input - rex->line) != rex->reg_win->w_cursor.col))
             status = RA_NOMATCH;
           break;
 
@@ -4533,16 +4633,16 @@ regmatch(
             int cmp = OPERAND(scan)[1];
             pos_T *pos;
 
-            pos = getmark_buf(rex.reg_buf, mark, FALSE);
+            pos = getmark_buf(rex->reg_buf, mark, FALSE);
             if (pos == NULL       /* mark doesn't exist */
                 || pos->lnum <= 0 /* mark isn't set in reg_buf */
-                || (pos->lnum == rex.lnum + rex.reg_firstlnum
-                        ? (pos->col == (colnr_T)(rex.input - rex.line)
+                || (pos->lnum == rex->lnum + rex->reg_firstlnum
+                        ? (pos->col == (colnr_T)(rex->input - rex->line)
                                ? (cmp == '<' || cmp == '>')
-                               : (pos->col < (colnr_T)(rex.input - rex.line)
+                               : (pos->col < (colnr_T)(rex->input - rex->line)
                                       ? cmp != '>'
                                       : cmp != '<'))
-                        : (pos->lnum < rex.lnum + rex.reg_firstlnum
+                        : (pos->lnum < rex->lnum + rex->reg_firstlnum
                                ? cmp != '>'
                                : cmp != '<')))
               status = RA_NOMATCH;
@@ -4550,25 +4650,25 @@ regmatch(
           break;
 
         case RE_VISUAL:
-          if (!reg_match_visual())
+          if (!reg_match_visual(rex))
             status = RA_NOMATCH;
           break;
 
         case RE_LNUM:
-          if (!REG_MULTI || !re_num_cmp((long_u)(rex.lnum + rex.reg_firstlnum),
+          if (!REG_MULTI || !re_num_cmp((long_u)(rex->lnum + rex->reg_firstlnum),
                                         scan))
             status = RA_NOMATCH;
           break;
 
         case RE_COL:
-          if (!re_num_cmp((long_u)(rex.input - rex.line) + 1, scan))
+          if (!re_num_cmp((long_u)(rex->input - rex->line) + 1, scan))
             status = RA_NOMATCH;
           break;
 
         case RE_VCOL:
           if (!re_num_cmp((long_u)win_linetabsize(
-                              rex.reg_win == NULL ? curwin : rex.reg_win,
-                              rex.line, (colnr_T)(rex.input - rex.line)) +
+                              rex->reg_win == NULL ? curwin : rex->reg_win,
+                              rex->line, (colnr_T)(rex->input - rex->line)) +
                               1,
                           scan))
             status = RA_NOMATCH;
@@ -4582,35 +4682,35 @@ regmatch(
             int this_class;
 
             /* Get class of current and previous char (if it exists). */
-            this_class = mb_get_class_buf(rex.input, rex.reg_buf);
+            this_class = mb_get_class_buf(rex->input, rex->reg_buf);
             if (this_class <= 1)
               status = RA_NOMATCH; /* not on a word at all */
-            else if (reg_prev_class() == this_class)
+            else if (reg_prev_class(rex) == this_class)
               status = RA_NOMATCH; /* previous char is in same word */
           }
           else
           {
-            if (!vim_iswordc_buf(c, rex.reg_buf) || (rex.input > rex.line && vim_iswordc_buf(rex.input[-1], rex.reg_buf)))
+            if (!vim_iswordc_buf(c, rex->reg_buf) || (rex->input > rex->line && vim_iswordc_buf(rex->input[-1], rex->reg_buf)))
               status = RA_NOMATCH;
           }
           break;
 
         case EOW:                    /* word\>; rex.input points after d */
-          if (rex.input == rex.line) /* Can't match at start of line */
+          if (rex->input == rex->line) /* Can't match at start of line */
             status = RA_NOMATCH;
           else if (has_mbyte)
           {
             int this_class, prev_class;
 
             /* Get class of current and previous char (if it exists). */
-            this_class = mb_get_class_buf(rex.input, rex.reg_buf);
-            prev_class = reg_prev_class();
+            this_class = mb_get_class_buf(rex->input, rex->reg_buf);
+            prev_class = reg_prev_class(rex);
             if (this_class == prev_class || prev_class == 0 || prev_class == 1)
               status = RA_NOMATCH;
           }
           else
           {
-            if (!vim_iswordc_buf(rex.input[-1], rex.reg_buf) || (rex.input[0] != NUL && vim_iswordc_buf(c, rex.reg_buf)))
+            if (!vim_iswordc_buf(rex->input[-1], rex->reg_buf) || (rex->input[0] != NUL && vim_iswordc_buf(c, rex->reg_buf)))
               status = RA_NOMATCH;
           }
           break; /* Matched with EOW */
@@ -4631,21 +4731,21 @@ regmatch(
           break;
 
         case SIDENT:
-          if (VIM_ISDIGIT(*rex.input) || !vim_isIDc(c))
+          if (VIM_ISDIGIT(*rex->input) || !vim_isIDc(c))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
           break;
 
         case KWORD:
-          if (!vim_iswordp_buf(rex.input, rex.reg_buf))
+          if (!vim_iswordp_buf(rex->input, rex->reg_buf))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
           break;
 
         case SKWORD:
-          if (VIM_ISDIGIT(*rex.input) || !vim_iswordp_buf(rex.input, rex.reg_buf))
+          if (VIM_ISDIGIT(*rex->input) || !vim_iswordp_buf(rex->input, rex->reg_buf))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
@@ -4659,21 +4759,21 @@ regmatch(
           break;
 
         case SFNAME:
-          if (VIM_ISDIGIT(*rex.input) || !vim_isfilec(c))
+          if (VIM_ISDIGIT(*rex->input) || !vim_isfilec(c))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
           break;
 
         case PRINT:
-          if (!vim_isprintc(PTR2CHAR(rex.input)))
+          if (!vim_isprintc(PTR2CHAR(rex->input)))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
           break;
 
         case SPRINT:
-          if (VIM_ISDIGIT(*rex.input) || !vim_isprintc(PTR2CHAR(rex.input)))
+          if (VIM_ISDIGIT(*rex->input) || !vim_isprintc(PTR2CHAR(rex->input)))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
@@ -4812,7 +4912,7 @@ regmatch(
 
           opnd = OPERAND(scan);
           /* Inline the first byte, for speed. */
-          if (*opnd != *rex.input && (!rex.reg_ic || (!enc_utf8 && MB_TOLOWER(*opnd) != MB_TOLOWER(*rex.input))))
+          if (*opnd != *rex->input && (!rex->reg_ic || (!enc_utf8 && MB_TOLOWER(*opnd) != MB_TOLOWER(*rex->input))))
             status = RA_NOMATCH;
           else if (*opnd == NUL)
           {
@@ -4821,7 +4921,7 @@ regmatch(
           }
           else
           {
-            if (opnd[1] == NUL && !(enc_utf8 && rex.reg_ic))
+            if (opnd[1] == NUL && !(enc_utf8 && rex->reg_ic))
             {
               len = 1; /* matched a single byte above */
             }
@@ -4829,12 +4929,12 @@ regmatch(
             {
               /* Need to match first byte again for multi-byte. */
               len = (int)STRLEN(opnd);
-              if (cstrncmp(opnd, rex.input, &len) != 0)
+              if (cstrncmp(rex, opnd, rex->input, &len) != 0)
                 status = RA_NOMATCH;
             }
             /* Check for following composing character, unless %C
 		     * follows (skips over all composing chars). */
-            if (status != RA_NOMATCH && enc_utf8 && UTF_COMPOSINGLIKE(rex.input, rex.input + len) && !rex.reg_icombine && OP(next) != RE_COMPOSING)
+            if (status != RA_NOMATCH && enc_utf8 && UTF_COMPOSINGLIKE(rex->input, rex->input + len) && !rex->reg_icombine && OP(next) != RE_COMPOSING)
             {
               /* raaron: This code makes a composing character get
 			 * ignored, which is the correct behavior (sometimes)
@@ -4842,7 +4942,7 @@ regmatch(
               status = RA_NOMATCH;
             }
             if (status != RA_NOMATCH)
-              rex.input += len;
+              rex->input += len;
           }
         }
         break;
@@ -4851,7 +4951,7 @@ regmatch(
         case ANYBUT:
           if (c == NUL)
             status = RA_NOMATCH;
-          else if ((cstrchr(OPERAND(scan), c) == NULL) == (op == ANYOF))
+          else if ((cstrchr(rex, OPERAND(scan), c) == NULL) == (op == ANYOF))
             status = RA_NOMATCH;
           else
             ADVANCE_REGINPUT();
@@ -4879,10 +4979,10 @@ regmatch(
               /* When only a composing char is given match at any
 		     * position where that composing char appears. */
               status = RA_NOMATCH;
-              for (i = 0; rex.input[i] != NUL;
-                   i += utf_ptr2len(rex.input + i))
+              for (i = 0; rex->input[i] != NUL;
+                   i += utf_ptr2len(rex->input + i))
               {
-                inpc = utf_ptr2char(rex.input + i);
+                inpc = utf_ptr2char(rex->input + i);
                 if (!utf_iscomposing(inpc))
                 {
                   if (i > 0)
@@ -4891,7 +4991,7 @@ regmatch(
                 else if (opndc == inpc)
                 {
                   /* Include all following composing chars. */
-                  len = i + utfc_ptr2len(rex.input + i);
+                  len = i + utfc_ptr2len(rex->input + i);
                   status = RA_MATCH;
                   break;
                 }
@@ -4899,12 +4999,12 @@ regmatch(
             }
             else
               for (i = 0; i < len; ++i)
-                if (opnd[i] != rex.input[i])
+                if (opnd[i] != rex->input[i])
                 {
                   status = RA_NOMATCH;
                   break;
                 }
-            rex.input += len;
+            rex->input += len;
           }
           else
             status = RA_NOMATCH;
@@ -4913,8 +5013,8 @@ regmatch(
           if (enc_utf8)
           {
             /* Skip composing characters. */
-            while (utf_iscomposing(utf_ptr2char(rex.input)))
-              MB_CPTR_ADV(rex.input);
+            while (utf_iscomposing(utf_ptr2char(rex->input)))
+              MB_CPTR_ADV(rex->input);
           }
           break;
 
@@ -4934,29 +5034,29 @@ regmatch(
 		 * The positions are stored in "backpos" and found by the
 		 * current value of "scan", the position in the RE program.
 		 */
-          bp = (backpos_T *)backpos.ga_data;
-          for (i = 0; i < backpos.ga_len; ++i)
+          bp = (backpos_T *)rex->backpos.ga_data;
+          for (i = 0; i < rex->backpos.ga_len; ++i)
             if (bp[i].bp_scan == scan)
               break;
-          if (i == backpos.ga_len)
+          if (i == rex->backpos.ga_len)
           {
             /* First time at this BACK, make room to store the pos. */
-            if (ga_grow(&backpos, 1) == FAIL)
+            if (ga_grow(&rex->backpos, 1) == FAIL)
               status = RA_FAIL;
             else
             {
               /* get "ga_data" again, it may have changed */
-              bp = (backpos_T *)backpos.ga_data;
+              bp = (backpos_T *)rex->backpos.ga_data;
               bp[i].bp_scan = scan;
-              ++backpos.ga_len;
+              ++rex->backpos.ga_len;
             }
           }
-          else if (reg_save_equal(&bp[i].bp_pos))
+          else if (reg_save_equal(rex, &bp[i].bp_pos))
             /* Still at same position as last time, fail. */
             status = RA_NOMATCH;
 
           if (status != RA_FAIL && status != RA_NOMATCH)
-            reg_save(&bp[i].bp_pos, &backpos);
+            reg_save(rex, &bp[i].bp_pos, &rex->backpos);
         }
         break;
 
@@ -4972,15 +5072,15 @@ regmatch(
         case MOPEN + 9:
         {
           no = op - MOPEN;
-          cleanup_subexpr();
-          rp = regstack_push(RS_MOPEN, scan);
+          cleanup_subexpr(rex);
+          rp = regstack_push(rex, RS_MOPEN, scan);
           if (rp == NULL)
             status = RA_FAIL;
           else
           {
             rp->rs_no = no;
-            save_se(&rp->rs_un.sesave, &rex.reg_startpos[no],
-                    &rex.reg_startp[no]);
+            save_se(&rp->rs_un.sesave, &rex->reg_startpos[no],
+                    &rex->reg_startp[no]);
             /* We simply continue and handle the result when done. */
           }
         }
@@ -4988,7 +5088,7 @@ regmatch(
 
         case NOPEN:  /* \%( */
         case NCLOSE: /* \) after \%( */
-          if (regstack_push(RS_NOPEN, scan) == NULL)
+          if (regstack_push(rex, RS_NOPEN, scan) == NULL)
             status = RA_FAIL;
           /* We simply continue and handle the result when done. */
           break;
@@ -5005,15 +5105,15 @@ regmatch(
         case MCLOSE + 9:
         {
           no = op - MCLOSE;
-          cleanup_subexpr();
-          rp = regstack_push(RS_MCLOSE, scan);
+          cleanup_subexpr(rex);
+          rp = regstack_push(rex, RS_MCLOSE, scan);
           if (rp == NULL)
             status = RA_FAIL;
           else
           {
             rp->rs_no = no;
-            save_se(&rp->rs_un.sesave, &rex.reg_endpos[no],
-                    &rex.reg_endp[no]);
+            save_se(&rp->rs_un.sesave, &rex->reg_endpos[no],
+                    &rex->reg_endp[no]);
             /* We simply continue and handle the result when done. */
           }
         }
@@ -5032,10 +5132,10 @@ regmatch(
           int len;
 
           no = op - BACKREF;
-          cleanup_subexpr();
+          cleanup_subexpr(rex);
           if (!REG_MULTI) /* Single-line regexp */
           {
-            if (rex.reg_startp[no] == NULL || rex.reg_endp[no] == NULL)
+            if (rex->reg_startp[no] == NULL || rex->reg_endp[no] == NULL)
             {
               /* Backref was not set: Match an empty string. */
               len = 0;
@@ -5044,26 +5144,26 @@ regmatch(
             {
               /* Compare current input with back-ref in the same
 			 * line. */
-              len = (int)(rex.reg_endp[no] - rex.reg_startp[no]);
-              if (cstrncmp(rex.reg_startp[no], rex.input, &len) != 0)
+              len = (int)(rex->reg_endp[no] - rex->reg_startp[no]);
+              if (cstrncmp(rex, rex->reg_startp[no], rex->input, &len) != 0)
                 status = RA_NOMATCH;
             }
           }
           else /* Multi-line regexp */
           {
-            if (rex.reg_startpos[no].lnum < 0 || rex.reg_endpos[no].lnum < 0)
+            if (rex->reg_startpos[no].lnum < 0 || rex->reg_endpos[no].lnum < 0)
             {
               /* Backref was not set: Match an empty string. */
               len = 0;
             }
             else
             {
-              if (rex.reg_startpos[no].lnum == rex.lnum && rex.reg_endpos[no].lnum == rex.lnum)
+              if (rex->reg_startpos[no].lnum == rex->lnum && rex->reg_endpos[no].lnum == rex->lnum)
               {
                 /* Compare back-ref within the current line. */
-                len = rex.reg_endpos[no].col - rex.reg_startpos[no].col;
-                if (cstrncmp(rex.line + rex.reg_startpos[no].col,
-                             rex.input, &len) != 0)
+                len = rex->reg_endpos[no].col - rex->reg_startpos[no].col;
+                if (cstrncmp(rex, rex->line + rex->reg_startpos[no].col,
+                             rex->input, &len) != 0)
                   status = RA_NOMATCH;
               }
               else
@@ -5071,10 +5171,11 @@ regmatch(
                 /* Messy situation: Need to compare between two
 			     * lines. */
                 int r = match_with_backref(
-                    rex.reg_startpos[no].lnum,
-                    rex.reg_startpos[no].col,
-                    rex.reg_endpos[no].lnum,
-                    rex.reg_endpos[no].col,
+                    rex,
+                    rex->reg_startpos[no].lnum,
+                    rex->reg_startpos[no].col,
+                    rex->reg_endpos[no].lnum,
+                    rex->reg_endpos[no].col,
                     &len);
 
                 if (r != RA_MATCH)
@@ -5084,7 +5185,7 @@ regmatch(
           }
 
           /* Matched the backref, skip over it. */
-          rex.input += len;
+          rex->input += len;
         }
         break;
 
@@ -5094,7 +5195,7 @@ regmatch(
             next = OPERAND(scan); /* Avoid recursion. */
           else
           {
-            rp = regstack_push(RS_BRANCH, scan);
+            rp = regstack_push(rex, RS_BRANCH, scan);
             if (rp == NULL)
               status = RA_FAIL;
             else
@@ -5107,15 +5208,15 @@ regmatch(
         {
           if (OP(next) == BRACE_SIMPLE)
           {
-            bl_minval = OPERAND_MIN(scan);
-            bl_maxval = OPERAND_MAX(scan);
+            rex->bl_minval = OPERAND_MIN(scan);
+            rex->bl_maxval = OPERAND_MAX(scan);
           }
           else if (OP(next) >= BRACE_COMPLEX && OP(next) < BRACE_COMPLEX + 10)
           {
             no = OP(next) - BRACE_COMPLEX;
-            brace_min[no] = OPERAND_MIN(scan);
-            brace_max[no] = OPERAND_MAX(scan);
-            brace_count[no] = 0;
+            rex->brace_min[no] = OPERAND_MIN(scan);
+            rex->brace_max[no] = OPERAND_MAX(scan);
+            rex->brace_count[no] = 0;
           }
           else
           {
@@ -5137,20 +5238,20 @@ regmatch(
         case BRACE_COMPLEX + 9:
         {
           no = op - BRACE_COMPLEX;
-          ++brace_count[no];
+          ++rex->brace_count[no];
 
           /* If not matched enough times yet, try one more */
-          if (brace_count[no] <= (brace_min[no] <= brace_max[no]
-                                      ? brace_min[no]
-                                      : brace_max[no]))
+          if (rex->brace_count[no] <= (rex->brace_min[no] <= rex->brace_max[no]
+                                           ? rex->brace_min[no]
+                                           : rex->brace_max[no]))
           {
-            rp = regstack_push(RS_BRCPLX_MORE, scan);
+            rp = regstack_push(rex, RS_BRCPLX_MORE, scan);
             if (rp == NULL)
               status = RA_FAIL;
             else
             {
               rp->rs_no = no;
-              reg_save(&rp->rs_un.regsave, &backpos);
+              reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
               next = OPERAND(scan);
               /* We continue and handle the result when done. */
             }
@@ -5158,18 +5259,18 @@ regmatch(
           }
 
           /* If matched enough times, may try matching some more */
-          if (brace_min[no] <= brace_max[no])
+          if (rex->brace_min[no] <= rex->brace_max[no])
           {
             /* Range is the normal way around, use longest match */
-            if (brace_count[no] <= brace_max[no])
+            if (rex->brace_count[no] <= rex->brace_max[no])
             {
-              rp = regstack_push(RS_BRCPLX_LONG, scan);
+              rp = regstack_push(rex, RS_BRCPLX_LONG, scan);
               if (rp == NULL)
                 status = RA_FAIL;
               else
               {
                 rp->rs_no = no;
-                reg_save(&rp->rs_un.regsave, &backpos);
+                reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
                 next = OPERAND(scan);
                 /* We continue and handle the result when done. */
               }
@@ -5178,14 +5279,14 @@ regmatch(
           else
           {
             /* Range is backwards, use shortest match first */
-            if (brace_count[no] <= brace_min[no])
+            if (rex->brace_count[no] <= rex->brace_min[no])
             {
-              rp = regstack_push(RS_BRCPLX_SHORT, scan);
+              rp = regstack_push(rex, RS_BRCPLX_SHORT, scan);
               if (rp == NULL)
                 status = RA_FAIL;
               else
               {
-                reg_save(&rp->rs_un.regsave, &backpos);
+                reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
                 /* We continue and handle the result when done. */
               }
             }
@@ -5206,7 +5307,7 @@ regmatch(
           if (OP(next) == EXACTLY)
           {
             rst.nextb = *OPERAND(next);
-            if (rex.reg_ic)
+            if (rex->reg_ic)
             {
               if (MB_ISUPPER(rst.nextb))
                 rst.nextb_ic = MB_TOLOWER(rst.nextb);
@@ -5228,8 +5329,8 @@ regmatch(
           }
           else
           {
-            rst.minval = bl_minval;
-            rst.maxval = bl_maxval;
+            rst.minval = rex->bl_minval;
+            rst.maxval = rex->bl_maxval;
           }
 
           /*
@@ -5238,7 +5339,7 @@ regmatch(
 		 * minimal number (since the range is backwards, that's also
 		 * maxval!).
 		 */
-          rst.count = regrepeat(OPERAND(scan), rst.maxval);
+          rst.count = regrepeat(rex, OPERAND(scan), rst.maxval);
           if (got_int)
           {
             status = RA_FAIL;
@@ -5251,17 +5352,17 @@ regmatch(
             /* It could match.  Prepare for trying to match what
 		     * follows.  The code is below.  Parameters are stored in
 		     * a regstar_T on the regstack. */
-            if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+            if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
             {
-              emsg(_(e_maxmempat));
+              rex_emsg(rex, _(e_maxmempat));
               status = RA_FAIL;
             }
-            else if (ga_grow(&regstack, sizeof(regstar_T)) == FAIL)
+            else if (ga_grow(&rex->regstack, sizeof(regstar_T)) == FAIL)
               status = RA_FAIL;
             else
             {
-              regstack.ga_len += sizeof(regstar_T);
-              rp = regstack_push(rst.minval <= rst.maxval
+              rex->regstack.ga_len += sizeof(regstar_T);
+              rp = regstack_push(rex, rst.minval <= rst.maxval
                                      ? RS_STAR_LONG
                                      : RS_STAR_SHORT,
                                  scan);
@@ -5282,13 +5383,13 @@ regmatch(
         case NOMATCH:
         case MATCH:
         case SUBPAT:
-          rp = regstack_push(RS_NOMATCH, scan);
+          rp = regstack_push(rex, RS_NOMATCH, scan);
           if (rp == NULL)
             status = RA_FAIL;
           else
           {
             rp->rs_no = op;
-            reg_save(&rp->rs_un.regsave, &backpos);
+            reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
             next = OPERAND(scan);
             /* We continue and handle the result when done. */
           }
@@ -5297,27 +5398,27 @@ regmatch(
         case BEHIND:
         case NOBEHIND:
           /* Need a bit of room to store extra positions. */
-          if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+          if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
           {
-            emsg(_(e_maxmempat));
+            rex_emsg(rex, _(e_maxmempat));
             status = RA_FAIL;
           }
-          else if (ga_grow(&regstack, sizeof(regbehind_T)) == FAIL)
+          else if (ga_grow(&rex->regstack, sizeof(regbehind_T)) == FAIL)
             status = RA_FAIL;
           else
           {
-            regstack.ga_len += sizeof(regbehind_T);
-            rp = regstack_push(RS_BEHIND1, scan);
+            rex->regstack.ga_len += sizeof(regbehind_T);
+            rp = regstack_push(rex, RS_BEHIND1, scan);
             if (rp == NULL)
               status = RA_FAIL;
             else
             {
               /* Need to save the subexpr to be able to restore them
 		     * when there is a match but we don't use it. */
-              save_subexpr(((regbehind_T *)rp) - 1);
+              save_subexpr(rex, ((regbehind_T *)rp) - 1);
 
               rp->rs_no = op;
-              reg_save(&rp->rs_un.regsave, &backpos);
+              reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
               /* First try if what follows matches.  If it does then we
 		     * check the behind match by looping. */
             }
@@ -5327,20 +5428,20 @@ regmatch(
         case BHPOS:
           if (REG_MULTI)
           {
-            if (behind_pos.rs_u.pos.col != (colnr_T)(rex.input - rex.line) || behind_pos.rs_u.pos.lnum != rex.lnum)
+            if (rex->behind_pos.rs_u.pos.col != (colnr_T)(rex->input - rex->line) || rex->behind_pos.rs_u.pos.lnum != rex->lnum)
               status = RA_NOMATCH;
           }
-          else if (behind_pos.rs_u.ptr != rex.input)
+          else if (rex->behind_pos.rs_u.ptr != rex->input)
             status = RA_NOMATCH;
           break;
 
         case NEWL:
-          if ((c != NUL || !REG_MULTI || rex.lnum > rex.reg_maxline || rex.reg_line_lbr) && (c != '\n' || !rex.reg_line_lbr))
+          if ((c != NUL || !REG_MULTI || rex->lnum > rex->reg_maxline || rex->reg_line_lbr) && (c != '\n' || !rex->reg_line_lbr))
             status = RA_NOMATCH;
-          else if (rex.reg_line_lbr)
+          else if (rex->reg_line_lbr)
             ADVANCE_REGINPUT();
           else
-            reg_nextline();
+            reg_nextline(rex);
           break;
 
         case END:
@@ -5348,7 +5449,7 @@ regmatch(
           break;
 
         default:
-          emsg(_(e_re_corr));
+          rex_emsg(rex, _(e_re_corr));
 #ifdef DEBUG
           printf("Illegal op code %d\n", op);
 #endif
@@ -5370,55 +5471,55 @@ regmatch(
      * If there is something on the regstack execute the code for the state.
      * If the state is popped then loop and use the older state.
      */
-    while (regstack.ga_len > 0 && status != RA_FAIL)
+    while (rex->regstack.ga_len > 0 && status != RA_FAIL)
     {
-      rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
+      rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1;
       switch (rp->rs_state)
       {
       case RS_NOPEN:
         /* Result is passed on as-is, simply pop the state. */
-        regstack_pop(&scan);
+        regstack_pop(rex, &scan);
         break;
 
       case RS_MOPEN:
         /* Pop the state.  Restore pointers when there is no match. */
         if (status == RA_NOMATCH)
-          restore_se(&rp->rs_un.sesave, &rex.reg_startpos[rp->rs_no],
-                     &rex.reg_startp[rp->rs_no]);
-        regstack_pop(&scan);
+          restore_se(&rp->rs_un.sesave, &rex->reg_startpos[rp->rs_no],
+                     &rex->reg_startp[rp->rs_no]);
+        regstack_pop(rex, &scan);
         break;
 
       case RS_MCLOSE:
         /* Pop the state.  Restore pointers when there is no match. */
         if (status == RA_NOMATCH)
-          restore_se(&rp->rs_un.sesave, &rex.reg_endpos[rp->rs_no],
-                     &rex.reg_endp[rp->rs_no]);
-        regstack_pop(&scan);
+          restore_se(&rp->rs_un.sesave, &rex->reg_endpos[rp->rs_no],
+                     &rex->reg_endp[rp->rs_no]);
+        regstack_pop(rex, &scan);
         break;
 
       case RS_BRANCH:
         if (status == RA_MATCH)
           /* this branch matched, use it */
-          regstack_pop(&scan);
+          regstack_pop(rex, &scan);
         else
         {
           if (status != RA_BREAK)
           {
             /* After a non-matching branch: try next one. */
-            reg_restore(&rp->rs_un.regsave, &backpos);
+            reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
             scan = rp->rs_scan;
           }
           if (scan == NULL || OP(scan) != BRANCH)
           {
             /* no more branches, didn't find a match */
             status = RA_NOMATCH;
-            regstack_pop(&scan);
+            regstack_pop(rex, &scan);
           }
           else
           {
             /* Prepare to try a branch. */
-            rp->rs_scan = regnext(scan);
-            reg_save(&rp->rs_un.regsave, &backpos);
+            rp->rs_scan = regnext_prog(scan);
+            reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
             scan = OPERAND(scan);
           }
         }
@@ -5428,10 +5529,10 @@ regmatch(
         /* Pop the state.  Restore pointers when there is no match. */
         if (status == RA_NOMATCH)
         {
-          reg_restore(&rp->rs_un.regsave, &backpos);
-          --brace_count[rp->rs_no]; /* decrement match count */
+          reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+          --rex->brace_count[rp->rs_no]; /* decrement match count */
         }
-        regstack_pop(&scan);
+        regstack_pop(rex, &scan);
         break;
 
       case RS_BRCPLX_LONG:
@@ -5439,22 +5540,22 @@ regmatch(
         if (status == RA_NOMATCH)
         {
           /* There was no match, but we did find enough matches. */
-          reg_restore(&rp->rs_un.regsave, &backpos);
-          --brace_count[rp->rs_no];
+          reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+          --rex->brace_count[rp->rs_no];
           /* continue with the items after "\{}" */
           status = RA_CONT;
         }
-        regstack_pop(&scan);
+        regstack_pop(rex, &scan);
         if (status == RA_CONT)
-          scan = regnext(scan);
+          scan = regnext_prog(scan);
         break;
 
       case RS_BRCPLX_SHORT:
         /* Pop the state.  Restore pointers when there is no match. */
         if (status == RA_NOMATCH)
           /* There was no match, try to match one more item. */
-          reg_restore(&rp->rs_un.regsave, &backpos);
-        regstack_pop(&scan);
+          reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+        regstack_pop(rex, &scan);
         if (status == RA_NOMATCH)
         {
           scan = OPERAND(scan);
@@ -5472,18 +5573,18 @@ regmatch(
         {
           status = RA_CONT;
           if (rp->rs_no != SUBPAT) /* zero-width */
-            reg_restore(&rp->rs_un.regsave, &backpos);
+            reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
         }
-        regstack_pop(&scan);
+        regstack_pop(rex, &scan);
         if (status == RA_CONT)
-          scan = regnext(scan);
+          scan = regnext_prog(scan);
         break;
 
       case RS_BEHIND1:
         if (status == RA_NOMATCH)
         {
-          regstack_pop(&scan);
-          regstack.ga_len -= sizeof(regbehind_T);
+          regstack_pop(rex, &scan);
+          rex->regstack.ga_len -= sizeof(regbehind_T);
         }
         else
         {
@@ -5494,7 +5595,7 @@ regmatch(
 		 * the current position. */
 
           /* save the position after the found match for next */
-          reg_save(&(((regbehind_T *)rp) - 1)->save_after, &backpos);
+          reg_save(rex, &(((regbehind_T *)rp) - 1)->save_after, &rex->backpos);
 
           /* Start looking for a match with operand at the current
 		 * position.  Go back one character until we find the
@@ -5502,12 +5603,12 @@ regmatch(
 		 * line (for multi-line matching).
 		 * Set behind_pos to where the match should end, BHPOS
 		 * will match it.  Save the current value. */
-          (((regbehind_T *)rp) - 1)->save_behind = behind_pos;
-          behind_pos = rp->rs_un.regsave;
+          (((regbehind_T *)rp) - 1)->save_behind = rex->behind_pos;
+          rex->behind_pos = rp->rs_un.regsave;
 
           rp->rs_state = RS_BEHIND2;
 
-          reg_restore(&rp->rs_un.regsave, &backpos);
+          reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
           scan = OPERAND(rp->rs_scan) + 4;
         }
         break;
@@ -5516,23 +5617,23 @@ regmatch(
         /*
 	     * Looping for BEHIND / NOBEHIND match.
 	     */
-        if (status == RA_MATCH && reg_save_equal(&behind_pos))
+        if (status == RA_MATCH && reg_save_equal(rex, &rex->behind_pos))
         {
           /* found a match that ends where "next" started */
-          behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+          rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
           if (rp->rs_no == BEHIND)
-            reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-                        &backpos);
+            reg_restore(rex, &(((regbehind_T *)rp) - 1)->save_after,
+                        &rex->backpos);
           else
           {
             /* But we didn't want a match.  Need to restore the
 		     * subexpr, because what follows matched, so they have
 		     * been set. */
             status = RA_NOMATCH;
-            restore_subexpr(((regbehind_T *)rp) - 1);
+            restore_subexpr(rex, ((regbehind_T *)rp) - 1);
           }
-          regstack_pop(&scan);
-          regstack.ga_len -= sizeof(regbehind_T);
+          regstack_pop(rex, &scan);
+          rex->regstack.ga_len -= sizeof(regbehind_T);
         }
         else
         {
@@ -5544,22 +5645,23 @@ regmatch(
           limit = OPERAND_MIN(rp->rs_scan);
           if (REG_MULTI)
           {
-            if (limit > 0 && ((rp->rs_un.regsave.rs_u.pos.lnum < behind_pos.rs_u.pos.lnum
-                                   ? (colnr_T)STRLEN(rex.line)
-                                   : behind_pos.rs_u.pos.col) -
+            if (limit > 0 && ((rp->rs_un.regsave.rs_u.pos.lnum < rex->behind_pos.rs_u.pos.lnum
+                                   ? (colnr_T)STRLEN(rex->line)
+                                   : rex->behind_pos.rs_u.pos.col) -
                                   rp->rs_un.regsave.rs_u.pos.col >=
                               limit))
               no = FAIL;
             else if (rp->rs_un.regsave.rs_u.pos.col == 0)
             {
-              if (rp->rs_un.regsave.rs_u.pos.lnum < behind_pos.rs_u.pos.lnum || reg_getline(
+              if (rp->rs_un.regsave.rs_u.pos.lnum < rex->behind_pos.rs_u.pos.lnum || reg_getline(
+                                                                                    rex,
                                                                                     --rp->rs_un.regsave.rs_u.pos.lnum) == NULL)
                 no = FAIL;
               else
               {
-                reg_restore(&rp->rs_un.regsave, &backpos);
+                reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
                 rp->rs_un.regsave.rs_u.pos.col =
-                    (colnr_T)STRLEN(rex.line);
+                    (colnr_T)STRLEN(rex->line);
               }
             }
             else
@@ -5567,7 +5669,7 @@ regmatch(
               if (has_mbyte)
               {
                 char_u *line =
-                    reg_getline(rp->rs_un.regsave.rs_u.pos.lnum);
+                    reg_getline(rex, rp->rs_un.regsave.rs_u.pos.lnum);
 
                 rp->rs_un.regsave.rs_u.pos.col -=
                     (*mb_head_off)(line, line + rp->rs_un.regsave.rs_u.pos.col - 1) + 1;
@@ -5578,36 +5680,36 @@ regmatch(
           }
           else
           {
-            if (rp->rs_un.regsave.rs_u.ptr == rex.line)
+            if (rp->rs_un.regsave.rs_u.ptr == rex->line)
               no = FAIL;
             else
             {
-              MB_PTR_BACK(rex.line, rp->rs_un.regsave.rs_u.ptr);
-              if (limit > 0 && (long)(behind_pos.rs_u.ptr - rp->rs_un.regsave.rs_u.ptr) > limit)
+              MB_PTR_BACK(rex->line, rp->rs_un.regsave.rs_u.ptr);
+              if (limit > 0 && (long)(rex->behind_pos.rs_u.ptr - rp->rs_un.regsave.rs_u.ptr) > limit)
                 no = FAIL;
             }
           }
           if (no == OK)
           {
             /* Advanced, prepare for finding match again. */
-            reg_restore(&rp->rs_un.regsave, &backpos);
+            reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
             scan = OPERAND(rp->rs_scan) + 4;
             if (status == RA_MATCH)
             {
               /* We did match, so subexpr may have been changed,
 			 * need to restore them for the next try. */
               status = RA_NOMATCH;
-              restore_subexpr(((regbehind_T *)rp) - 1);
+              restore_subexpr(rex, ((regbehind_T *)rp) - 1);
             }
           }
           else
           {
             /* Can't advance.  For NOBEHIND that's a match. */
-            behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+            rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
             if (rp->rs_no == NOBEHIND)
             {
-              reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-                          &backpos);
+              reg_restore(rex, &(((regbehind_T *)rp) - 1)->save_after,
+                          &rex->backpos);
               status = RA_MATCH;
             }
             else
@@ -5618,11 +5720,11 @@ regmatch(
               if (status == RA_MATCH)
               {
                 status = RA_NOMATCH;
-                restore_subexpr(((regbehind_T *)rp) - 1);
+                restore_subexpr(rex, ((regbehind_T *)rp) - 1);
               }
             }
-            regstack_pop(&scan);
-            regstack.ga_len -= sizeof(regbehind_T);
+            regstack_pop(rex, &scan);
+            rex->regstack.ga_len -= sizeof(regbehind_T);
           }
         }
         break;
@@ -5634,14 +5736,14 @@ regmatch(
 
         if (status == RA_MATCH)
         {
-          regstack_pop(&scan);
-          regstack.ga_len -= sizeof(regstar_T);
+          regstack_pop(rex, &scan);
+          rex->regstack.ga_len -= sizeof(regstar_T);
           break;
         }
 
         /* Tried once already, restore input pointers. */
         if (status != RA_BREAK)
-          reg_restore(&rp->rs_un.regsave, &backpos);
+          reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 
         /* Repeat until we found a position where it could match. */
         for (;;)
@@ -5655,20 +5757,20 @@ regmatch(
 			     * didn't match -- back up one char. */
               if (--rst->count < rst->minval)
                 break;
-              if (rex.input == rex.line)
+              if (rex->input == rex->line)
               {
                 /* backup to last char of previous line */
-                --rex.lnum;
-                rex.line = reg_getline(rex.lnum);
+                --rex->lnum;
+                rex->line = reg_getline(rex, rex->lnum);
                 /* Just in case regrepeat() didn't count
 				 * right. */
-                if (rex.line == NULL)
+                if (rex->line == NULL)
                   break;
-                rex.input = rex.line + STRLEN(rex.line);
-                fast_breakcheck();
+                rex->input = rex->line + STRLEN(rex->line);
+                reg_breakcheck(rex);
               }
               else
-                MB_PTR_BACK(rex.line, rex.input);
+                MB_PTR_BACK(rex->line, rex->input);
             }
             else
             {
@@ -5676,7 +5778,7 @@ regmatch(
 			     * Careful: maxval and minval are exchanged!
 			     * Couldn't or didn't match: try advancing one
 			     * char. */
-              if (rst->count == rst->minval || regrepeat(OPERAND(rp->rs_scan), 1L) == 0)
+              if (rst->count == rst->minval || regrepeat(rex, OPERAND(rp->rs_scan), 1L) == 0)
                 break;
               ++rst->count;
             }
@@ -5687,10 +5789,10 @@ regmatch(
             status = RA_NOMATCH;
 
           /* If it could match, try it. */
-          if (rst->nextb == NUL || *rex.input == rst->nextb || *rex.input == rst->nextb_ic)
+          if (rst->nextb == NUL || *rex->input == rst->nextb || *rex->input == rst->nextb_ic)
           {
-            reg_save(&rp->rs_un.regsave, &backpos);
-            scan = regnext(rp->rs_scan);
+            reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+            scan = regnext_prog(rp->rs_scan);
             status = RA_CONT;
             break;
           }
@@ -5698,8 +5800,8 @@ regmatch(
         if (status != RA_CONT)
         {
           /* Failed. */
-          regstack_pop(&scan);
-          regstack.ga_len -= sizeof(regstar_T);
+          regstack_pop(rex, &scan);
+          rex->regstack.ga_len -= sizeof(regstar_T);
           status = RA_NOMATCH;
         }
       }
@@ -5708,7 +5810,7 @@ regmatch(
 
       /* If we want to continue the inner loop or didn't pop a state
 	 * continue matching loop */
-      if (status == RA_CONT || rp == (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1)
+      if (status == RA_CONT || rp == (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1)
         break;
     }
 
@@ -5719,7 +5821,7 @@ regmatch(
     /*
      * If the regstack is empty or something failed we are done.
      */
-    if (regstack.ga_len == 0 || status == RA_FAIL)
+    if (rex->regstack.ga_len == 0 || status == RA_FAIL)
     {
       if (scan == NULL)
       {
@@ -5727,7 +5829,7 @@ regmatch(
 	     * We get here only if there's trouble -- normally "case END" is
 	     * the terminating point.
 	     */
-        emsg(_(e_re_corr));
+        rex_emsg(rex, _(e_re_corr));
 #ifdef DEBUG
         printf("Premature EOL\n");
 #endif
@@ -5745,23 +5847,23 @@ regmatch(
  * Returns pointer to new item.  Returns NULL when out of memory.
  */
 static regitem_T *
-regstack_push(regstate_T state, char_u *scan)
+regstack_push(regexec_T *rex, regstate_T state, char_u *scan)
 {
   regitem_T *rp;
 
-  if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+  if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
   {
-    emsg(_(e_maxmempat));
+    rex_emsg(rex, _(e_maxmempat));
     return NULL;
   }
-  if (ga_grow(&regstack, sizeof(regitem_T)) == FAIL)
+  if (ga_grow(&rex->regstack, sizeof(regitem_T)) == FAIL)
     return NULL;
 
-  rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len);
+  rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len);
   rp->rs_state = state;
   rp->rs_scan = scan;
 
-  regstack.ga_len += sizeof(regitem_T);
+  rex->regstack.ga_len += sizeof(regitem_T);
   return rp;
 }
 
@@ -5769,14 +5871,14 @@ regstack_push(regstate_T state, char_u *scan)
  * Pop an item from the regstack.
  */
 static void
-regstack_pop(char_u **scan)
+regstack_pop(regexec_T *rex, char_u **scan)
 {
   regitem_T *rp;
 
-  rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
+  rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1;
   *scan = rp->rs_scan;
 
-  regstack.ga_len -= sizeof(regitem_T);
+  rex->regstack.ga_len -= sizeof(regitem_T);
 }
 
 /*
@@ -5785,6 +5887,7 @@ regstack_pop(char_u **scan)
  */
 static int
 regrepeat(
+    regexec_T *rex,
     char_u *p,
     long maxcount) /* maximum number of matches allowed */
 {
@@ -5794,7 +5897,7 @@ regrepeat(
   int mask;
   int testval = 0;
 
-  scan = rex.input; /* Make local copy of rex.input for speed. */
+  scan = rex->input; /* Make local copy of rex.input for speed. */
   opnd = OPERAND(p);
   switch (OP(p))
   {
@@ -5809,11 +5912,11 @@ regrepeat(
         ++count;
         MB_PTR_ADV(scan);
       }
-      if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr || count == maxcount)
+      if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr || count == maxcount)
         break;
       ++count; /* count the line-break */
-      reg_nextline();
-      scan = rex.input;
+      reg_nextline(rex);
+      scan = rex->input;
       if (got_int)
         break;
     }
@@ -5833,14 +5936,14 @@ regrepeat(
       }
       else if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else
         break;
@@ -5856,20 +5959,20 @@ regrepeat(
   case SKWORD + ADD_NL:
     while (count < maxcount)
     {
-      if (vim_iswordp_buf(scan, rex.reg_buf) && (testval || !VIM_ISDIGIT(*scan)))
+      if (vim_iswordp_buf(scan, rex->reg_buf) && (testval || !VIM_ISDIGIT(*scan)))
       {
         MB_PTR_ADV(scan);
       }
       else if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else
         break;
@@ -5891,14 +5994,14 @@ regrepeat(
       }
       else if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else
         break;
@@ -5916,10 +6019,10 @@ regrepeat(
     {
       if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
@@ -5927,7 +6030,7 @@ regrepeat(
       {
         MB_PTR_ADV(scan);
       }
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else
         break;
@@ -5945,10 +6048,10 @@ regrepeat(
 
       if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
@@ -5960,7 +6063,7 @@ regrepeat(
       }
       else if ((class_tab[*scan] & mask) == testval)
         ++scan;
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else
         break;
@@ -6044,7 +6147,7 @@ regrepeat(
     /* This doesn't do a multi-byte character, because a MULTIBYTECODE
 	     * would have been used for it.  It does handle single-byte
 	     * characters, such as latin1. */
-    if (rex.reg_ic)
+    if (rex->reg_ic)
     {
       cu = MB_TOUPPER(*opnd);
       cl = MB_TOLOWER(*opnd);
@@ -6074,14 +6177,14 @@ regrepeat(
 	     * compiling the program). */
     if ((len = (*mb_ptr2len)(opnd)) > 1)
     {
-      if (rex.reg_ic && enc_utf8)
+      if (rex->reg_ic && enc_utf8)
         cf = utf_fold(utf_ptr2char(opnd));
       while (count < maxcount && (*mb_ptr2len)(scan) >= len)
       {
         for (i = 0; i < len; ++i)
           if (opnd[i] != scan[i])
             break;
-        if (i < len && (!rex.reg_ic || !enc_utf8 || utf_fold(utf_ptr2char(scan)) != cf))
+        if (i < len && (!rex->reg_ic || !enc_utf8 || utf_fold(utf_ptr2char(scan)) != cf))
           break;
         scan += len;
         ++count;
@@ -6103,24 +6206,24 @@ regrepeat(
 
       if (*scan == NUL)
       {
-        if (!REG_MULTI || !WITH_NL(OP(p)) || rex.lnum > rex.reg_maxline || rex.reg_line_lbr)
+        if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
           break;
-        reg_nextline();
-        scan = rex.input;
+        reg_nextline(rex);
+        scan = rex->input;
         if (got_int)
           break;
       }
-      else if (rex.reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+      else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
         ++scan;
       else if (has_mbyte && (len = (*mb_ptr2len)(scan)) > 1)
       {
-        if ((cstrchr(opnd, (*mb_ptr2char)(scan)) == NULL) == testval)
+        if ((cstrchr(rex, opnd, (*mb_ptr2char)(scan)) == NULL) == testval)
           break;
         scan += len;
       }
       else
       {
-        if ((cstrchr(opnd, *scan) == NULL) == testval)
+        if ((cstrchr(rex, opnd, *scan) == NULL) == testval)
           break;
         ++scan;
       }
@@ -6129,28 +6232,28 @@ regrepeat(
     break;
 
   case NEWL:
-    while (count < maxcount && ((*scan == NUL && rex.lnum <= rex.reg_maxline && !rex.reg_line_lbr && REG_MULTI) || (*scan == '\n' && rex.reg_line_lbr)))
+    while (count < maxcount && ((*scan == NUL && rex->lnum <= rex->reg_maxline && !rex->reg_line_lbr && REG_MULTI) || (*scan == '\n' && rex->reg_line_lbr)))
     {
       count++;
-      if (rex.reg_line_lbr)
+      if (rex->reg_line_lbr)
         ADVANCE_REGINPUT();
       else
-        reg_nextline();
-      scan = rex.input;
+        reg_nextline(rex);
+      scan = rex->input;
       if (got_int)
         break;
     }
     break;
 
   default: /* Oh dear.  Called inappropriately. */
-    emsg(_(e_re_corr));
+    rex_emsg(rex, _(e_re_corr));
 #ifdef DEBUG
     printf("Called regrepeat with op code %d\n", OP(p));
 #endif
     break;
   }
 
-  rex.input = scan;
+  rex->input = scan;
 
   return (int)count;
 }
@@ -6163,10 +6266,19 @@ regrepeat(
 static char_u *
 regnext(char_u *p)
 {
-  int offset;
-
   if (p == JUST_CALC_SIZE || reg_toolong)
     return NULL;
+  return regnext_prog(p);
+}
+
+/*
+ * Like regnext(), for a compiled program.  Doesn't use the state of
+ * compiling, another pattern may be compiled while matching in a thread.
+ */
+static char_u *
+regnext_prog(char_u *p)
+{
+  int offset;
 
   offset = NEXT(p);
   if (offset == 0)
@@ -6183,18 +6295,18 @@ regnext(char_u *p)
  * Return TRUE if it's wrong.
  */
 static int
-prog_magic_wrong(void)
+prog_magic_wrong(regexec_T *rex)
 {
   regprog_T *prog;
 
-  prog = REG_MULTI ? rex.reg_mmatch->regprog : rex.reg_match->regprog;
+  prog = REG_MULTI ? rex->reg_mmatch->regprog : rex->reg_match->regprog;
   if (prog->engine == &nfa_regengine)
     /* For NFA matcher we don't check the magic */
     return FALSE;
 
   if (UCHARAT(((bt_regprog_T *)prog)->program) != REGMAGIC)
   {
-    emsg(_(e_re_corr));
+    rex_emsg(rex, _(e_re_corr));
     return TRUE;
   }
   return FALSE;
@@ -6206,22 +6318,22 @@ prog_magic_wrong(void)
  * used (to increase speed).
  */
 static void
-cleanup_subexpr(void)
+cleanup_subexpr(regexec_T *rex)
 {
-  if (rex.need_clear_subexpr)
+  if (rex->need_clear_subexpr)
   {
     if (REG_MULTI)
     {
       /* Use 0xff to set lnum to -1 */
-      vim_memset(rex.reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
-      vim_memset(rex.reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+      vim_memset(rex->reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+      vim_memset(rex->reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
     }
     else
     {
-      vim_memset(rex.reg_startp, 0, sizeof(char_u *) * NSUBEXP);
-      vim_memset(rex.reg_endp, 0, sizeof(char_u *) * NSUBEXP);
+      vim_memset(rex->reg_startp, 0, sizeof(char_u *) * NSUBEXP);
+      vim_memset(rex->reg_endp, 0, sizeof(char_u *) * NSUBEXP);
     }
-    rex.need_clear_subexpr = FALSE;
+    rex->need_clear_subexpr = FALSE;
   }
 }
 
@@ -6230,26 +6342,26 @@ cleanup_subexpr(void)
  * later by restore_subexpr().
  */
 static void
-save_subexpr(regbehind_T *bp)
+save_subexpr(regexec_T *rex, regbehind_T *bp)
 {
   int i;
 
   /* When "rex.need_clear_subexpr" is set we don't need to save the values, only
      * remember that this flag needs to be set again when restoring. */
-  bp->save_need_clear_subexpr = rex.need_clear_subexpr;
-  if (!rex.need_clear_subexpr)
+  bp->save_need_clear_subexpr = rex->need_clear_subexpr;
+  if (!rex->need_clear_subexpr)
   {
     for (i = 0; i < NSUBEXP; ++i)
     {
       if (REG_MULTI)
       {
-        bp->save_start[i].se_u.pos = rex.reg_startpos[i];
-        bp->save_end[i].se_u.pos = rex.reg_endpos[i];
+        bp->save_start[i].se_u.pos = rex->reg_startpos[i];
+        bp->save_end[i].se_u.pos = rex->reg_endpos[i];
       }
       else
       {
-        bp->save_start[i].se_u.ptr = rex.reg_startp[i];
-        bp->save_end[i].se_u.ptr = rex.reg_endp[i];
+        bp->save_start[i].se_u.ptr = rex->reg_startp[i];
+        bp->save_end[i].se_u.ptr = rex->reg_endp[i];
       }
     }
   }
@@ -6259,25 +6371,25 @@ save_subexpr(regbehind_T *bp)
  * Restore the subexpr from "bp".
  */
 static void
-restore_subexpr(regbehind_T *bp)
+restore_subexpr(regexec_T *rex, regbehind_T *bp)
 {
   int i;
 
   /* Only need to restore saved values when they are not to be cleared. */
-  rex.need_clear_subexpr = bp->save_need_clear_subexpr;
-  if (!rex.need_clear_subexpr)
+  rex->need_clear_subexpr = bp->save_need_clear_subexpr;
+  if (!rex->need_clear_subexpr)
   {
     for (i = 0; i < NSUBEXP; ++i)
     {
       if (REG_MULTI)
       {
-        rex.reg_startpos[i] = bp->save_start[i].se_u.pos;
-        rex.reg_endpos[i] = bp->save_end[i].se_u.pos;
+        rex->reg_startpos[i] = bp->save_start[i].se_u.pos;
+        rex->reg_endpos[i] = bp->save_end[i].se_u.pos;
       }
       else
       {
-        rex.reg_startp[i] = bp->save_start[i].se_u.ptr;
-        rex.reg_endp[i] = bp->save_end[i].se_u.ptr;
+        rex->reg_startp[i] = bp->save_start[i].se_u.ptr;
+        rex->reg_endp[i] = bp->save_end[i].se_u.ptr;
       }
     }
   }
@@ -6287,26 +6399,26 @@ restore_subexpr(regbehind_T *bp)
  * Advance rex.lnum, rex.line and rex.input to the next line.
  */
 static void
-reg_nextline(void)
+reg_nextline(regexec_T *rex)
 {
-  rex.line = reg_getline(++rex.lnum);
-  rex.input = rex.line;
-  fast_breakcheck();
+  rex->line = reg_getline(rex, ++rex->lnum);
+  rex->input = rex->line;
+  reg_breakcheck(rex);
 }
 
 /*
  * Save the input line and position in a regsave_T.
  */
 static void
-reg_save(regsave_T *save, garray_T *gap)
+reg_save(regexec_T *rex, regsave_T *save, garray_T *gap)
 {
   if (REG_MULTI)
   {
-    save->rs_u.pos.col = (colnr_T)(rex.input - rex.line);
-    save->rs_u.pos.lnum = rex.lnum;
+    save->rs_u.pos.col = (colnr_T)(rex->input - rex->line);
+    save->rs_u.pos.lnum = rex->lnum;
   }
   else
-    save->rs_u.ptr = rex.input;
+    save->rs_u.ptr = rex->input;
   save->rs_len = gap->ga_len;
 }
 
@@ -6314,21 +6426,21 @@ reg_save(regsave_T *save, garray_T *gap)
  * Restore the input line and position from a regsave_T.
  */
 static void
-reg_restore(regsave_T *save, garray_T *gap)
+reg_restore(regexec_T *rex, regsave_T *save, garray_T *gap)
 {
   if (REG_MULTI)
   {
-    if (rex.lnum != save->rs_u.pos.lnum)
+    if (rex->lnum != save->rs_u.pos.lnum)
     {
       /* only call reg_getline() when the line number changed to save
 	     * a bit of time */
-      rex.lnum = save->rs_u.pos.lnum;
-      rex.line = reg_getline(rex.lnum);
+      rex->lnum = save->rs_u.pos.lnum;
+      rex->line = reg_getline(rex, rex->lnum);
     }
-    rex.input = rex.line + save->rs_u.pos.col;
+    rex->input = rex->line + save->rs_u.pos.col;
   }
   else
-    rex.input = save->rs_u.ptr;
+    rex->input = save->rs_u.ptr;
   gap->ga_len = save->rs_len;
 }
 
@@ -6336,11 +6448,11 @@ reg_restore(regsave_T *save, garray_T *gap)
  * Return TRUE if current position is equal to saved position.
  */
 static int
-reg_save_equal(regsave_T *save)
+reg_save_equal(regexec_T *rex, regsave_T *save)
 {
   if (REG_MULTI)
-    return rex.lnum == save->rs_u.pos.lnum && rex.input == rex.line + save->rs_u.pos.col;
-  return rex.input == save->rs_u.ptr;
+    return rex->lnum == save->rs_u.pos.lnum && rex->input == rex->line + save->rs_u.pos.col;
+  return rex->input == save->rs_u.ptr;
 }
 
 /*
@@ -6351,18 +6463,18 @@ reg_save_equal(regsave_T *save)
  * depending on REG_MULTI.
  */
 static void
-save_se_multi(save_se_T *savep, lpos_T *posp)
+save_se_multi(regexec_T *rex, save_se_T *savep, lpos_T *posp)
 {
   savep->se_u.pos = *posp;
-  posp->lnum = rex.lnum;
-  posp->col = (colnr_T)(rex.input - rex.line);
+  posp->lnum = rex->lnum;
+  posp->col = (colnr_T)(rex->input - rex->line);
 }
 
 static void
-save_se_one(save_se_T *savep, char_u **pp)
+save_se_one(regexec_T *rex, save_se_T *savep, char_u **pp)
 {
   savep->se_u.ptr = *pp;
-  *pp = rex.input;
+  *pp = rex->input;
 }
 
 /*
@@ -6388,6 +6500,7 @@ re_num_cmp(long_u val, char_u *scan)
  */
 static int
 match_with_backref(
+    regexec_T *rex,
     linenr_T start_lnum,
     colnr_T start_col,
     linenr_T end_lnum,
@@ -6405,41 +6518,41 @@ match_with_backref(
   {
     /* Since getting one line may invalidate the other, need to make copy.
 	 * Slow! */
-    if (rex.line != reg_tofree)
+    if (rex->line != rex->reg_tofree)
     {
-      len = (int)STRLEN(rex.line);
-      if (reg_tofree == NULL || len >= (int)reg_tofreelen)
+      len = (int)STRLEN(rex->line);
+      if (rex->reg_tofree == NULL || len >= (int)rex->reg_tofreelen)
       {
         len += 50; /* get some extra */
-        vim_free(reg_tofree);
-        reg_tofree = alloc(len);
-        if (reg_tofree == NULL)
+        vim_free(rex->reg_tofree);
+        rex->reg_tofree = alloc(len);
+        if (rex->reg_tofree == NULL)
           return RA_FAIL; /* out of memory!*/
-        reg_tofreelen = len;
+        rex->reg_tofreelen = len;
       }
-      STRCPY(reg_tofree, rex.line);
-      rex.input = reg_tofree + (rex.input - rex.line);
-      rex.line = reg_tofree;
+      STRCPY(rex->reg_tofree, rex->line);
+      rex->input = rex->reg_tofree + (rex->input - rex->line);
+      rex->line = rex->reg_tofree;
     }
 
     /* Get the line to compare with. */
-    p = reg_getline(clnum);
+    p = reg_getline(rex, clnum);
     if (clnum == end_lnum)
       len = end_col - ccol;
     else
       len = (int)STRLEN(p + ccol);
 
-    if (cstrncmp(p + ccol, rex.input, &len) != 0)
+    if (cstrncmp(rex, p + ccol, rex->input, &len) != 0)
       return RA_NOMATCH; /* doesn't match */
     if (bytelen != NULL)
       *bytelen += len;
     if (clnum == end_lnum)
       break; /* match and at end! */
-    if (rex.lnum >= rex.reg_maxline)
+    if (rex->lnum >= rex->reg_maxline)
       return RA_NOMATCH; /* text too short */
 
     /* Advance to next line. */
-    reg_nextline();
+    reg_nextline(rex);
     if (bytelen != NULL)
       *bytelen = 0;
     ++clnum;
@@ -6980,17 +7093,17 @@ mb_decompose(int c, int *c1, int *c2, int *c3)
  * Correct the length "*n" when composing characters are ignored.
  */
 static int
-cstrncmp(char_u *s1, char_u *s2, int *n)
+cstrncmp(regexec_T *rex, char_u *s1, char_u *s2, int *n)
 {
   int result;
 
-  if (!rex.reg_ic)
+  if (!rex->reg_ic)
     result = STRNCMP(s1, s2, *n);
   else
     result = MB_STRNICMP(s1, s2, *n);
 
   /* if it failed and it's utf8 and we want to combineignore: */
-  if (result != 0 && enc_utf8 && rex.reg_icombine)
+  if (result != 0 && enc_utf8 && rex->reg_icombine)
   {
     char_u *str1, *str2;
     int c1, c2, c11, c12;
@@ -7009,14 +7122,14 @@ cstrncmp(char_u *s1, char_u *s2, int *n)
       /* decompose the character if necessary, into 'base' characters
 	     * because I don't care about Arabic, I will hard-code the Hebrew
 	     * which I *do* care about!  So sue me... */
-      if (c1 != c2 && (!rex.reg_ic || utf_fold(c1) != utf_fold(c2)))
+      if (c1 != c2 && (!rex->reg_ic || utf_fold(c1) != utf_fold(c2)))
       {
         /* decomposition necessary? */
         mb_decompose(c1, &c11, &junk, &junk);
         mb_decompose(c2, &c12, &junk, &junk);
         c1 = c11;
         c2 = c12;
-        if (c11 != c12 && (!rex.reg_ic || utf_fold(c11) != utf_fold(c12)))
+        if (c11 != c12 && (!rex->reg_ic || utf_fold(c11) != utf_fold(c12)))
           break;
       }
     }
@@ -7032,12 +7145,12 @@ cstrncmp(char_u *s1, char_u *s2, int *n)
  * cstrchr: This function is used a lot for simple searches, keep it fast!
  */
 static char_u *
-cstrchr(char_u *s, int c)
+cstrchr(regexec_T *rex, char_u *s, int c)
 {
   char_u *p;
   int cc;
 
-  if (!rex.reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
+  if (!rex->reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
     return vim_strchr(s, c);
 
   /* tolower() and toupper() can be slow, comparing twice should be a lot
@@ -7086,7 +7199,7 @@ cstrchr(char_u *s, int c)
  */
 typedef void (*(*fptr_T)(int *, int))();
 
-static int vim_regsub_both(char_u *source, typval_T *expr, char_u *dest, int copy, int magic, int backslash);
+static int vim_regsub_both(regexec_T *rex, char_u *source, typval_T *expr, char_u *dest, int copy, int magic, int backslash);
 
 static fptr_T
 do_upper(int *d, int c)
@@ -7282,25 +7395,17 @@ int vim_regsub(
     int backslash)
 {
   int result;
-  regexec_T rex_save;
-  int rex_in_use_save = rex_in_use;
-
-  if (rex_in_use)
-    /* Being called recursively, save the state. */
-    rex_save = rex;
-  rex_in_use = TRUE;
+  regexec_T rex_local;
+  regexec_T *rex = rex_get(&rex_local);
 
-  rex.reg_match = rmp;
-  rex.reg_mmatch = NULL;
-  rex.reg_maxline = 0;
-  rex.reg_buf = curbuf;
-  rex.reg_line_lbr = TRUE;
-  result = vim_regsub_both(source, expr, dest, copy, magic, backslash);
-
-  rex_in_use = rex_in_use_save;
-  if (rex_in_use)
-    rex = rex_save;
+  rex->reg_match = rmp;
+  rex->reg_mmatch = NULL;
+  rex->reg_maxline = 0;
+  rex->reg_buf = curbuf;
+  rex->reg_line_lbr = TRUE;
+  result = vim_regsub_both(rex, source, expr, dest, copy, magic, backslash);
 
+  rex_release(rex);
   return result;
 }
 #endif
@@ -7315,31 +7420,24 @@ int vim_regsub_multi(
     int backslash)
 {
   int result;
-  regexec_T rex_save;
-  int rex_in_use_save = rex_in_use;
-
-  if (rex_in_use)
-    /* Being called recursively, save the state. */
-    rex_save = rex;
-  rex_in_use = TRUE;
-
-  rex.reg_match = NULL;
-  rex.reg_mmatch = rmp;
-  rex.reg_buf = curbuf; /* always works on the current buffer! */
-  rex.reg_firstlnum = lnum;
-  rex.reg_maxline = curbuf->b_ml.ml_line_count - lnum;
-  rex.reg_line_lbr = FALSE;
-  result = vim_regsub_both(source, NULL, dest, copy, magic, backslash);
-
-  rex_in_use = rex_in_use_save;
-  if (rex_in_use)
-    rex = rex_save;
-
+  regexec_T rex_local;
+  regexec_T *rex = rex_get(&rex_local);
+
+  rex->reg_match = NULL;
+  rex->reg_mmatch = rmp;
+  rex->reg_buf = curbuf; /* always works on the current buffer! */
+  rex->reg_firstlnum = lnum;
+  rex->reg_maxline = curbuf->b_ml.ml_line_count - lnum;
+  rex->reg_line_lbr = FALSE;
+  result = vim_regsub_both(rex, source, NULL, dest, copy, magic, backslash);
+
+  rex_release(rex);
   return result;
 }
 
 static int
 vim_regsub_both(
+    regexec_T *rex,
     char_u *source,
     typval_T *expr,
     char_u *dest,
@@ -7367,7 +7465,7 @@ vim_regsub_both(
     emsg(_(e_null));
     return 0;
   }
-  if (prog_magic_wrong())
+  if (prog_magic_wrong(rex))
     return 0;
   src = source;
   dst = dest;
@@ -7404,11 +7502,11 @@ vim_regsub_both(
       if (can_f_submatch)
         rsm_save = rsm;
       can_f_submatch = TRUE;
-      rsm.sm_match = rex.reg_match;
-      rsm.sm_mmatch = rex.reg_mmatch;
-      rsm.sm_firstlnum = rex.reg_firstlnum;
-      rsm.sm_maxline = rex.reg_maxline;
-      rsm.sm_line_lbr = rex.reg_line_lbr;
+      rsm.sm_match = rex->reg_match;
+      rsm.sm_mmatch = rex->reg_mmatch;
+      rsm.sm_firstlnum = rex->reg_firstlnum;
+      rsm.sm_maxline = rex->reg_maxline;
+      rsm.sm_line_lbr = rex->reg_line_lbr;
 
       if (expr != NULL)
       {
@@ -7634,25 +7732,25 @@ vim_regsub_both(
       {
         if (REG_MULTI)
         {
-          clnum = rex.reg_mmatch->startpos[no].lnum;
-          if (clnum < 0 || rex.reg_mmatch->endpos[no].lnum < 0)
+          clnum = rex->reg_mmatch->startpos[no].lnum;
+          if (clnum < 0 || rex->reg_mmatch->endpos[no].lnum < 0)
             s = NULL;
           else
           {
-            s = reg_getline(clnum) + rex.reg_mmatch->startpos[no].col;
-            if (rex.reg_mmatch->endpos[no].lnum == clnum)
-              len = rex.reg_mmatch->endpos[no].col - rex.reg_mmatch->startpos[no].col;
+            s = reg_getline(rex, clnum) + rex->reg_mmatch->startpos[no].col;
+            if (rex->reg_mmatch->endpos[no].lnum == clnum)
+              len = rex->reg_mmatch->endpos[no].col - rex->reg_mmatch->startpos[no].col;
             else
               len = (int)STRLEN(s);
           }
         }
         else
         {
-          s = rex.reg_match->startp[no];
-          if (rex.reg_match->endp[no] == NULL)
+          s = rex->reg_match->startp[no];
+          if (rex->reg_match->endp[no] == NULL)
             s = NULL;
           else
-            len = (int)(rex.reg_match->endp[no] - s);
+            len = (int)(rex->reg_match->endp[no] - s);
         }
         if (s != NULL)
         {
@@ -7662,14 +7760,14 @@ vim_regsub_both(
             {
               if (REG_MULTI)
               {
-                if (rex.reg_mmatch->endpos[no].lnum == clnum)
+                if (rex->reg_mmatch->endpos[no].lnum == clnum)
                   break;
                 if (copy)
                   *dst = CAR;
                 ++dst;
-                s = reg_getline(++clnum);
-                if (rex.reg_mmatch->endpos[no].lnum == clnum)
-                  len = rex.reg_mmatch->endpos[no].col;
+                s = reg_getline(rex, ++clnum);
+                if (rex->reg_mmatch->endpos[no].lnum == clnum)
+                  len = rex->reg_mmatch->endpos[no].col;
                 else
                   len = (int)STRLEN(s);
               }
@@ -7761,18 +7859,13 @@ exit:
 static char_u *
 reg_getline_submatch(linenr_T lnum)
 {
-  char_u *s;
-  linenr_T save_first = rex.reg_firstlnum;
-  linenr_T save_max = rex.reg_maxline;
+  regexec_T rex_sub;
 
-  rex.reg_firstlnum = rsm.sm_firstlnum;
-  rex.reg_maxline = rsm.sm_maxline;
-
-  s = reg_getline(lnum);
-
-  rex.reg_firstlnum = save_first;
-  rex.reg_maxline = save_max;
-  return s;
+  vim_memset(&rex_sub, 0, sizeof(rex_sub));
+  rex_sub.reg_buf = curbuf;
+  rex_sub.reg_firstlnum = rsm.sm_firstlnum;
+  rex_sub.reg_maxline = rsm.sm_maxline;
+  return reg_getline(&rex_sub, lnum);
 }
 
 /*
@@ -7975,14 +8068,234 @@ static char_u regname[][30] = {
     "NFA Regexp Engine"};
 #endif
 
+/*
+ * Cache of compiled patterns.  The same pattern is often compiled again right
+ * after it was freed, e.g. for each line of ":g/pat/s//x/" or when calling
+ * match() in a loop.  vim_regcomp() returns the program from the cache when
+ * the pattern, flags, 'regexpengine' and the 'cpoptions' flags used for
+ * compiling are the same.  The program is then shared by all that got it,
+ * vim_regfree() only frees it when it is not used and dropped from the cache.
+ * Only used in the main thread.
+ */
+typedef struct
+{
+  char_u *rc_pattern;
+  int rc_flags;       /* "re_flags" for vim_regcomp() */
+  int rc_engine;      /* 'regexpengine' */
+  int rc_cpo;         /* CPO_LITERAL and CPO_BACKSL in 'cpoptions' */
+  int rc_stale;       /* can't be used again, free when not used */
+  regprog_T *rc_prog;
+  int rc_refcount;    /* number of users of "rc_prog" */
+  long rc_used;       /* "regcache_tick" when last used */
+} regcache_T;
+
+static regprog_T *regcomp_prog(char_u *expr_arg, int re_flags);
+
+static regcache_T *regcache = NULL;
+static int regcache_len = 0;       /* used entries in "regcache" */
+static int regcache_alloced = 0;   /* allocated entries in "regcache" */
+static int regcache_size = 32;     /* max number of unused programs kept */
+static long regcache_tick = 0;
+static long regcache_hits = 0;
+static long regcache_misses = 0;
+
+/*
+ * Return the 'cpoptions' flags that compiling a pattern depends on.
+ */
+static int
+regcache_cpo(void)
+{
+  return (vim_strchr(p_cpo, CPO_LITERAL) != NULL) + (vim_strchr(p_cpo, CPO_BACKSL) != NULL) * 2;
+}
+
+/*
+ * Return TRUE when compiling "expr" only depends on what is in the cache key.
+ * Not when using the previous substitute string for "~" or the 'iskeyword',
+ * 'isident' or 'isfname' options for a character class.
+ */
+static int
+regcache_can_use(char_u *expr)
+{
+  return vim_strchr(expr, '~') == NULL && strstr((char *)expr, ":keyword:]") == NULL && strstr((char *)expr, ":ident:]") == NULL && strstr((char *)expr, ":fname:]") == NULL;
+}
+
+/*
+ * Free the programs in the cache that are not used and stale, and the least
+ * recently used ones while there are more than "regcache_size" unused ones.
+ */
+static void
+regcache_prune(void)
+{
+  regcache_T *rc;
+  int unused = 0;
+  int lru;
+  int i;
+
+  for (i = 0; i < regcache_len; ++i)
+  {
+    rc = regcache + i;
+    if (rc->rc_refcount > 0)
+      continue;
+    if (!rc->rc_stale)
+    {
+      ++unused;
+      continue;
+    }
+    rc->rc_prog->engine->regfree(rc->rc_prog);
+    vim_free(rc->rc_pattern);
+    *rc = regcache[--regcache_len];
+    --i;
+  }
+
+  while (unused > regcache_size)
+  {
+    lru = -1;
+    for (i = 0; i < regcache_len; ++i)
+      if (regcache[i].rc_refcount == 0 && (lru < 0 || regcache[i].rc_used < regcache[lru].rc_used))
+        lru = i;
+    rc = regcache + lru;
+    rc->rc_prog->engine->regfree(rc->rc_prog);
+    vim_free(rc->rc_pattern);
+    *rc = regcache[--regcache_len];
+    --unused;
+  }
+
+  if (regcache_len == 0)
+  {
+    VIM_CLEAR(regcache);
+    regcache_alloced = 0;
+  }
+}
+
+/*
+ * Add "prog", compiled from "expr" with "re_flags", to the cache.  It is not
+ * added when out of memory, it is then not shared.
+ */
+static void
+regcache_add(char_u *expr, int re_flags, regprog_T *prog)
+{
+  regcache_T *rc;
+  regcache_T *grown;
+  int len;
+
+  if (regcache_len == regcache_alloced)
+  {
+    len = regcache_alloced == 0 ? 8 : regcache_alloced * 2;
+    grown = vim_realloc(regcache, sizeof(regcache_T) * len);
+    if (grown == NULL)
+      return;
+    regcache = grown;
+    regcache_alloced = len;
+  }
+  rc = regcache + regcache_len;
+  if ((rc->rc_pattern = vim_strsave(expr)) == NULL)
+    return;
+  rc->rc_flags = re_flags;
+  rc->rc_engine = p_re;
+  rc->rc_cpo = regcache_cpo();
+  rc->rc_stale = FALSE;
+  rc->rc_prog = prog;
+  rc->rc_refcount = 1;
+  rc->rc_used = ++regcache_tick;
+  ++regcache_len;
+}
+
+/*
+ * Find the cache entry for "prog".  Returns NULL when it is not cached.
+ */
+static regcache_T *
+regcache_find(regprog_T *prog)
+{
+  int i;
+
+  for (i = 0; i < regcache_len; ++i)
+    if (regcache[i].rc_prog == prog)
+      return regcache + i;
+  return NULL;
+}
+
+/*
+ * Drop the compiled patterns from the cache, for when something they depend
+ * on changed, e.g. 'encoding'.  Programs that are used are freed when they
+ * are no longer used.
+ */
+void vim_regcomp_cache_clear(void)
+{
+  int i;
+
+  for (i = 0; i < regcache_len; ++i)
+    regcache[i].rc_stale = TRUE;
+  regcache_prune();
+}
+
+/*
+ * Set the number of unused compiled patterns kept in the cache, zero to not
+ * keep any.
+ */
+void vim_regcomp_cache_set_size(int size)
+{
+  regcache_size = size < 0 ? 0 : size;
+  regcache_prune();
+}
+
+/*
+ * Get the number of times vim_regcomp() found the program in the cache and
+ * the number of times it compiled the pattern.
+ */
+void vim_regcomp_cache_stats(long *hits, long *misses)
+{
+  *hits = regcache_hits;
+  *misses = regcache_misses;
+}
+
 /*
  * Compile a regular expression into internal code.
  * Returns the program in allocated memory.
  * Use vim_regfree() to free the memory.
  * Returns NULL for an error.
+ * The program may be shared with others that compiled the same pattern, see
+ * "regcache".  Use RE_NOCACHE in "re_flags" to get one that isn't, e.g. for
+ * matching in another thread.
  */
 regprog_T *
 vim_regcomp(char_u *expr_arg, int re_flags)
+{
+  regcache_T *rc;
+  regprog_T *prog;
+  int cpo;
+  int i;
+
+  if ((re_flags & RE_NOCACHE) || !regcache_can_use(expr_arg))
+    return regcomp_prog(expr_arg, re_flags);
+
+  cpo = regcache_cpo();
+  for (i = 0; i < regcache_len; ++i)
+  {
+    rc = regcache + i;
+    if (rc->rc_flags == re_flags && rc->rc_engine == p_re && rc->rc_cpo == cpo && !rc->rc_stale && STRCMP(rc->rc_pattern, expr_arg) == 0)
+    {
+      /* Can't share it while it is matching. */
+      if (rc->rc_prog->re_in_use)
+        break;
+      ++rc->rc_refcount;
+      rc->rc_used = ++regcache_tick;
+      ++regcache_hits;
+      return rc->rc_prog;
+    }
+  }
+
+  ++regcache_misses;
+  prog = regcomp_prog(expr_arg, re_flags);
+  if (prog != NULL && regcache_size > 0 && i == regcache_len)
+    regcache_add(expr_arg, re_flags, prog);
+  return prog;
+}
+
+/*
+ * Compile "expr_arg" with the engine selected by 'regexpengine' or "\%#=".
+ */
+static regprog_T *
+regcomp_prog(char_u *expr_arg, int re_flags)
 {
   regprog_T *prog = NULL;
   char_u *expr = expr_arg;
@@ -8014,9 +8327,6 @@ vim_regcomp(char_u *expr_arg, int re_flags)
   bt_regengine.expr = expr;
   nfa_regengine.expr = expr;
 #endif
-  // reg_iswordc() uses rex.reg_buf
-  rex.reg_buf = curbuf;
-
   /*
      * First try the NFA engine, unless backtracking was requested.
      */
@@ -8076,8 +8386,15 @@ vim_regcomp(char_u *expr_arg, int re_flags)
  */
 void vim_regfree(regprog_T *prog)
 {
-  if (prog != NULL)
+  regcache_T *rc;
+
+  if (prog == NULL)
+    return;
+  rc = regcache_find(prog);
+  if (rc == NULL)
     prog->engine->regfree(prog);
+  else if (--rc->rc_refcount == 0)
+    regcache_prune();
 }
 
 #ifdef FEAT_EVAL
@@ -8121,8 +8438,8 @@ vim_regexec_string(
     int nl)
 {
   int result;
-  regexec_T rex_save;
-  int rex_in_use_save = rex_in_use;
+  regexec_T rex_local;
+  regexec_T *rex;
 
   // Cannot use the same prog recursively, it contains state.
   if (rmp->regprog->re_in_use)
@@ -8132,17 +8449,13 @@ vim_regexec_string(
   }
   rmp->regprog->re_in_use = TRUE;
 
-  if (rex_in_use)
-    // Being called recursively, save the state.
-    rex_save = rex;
-  rex_in_use = TRUE;
-
-  rex.reg_startp = NULL;
-  rex.reg_endp = NULL;
-  rex.reg_startpos = NULL;
-  rex.reg_endpos = NULL;
+  rex = rex_get(&rex_local);
+  rex->reg_startp = NULL;
+  rex->reg_endp = NULL;
+  rex->reg_startpos = NULL;
+  rex->reg_endpos = NULL;
 
-  result = rmp->regprog->engine->regexec_nl(rmp, line, col, nl);
+  result = rmp->regprog->engine->regexec_nl(rex, rmp, line, col, nl);
   rmp->regprog->re_in_use = FALSE;
 
   /* NFA engine aborted because it's very slow. */
@@ -8163,7 +8476,7 @@ vim_regexec_string(
       if (rmp->regprog != NULL)
       {
         rmp->regprog->re_in_use = TRUE;
-        result = rmp->regprog->engine->regexec_nl(rmp, line, col, nl);
+        result = rmp->regprog->engine->regexec_nl(rex, rmp, line, col, nl);
         rmp->regprog->re_in_use = FALSE;
       }
       vim_free(pat);
@@ -8172,10 +8485,7 @@ vim_regexec_string(
     p_re = save_p_re;
   }
 
-  rex_in_use = rex_in_use_save;
-  if (rex_in_use)
-    rex = rex_save;
-
+  rex_release(rex);
   return result > 0;
 }
 
@@ -8239,8 +8549,8 @@ long vim_regexec_multi(
     int *timed_out) /* flag is set when timeout limit reached */
 {
   int result;
-  regexec_T rex_save;
-  int rex_in_use_save = rex_in_use;
+  regexec_T rex_local;
+  regexec_T *rex;
 
   // Cannot use the same prog recursively, it contains state.
   if (rmp->regprog->re_in_use)
@@ -8250,13 +8560,9 @@ long vim_regexec_multi(
   }
   rmp->regprog->re_in_use = TRUE;
 
-  if (rex_in_use)
-    /* Being called recursively, save the state. */
-    rex_save = rex;
-  rex_in_use = TRUE;
-
+  rex = rex_get(&rex_local);
   result = rmp->regprog->engine->regexec_multi(
-      rmp, win, buf, lnum, col, tm, timed_out);
+      rex, rmp, win, buf, lnum, col, tm, timed_out);
   rmp->regprog->re_in_use = FALSE;
 
   /* NFA engine aborted because it's very slow. */
@@ -8279,7 +8585,7 @@ long vim_regexec_multi(
       {
         rmp->regprog->re_in_use = TRUE;
         result = rmp->regprog->engine->regexec_multi(
-            rmp, win, buf, lnum, col, tm, timed_out);
+            rex, rmp, win, buf, lnum, col, tm, timed_out);
         rmp->regprog->re_in_use = FALSE;
       }
       vim_free(pat);
@@ -8287,9 +8593,90 @@ long vim_regexec_multi(
     p_re = save_p_re;
   }
 
-  rex_in_use = rex_in_use_save;
-  if (rex_in_use)
-    rex = rex_save;
+  rex_release(rex);
+  return result <= 0 ? 0 : result;
+}
+
+/*
+ * Allocate a regexec_T, to match with vim_regexec_ctx_multi() in another
+ * thread.  Free it with vim_regexec_ctx_free().
+ */
+regexec_T *
+vim_regexec_ctx_alloc(void)
+{
+  regexec_T *rex = ALLOC_CLEAR_ONE(regexec_T);
+
+  if (rex != NULL)
+    rex->reg_no_ui = TRUE;
+  return rex;
+}
+
+void vim_regexec_ctx_free(regexec_T *rex)
+{
+  if (rex == NULL)
+    return;
+  rex_clear(rex);
+  vim_free(rex);
+}
+
+/*
+ * Get the lines to match against from "getline" instead of the buffer, e.g.
+ * from a copy of the text that does not change while matching.  "getline" is
+ * called with a line number and "cookie" and returns the text of the line,
+ * which must stay valid until the match is done.  "line_count" is the number
+ * of lines.  When "getline" is NULL the buffer is used again.
+ */
+void vim_regexec_ctx_set_getline(
+    regexec_T *rex,
+    char_u *(*getline)(linenr_T lnum, void *cookie),
+    void *cookie,
+    linenr_T line_count)
+{
+  rex->reg_getline_func = getline;
+  rex->reg_getline_cookie = cookie;
+  rex->reg_getline_count = line_count;
+}
+
+/*
+ * Like vim_regexec_multi(), but keep the state of matching in "rex", so that
+ * it can be done in another thread than the main one.
+ * "rmp->regprog" can't be used by two threads at the same time, compile the
+ * pattern for each of them with RE_NOCACHE.  Compiling and freeing must be
+ * done in the main thread.
+ * "buf" is used for 'iskeyword', and for the text when
+ * vim_regexec_ctx_set_getline() wasn't used.  Patterns that use the cursor,
+ * marks or the Visual area look at the current window, these should not be
+ * used in another thread.
+ * CTRL-C is not checked for, use "tm" to avoid a match taking too long.  No
+ * error messages are given.
+ *
+ * Return zero if there is no match.  Return number of lines contained in the
+ * match otherwise.  Returns NFA_TOO_EXPENSIVE when the NFA engine found the
+ * pattern too expensive, it needs to be compiled for the backtracking engine
+ * then.  Also returns NFA_TOO_EXPENSIVE when matching failed with an error
+ * that would have given a message, e.g. for 'maxmempattern'.  In both cases
+ * the match can be done with vim_regexec_multi() in the main thread.
+ */
+long vim_regexec_ctx_multi(
+    regexec_T *rex,
+    regmmatch_T *rmp,
+    buf_T *buf,     /* buffer in which to search */
+    linenr_T lnum,  /* nr of line to start looking for match */
+    colnr_T col,    /* column to start looking for match */
+    proftime_T *tm, /* timeout limit or NULL */
+    int *timed_out) /* flag is set when timeout limit reached */
+{
+  long result;
+
+  if (rmp->regprog->re_in_use)
+    return 0;
+  rmp->regprog->re_in_use = TRUE;
+  rex->reg_error = FALSE;
+  result = rmp->regprog->engine->regexec_multi(
+      rex, rmp, NULL, buf, lnum, col, tm, timed_out);
+  rmp->regprog->re_in_use = FALSE;
 
+  if (rex->reg_error || (rmp->regprog->re_engine == AUTOMATIC_ENGINE && result == NFA_TOO_EXPENSIVE))
+    return NFA_TOO_EXPENSIVE;
   return result <= 0 ? 0 : result;
 }
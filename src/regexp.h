@@ -41,6 +41,12 @@
 
 typedef struct regengine regengine_T;
 
+/*
+ * State of executing a regexp, defined in regexp.c.  Matching in another
+ * thread is done with one allocated by vim_regexec_ctx_alloc().
+ */
+typedef struct regexec_S regexec_T;
+
 /*
  * Structure returned by vim_regcomp() to pass on to vim_regexec().
  * This is the general structure. For the actual matcher, two specific
@@ -162,8 +168,8 @@ struct regengine
 {
   regprog_T *(*regcomp)(char_u *, int);
   void (*regfree)(regprog_T *);
-  int (*regexec_nl)(regmatch_T *, char_u *, colnr_T, int);
-  long (*regexec_multi)(regmmatch_T *, win_T *, buf_T *, linenr_T, colnr_T, proftime_T *, int *);
+  int (*regexec_nl)(regexec_T *, regmatch_T *, char_u *, colnr_T, int);
+  long (*regexec_multi)(regexec_T *, regmmatch_T *, win_T *, buf_T *, linenr_T, colnr_T, proftime_T *, int *);
   char_u *expr;
 };
 
@@ -219,12 +219,6 @@ static int *post_ptr;
 static int nstate; // Number of states in the NFA.
 static int istate; // Index in the state vector, used in alloc_state()
 
-/* If not NULL match must end at this position */
-static save_se_T *nfa_endp = NULL;
-
-/* 0 for first call to nfa_regmatch(), 1 for recursive call. */
-static int nfa_ll_index = 0;
-
 static int realloc_post_list(void);
 static int nfa_reg(int paren);
 #ifdef DEBUG
@@ -271,8 +265,8 @@ nfa_regcomp_start(
     return FAIL;
   post_ptr = post_start;
   post_end = post_start + nstate_max;
-  rex.nfa_has_zend = FALSE;
-  rex.nfa_has_backref = FALSE;
+  rex_main.nfa_has_zend = FALSE;
+  rex_main.nfa_has_backref = FALSE;
 
   /* shared with BT engine */
   regcomp_start(expr, re_flags);
@@ -1771,7 +1765,7 @@ nfa_regatom(void)
     if (!seen_endbrace(refnum + 1))
       return FAIL;
     EMIT(NFA_BACKREF1 + refnum);
-    rex.nfa_has_backref = TRUE;
+    rex_main.nfa_has_backref = TRUE;
   }
   break;
 
@@ -1786,7 +1780,7 @@ nfa_regatom(void)
       break;
     case 'e':
       EMIT(NFA_ZEND);
-      rex.nfa_has_zend = TRUE;
+      rex_main.nfa_has_zend = TRUE;
       if (re_mult_next("\\ze") == FAIL)
         return FAIL;
       break;
@@ -4246,7 +4240,7 @@ typedef struct
   } list;
 } regsub_T;
 
-typedef struct
+typedef struct regsubs_S
 {
   regsub_T norm; /* \( .. \) matches */
 } regsubs_T;
@@ -4334,46 +4328,38 @@ pim_info(nfa_pim_T *pim)
     buf[0] = NUL;
   else
   {
-    sprintf(buf, " PIM col %d", REG_MULTI ? (int)pim->end.pos.col : (int)(pim->end.ptr - rex.input));
+    sprintf(buf, " PIM col %d", REG_MULTI ? (int)pim->end.pos.col : (int)(pim->end.ptr - rex->input));
   }
   return buf;
 }
 
 #endif
 
-/* Used during execution: whether a match has been found. */
-static int nfa_match;
-#ifdef FEAT_RELTIME
-static proftime_T *nfa_time_limit;
-static int *nfa_timed_out;
-static int nfa_time_count;
-#endif
-
-static void copy_sub(regsub_T *to, regsub_T *from);
-static int pim_equal(nfa_pim_T *one, nfa_pim_T *two);
+static void copy_sub(regexec_T *rex, regsub_T *to, regsub_T *from);
+static int pim_equal(regexec_T *rex, nfa_pim_T *one, nfa_pim_T *two);
 
 /*
  * Copy postponed invisible match info from "from" to "to".
  */
 static void
-copy_pim(nfa_pim_T *to, nfa_pim_T *from)
+copy_pim(regexec_T *rex, nfa_pim_T *to, nfa_pim_T *from)
 {
   to->result = from->result;
   to->state = from->state;
-  copy_sub(&to->subs.norm, &from->subs.norm);
+  copy_sub(rex, &to->subs.norm, &from->subs.norm);
   to->end = from->end;
 }
 
 static void
-clear_sub(regsub_T *sub)
+clear_sub(regexec_T *rex, regsub_T *sub)
 {
   if (REG_MULTI)
     /* Use 0xff to set lnum to -1 */
     vim_memset(sub->list.multi, 0xff,
-               sizeof(struct multipos) * rex.nfa_nsubexpr);
+               sizeof(struct multipos) * rex->nfa_nsubexpr);
   else
     vim_memset(sub->list.line, 0,
-               sizeof(struct linepos) * rex.nfa_nsubexpr);
+               sizeof(struct linepos) * rex->nfa_nsubexpr);
   sub->in_use = 0;
 }
 
@@ -4381,7 +4367,7 @@ clear_sub(regsub_T *sub)
  * Copy the submatches from "from" to "to".
  */
 static void
-copy_sub(regsub_T *to, regsub_T *from)
+copy_sub(regexec_T *rex, regsub_T *to, regsub_T *from)
 {
   to->in_use = from->in_use;
   if (from->in_use > 0)
@@ -4402,7 +4388,7 @@ copy_sub(regsub_T *to, regsub_T *from)
  * Like copy_sub() but exclude the main match.
  */
 static void
-copy_sub_off(regsub_T *to, regsub_T *from)
+copy_sub_off(regexec_T *rex, regsub_T *to, regsub_T *from)
 {
   if (to->in_use < from->in_use)
     to->in_use = from->in_use;
@@ -4424,9 +4410,9 @@ copy_sub_off(regsub_T *to, regsub_T *from)
  * Like copy_sub() but only do the end of the main match if \ze is present.
  */
 static void
-copy_ze_off(regsub_T *to, regsub_T *from)
+copy_ze_off(regexec_T *rex, regsub_T *to, regsub_T *from)
 {
-  if (rex.nfa_has_zend)
+  if (rex->nfa_has_zend)
   {
     if (REG_MULTI)
     {
@@ -4449,7 +4435,7 @@ copy_ze_off(regsub_T *to, regsub_T *from)
  * When using back-references also check the end position.
  */
 static int
-sub_equal(regsub_T *sub1, regsub_T *sub2)
+sub_equal(regexec_T *rex, regsub_T *sub1, regsub_T *sub2)
 {
   int i;
   int todo;
@@ -4476,7 +4462,7 @@ sub_equal(regsub_T *sub1, regsub_T *sub2)
       if (s1 != -1 && sub1->list.multi[i].start_col != sub2->list.multi[i].start_col)
         return FALSE;
 
-      if (rex.nfa_has_backref)
+      if (rex->nfa_has_backref)
       {
         if (i < sub1->in_use)
           s1 = sub1->list.multi[i].end_lnum;
@@ -4507,7 +4493,7 @@ sub_equal(regsub_T *sub1, regsub_T *sub2)
         sp2 = NULL;
       if (sp1 != sp2)
         return FALSE;
-      if (rex.nfa_has_backref)
+      if (rex->nfa_has_backref)
       {
         if (i < sub1->in_use)
           sp1 = sub1->list.line[i].end;
@@ -4541,7 +4527,7 @@ report_state(char *action,
   else if (REG_MULTI)
     col = sub->list.multi[0].start_col;
   else
-    col = (int)(sub->list.line[0].start - rex.line);
+    col = (int)(sub->list.line[0].start - rex->line);
   nfa_set_code(state->c);
   fprintf(log_fd, "> %s state %d to list %d. char %d: %s (start col %d)%s\n",
           action, abs(state->id), lid, state->c, code, col,
@@ -4555,6 +4541,7 @@ report_state(char *action,
  */
 static int
 has_state_with_pos(
+    regexec_T *rex,
     nfa_list_T *l,      /* runtime state list */
     nfa_state_T *state, /* state to update */
     regsubs_T *subs,    /* pointers to subexpressions */
@@ -4566,7 +4553,7 @@ has_state_with_pos(
   for (i = 0; i < l->n; ++i)
   {
     thread = &l->t[i];
-    if (thread->state->id == state->id && sub_equal(&thread->subs.norm, &subs->norm) && pim_equal(&thread->pim, pim))
+    if (thread->state->id == state->id && sub_equal(rex, &thread->subs.norm, &subs->norm) && pim_equal(rex, &thread->pim, pim))
       return TRUE;
   }
   return FALSE;
@@ -4577,7 +4564,7 @@ has_state_with_pos(
  * set.
  */
 static int
-pim_equal(nfa_pim_T *one, nfa_pim_T *two)
+pim_equal(regexec_T *rex, nfa_pim_T *one, nfa_pim_T *two)
 {
   int one_unused = (one == NULL || one->result == NFA_PIM_UNUSED);
   int two_unused = (two == NULL || two->result == NFA_PIM_UNUSED);
@@ -4693,13 +4680,14 @@ match_follows(nfa_state_T *startstate, int depth)
  */
 static int
 state_in_list(
+    regexec_T *rex,
     nfa_list_T *l,      /* runtime state list */
     nfa_state_T *state, /* state to update */
     regsubs_T *subs)    /* pointers to subexpressions */
 {
-  if (state->lastlist[nfa_ll_index] == l->id)
+  if (state->lastlist[rex->nfa_ll_index] == l->id)
   {
-    if (!rex.nfa_has_backref || has_state_with_pos(l, state, subs, NULL))
+    if (!rex->nfa_has_backref || has_state_with_pos(rex, l, state, subs, NULL))
       return TRUE;
   }
   return FALSE;
@@ -4710,11 +4698,12 @@ state_in_list(
 
 /*
  * Add "state" and possibly what follows to state list ".".
- * Returns "subs_arg", possibly copied into temp_subs.
+ * Returns "subs_arg", possibly copied into rex->nfa_temp_subs.
  * Returns NULL when recursiveness is too deep.
  */
 static regsubs_T *
 addstate(
+    regexec_T *rex,
     nfa_list_T *l,       /* runtime state list */
     nfa_state_T *state,  /* state to update */
     regsubs_T *subs_arg, /* pointers to subexpressions */
@@ -4734,17 +4723,15 @@ addstate(
   int i;
   regsub_T *sub;
   regsubs_T *subs = subs_arg;
-  static regsubs_T temp_subs;
 #ifdef ENABLE_LOG
   int did_print = FALSE;
 #endif
-  static int depth = 0;
 
   // This function is called recursively.  When the depth is too much we run
   // out of stack and crash, limit recursiveness here.
-  if (++depth >= 5000 || subs == NULL)
+  if (++rex->nfa_addstate_depth >= 5000 || subs == NULL)
   {
-    --depth;
+    --rex->nfa_addstate_depth;
     return NULL;
   }
 
@@ -4781,7 +4768,7 @@ addstate(
     /* "^" won't match past end-of-line, don't bother trying.
 	     * Except when at the end of the line, or when we are going to the
 	     * next line for a look-behind match. */
-    if (rex.input > rex.line && *rex.input != NUL && (nfa_endp == NULL || !REG_MULTI || rex.lnum == nfa_endp->se_u.pos.lnum))
+    if (rex->input > rex->line && *rex->input != NUL && (rex->nfa_endp == NULL || !REG_MULTI || rex->lnum == rex->nfa_endp->se_u.pos.lnum))
       goto skip_add;
     /* FALLTHROUGH */
 
@@ -4801,13 +4788,13 @@ addstate(
 	     * endless loop for "\(\)*" */
 
   default:
-    if (state->lastlist[nfa_ll_index] == l->id && state->c != NFA_SKIP)
+    if (state->lastlist[rex->nfa_ll_index] == l->id && state->c != NFA_SKIP)
     {
       /* This state is already in the list, don't add it again,
 		 * unless it is an MOPEN that is used for a backreference or
 		 * when there is a PIM. For NFA_MATCH check the position,
 		 * lower position is preferred. */
-      if (!rex.nfa_has_backref && pim == NULL && !l->has_pim && state->c != NFA_MATCH)
+      if (!rex->nfa_has_backref && pim == NULL && !l->has_pim && state->c != NFA_MATCH)
       {
         /* When called from addstate_here() do insert before
 		     * existing states. */
@@ -4829,14 +4816,14 @@ addstate(
                   abs(state->id), l->id, state->c, code,
                   pim == NULL ? "NULL" : "yes", l->has_pim, found);
 #endif
-          --depth;
+          --rex->nfa_addstate_depth;
           return subs;
         }
       }
 
       /* Do not add the state again when it exists with the same
 		 * positions. */
-      if (has_state_with_pos(l, state, subs, pim))
+      if (has_state_with_pos(rex, l, state, subs, pim))
         goto skip_add;
     }
 
@@ -4850,23 +4837,30 @@ addstate(
 
       if ((long)(newsize >> 10) >= p_mmp)
       {
-        emsg(_(e_maxmempat));
-        --depth;
+        rex_emsg(rex, _(e_maxmempat));
+        --rex->nfa_addstate_depth;
         return NULL;
       }
-      if (subs != &temp_subs)
+      if (subs != rex->nfa_temp_subs)
       {
+        if (rex->nfa_temp_subs == NULL)
+          rex->nfa_temp_subs = ALLOC_ONE(regsubs_T);
+        if (rex->nfa_temp_subs == NULL)
+        {
+          --rex->nfa_addstate_depth;
+          return NULL;
+        }
         /* "subs" may point into the current array, need to make a
 		     * copy before it becomes invalid. */
-        copy_sub(&temp_subs.norm, &subs->norm);
-        subs = &temp_subs;
+        copy_sub(rex, &rex->nfa_temp_subs->norm, &subs->norm);
+        subs = rex->nfa_temp_subs;
       }
 
       newt = vim_realloc(l->t, newsize);
       if (newt == NULL)
       {
         // out of memory
-        --depth;
+        --rex->nfa_addstate_depth;
         return NULL;
       }
       l->t = newt;
@@ -4874,17 +4868,17 @@ addstate(
     }
 
     /* add the state to the list */
-    state->lastlist[nfa_ll_index] = l->id;
+    state->lastlist[rex->nfa_ll_index] = l->id;
     thread = &l->t[l->n++];
     thread->state = state;
     if (pim == NULL)
       thread->pim.result = NFA_PIM_UNUSED;
     else
     {
-      copy_pim(&thread->pim, pim);
+      copy_pim(rex, &thread->pim, pim);
       l->has_pim = TRUE;
     }
-    copy_sub(&thread->subs.norm, &subs->norm);
+    copy_sub(rex, &thread->subs.norm, &subs->norm);
 #ifdef ENABLE_LOG
     report_state("Adding", &thread->subs.norm, state, l->id, pim);
     did_print = TRUE;
@@ -4902,14 +4896,14 @@ addstate(
 
   case NFA_SPLIT:
     /* order matters here */
-    subs = addstate(l, state->out, subs, pim, off_arg);
-    subs = addstate(l, state->out1, subs, pim, off_arg);
+    subs = addstate(rex, l, state->out, subs, pim, off_arg);
+    subs = addstate(rex, l, state->out1, subs, pim, off_arg);
     break;
 
   case NFA_EMPTY:
   case NFA_NOPEN:
   case NFA_NCLOSE:
-    subs = addstate(l, state->out, subs, pim, off_arg);
+    subs = addstate(rex, l, state->out, subs, pim, off_arg);
     break;
 
   case NFA_MOPEN:
@@ -4959,14 +4953,14 @@ addstate(
       }
       if (off == -1)
       {
-        sub->list.multi[subidx].start_lnum = rex.lnum + 1;
+        sub->list.multi[subidx].start_lnum = rex->lnum + 1;
         sub->list.multi[subidx].start_col = 0;
       }
       else
       {
-        sub->list.multi[subidx].start_lnum = rex.lnum;
+        sub->list.multi[subidx].start_lnum = rex->lnum;
         sub->list.multi[subidx].start_col =
-            (colnr_T)(rex.input - rex.line + off);
+            (colnr_T)(rex->input - rex->line + off);
       }
       sub->list.multi[subidx].end_lnum = -1;
     }
@@ -4987,10 +4981,10 @@ addstate(
         }
         sub->in_use = subidx + 1;
       }
-      sub->list.line[subidx].start = rex.input + off;
+      sub->list.line[subidx].start = rex->input + off;
     }
 
-    subs = addstate(l, state->out, subs, pim, off_arg);
+    subs = addstate(rex, l, state->out, subs, pim, off_arg);
     if (subs == NULL)
       break;
     // "subs" may have changed, need to set "sub" again
@@ -5008,12 +5002,12 @@ addstate(
     break;
 
   case NFA_MCLOSE:
-    if (rex.nfa_has_zend && (REG_MULTI
+    if (rex->nfa_has_zend && (REG_MULTI
                                  ? subs->norm.list.multi[0].end_lnum >= 0
                                  : subs->norm.list.line[0].end != NULL))
     {
       // Do not overwrite the position set by \ze.
-      subs = addstate(l, state->out, subs, pim, off_arg);
+      subs = addstate(rex, l, state->out, subs, pim, off_arg);
       break;
     }
     /* FALLTHROUGH */
@@ -5048,14 +5042,14 @@ addstate(
       save_multipos = sub->list.multi[subidx];
       if (off == -1)
       {
-        sub->list.multi[subidx].end_lnum = rex.lnum + 1;
+        sub->list.multi[subidx].end_lnum = rex->lnum + 1;
         sub->list.multi[subidx].end_col = 0;
       }
       else
       {
-        sub->list.multi[subidx].end_lnum = rex.lnum;
+        sub->list.multi[subidx].end_lnum = rex->lnum;
         sub->list.multi[subidx].end_col =
-            (colnr_T)(rex.input - rex.line + off);
+            (colnr_T)(rex->input - rex->line + off);
       }
       /* avoid compiler warnings */
       save_ptr = NULL;
@@ -5063,12 +5057,12 @@ addstate(
     else
     {
       save_ptr = sub->list.line[subidx].end;
-      sub->list.line[subidx].end = rex.input + off;
+      sub->list.line[subidx].end = rex->input + off;
       /* avoid compiler warnings */
       vim_memset(&save_multipos, 0, sizeof(save_multipos));
     }
 
-    subs = addstate(l, state->out, subs, pim, off_arg);
+    subs = addstate(rex, l, state->out, subs, pim, off_arg);
     if (subs == NULL)
       break;
     /* "subs" may have changed, need to set "sub" again */
@@ -5081,7 +5075,7 @@ addstate(
     sub->in_use = save_in_use;
     break;
   }
-  --depth;
+  --rex->nfa_addstate_depth;
   return subs;
 }
 
@@ -5093,6 +5087,7 @@ addstate(
  */
 static regsubs_T *
 addstate_here(
+    regexec_T *rex,
     nfa_list_T *l,      /* runtime state list */
     nfa_state_T *state, /* state to update */
     regsubs_T *subs,    /* pointers to subexpressions */
@@ -5107,7 +5102,7 @@ addstate_here(
   /* First add the state(s) at the end, so that we know how many there are.
      * Pass the listidx as offset (avoids adding another argument to
      * addstate(). */
-  r = addstate(l, state, subs, pim, -listidx - ADDSTATE_HERE_OFFSET);
+  r = addstate(rex, l, state, subs, pim, -listidx - ADDSTATE_HERE_OFFSET);
   if (r == NULL)
     return NULL;
 
@@ -5136,7 +5131,7 @@ addstate_here(
 
       if ((long)(newsize >> 10) >= p_mmp)
       {
-        emsg(_(e_maxmempat));
+        rex_emsg(rex, _(e_maxmempat));
         return NULL;
       }
       newl = alloc(newsize);
@@ -5177,7 +5172,7 @@ addstate_here(
  * Check character class "class" against current character c.
  */
 static int
-check_char_class(int class, int c)
+check_char_class(regexec_T *rex, int class, int c)
 {
   switch (class)
   {
@@ -5250,7 +5245,7 @@ check_char_class(int class, int c)
       return OK;
     break;
   case NFA_CLASS_KEYWORD:
-    if (reg_iswordc(c))
+    if (reg_iswordc(rex, c))
       return OK;
     break;
   case NFA_CLASS_FNAME:
@@ -5272,6 +5267,7 @@ check_char_class(int class, int c)
  */
 static int
 match_backref(
+    regexec_T *rex,
     regsub_T *sub, /* pointers to subexpressions */
     int subidx,
     int *bytelen) /* out: length of match in bytes */
@@ -5290,11 +5286,11 @@ match_backref(
   {
     if (sub->list.multi[subidx].start_lnum < 0 || sub->list.multi[subidx].end_lnum < 0)
       goto retempty;
-    if (sub->list.multi[subidx].start_lnum == rex.lnum && sub->list.multi[subidx].end_lnum == rex.lnum)
+    if (sub->list.multi[subidx].start_lnum == rex->lnum && sub->list.multi[subidx].end_lnum == rex->lnum)
     {
       len = sub->list.multi[subidx].end_col - sub->list.multi[subidx].start_col;
-      if (cstrncmp(rex.line + sub->list.multi[subidx].start_col,
-                   rex.input, &len) == 0)
+      if (cstrncmp(rex, rex->line + sub->list.multi[subidx].start_col,
+                   rex->input, &len) == 0)
       {
         *bytelen = len;
         return TRUE;
@@ -5303,6 +5299,7 @@ match_backref(
     else
     {
       if (match_with_backref(
+              rex,
               sub->list.multi[subidx].start_lnum,
               sub->list.multi[subidx].start_col,
               sub->list.multi[subidx].end_lnum,
@@ -5316,7 +5313,7 @@ match_backref(
     if (sub->list.line[subidx].start == NULL || sub->list.line[subidx].end == NULL)
       goto retempty;
     len = (int)(sub->list.line[subidx].end - sub->list.line[subidx].start);
-    if (cstrncmp(sub->list.line[subidx].start, rex.input, &len) == 0)
+    if (cstrncmp(rex, sub->list.line[subidx].start, rex->input, &len) == 0)
     {
       *bytelen = len;
       return TRUE;
@@ -5373,7 +5370,7 @@ nfa_re_num_cmp(long_u val, int op, long_u pos)
   return val == pos;
 }
 
-static int nfa_regmatch(nfa_regprog_T *prog, nfa_state_T *start, regsubs_T *submatch, regsubs_T *m);
+static int nfa_regmatch(regexec_T *rex, nfa_regprog_T *prog, nfa_state_T *start, regsubs_T *submatch, regsubs_T *m);
 
 /*
  * Recursively call nfa_regmatch()
@@ -5382,6 +5379,7 @@ static int nfa_regmatch(nfa_regprog_T *prog, nfa_state_T *start, regsubs_T *subm
  */
 static int
 recursive_regmatch(
+    regexec_T *rex,
     nfa_state_T *state,
     nfa_pim_T *pim,
     nfa_regprog_T *prog,
@@ -5390,11 +5388,11 @@ recursive_regmatch(
     int **listids,
     int *listids_len)
 {
-  int save_reginput_col = (int)(rex.input - rex.line);
-  int save_reglnum = rex.lnum;
-  int save_nfa_match = nfa_match;
-  int save_nfa_listid = rex.nfa_listid;
-  save_se_T *save_nfa_endp = nfa_endp;
+  int save_reginput_col = (int)(rex->input - rex->line);
+  int save_reglnum = rex->lnum;
+  int save_nfa_match = rex->nfa_match;
+  int save_nfa_listid = rex->nfa_listid;
+  save_se_T *save_nfa_endp = rex->nfa_endp;
   save_se_T endpos;
   save_se_T *endposp = NULL;
   int result;
@@ -5404,9 +5402,9 @@ recursive_regmatch(
   {
     /* start at the position where the postponed match was */
     if (REG_MULTI)
-      rex.input = rex.line + pim->end.pos.col;
+      rex->input = rex->line + pim->end.pos.col;
     else
-      rex.input = pim->end.ptr;
+      rex->input = pim->end.ptr;
   }
 
   if (state->c == NFA_START_INVISIBLE_BEFORE || state->c == NFA_START_INVISIBLE_BEFORE_FIRST || state->c == NFA_START_INVISIBLE_BEFORE_NEG || state->c == NFA_START_INVISIBLE_BEFORE_NEG_FIRST)
@@ -5418,8 +5416,8 @@ recursive_regmatch(
     {
       if (pim == NULL)
       {
-        endpos.se_u.pos.col = (int)(rex.input - rex.line);
-        endpos.se_u.pos.lnum = rex.lnum;
+        endpos.se_u.pos.col = (int)(rex->input - rex->line);
+        endpos.se_u.pos.lnum = rex->lnum;
       }
       else
         endpos.se_u.pos = pim->end.pos;
@@ -5427,7 +5425,7 @@ recursive_regmatch(
     else
     {
       if (pim == NULL)
-        endpos.se_u.ptr = rex.input;
+        endpos.se_u.ptr = rex->input;
       else
         endpos.se_u.ptr = pim->end.ptr;
     }
@@ -5440,37 +5438,37 @@ recursive_regmatch(
     {
       if (REG_MULTI)
       {
-        rex.line = reg_getline(--rex.lnum);
-        if (rex.line == NULL)
+        rex->line = reg_getline(rex, --rex->lnum);
+        if (rex->line == NULL)
           /* can't go before the first line */
-          rex.line = reg_getline(++rex.lnum);
+          rex->line = reg_getline(rex, ++rex->lnum);
       }
-      rex.input = rex.line;
+      rex->input = rex->line;
     }
     else
     {
-      if (REG_MULTI && (int)(rex.input - rex.line) < state->val)
+      if (REG_MULTI && (int)(rex->input - rex->line) < state->val)
       {
         /* Not enough bytes in this line, go to end of
 		 * previous line. */
-        rex.line = reg_getline(--rex.lnum);
-        if (rex.line == NULL)
+        rex->line = reg_getline(rex, --rex->lnum);
+        if (rex->line == NULL)
         {
           /* can't go before the first line */
-          rex.line = reg_getline(++rex.lnum);
-          rex.input = rex.line;
+          rex->line = reg_getline(rex, ++rex->lnum);
+          rex->input = rex->line;
         }
         else
-          rex.input = rex.line + STRLEN(rex.line);
+          rex->input = rex->line + STRLEN(rex->line);
       }
-      if ((int)(rex.input - rex.line) >= state->val)
+      if ((int)(rex->input - rex->line) >= state->val)
       {
-        rex.input -= state->val;
+        rex->input -= state->val;
         if (has_mbyte)
-          rex.input -= mb_head_off(rex.line, rex.input);
+          rex->input -= mb_head_off(rex->line, rex->input);
       }
       else
-        rex.input = rex.line;
+        rex->input = rex->line;
     }
   }
 
@@ -5481,7 +5479,7 @@ recursive_regmatch(
 #endif
   /* Have to clear the lastlist field of the NFA nodes, so that
      * nfa_regmatch() and addstate() can run properly after recursion. */
-  if (nfa_ll_index == 1)
+  if (rex->nfa_ll_index == 1)
   {
     /* Already calling nfa_regmatch() recursively.  Save the lastlist[1]
 	 * values and clear them. */
@@ -5491,7 +5489,7 @@ recursive_regmatch(
       *listids = ALLOC_MULT(int, prog->nstate);
       if (*listids == NULL)
       {
-        emsg(_("E878: (NFA) Could not allocate memory for branch traversal!"));
+        rex_emsg(rex, _("E878: (NFA) Could not allocate memory for branch traversal!"));
         return 0;
       }
       *listids_len = prog->nstate;
@@ -5505,42 +5503,42 @@ recursive_regmatch(
     /* First recursive nfa_regmatch() call, switch to the second lastlist
 	 * entry.  Make sure rex.nfa_listid is different from a previous
 	 * recursive call, because some states may still have this ID. */
-    ++nfa_ll_index;
-    if (rex.nfa_listid <= rex.nfa_alt_listid)
-      rex.nfa_listid = rex.nfa_alt_listid;
+    ++rex->nfa_ll_index;
+    if (rex->nfa_listid <= rex->nfa_alt_listid)
+      rex->nfa_listid = rex->nfa_alt_listid;
   }
 
   /* Call nfa_regmatch() to check if the current concat matches at this
      * position. The concat ends with the node NFA_END_INVISIBLE */
-  nfa_endp = endposp;
-  result = nfa_regmatch(prog, state->out, submatch, m);
+  rex->nfa_endp = endposp;
+  result = nfa_regmatch(rex, prog, state->out, submatch, m);
 
   if (need_restore)
     nfa_restore_listids(prog, *listids);
   else
   {
-    --nfa_ll_index;
-    rex.nfa_alt_listid = rex.nfa_listid;
+    --rex->nfa_ll_index;
+    rex->nfa_alt_listid = rex->nfa_listid;
   }
 
   /* restore position in input text */
-  rex.lnum = save_reglnum;
+  rex->lnum = save_reglnum;
   if (REG_MULTI)
-    rex.line = reg_getline(rex.lnum);
-  rex.input = rex.line + save_reginput_col;
+    rex->line = reg_getline(rex, rex->lnum);
+  rex->input = rex->line + save_reginput_col;
   if (result != NFA_TOO_EXPENSIVE)
   {
-    nfa_match = save_nfa_match;
-    rex.nfa_listid = save_nfa_listid;
+    rex->nfa_match = save_nfa_match;
+    rex->nfa_listid = save_nfa_listid;
   }
-  nfa_endp = save_nfa_endp;
+  rex->nfa_endp = save_nfa_endp;
 
 #ifdef ENABLE_LOG
   log_fd = fopen(NFA_REGEXP_RUN_LOG, "a");
   if (log_fd != NULL)
   {
     fprintf(log_fd, "****************************\n");
-    fprintf(log_fd, "FINISHED RUNNING nfa_regmatch() recursively\n");
+    fprintf(log_fd, "FINISHED RUNNING nfa_regmatch(rex) recursively\n");
     fprintf(log_fd, "MATCH = %s\n", result == TRUE ? "OK" : "FALSE");
     fprintf(log_fd, "****************************\n");
   }
@@ -5688,18 +5686,18 @@ failure_chance(nfa_state_T *state, int depth)
  * Skip until the char "c" we know a match must start with.
  */
 static int
-skip_to_start(int c, colnr_T *colp)
+skip_to_start(regexec_T *rex, int c, colnr_T *colp)
 {
   char_u *s;
 
   /* Used often, do some work to avoid call overhead. */
-  if (!rex.reg_ic && !has_mbyte)
-    s = vim_strbyte(rex.line + *colp, c);
+  if (!rex->reg_ic && !has_mbyte)
+    s = vim_strbyte(rex->line + *colp, c);
   else
-    s = cstrchr(rex.line + *colp, c);
+    s = cstrchr(rex, rex->line + *colp, c);
   if (s == NULL)
     return FAIL;
-  *colp = (int)(s - rex.line);
+  *colp = (int)(s - rex->line);
   return OK;
 }
 
@@ -5709,7 +5707,7 @@ skip_to_start(int c, colnr_T *colp)
  * Returns zero for no match, 1 for a match.
  */
 static long
-find_match_text(colnr_T startcol, int regstart, char_u *match_text)
+find_match_text(regexec_T *rex, colnr_T startcol, int regstart, char_u *match_text)
 {
   colnr_T col = startcol;
   int c1, c2;
@@ -5723,8 +5721,8 @@ find_match_text(colnr_T startcol, int regstart, char_u *match_text)
     for (len1 = 0; match_text[len1] != NUL; len1 += MB_CHAR2LEN(c1))
     {
       c1 = PTR2CHAR(match_text + len1);
-      c2 = PTR2CHAR(rex.line + col + len2);
-      if (c1 != c2 && (!rex.reg_ic || MB_TOLOWER(c1) != MB_TOLOWER(c2)))
+      c2 = PTR2CHAR(rex->line + col + len2);
+      if (c1 != c2 && (!rex->reg_ic || MB_TOLOWER(c1) != MB_TOLOWER(c2)))
       {
         match = FALSE;
         break;
@@ -5733,27 +5731,27 @@ find_match_text(colnr_T startcol, int regstart, char_u *match_text)
     }
     if (match
         /* check that no composing char follows */
-        && !(enc_utf8 && utf_iscomposing(PTR2CHAR(rex.line + col + len2))))
+        && !(enc_utf8 && utf_iscomposing(PTR2CHAR(rex->line + col + len2))))
     {
-      cleanup_subexpr();
+      cleanup_subexpr(rex);
       if (REG_MULTI)
       {
-        rex.reg_startpos[0].lnum = rex.lnum;
-        rex.reg_startpos[0].col = col;
-        rex.reg_endpos[0].lnum = rex.lnum;
-        rex.reg_endpos[0].col = col + len2;
+        rex->reg_startpos[0].lnum = rex->lnum;
+        rex->reg_startpos[0].col = col;
+        rex->reg_endpos[0].lnum = rex->lnum;
+        rex->reg_endpos[0].col = col + len2;
       }
       else
       {
-        rex.reg_startp[0] = rex.line + col;
-        rex.reg_endp[0] = rex.line + col + len2;
+        rex->reg_startp[0] = rex->line + col;
+        rex->reg_endp[0] = rex->line + col + len2;
       }
       return 1L;
     }
 
     /* Try finding regstart after the current match. */
     col += MB_CHAR2LEN(regstart); /* skip regstart */
-    if (skip_to_start(regstart, &col) == FAIL)
+    if (skip_to_start(rex, regstart, &col) == FAIL)
       break;
   }
   return 0L;
@@ -5761,12 +5759,12 @@ find_match_text(colnr_T startcol, int regstart, char_u *match_text)
 
 #ifdef FEAT_RELTIME
 static int
-nfa_did_time_out()
+nfa_did_time_out(regexec_T *rex)
 {
-  if (nfa_time_limit != NULL && profile_passed_limit(nfa_time_limit))
+  if (rex->nfa_time_limit != NULL && profile_passed_limit(rex->nfa_time_limit))
   {
-    if (nfa_timed_out != NULL)
-      *nfa_timed_out = TRUE;
+    if (rex->nfa_timed_out != NULL)
+      *rex->nfa_timed_out = TRUE;
     return TRUE;
   }
   return FALSE;
@@ -5788,6 +5786,7 @@ nfa_did_time_out()
  */
 static int
 nfa_regmatch(
+    regexec_T *rex,
     nfa_regprog_T *prog,
     nfa_state_T *start,
     regsubs_T *submatch,
@@ -5816,11 +5815,11 @@ nfa_regmatch(
 
   /* Some patterns may take a long time to match, especially when using
      * recursive_regmatch(). Allow interrupting them with CTRL-C. */
-  fast_breakcheck();
+  reg_breakcheck(rex);
   if (got_int)
     return FALSE;
 #ifdef FEAT_RELTIME
-  if (nfa_did_time_out())
+  if (nfa_did_time_out(rex))
     return FALSE;
 #endif
 
@@ -5832,7 +5831,7 @@ nfa_regmatch(
     return FALSE;
   }
 #endif
-  nfa_match = FALSE;
+  rex->nfa_match = FALSE;
 
   /* Allocate memory for the lists of nodes. */
   size = (prog->nstate + 1) * sizeof(nfa_thread_T);
@@ -5850,7 +5849,7 @@ nfa_regmatch(
   {
     fprintf(log_fd, "**********************************\n");
     nfa_set_code(start->c);
-    fprintf(log_fd, " RUNNING nfa_regmatch() starting with state %d, code %s\n",
+    fprintf(log_fd, " RUNNING nfa_regmatch(rex) starting with state %d, code %s\n",
             abs(start->id), code);
     fprintf(log_fd, "**********************************\n");
   }
@@ -5870,7 +5869,7 @@ nfa_regmatch(
 #ifdef ENABLE_LOG
   fprintf(log_fd, "(---) STARTSTATE first\n");
 #endif
-  thislist->id = rex.nfa_listid + 1;
+  thislist->id = rex->nfa_listid + 1;
 
   /* Inline optimized code for addstate(thislist, start, m, 0) if we know
      * it's the first MOPEN. */
@@ -5878,19 +5877,19 @@ nfa_regmatch(
   {
     if (REG_MULTI)
     {
-      m->norm.list.multi[0].start_lnum = rex.lnum;
-      m->norm.list.multi[0].start_col = (colnr_T)(rex.input - rex.line);
+      m->norm.list.multi[0].start_lnum = rex->lnum;
+      m->norm.list.multi[0].start_col = (colnr_T)(rex->input - rex->line);
     }
     else
-      m->norm.list.line[0].start = rex.input;
+      m->norm.list.line[0].start = rex->input;
     m->norm.in_use = 1;
-    r = addstate(thislist, start->out, m, NULL, 0);
+    r = addstate(rex, thislist, start->out, m, NULL, 0);
   }
   else
-    r = addstate(thislist, start, m, NULL, 0);
+    r = addstate(rex, thislist, start, m, NULL, 0);
   if (r == NULL)
   {
-    nfa_match = NFA_TOO_EXPENSIVE;
+    rex->nfa_match = NFA_TOO_EXPENSIVE;
     goto theend;
   }
 
@@ -5911,12 +5910,12 @@ nfa_regmatch(
 
     if (has_mbyte)
     {
-      curc = (*mb_ptr2char)(rex.input);
-      clen = (*mb_ptr2len)(rex.input);
+      curc = (*mb_ptr2char)(rex->input);
+      clen = (*mb_ptr2len)(rex->input);
     }
     else
     {
-      curc = *rex.input;
+      curc = *rex->input;
       clen = 1;
     }
     if (curc == NUL)
@@ -5930,24 +5929,24 @@ nfa_regmatch(
     nextlist = &list[flag ^= 1];
     nextlist->n = 0; /* clear nextlist */
     nextlist->has_pim = FALSE;
-    ++rex.nfa_listid;
-    if (prog->re_engine == AUTOMATIC_ENGINE && (rex.nfa_listid >= NFA_MAX_STATES
+    ++rex->nfa_listid;
+    if (prog->re_engine == AUTOMATIC_ENGINE && (rex->nfa_listid >= NFA_MAX_STATES
 #ifdef FEAT_EVAL
                                                 || nfa_fail_for_testing
 #endif
                                                 ))
     {
       /* too many states, retry with old engine */
-      nfa_match = NFA_TOO_EXPENSIVE;
+      rex->nfa_match = NFA_TOO_EXPENSIVE;
       goto theend;
     }
 
-    thislist->id = rex.nfa_listid;
-    nextlist->id = rex.nfa_listid + 1;
+    thislist->id = rex->nfa_listid;
+    nextlist->id = rex->nfa_listid + 1;
 
 #ifdef ENABLE_LOG
     fprintf(log_fd, "------------------------------------------\n");
-    fprintf(log_fd, ">>> Reginput is \"%s\"\n", rex.input);
+    fprintf(log_fd, ">>> Reginput is \"%s\"\n", rex->input);
     fprintf(log_fd, ">>> Advanced one character... Current char is %c (code %d) \n", curc, (int)curc);
     fprintf(log_fd, ">>> Thislist has %d states available: ", thislist->n);
     {
@@ -5973,14 +5972,14 @@ nfa_regmatch(
     {
       /* If the list gets very long there probably is something wrong.
 	     * At least allow interrupting with CTRL-C. */
-      fast_breakcheck();
+      reg_breakcheck(rex);
       if (got_int)
         break;
 #ifdef FEAT_RELTIME
-      if (nfa_time_limit != NULL && ++nfa_time_count == 20)
+      if (rex->nfa_time_limit != NULL && ++rex->nfa_time_count == 20)
       {
-        nfa_time_count = 0;
-        if (nfa_did_time_out())
+        rex->nfa_time_count = 0;
+        if (nfa_did_time_out(rex))
           break;
       }
 #endif
@@ -5999,7 +5998,7 @@ nfa_regmatch(
         else if (REG_MULTI)
           col = t->subs.norm.list.multi[0].start_col;
         else
-          col = (int)(t->subs.norm.list.line[0].start - rex.line);
+          col = (int)(t->subs.norm.list.line[0].start - rex->line);
         nfa_set_code(t->state->c);
         fprintf(log_fd, "(%d) char %d %s (start col %d)%s... \n",
                 abs(t->state->id), (int)t->state->c, code, col,
@@ -6020,11 +6019,11 @@ nfa_regmatch(
       {
         /* If the match ends before a composing characters and
 		 * rex.reg_icombine is not set, that is not really a match. */
-        if (enc_utf8 && !rex.reg_icombine && utf_iscomposing(curc))
+        if (enc_utf8 && !rex->reg_icombine && utf_iscomposing(curc))
           break;
 
-        nfa_match = TRUE;
-        copy_sub(&submatch->norm, &t->subs.norm);
+        rex->nfa_match = TRUE;
+        copy_sub(rex, &submatch->norm, &t->subs.norm);
 #ifdef ENABLE_LOG
         log_subsexpr(&t->subs);
 #endif
@@ -6052,37 +6051,37 @@ nfa_regmatch(
 		 * Submatches are stored in *m, and used in the parent call.
 		 */
 #ifdef ENABLE_LOG
-        if (nfa_endp != NULL)
+        if (rex->nfa_endp != NULL)
         {
           if (REG_MULTI)
             fprintf(log_fd, "Current lnum: %d, endp lnum: %d; current col: %d, endp col: %d\n",
-                    (int)rex.lnum,
-                    (int)nfa_endp->se_u.pos.lnum,
-                    (int)(rex.input - rex.line),
-                    nfa_endp->se_u.pos.col);
+                    (int)rex->lnum,
+                    (int)rex->nfa_endp->se_u.pos.lnum,
+                    (int)(rex->input - rex->line),
+                    rex->nfa_endp->se_u.pos.col);
           else
             fprintf(log_fd, "Current col: %d, endp col: %d\n",
-                    (int)(rex.input - rex.line),
-                    (int)(nfa_endp->se_u.ptr - rex.input));
+                    (int)(rex->input - rex->line),
+                    (int)(rex->nfa_endp->se_u.ptr - rex->input));
         }
 #endif
         /* If "nfa_endp" is set it's only a match if it ends at
 		 * "nfa_endp" */
-        if (nfa_endp != NULL && (REG_MULTI
-                                     ? (rex.lnum != nfa_endp->se_u.pos.lnum || (int)(rex.input - rex.line) != nfa_endp->se_u.pos.col)
-                                     : rex.input != nfa_endp->se_u.ptr))
+        if (rex->nfa_endp != NULL && (REG_MULTI
+                                     ? (rex->lnum != rex->nfa_endp->se_u.pos.lnum || (int)(rex->input - rex->line) != rex->nfa_endp->se_u.pos.col)
+                                     : rex->input != rex->nfa_endp->se_u.ptr))
           break;
 
         /* do not set submatches for \@! */
         if (t->state->c != NFA_END_INVISIBLE_NEG)
         {
-          copy_sub(&m->norm, &t->subs.norm);
+          copy_sub(rex, &m->norm, &t->subs.norm);
         }
 #ifdef ENABLE_LOG
         fprintf(log_fd, "Match found:\n");
         log_subsexpr(m);
 #endif
-        nfa_match = TRUE;
+        rex->nfa_match = TRUE;
         /* See comment above at "goto nextchar". */
         if (nextlist->n == 0)
           clen = 0;
@@ -6110,17 +6109,17 @@ nfa_regmatch(
 
           /* Copy submatch info for the recursive call, opposite
 			 * of what happens on success below. */
-          copy_sub_off(&m->norm, &t->subs.norm);
+          copy_sub_off(rex, &m->norm, &t->subs.norm);
 
           /*
 			 * First try matching the invisible match, then what
 			 * follows.
 			 */
-          result = recursive_regmatch(t->state, NULL, prog,
+          result = recursive_regmatch(rex, t->state, NULL, prog,
                                       submatch, m, &listids, &listids_len);
           if (result == NFA_TOO_EXPENSIVE)
           {
-            nfa_match = result;
+            rex->nfa_match = result;
             goto theend;
           }
 
@@ -6129,10 +6128,10 @@ nfa_regmatch(
           if (result != (t->state->c == NFA_START_INVISIBLE_NEG || t->state->c == NFA_START_INVISIBLE_NEG_FIRST || t->state->c == NFA_START_INVISIBLE_BEFORE_NEG || t->state->c == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
           {
             /* Copy submatch info from the recursive call */
-            copy_sub_off(&t->subs.norm, &m->norm);
+            copy_sub_off(rex, &t->subs.norm, &m->norm);
             /* If the pattern has \ze and it matched in the
 			     * sub pattern, use it. */
-            copy_ze_off(&t->subs.norm, &m->norm);
+            copy_ze_off(rex, &t->subs.norm, &m->norm);
 
             /* t->state->out1 is the corresponding
 			     * END_INVISIBLE node; Add its out to the current
@@ -6157,19 +6156,19 @@ nfa_regmatch(
           pim.subs.norm.in_use = 0;
           if (REG_MULTI)
           {
-            pim.end.pos.col = (int)(rex.input - rex.line);
-            pim.end.pos.lnum = rex.lnum;
+            pim.end.pos.col = (int)(rex->input - rex->line);
+            pim.end.pos.lnum = rex->lnum;
           }
           else
-            pim.end.ptr = rex.input;
+            pim.end.ptr = rex->input;
 
           /* t->state->out1 is the corresponding END_INVISIBLE
 			 * node; Add its out to the current list (zero-width
 			 * match). */
-          if (addstate_here(thislist, t->state->out1->out,
+          if (addstate_here(rex, thislist, t->state->out1->out,
                             &t->subs, &pim, &listidx) == NULL)
           {
-            nfa_match = NFA_TOO_EXPENSIVE;
+            rex->nfa_match = NFA_TOO_EXPENSIVE;
             goto theend;
           }
         }
@@ -6185,14 +6184,14 @@ nfa_regmatch(
 
         /* There is no point in trying to match the pattern if the
 		 * output state is not going to be added to the list. */
-        if (state_in_list(nextlist, t->state->out1->out, &t->subs))
+        if (state_in_list(rex, nextlist, t->state->out1->out, &t->subs))
         {
           skip = t->state->out1->out;
 #ifdef ENABLE_LOG
           skip_lid = nextlist->id;
 #endif
         }
-        else if (state_in_list(nextlist,
+        else if (state_in_list(rex, nextlist,
                                t->state->out1->out->out, &t->subs))
         {
           skip = t->state->out1->out->out;
@@ -6200,7 +6199,7 @@ nfa_regmatch(
           skip_lid = nextlist->id;
 #endif
         }
-        else if (state_in_list(thislist,
+        else if (state_in_list(rex, thislist,
                                t->state->out1->out->out, &t->subs))
         {
           skip = t->state->out1->out->out;
@@ -6219,14 +6218,14 @@ nfa_regmatch(
         }
         /* Copy submatch info to the recursive call, opposite of what
 		 * happens afterwards. */
-        copy_sub_off(&m->norm, &t->subs.norm);
+        copy_sub_off(rex, &m->norm, &t->subs.norm);
 
         /* First try matching the pattern. */
-        result = recursive_regmatch(t->state, NULL, prog,
+        result = recursive_regmatch(rex, t->state, NULL, prog,
                                     submatch, m, &listids, &listids_len);
         if (result == NFA_TOO_EXPENSIVE)
         {
-          nfa_match = result;
+          rex->nfa_match = result;
           goto theend;
         }
         if (result)
@@ -6238,14 +6237,14 @@ nfa_regmatch(
           log_subsexpr(m);
 #endif
           /* Copy submatch info from the recursive call */
-          copy_sub_off(&t->subs.norm, &m->norm);
+          copy_sub_off(rex, &t->subs.norm, &m->norm);
           /* Now we need to skip over the matched text and then
 		     * continue with what follows. */
           if (REG_MULTI)
             /* TODO: multi-line match */
-            bytelen = m->norm.list.multi[0].end_col - (int)(rex.input - rex.line);
+            bytelen = m->norm.list.multi[0].end_col - (int)(rex->input - rex->line);
           else
-            bytelen = (int)(m->norm.list.line[0].end - rex.input);
+            bytelen = (int)(m->norm.list.line[0].end - rex->input);
 
 #ifdef ENABLE_LOG
           fprintf(log_fd, "NFA_START_PATTERN length: %d\n", bytelen);
@@ -6278,7 +6277,7 @@ nfa_regmatch(
       }
 
       case NFA_BOL:
-        if (rex.input == rex.line)
+        if (rex->input == rex->line)
         {
           add_here = TRUE;
           add_state = t->state->out;
@@ -6303,13 +6302,13 @@ nfa_regmatch(
           int this_class;
 
           /* Get class of current and previous char (if it exists). */
-          this_class = mb_get_class_buf(rex.input, rex.reg_buf);
+          this_class = mb_get_class_buf(rex->input, rex->reg_buf);
           if (this_class <= 1)
             result = FALSE;
-          else if (reg_prev_class() == this_class)
+          else if (reg_prev_class(rex) == this_class)
             result = FALSE;
         }
-        else if (!vim_iswordc_buf(curc, rex.reg_buf) || (rex.input > rex.line && vim_iswordc_buf(rex.input[-1], rex.reg_buf)))
+        else if (!vim_iswordc_buf(curc, rex->reg_buf) || (rex->input > rex->line && vim_iswordc_buf(rex->input[-1], rex->reg_buf)))
           result = FALSE;
         if (result)
         {
@@ -6320,19 +6319,19 @@ nfa_regmatch(
 
       case NFA_EOW:
         result = TRUE;
-        if (rex.input == rex.line)
+        if (rex->input == rex->line)
           result = FALSE;
         else if (has_mbyte)
         {
           int this_class, prev_class;
 
           /* Get class of current and previous char (if it exists). */
-          this_class = mb_get_class_buf(rex.input, rex.reg_buf);
-          prev_class = reg_prev_class();
+          this_class = mb_get_class_buf(rex->input, rex->reg_buf);
+          prev_class = reg_prev_class(rex);
           if (this_class == prev_class || prev_class == 0 || prev_class == 1)
             result = FALSE;
         }
-        else if (!vim_iswordc_buf(rex.input[-1], rex.reg_buf) || (rex.input[0] != NUL && vim_iswordc_buf(curc, rex.reg_buf)))
+        else if (!vim_iswordc_buf(rex->input[-1], rex->reg_buf) || (rex->input[0] != NUL && vim_iswordc_buf(curc, rex->reg_buf)))
           result = FALSE;
         if (result)
         {
@@ -6342,7 +6341,7 @@ nfa_regmatch(
         break;
 
       case NFA_BOF:
-        if (rex.lnum == 0 && rex.input == rex.line && (!REG_MULTI || rex.reg_firstlnum == 1))
+        if (rex->lnum == 0 && rex->input == rex->line && (!REG_MULTI || rex->reg_firstlnum == 1))
         {
           add_here = TRUE;
           add_state = t->state->out;
@@ -6350,7 +6349,7 @@ nfa_regmatch(
         break;
 
       case NFA_EOF:
-        if (rex.lnum == rex.reg_maxline && curc == NUL)
+        if (rex->lnum == rex->reg_maxline && curc == NUL)
         {
           add_here = TRUE;
           add_state = t->state->out;
@@ -6376,7 +6375,7 @@ nfa_regmatch(
 		     * (no preceding character). */
           len += mb_char2len(mc);
         }
-        if (rex.reg_icombine && len == 0)
+        if (rex->reg_icombine && len == 0)
         {
           /* If \Z was present, then ignore composing characters.
 		     * When ignoring the base character this always matches. */
@@ -6401,7 +6400,7 @@ nfa_regmatch(
 		     * Get them into cchars[] first. */
           while (len < clen)
           {
-            mc = mb_ptr2char(rex.input + len);
+            mc = mb_ptr2char(rex->input + len);
             cchars[ccount++] = mc;
             len += mb_char2len(mc);
             if (ccount == MAX_MCO)
@@ -6434,7 +6433,7 @@ nfa_regmatch(
       }
 
       case NFA_NEWL:
-        if (curc == NUL && !rex.reg_line_lbr && REG_MULTI && rex.lnum <= rex.reg_maxline)
+        if (curc == NUL && !rex->reg_line_lbr && REG_MULTI && rex->lnum <= rex->reg_maxline)
         {
           go_to_nextline = TRUE;
           /* Pass -1 for the offset, which means taking the position
@@ -6442,7 +6441,7 @@ nfa_regmatch(
           add_state = t->state->out;
           add_off = -1;
         }
-        else if (curc == '\n' && rex.reg_line_lbr)
+        else if (curc == '\n' && rex->reg_line_lbr)
         {
           /* match \n as if it is an ordinary character */
           add_state = t->state->out;
@@ -6487,7 +6486,7 @@ nfa_regmatch(
               result = result_if_matched;
               break;
             }
-            if (rex.reg_ic)
+            if (rex->reg_ic)
             {
               int curc_low = MB_TOLOWER(curc);
               int done = FALSE;
@@ -6503,8 +6502,8 @@ nfa_regmatch(
                 break;
             }
           }
-          else if (state->c < 0 ? check_char_class(state->c, curc)
-                                : (curc == state->c || (rex.reg_ic && MB_TOLOWER(curc) == MB_TOLOWER(state->c))))
+          else if (state->c < 0 ? check_char_class(rex, state->c, curc)
+                                : (curc == state->c || (rex->reg_ic && MB_TOLOWER(curc) == MB_TOLOWER(state->c))))
           {
             result = result_if_matched;
             break;
@@ -6559,12 +6558,12 @@ nfa_regmatch(
         break;
 
       case NFA_KWORD: /*  \k	*/
-        result = vim_iswordp_buf(rex.input, rex.reg_buf);
+        result = vim_iswordp_buf(rex->input, rex->reg_buf);
         ADD_STATE_IF_MATCH(t->state);
         break;
 
       case NFA_SKWORD: /*  \K	*/
-        result = !VIM_ISDIGIT(curc) && vim_iswordp_buf(rex.input, rex.reg_buf);
+        result = !VIM_ISDIGIT(curc) && vim_iswordp_buf(rex->input, rex->reg_buf);
         ADD_STATE_IF_MATCH(t->state);
         break;
 
@@ -6579,12 +6578,12 @@ nfa_regmatch(
         break;
 
       case NFA_PRINT: /*  \p	*/
-        result = vim_isprintc(PTR2CHAR(rex.input));
+        result = vim_isprintc(PTR2CHAR(rex->input));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
       case NFA_SPRINT: /*  \P	*/
-        result = !VIM_ISDIGIT(curc) && vim_isprintc(PTR2CHAR(rex.input));
+        result = !VIM_ISDIGIT(curc) && vim_isprintc(PTR2CHAR(rex->input));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
@@ -6679,22 +6678,22 @@ nfa_regmatch(
         break;
 
       case NFA_LOWER_IC: /* [a-z] */
-        result = ri_lower(curc) || (rex.reg_ic && ri_upper(curc));
+        result = ri_lower(curc) || (rex->reg_ic && ri_upper(curc));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
       case NFA_NLOWER_IC: /* [^a-z] */
-        result = curc != NUL && !(ri_lower(curc) || (rex.reg_ic && ri_upper(curc)));
+        result = curc != NUL && !(ri_lower(curc) || (rex->reg_ic && ri_upper(curc)));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
       case NFA_UPPER_IC: /* [A-Z] */
-        result = ri_upper(curc) || (rex.reg_ic && ri_lower(curc));
+        result = ri_upper(curc) || (rex->reg_ic && ri_lower(curc));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
       case NFA_NUPPER_IC: /* ^[A-Z] */
-        result = curc != NUL && !(ri_upper(curc) || (rex.reg_ic && ri_lower(curc)));
+        result = curc != NUL && !(ri_upper(curc) || (rex->reg_ic && ri_lower(curc)));
         ADD_STATE_IF_MATCH(t->state);
         break;
 
@@ -6715,7 +6714,7 @@ nfa_regmatch(
           if (t->state->c <= NFA_BACKREF9)
           {
             subidx = t->state->c - NFA_BACKREF1 + 1;
-            result = match_backref(&t->subs.norm, subidx, &bytelen);
+            result = match_backref(rex, &t->subs.norm, subidx, &bytelen);
           }
 
           if (result)
@@ -6767,7 +6766,7 @@ nfa_regmatch(
       case NFA_LNUM_LT:
         result = (REG_MULTI &&
                   nfa_re_num_cmp(t->state->val, t->state->c - NFA_LNUM,
-                                 (long_u)(rex.lnum + rex.reg_firstlnum)));
+                                 (long_u)(rex->lnum + rex->reg_firstlnum)));
         if (result)
         {
           add_here = TRUE;
@@ -6779,7 +6778,7 @@ nfa_regmatch(
       case NFA_COL_GT:
       case NFA_COL_LT:
         result = nfa_re_num_cmp(t->state->val, t->state->c - NFA_COL,
-                                (long_u)(rex.input - rex.line) + 1);
+                                (long_u)(rex->input - rex->line) + 1);
         if (result)
         {
           add_here = TRUE;
@@ -6792,8 +6791,8 @@ nfa_regmatch(
       case NFA_VCOL_LT:
       {
         int op = t->state->c - NFA_VCOL;
-        colnr_T col = (colnr_T)(rex.input - rex.line);
-        win_T *wp = rex.reg_win == NULL ? curwin : rex.reg_win;
+        colnr_T col = (colnr_T)(rex->input - rex->line);
+        win_T *wp = rex->reg_win == NULL ? curwin : rex->reg_win;
 
         /* Bail out quickly when there can't be a match, avoid the
 		     * overhead of win_linetabsize() on long lines. */
@@ -6812,7 +6811,7 @@ nfa_regmatch(
         }
         if (!result)
           result = nfa_re_num_cmp(t->state->val, op,
-                                  (long_u)win_linetabsize(wp, rex.line, col) + 1);
+                                  (long_u)win_linetabsize(wp, rex->line, col) + 1);
         if (result)
         {
           add_here = TRUE;
@@ -6825,18 +6824,18 @@ nfa_regmatch(
       case NFA_MARK_GT:
       case NFA_MARK_LT:
       {
-        pos_T *pos = getmark_buf(rex.reg_buf, t->state->val, FALSE);
+        pos_T *pos = getmark_buf(rex->reg_buf, t->state->val, FALSE);
 
         /* Compare the mark position to the match position. */
         result = (pos != NULL      /* mark doesn't exist */
                   && pos->lnum > 0 /* mark isn't set in reg_buf */
-                  && (pos->lnum == rex.lnum + rex.reg_firstlnum
-                          ? (pos->col == (colnr_T)(rex.input - rex.line)
+                  && (pos->lnum == rex->lnum + rex->reg_firstlnum
+                          ? (pos->col == (colnr_T)(rex->input - rex->line)
                                  ? t->state->c == NFA_MARK
-                                 : (pos->col < (colnr_T)(rex.input - rex.line)
+                                 : (pos->col < (colnr_T)(rex->input - rex->line)
                                         ? t->state->c == NFA_MARK_GT
                                         : t->state->c == NFA_MARK_LT))
-                          : (pos->lnum < rex.lnum + rex.reg_firstlnum
+                          : (pos->lnum < rex->lnum + rex->reg_firstlnum
                                  ? t->state->c == NFA_MARK_GT
                                  : t->state->c == NFA_MARK_LT)));
         if (result)
@@ -6848,7 +6847,7 @@ nfa_regmatch(
       }
 
       case NFA_CURSOR:
-        result = (rex.reg_win != NULL && (rex.lnum + rex.reg_firstlnum == rex.reg_win->w_cursor.lnum) && ((colnr_T)(rex.input - rex.line) == rex.reg_win->w_cursor.col));
+        result = (rex->reg_win != NULL && (rex->lnum + rex->reg_firstlnum == rex->reg_win->w_cursor.lnum) && ((colnr_T)(rex->input - rex->line) == rex->reg_win->w_cursor.col));
         if (result)
         {
           add_here = TRUE;
@@ -6857,7 +6856,7 @@ nfa_regmatch(
         break;
 
       case NFA_VISUAL:
-        result = reg_match_visual();
+        result = reg_match_visual(rex);
         if (result)
         {
           add_here = TRUE;
@@ -6890,12 +6889,12 @@ nfa_regmatch(
 #endif
         result = (c == curc);
 
-        if (!result && rex.reg_ic)
+        if (!result && rex->reg_ic)
           result = MB_TOLOWER(c) == MB_TOLOWER(curc);
         /* If rex.reg_icombine is not set only skip over the character
 		 * itself.  When it is set skip over composing characters. */
-        if (result && enc_utf8 && !rex.reg_icombine)
-          clen = utf_ptr2len(rex.input);
+        if (result && enc_utf8 && !rex->reg_icombine)
+          clen = utf_ptr2len(rex->input);
         ADD_STATE_IF_MATCH(t->state);
         break;
       }
@@ -6921,10 +6920,10 @@ nfa_regmatch(
 #ifdef ENABLE_LOG
             fprintf(log_fd, "\n");
             fprintf(log_fd, "==================================\n");
-            fprintf(log_fd, "Postponed recursive nfa_regmatch()\n");
+            fprintf(log_fd, "Postponed recursive nfa_regmatch(rex)\n");
             fprintf(log_fd, "\n");
 #endif
-            result = recursive_regmatch(pim->state, pim,
+            result = recursive_regmatch(rex, pim->state, pim,
                                         prog, submatch, m, &listids, &listids_len);
             pim->result = result ? NFA_PIM_MATCH : NFA_PIM_NOMATCH;
             /* for \@! and \@<! it is a match when the result is
@@ -6932,7 +6931,7 @@ nfa_regmatch(
             if (result != (pim->state->c == NFA_START_INVISIBLE_NEG || pim->state->c == NFA_START_INVISIBLE_NEG_FIRST || pim->state->c == NFA_START_INVISIBLE_BEFORE_NEG || pim->state->c == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
             {
               /* Copy submatch info from the recursive call */
-              copy_sub_off(&pim->subs.norm, &m->norm);
+              copy_sub_off(rex, &pim->subs.norm, &m->norm);
             }
           }
           else
@@ -6940,7 +6939,7 @@ nfa_regmatch(
             result = (pim->result == NFA_PIM_MATCH);
 #ifdef ENABLE_LOG
             fprintf(log_fd, "\n");
-            fprintf(log_fd, "Using previous recursive nfa_regmatch() result, result == %d\n", pim->result);
+            fprintf(log_fd, "Using previous recursive nfa_regmatch(rex) result, result == %d\n", pim->result);
             fprintf(log_fd, "MATCH = %s\n", result == TRUE ? "OK" : "FALSE");
             fprintf(log_fd, "\n");
 #endif
@@ -6950,7 +6949,7 @@ nfa_regmatch(
           if (result != (pim->state->c == NFA_START_INVISIBLE_NEG || pim->state->c == NFA_START_INVISIBLE_NEG_FIRST || pim->state->c == NFA_START_INVISIBLE_BEFORE_NEG || pim->state->c == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
           {
             /* Copy submatch info from the recursive call */
-            copy_sub_off(&t->subs.norm, &pim->subs.norm);
+            copy_sub_off(rex, &t->subs.norm, &pim->subs.norm);
           }
           else
             /* look-behind match failed, don't add the state */
@@ -6966,22 +6965,22 @@ nfa_regmatch(
 		 * local copy to avoid that. */
         if (pim == &t->pim)
         {
-          copy_pim(&pim_copy, pim);
+          copy_pim(rex, &pim_copy, pim);
           pim = &pim_copy;
         }
 
         if (add_here)
-          r = addstate_here(thislist, add_state, &t->subs,
+          r = addstate_here(rex, thislist, add_state, &t->subs,
                             pim, &listidx);
         else
         {
-          r = addstate(nextlist, add_state, &t->subs, pim, add_off);
+          r = addstate(rex, nextlist, add_state, &t->subs, pim, add_off);
           if (add_count > 0)
             nextlist->t[nextlist->n - 1].count = add_count;
         }
         if (r == NULL)
         {
-          nfa_match = NFA_TOO_EXPENSIVE;
+          rex->nfa_match = NFA_TOO_EXPENSIVE;
           goto theend;
         }
       }
@@ -6996,9 +6995,9 @@ nfa_regmatch(
 	 * because recursive calls should only start in the first position.
 	 * Unless "nfa_endp" is not NULL, then we match the end position.
 	 * Also don't start a match past the first line. */
-    if (nfa_match == FALSE && ((toplevel && rex.lnum == 0 && clen != 0 && (rex.reg_maxcol == 0 || (colnr_T)(rex.input - rex.line) < rex.reg_maxcol)) || (nfa_endp != NULL && (REG_MULTI
-                                                                                                                                                                                  ? (rex.lnum < nfa_endp->se_u.pos.lnum || (rex.lnum == nfa_endp->se_u.pos.lnum && (int)(rex.input - rex.line) < nfa_endp->se_u.pos.col))
-                                                                                                                                                                                  : rex.input < nfa_endp->se_u.ptr))))
+    if (rex->nfa_match == FALSE && ((toplevel && rex->lnum == 0 && clen != 0 && (rex->reg_maxcol == 0 || (colnr_T)(rex->input - rex->line) < rex->reg_maxcol)) || (rex->nfa_endp != NULL && (REG_MULTI
+                                                                                                                                                                                  ? (rex->lnum < rex->nfa_endp->se_u.pos.lnum || (rex->lnum == rex->nfa_endp->se_u.pos.lnum && (int)(rex->input - rex->line) < rex->nfa_endp->se_u.pos.col))
+                                                                                                                                                                                  : rex->input < rex->nfa_endp->se_u.ptr))))
     {
 #ifdef ENABLE_LOG
       fprintf(log_fd, "(---) STARTSTATE\n");
@@ -7014,24 +7013,24 @@ nfa_regmatch(
         {
           if (nextlist->n == 0)
           {
-            colnr_T col = (colnr_T)(rex.input - rex.line) + clen;
+            colnr_T col = (colnr_T)(rex->input - rex->line) + clen;
 
             /* Nextlist is empty, we can skip ahead to the
 			 * character that must appear at the start. */
-            if (skip_to_start(prog->regstart, &col) == FAIL)
+            if (skip_to_start(rex, prog->regstart, &col) == FAIL)
               break;
 #ifdef ENABLE_LOG
             fprintf(log_fd, "  Skipping ahead %d bytes to regstart\n",
-                    col - ((colnr_T)(rex.input - rex.line) + clen));
+                    col - ((colnr_T)(rex->input - rex->line) + clen));
 #endif
-            rex.input = rex.line + col - clen;
+            rex->input = rex->line + col - clen;
           }
           else
           {
             /* Checking if the required start character matches is
 			 * cheaper than adding a state that won't match. */
-            c = PTR2CHAR(rex.input + clen);
-            if (c != prog->regstart && (!rex.reg_ic || MB_TOLOWER(c) != MB_TOLOWER(prog->regstart)))
+            c = PTR2CHAR(rex->input + clen);
+            if (c != prog->regstart && (!rex->reg_ic || MB_TOLOWER(c) != MB_TOLOWER(prog->regstart)))
             {
 #ifdef ENABLE_LOG
               fprintf(log_fd, "  Skipping start state, regstart does not match\n");
@@ -7045,21 +7044,21 @@ nfa_regmatch(
         {
           if (REG_MULTI)
             m->norm.list.multi[0].start_col =
-                (colnr_T)(rex.input - rex.line) + clen;
+                (colnr_T)(rex->input - rex->line) + clen;
           else
-            m->norm.list.line[0].start = rex.input + clen;
-          if (addstate(nextlist, start->out, m, NULL, clen) == NULL)
+            m->norm.list.line[0].start = rex->input + clen;
+          if (addstate(rex, nextlist, start->out, m, NULL, clen) == NULL)
           {
-            nfa_match = NFA_TOO_EXPENSIVE;
+            rex->nfa_match = NFA_TOO_EXPENSIVE;
             goto theend;
           }
         }
       }
       else
       {
-        if (addstate(nextlist, start, m, NULL, clen) == NULL)
+        if (addstate(rex, nextlist, start, m, NULL, clen) == NULL)
         {
-          nfa_match = NFA_TOO_EXPENSIVE;
+          rex->nfa_match = NFA_TOO_EXPENSIVE;
           goto theend;
         }
       }
@@ -7080,22 +7079,23 @@ nfa_regmatch(
     /* Advance to the next character, or advance to the next line, or
 	 * finish. */
     if (clen != 0)
-      rex.input += clen;
-    else if (go_to_nextline || (nfa_endp != NULL && REG_MULTI && rex.lnum < nfa_endp->se_u.pos.lnum))
-      reg_nextline();
+      rex->input += clen;
+    else if (go_to_nextline || (rex->nfa_endp != NULL && REG_MULTI && rex->lnum < rex->nfa_endp->se_u.pos.lnum))
+      reg_nextline(rex);
     else
       break;
 
     /* Allow interrupting with CTRL-C. */
-    line_breakcheck();
+    if (!rex->reg_no_ui)
+      line_breakcheck();
     if (got_int)
       break;
 #ifdef FEAT_RELTIME
     /* Check for timeout once in a twenty times to avoid overhead. */
-    if (nfa_time_limit != NULL && ++nfa_time_count == 20)
+    if (rex->nfa_time_limit != NULL && ++rex->nfa_time_count == 20)
     {
-      nfa_time_count = 0;
-      if (nfa_did_time_out())
+      rex->nfa_time_count = 0;
+      if (nfa_did_time_out(rex))
         break;
     }
 #endif
@@ -7117,7 +7117,7 @@ theend:
   fclose(debug);
 #endif
 
-  return nfa_match;
+  return rex->nfa_match;
 }
 
 /*
@@ -7126,6 +7126,7 @@ theend:
  */
 static long
 nfa_regtry(
+    regexec_T *rex,
     nfa_regprog_T *prog,
     colnr_T col,
     proftime_T *tm UNUSED, /* timeout limit or NULL */
@@ -7139,11 +7140,11 @@ nfa_regtry(
   FILE *f;
 #endif
 
-  rex.input = rex.line + col;
+  rex->input = rex->line + col;
 #ifdef FEAT_RELTIME
-  nfa_time_limit = tm;
-  nfa_timed_out = timed_out;
-  nfa_time_count = 0;
+  rex->nfa_time_limit = tm;
+  rex->nfa_timed_out = timed_out;
+  rex->nfa_time_count = 0;
 #endif
 
 #ifdef ENABLE_LOG
@@ -7154,7 +7155,7 @@ nfa_regtry(
 #ifdef DEBUG
     fprintf(f, "\tRegexp is \"%s\"\n", nfa_regengine.expr);
 #endif
-    fprintf(f, "\tInput text is \"%s\" \n", rex.input);
+    fprintf(f, "\tInput text is \"%s\" \n", rex->input);
     fprintf(f, "\t=======================================================\n\n");
     nfa_print_state(f, start);
     fprintf(f, "\n\n");
@@ -7164,57 +7165,57 @@ nfa_regtry(
     emsg("Could not open temporary log file for writing");
 #endif
 
-  clear_sub(&subs.norm);
-  clear_sub(&m.norm);
+  clear_sub(rex, &subs.norm);
+  clear_sub(rex, &m.norm);
 
-  result = nfa_regmatch(prog, start, &subs, &m);
+  result = nfa_regmatch(rex, prog, start, &subs, &m);
   if (result == FALSE)
     return 0;
   else if (result == NFA_TOO_EXPENSIVE)
     return result;
 
-  cleanup_subexpr();
+  cleanup_subexpr(rex);
   if (REG_MULTI)
   {
     for (i = 0; i < subs.norm.in_use; i++)
     {
-      rex.reg_startpos[i].lnum = subs.norm.list.multi[i].start_lnum;
-      rex.reg_startpos[i].col = subs.norm.list.multi[i].start_col;
+      rex->reg_startpos[i].lnum = subs.norm.list.multi[i].start_lnum;
+      rex->reg_startpos[i].col = subs.norm.list.multi[i].start_col;
 
-      rex.reg_endpos[i].lnum = subs.norm.list.multi[i].end_lnum;
-      rex.reg_endpos[i].col = subs.norm.list.multi[i].end_col;
+      rex->reg_endpos[i].lnum = subs.norm.list.multi[i].end_lnum;
+      rex->reg_endpos[i].col = subs.norm.list.multi[i].end_col;
     }
 
-    if (rex.reg_startpos[0].lnum < 0)
+    if (rex->reg_startpos[0].lnum < 0)
     {
-      rex.reg_startpos[0].lnum = 0;
-      rex.reg_startpos[0].col = col;
+      rex->reg_startpos[0].lnum = 0;
+      rex->reg_startpos[0].col = col;
     }
-    if (rex.reg_endpos[0].lnum < 0)
+    if (rex->reg_endpos[0].lnum < 0)
     {
       /* pattern has a \ze but it didn't match, use current end */
-      rex.reg_endpos[0].lnum = rex.lnum;
-      rex.reg_endpos[0].col = (int)(rex.input - rex.line);
+      rex->reg_endpos[0].lnum = rex->lnum;
+      rex->reg_endpos[0].col = (int)(rex->input - rex->line);
     }
     else
       /* Use line number of "\ze". */
-      rex.lnum = rex.reg_endpos[0].lnum;
+      rex->lnum = rex->reg_endpos[0].lnum;
   }
   else
   {
     for (i = 0; i < subs.norm.in_use; i++)
     {
-      rex.reg_startp[i] = subs.norm.list.line[i].start;
-      rex.reg_endp[i] = subs.norm.list.line[i].end;
+      rex->reg_startp[i] = subs.norm.list.line[i].start;
+      rex->reg_endp[i] = subs.norm.list.line[i].end;
     }
 
-    if (rex.reg_startp[0] == NULL)
-      rex.reg_startp[0] = rex.line + col;
-    if (rex.reg_endp[0] == NULL)
-      rex.reg_endp[0] = rex.input;
+    if (rex->reg_startp[0] == NULL)
+      rex->reg_startp[0] = rex->line + col;
+    if (rex->reg_endp[0] == NULL)
+      rex->reg_endp[0] = rex->input;
   }
 
-  return 1 + rex.lnum;
+  return 1 + rex->lnum;
 }
 
 /*
@@ -7225,6 +7226,7 @@ nfa_regtry(
  */
 static long
 nfa_regexec_both(
+    regexec_T *rex,
     char_u *line,
     colnr_T startcol, /* column to start looking for match */
     proftime_T *tm,   /* timeout limit or NULL */
@@ -7237,16 +7239,16 @@ nfa_regexec_both(
 
   if (REG_MULTI)
   {
-    prog = (nfa_regprog_T *)rex.reg_mmatch->regprog;
-    line = reg_getline((linenr_T)0); /* relative to the cursor */
-    rex.reg_startpos = rex.reg_mmatch->startpos;
-    rex.reg_endpos = rex.reg_mmatch->endpos;
+    prog = (nfa_regprog_T *)rex->reg_mmatch->regprog;
+    line = reg_getline(rex, (linenr_T)0); /* relative to the cursor */
+    rex->reg_startpos = rex->reg_mmatch->startpos;
+    rex->reg_endpos = rex->reg_mmatch->endpos;
   }
   else
   {
-    prog = (nfa_regprog_T *)rex.reg_match->regprog;
-    rex.reg_startp = rex.reg_match->startp;
-    rex.reg_endp = rex.reg_match->endp;
+    prog = (nfa_regprog_T *)rex->reg_match->regprog;
+    rex->reg_startp = rex->reg_match->startp;
+    rex->reg_endp = rex->reg_match->endp;
   }
 
   /* Be paranoid... */
@@ -7258,22 +7260,22 @@ nfa_regexec_both(
 
   /* If pattern contains "\c" or "\C": overrule value of rex.reg_ic */
   if (prog->regflags & RF_ICASE)
-    rex.reg_ic = TRUE;
+    rex->reg_ic = TRUE;
   else if (prog->regflags & RF_NOICASE)
-    rex.reg_ic = FALSE;
+    rex->reg_ic = FALSE;
 
   /* If pattern contains "\Z" overrule value of rex.reg_icombine */
   if (prog->regflags & RF_ICOMBINE)
-    rex.reg_icombine = TRUE;
+    rex->reg_icombine = TRUE;
 
-  rex.line = line;
-  rex.lnum = 0; /* relative to line */
+  rex->line = line;
+  rex->lnum = 0; /* relative to line */
 
-  rex.nfa_has_zend = prog->has_zend;
-  rex.nfa_has_backref = prog->has_backref;
-  rex.nfa_nsubexpr = prog->nsubexp;
-  rex.nfa_listid = 1;
-  rex.nfa_alt_listid = 2;
+  rex->nfa_has_zend = prog->has_zend;
+  rex->nfa_has_backref = prog->has_backref;
+  rex->nfa_nsubexpr = prog->nsubexp;
+  rex->nfa_listid = 1;
+  rex->nfa_alt_listid = 2;
 #ifdef DEBUG
   nfa_regengine.expr = prog->pattern;
 #endif
@@ -7281,28 +7283,25 @@ nfa_regexec_both(
   if (prog->reganch && col > 0)
     return 0L;
 
-  rex.need_clear_subexpr = TRUE;
+  rex->need_clear_subexpr = TRUE;
 
   if (prog->regstart != NUL)
   {
     /* Skip ahead until a character we know the match must start with.
 	 * When there is none there is no match. */
-    if (skip_to_start(prog->regstart, &col) == FAIL)
+    if (skip_to_start(rex, prog->regstart, &col) == FAIL)
       return 0L;
 
     /* If match_text is set it contains the full text that must match.
 	 * Nothing else to try. Doesn't handle combining chars well. */
-    if (prog->match_text != NULL && !rex.reg_icombine)
-      return find_match_text(col, prog->regstart, prog->match_text);
+    if (prog->match_text != NULL && !rex->reg_icombine)
+      return find_match_text(rex, col, prog->regstart, prog->match_text);
   }
 
   /* If the start column is past the maximum column: no need to try. */
-  if (rex.reg_maxcol > 0 && col >= rex.reg_maxcol)
+  if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
     goto theend;
 
-  // Set the "nstate" used by nfa_regcomp() to zero to trigger an error when
-  // it's accidentally used during execution.
-  nstate = 0;
   for (i = 0; i < prog->nstate; ++i)
   {
     prog->state[i].id = i;
@@ -7310,7 +7309,7 @@ nfa_regexec_both(
     prog->state[i].lastlist[1] = 0;
   }
 
-  retval = nfa_regtry(prog, col, tm, timed_out);
+  retval = nfa_regtry(rex, prog, col, tm, timed_out);
 
 #ifdef DEBUG
   nfa_regengine.expr = NULL;
@@ -7392,8 +7391,8 @@ nfa_regcomp(char_u *expr, int re_flags)
   prog->regflags = regflags;
   prog->engine = &nfa_regengine;
   prog->nstate = nstate;
-  prog->has_zend = rex.nfa_has_zend;
-  prog->has_backref = rex.nfa_has_backref;
+  prog->has_zend = rex_main.nfa_has_zend;
+  prog->has_backref = rex_main.nfa_has_backref;
   prog->nsubexp = regnpar;
 
   nfa_postprocess(prog);
@@ -7452,21 +7451,22 @@ nfa_regfree(regprog_T *prog)
  */
 static int
 nfa_regexec_nl(
+    regexec_T *rex,
     regmatch_T *rmp,
     char_u *line, /* string to match against */
     colnr_T col,  /* column to start looking for match */
     int line_lbr)
 {
-  rex.reg_match = rmp;
-  rex.reg_mmatch = NULL;
-  rex.reg_maxline = 0;
-  rex.reg_line_lbr = line_lbr;
-  rex.reg_buf = curbuf;
-  rex.reg_win = NULL;
-  rex.reg_ic = rmp->rm_ic;
-  rex.reg_icombine = FALSE;
-  rex.reg_maxcol = 0;
-  return nfa_regexec_both(line, col, NULL, NULL);
+  rex->reg_match = rmp;
+  rex->reg_mmatch = NULL;
+  rex->reg_maxline = 0;
+  rex->reg_line_lbr = line_lbr;
+  rex->reg_buf = curbuf;
+  rex->reg_win = NULL;
+  rex->reg_ic = rmp->rm_ic;
+  rex->reg_icombine = FALSE;
+  rex->reg_maxcol = 0;
+  return nfa_regexec_both(rex, line, col, NULL, NULL);
 }
 
 /*
@@ -7496,6 +7496,7 @@ nfa_regexec_nl(
  */
 static long
 nfa_regexec_multi(
+    regexec_T *rex,
     regmmatch_T *rmp,
     win_T *win,     /* window in which to search or NULL */
     buf_T *buf,     /* buffer in which to search */
@@ -7504,18 +7505,18 @@ nfa_regexec_multi(
     proftime_T *tm, /* timeout limit or NULL */
     int *timed_out) /* flag set on timeout or NULL */
 {
-  rex.reg_match = NULL;
-  rex.reg_mmatch = rmp;
-  rex.reg_buf = buf;
-  rex.reg_win = win;
-  rex.reg_firstlnum = lnum;
-  rex.reg_maxline = rex.reg_buf->b_ml.ml_line_count - lnum;
-  rex.reg_line_lbr = FALSE;
-  rex.reg_ic = rmp->rmm_ic;
-  rex.reg_icombine = FALSE;
-  rex.reg_maxcol = rmp->rmm_maxcol;
-
-  return nfa_regexec_both(NULL, col, tm, timed_out);
+  rex->reg_match = NULL;
+  rex->reg_mmatch = rmp;
+  rex->reg_buf = buf;
+  rex->reg_win = win;
+  rex->reg_firstlnum = lnum;
+  rex->reg_maxline = reg_line_count(rex) - lnum;
+  rex->reg_line_lbr = FALSE;
+  rex->reg_ic = rmp->rmm_ic;
+  rex->reg_icombine = FALSE;
+  rex->reg_maxcol = rmp->rmm_maxcol;
+
+  return nfa_regexec_both(rex, NULL, col, tm, timed_out);
 }
 
 #ifdef DEBUG
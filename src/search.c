@@ -12,6 +12,12 @@
 
 #include "vim.h"
 
+/* search_all() uses several threads. */
+#ifdef UNIX
+#include <pthread.h>
+#define SEARCH_ALL_THREADS
+#endif
+
 #ifdef FEAT_EVAL
 static void set_vv_searchforward(void);
 static int first_submatch(regmmatch_T *rp);
@@ -27,6 +33,27 @@ static void show_pat_in_path(char_u *, int,
 static void wvsp_one(FILE *fp, int idx, char *s, int sc);
 #endif
 static void search_stat(int dirc, pos_T *pos, int show_top_bot_msg, char_u *msgbuf, int recompute);
+static int hl_pattern_cacheable(char_u *pat);
+static hlindex_T *hl_index_get(buf_T *buf, char_u *pat);
+static void hl_index_free_lines(hlindex_T *hi, linenr_T first, linenr_T last);
+static colnr_T *hl_index_line(buf_T *buf, hlindex_T *hi, linenr_T lnum, proftime_T *tm);
+static int hl_passed_limit(proftime_T *tm);
+static int hl_extra_col(char_u *ptr, colnr_T col);
+static void hl_add(garray_T *gap, linenr_T lnum, colnr_T start, linenr_T end_lnum, colnr_T end);
+#ifdef SEARCH_ALL_THREADS
+typedef struct sapart_S sapart_T;
+typedef struct samatcher_S samatcher_T;
+typedef struct searchall_S searchall_T;
+static char_u *sa_getline(linenr_T lnum, void *cookie);
+static char_u *sa_line(samatcher_T *sm, linenr_T lnum);
+static long sa_regexec(samatcher_T *sm, linenr_T lnum, colnr_T col);
+static int sa_search(samatcher_T *sm, pos_T *pos, pos_T *end_pos, linenr_T stop_lnum);
+static void sa_search_range(samatcher_T *sm, pos_T *pos, linenr_T last, garray_T *gap, sapart_T *sync);
+static void sa_search_parts(searchall_T *sa, samatcher_T *sm);
+static void *sa_worker(void *arg);
+static sapart_T *sa_split(snapshot_T *ss, int threads, int *countp);
+static int sa_thread_count(void);
+#endif
 
 /*
  * This file contains various searching-related routines. These fall into
@@ -5483,3 +5510,979 @@ wvsp_one(
   }
 }
 #endif /* FEAT_VIMINFO */
+
+/*
+ * Index of search highlights.
+ *
+ * For each line of a buffer the matches of the search pattern are kept, so
+ * that getting the highlights for the lines in view only needs to look at the
+ * lines that changed since the last time.  The entry for a line is NULL when
+ * not known yet, otherwise it is an array with the number of matches followed
+ * by the start and end column of each.  These are all the matches a forward
+ * search in the line can find, in the order it finds them.
+ */
+struct hlindex_S
+{
+  char_u *hi_pattern;      /* pattern the matches are for */
+  int hi_magic;            /* 'magic' when compiled */
+  int hi_ic;               /* ignoring case */
+  int hi_cpo_search;       /* 'cpoptions' has CPO_SEARCH */
+  char_u *hi_isk;          /* 'iskeyword' when compiled */
+  regmmatch_T hi_regmatch; /* compiled pattern */
+  colnr_T **hi_lines;      /* matches per line */
+  linenr_T hi_line_count;  /* number of entries in hi_lines */
+};
+
+/* Entry for a line without a match. */
+static colnr_T hl_no_match[1] = {0};
+
+/* Lines searched at once when not using the index with a time limit. */
+#define HL_SEARCH_LINES 1000
+
+/*
+ * Return TRUE when the matches of "pat" only depend on the text of the line
+ * they are in, not the line number or the cursor, marks and Visual area.
+ */
+static int
+hl_pattern_cacheable(char_u *pat)
+{
+  char_u *p;
+
+  for (p = pat; *p != NUL; ++p)
+    if (*p == '%' && (VIM_ISDIGIT(p[1]) || vim_strchr((char_u *)"<>#V'^$", p[1]) != NULL))
+      return FALSE;
+  return TRUE;
+}
+
+/*
+ * Free the matches of lines "first" to "last" and mark them as not known.
+ */
+static void
+hl_index_free_lines(hlindex_T *hi, linenr_T first, linenr_T last)
+{
+  linenr_T lnum;
+
+  for (lnum = first; lnum <= last && lnum <= hi->hi_line_count; ++lnum)
+  {
+    if (hi->hi_lines[lnum - 1] != hl_no_match)
+      vim_free(hi->hi_lines[lnum - 1]);
+    hi->hi_lines[lnum - 1] = NULL;
+  }
+}
+
+/*
+ * Free the search highlight index of "buf".
+ */
+void hl_index_clear(buf_T *buf)
+{
+  hlindex_T *hi = buf->b_hlindex;
+
+  if (hi == NULL)
+    return;
+  hl_index_free_lines(hi, 1, hi->hi_line_count);
+  vim_free(hi->hi_lines);
+  vim_regfree(hi->hi_regmatch.regprog);
+  vim_free(hi->hi_pattern);
+  vim_free(hi->hi_isk);
+  vim_free(hi);
+  buf->b_hlindex = NULL;
+}
+
+/*
+ * Called after lines "lnum" to "lnume" (not including) of "buf" were changed
+ * and "xtra" lines were added (negative when deleted): forget the matches of
+ * the changed lines and move the ones below.
+ */
+void hl_index_changed(buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra)
+{
+  hlindex_T *hi = buf->b_hlindex;
+  linenr_T count;
+  colnr_T **lines;
+
+  if (hi == NULL || hi->hi_line_count == 0)
+    return;
+  if (lnum < 1)
+    lnum = 1;
+  if (lnume > hi->hi_line_count + 1)
+    lnume = hi->hi_line_count + 1;
+  count = hi->hi_line_count + xtra;
+  if (lnume < lnum || count != buf->b_ml.ml_line_count || lnume + xtra < lnum)
+  {
+    /* Not what the buffer has, start again. */
+    hl_index_free_lines(hi, 1, hi->hi_line_count);
+    VIM_CLEAR(hi->hi_lines);
+    hi->hi_line_count = 0;
+    return;
+  }
+
+  hl_index_free_lines(hi, lnum, lnume - 1);
+  if (xtra == 0)
+    return;
+  if (xtra > 0)
+  {
+    lines = vim_realloc(hi->hi_lines, sizeof(colnr_T *) * count);
+    if (lines == NULL)
+    {
+      hl_index_clear(buf);
+      return;
+    }
+    hi->hi_lines = lines;
+  }
+  mch_memmove(hi->hi_lines + lnume - 1 + xtra, hi->hi_lines + lnume - 1,
+              sizeof(colnr_T *) * (hi->hi_line_count - (lnume - 1)));
+  if (xtra > 0)
+    vim_memset(hi->hi_lines + lnume - 1, 0, sizeof(colnr_T *) * xtra);
+  hi->hi_line_count = count;
+}
+
+/*
+ * Get the search highlight index of "buf" for pattern "pat", creating it
+ * when needed.  Returns NULL when the pattern can't be indexed.
+ */
+static hlindex_T *
+hl_index_get(buf_T *buf, char_u *pat)
+{
+  hlindex_T *hi = buf->b_hlindex;
+  int cpo_search = vim_strchr(p_cpo, CPO_SEARCH) != NULL;
+
+  if (hi != NULL && (STRCMP(hi->hi_pattern, pat) != 0 || hi->hi_magic != p_magic || hi->hi_ic != ignorecase(pat) || hi->hi_cpo_search != cpo_search || STRCMP(hi->hi_isk, buf->b_p_isk) != 0))
+  {
+    hl_index_clear(buf);
+    hi = NULL;
+  }
+
+  if (hi == NULL)
+  {
+    if (!hl_pattern_cacheable(pat))
+      return NULL;
+    hi = ALLOC_CLEAR_ONE(hlindex_T);
+    if (hi == NULL)
+      return NULL;
+    if (search_regcomp(pat, RE_SEARCH, RE_SEARCH, SEARCH_KEEP,
+                       &hi->hi_regmatch) == FAIL)
+    {
+      vim_free(hi);
+      return NULL;
+    }
+    /* A match that continues in the next line depends on that line. */
+    if (re_multiline(hi->hi_regmatch.regprog))
+    {
+      vim_regfree(hi->hi_regmatch.regprog);
+      vim_free(hi);
+      return NULL;
+    }
+    hi->hi_pattern = vim_strsave(pat);
+    hi->hi_magic = p_magic;
+    hi->hi_ic = hi->hi_regmatch.rmm_ic;
+    hi->hi_cpo_search = cpo_search;
+    hi->hi_isk = vim_strsave(buf->b_p_isk);
+    buf->b_hlindex = hi;
+    if (hi->hi_pattern == NULL || hi->hi_isk == NULL)
+    {
+      hl_index_clear(buf);
+      return NULL;
+    }
+  }
+
+  /* Lines were added or deleted without calling hl_index_changed(), e.g.
+     * with ml_append() for the quickfix buffer: find all matches again. */
+  if (hi->hi_lines != NULL && hi->hi_line_count != buf->b_ml.ml_line_count)
+  {
+    hl_index_free_lines(hi, 1, hi->hi_line_count);
+    VIM_CLEAR(hi->hi_lines);
+    hi->hi_line_count = 0;
+  }
+
+  if (hi->hi_lines == NULL)
+  {
+    hi->hi_lines = ALLOC_CLEAR_MULT(colnr_T *, buf->b_ml.ml_line_count);
+    if (hi->hi_lines == NULL)
+    {
+      hl_index_clear(buf);
+      return NULL;
+    }
+    hi->hi_line_count = buf->b_ml.ml_line_count;
+  }
+  return hi;
+}
+
+/*
+ * Get the matches in line "lnum", finding them when not known yet.
+ * Like searchit() does in the line it starts in: after each match, continue
+ * at its end, or one character further for an empty match.  Without
+ * CPO_SEARCH continue one character after the start of the match.
+ * Returns NULL when the "tm" time limit was passed before all matches were
+ * found.
+ */
+static colnr_T *
+hl_index_line(buf_T *buf, hlindex_T *hi, linenr_T lnum, proftime_T *tm)
+{
+  garray_T ga;
+  char_u *ptr;
+  colnr_T col = 0;
+  colnr_T matchcol;
+  colnr_T start;
+  colnr_T end;
+  int timed_out = FALSE;
+
+  if (hi->hi_lines[lnum - 1] != NULL)
+    return hi->hi_lines[lnum - 1];
+
+  ga_init2(&ga, (int)sizeof(colnr_T), 8);
+  for (;;)
+  {
+    if (vim_regexec_multi(&hi->hi_regmatch, NULL, buf, lnum, col,
+                          tm, &timed_out) == 0 ||
+        hi->hi_regmatch.startpos[0].lnum != 0)
+      break;
+    start = hi->hi_regmatch.startpos[0].col;
+    end = hi->hi_regmatch.endpos[0].col;
+    if (ga_grow(&ga, 3) == FAIL)
+      break;
+    if (ga.ga_len == 0)
+      ((colnr_T *)ga.ga_data)[ga.ga_len++] = 0;
+    ((colnr_T *)ga.ga_data)[ga.ga_len++] = start;
+    ((colnr_T *)ga.ga_data)[ga.ga_len++] = end;
+    ++((colnr_T *)ga.ga_data)[0];
+
+    ptr = ml_get_buf(buf, lnum, FALSE);
+    matchcol = hi->hi_cpo_search ? end : start;
+    if ((!hi->hi_cpo_search || matchcol == start) && ptr[matchcol] != NUL)
+      matchcol += has_mbyte ? (*mb_ptr2len)(ptr + matchcol) : 1;
+    if (ptr[matchcol] == NUL)
+      break;
+    col = matchcol;
+  }
+
+  if (timed_out)
+  {
+    ga_clear(&ga);
+    return NULL;
+  }
+  hi->hi_lines[lnum - 1] = ga.ga_len == 0 ? hl_no_match : (colnr_T *)ga.ga_data;
+  return hi->hi_lines[lnum - 1];
+}
+
+/*
+ * Return TRUE when the "tm" time limit was passed, FALSE when there is none.
+ */
+static int
+hl_passed_limit(proftime_T *tm UNUSED)
+{
+#ifdef FEAT_RELTIME
+  return tm != NULL && profile_passed_limit(tm);
+#else
+  return FALSE;
+#endif
+}
+
+/*
+ * Number of bytes a search starting at "col" in "ptr" skips, see searchit().
+ */
+static int
+hl_extra_col(char_u *ptr, colnr_T col)
+{
+  if (!has_mbyte || (colnr_T)STRLEN(ptr) <= col)
+    return 1;
+  return (*mb_ptr2len)(ptr + col);
+}
+
+static void
+hl_add(garray_T *gap, linenr_T lnum, colnr_T start, linenr_T end_lnum, colnr_T end)
+{
+  searchHighlight_T *hl;
+
+  if (ga_grow(gap, 1) == FAIL)
+    return;
+  hl = (searchHighlight_T *)gap->ga_data + gap->ga_len++;
+  hl->start.lnum = lnum;
+  hl->start.col = start;
+  hl->start.coladd = 0;
+  hl->end.lnum = end_lnum;
+  hl->end.col = end;
+  hl->end.coladd = 0;
+}
+
+/*
+ * Add the matches of the last search pattern in lines "start_lnum" to
+ * "end_lnum" of "buf" to "gap", a growarray of searchHighlight_T.
+ * "start_lnum" zero means from the start of the buffer, then a match at the
+ * start of line 1 is included.  "end_lnum" zero means up to the end.
+ * These are the matches found by searching forward again and again from the
+ * start, without wrapping around the end of the buffer.
+ */
+void search_get_highlights(
+    buf_T *buf,
+    linenr_T start_lnum,
+    linenr_T end_lnum,
+    garray_T *gap)
+{
+  pos_T pos;
+
+  pos.lnum = start_lnum;
+  pos.col = 0;
+  pos.coladd = 0;
+  (void)search_get_highlights_timed(buf, &pos, end_lnum, 0L, gap);
+}
+
+/*
+ * Like search_get_highlights(), but stop after about "msec" milliseconds,
+ * zero for no limit.  Searching starts after "resume", like searchit() does.
+ * For the first call set it to line "start_lnum" column zero.
+ * Returns TRUE when all matches up to "end_lnum" were added.  Returns FALSE
+ * when the time ran out, "resume" is then set to where the next call
+ * continues.  Each call finds at least one match or goes over at least one
+ * line, thus repeated calls always finish.
+ */
+int search_get_highlights_timed(
+    buf_T *buf,
+    pos_T *resume,
+    linenr_T end_lnum,
+    long msec,
+    garray_T *gap)
+{
+  char_u *pat = get_search_pat();
+  hlindex_T *hi;
+  linenr_T lnum;
+  linenr_T first_lnum;
+  linenr_T last;
+  linenr_T stop_lnum;
+  colnr_T *matches;
+  colnr_T start;
+  colnr_T end;
+  char_u *ptr;
+  int min_col;
+  int i;
+  int found;
+  int first = TRUE;
+  int timed_out = FALSE;
+  pos_T pos;
+  pos_T match_pos;
+  pos_T end_pos;
+  proftime_T limit;
+  proftime_T *tm = NULL;
+
+  if (pat == NULL)
+    return TRUE;
+#ifdef FEAT_RELTIME
+  if (msec > 0)
+  {
+    profile_setlimit(msec, &limit);
+    tm = &limit;
+  }
+#endif
+
+  last = end_lnum == 0 || end_lnum > buf->b_ml.ml_line_count
+             ? buf->b_ml.ml_line_count
+             : end_lnum;
+
+  hi = hl_index_get(buf, pat);
+  if (hi == NULL)
+  {
+    /*
+     * Can't use the index, search for each match.  With a time limit,
+     * search a block of lines at a time, so that a call makes progress when
+     * there is no match in many lines.  Using "stop_lnum" also avoids
+     * wrapping around the end.  The first search is done without a time
+     * limit.
+     */
+    pos = *resume;
+    while (pos.lnum < last || (pos.lnum == last && pos.col != MAXCOL))
+    {
+      stop_lnum = last;
+      if (tm != NULL && (pos.lnum == 0 ? 1 : pos.lnum) + HL_SEARCH_LINES < last)
+        stop_lnum = (pos.lnum == 0 ? 1 : pos.lnum) + HL_SEARCH_LINES;
+      match_pos = pos;
+      found = searchit(NULL, buf, &match_pos, &end_pos, FORWARD, pat, 1,
+                       SEARCH_KEEP, RE_SEARCH, stop_lnum,
+                       first ? NULL : tm, &timed_out);
+      if (!first && (timed_out || (found == FAIL && hl_passed_limit(tm))))
+        break; /* not known how far it got, search again in the next call */
+      first = FALSE;
+      if (found == FAIL)
+      {
+        /* Continue after "stop_lnum". */
+        pos.lnum = stop_lnum;
+        pos.col = MAXCOL;
+      }
+      else
+      {
+        /* A match past the last line is put on the last line. */
+        if (pos.lnum > 0 && LTOREQ_POS(match_pos, pos))
+        {
+          pos.lnum = last;
+          pos.col = MAXCOL;
+          break;
+        }
+        hl_add(gap, match_pos.lnum, match_pos.col, end_pos.lnum, end_pos.col);
+        pos = end_pos;
+        ++pos.col;
+      }
+      if (hl_passed_limit(tm))
+        break;
+    }
+    *resume = pos;
+    return pos.lnum > last || (pos.lnum == last && pos.col == MAXCOL);
+  }
+
+  /*
+   * When not starting after a line, the first match must be after the first
+   * character at the start position.  The first line is searched without a
+   * time limit.
+   */
+  lnum = resume->lnum == 0 ? 1 : resume->lnum;
+  min_col = -1;
+  if (resume->lnum > 0 && resume->col == MAXCOL)
+    ++lnum;
+  else if (resume->lnum > 0 && lnum <= last)
+    min_col = resume->col + hl_extra_col(ml_get_buf(buf, lnum, FALSE),
+                                         resume->col);
+  for (first_lnum = lnum; lnum <= last; ++lnum, min_col = -1)
+  {
+    matches = hl_index_line(buf, hi, lnum, lnum == first_lnum ? NULL : tm);
+    if (matches == NULL)
+    {
+      resume->lnum = lnum - 1;
+      resume->col = MAXCOL;
+      return FALSE;
+    }
+    for (i = 0; i < matches[0]; ++i)
+    {
+      start = matches[1 + i * 2];
+      end = matches[2 + i * 2];
+      if (min_col >= 0)
+      {
+        /* A match on the NUL counts as being one character earlier. */
+        ptr = ml_get_buf(buf, lnum, FALSE);
+        if (start - (ptr[start] == NUL) < min_col)
+          continue;
+      }
+      hl_add(gap, lnum, start, lnum, end);
+      /* The next search starts one character after the end. */
+      ptr = ml_get_buf(buf, lnum, FALSE);
+      min_col = end + 1 + hl_extra_col(ptr, end + 1);
+    }
+    if (lnum < last && hl_passed_limit(tm))
+    {
+      resume->lnum = lnum;
+      resume->col = MAXCOL;
+      return FALSE;
+    }
+  }
+  resume->lnum = last;
+  resume->col = MAXCOL;
+  return TRUE;
+}
+
+/*
+ * Finding all matches with several threads, for search_all().
+ *
+ * A snapshot of the lines is split into parts of whole blocks.  Each part is
+ * searched like search_get_highlights() does, as if searching continued
+ * after the line before the part.  Worker threads and the main thread take
+ * the next part until all are done, each with its own compiled pattern.
+ * Then the matches of the parts are joined in order.  Where the last match of
+ * a part continues into the next part, that part is searched again from the
+ * end of the match, until a match is found that the part also has: searching
+ * continues the same from there.
+ */
+/* Number of threads for search_all(), zero for one per processor. */
+static int sa_threads = 0;
+
+#ifdef SEARCH_ALL_THREADS
+
+/* A part has at least this many lines. */
+#define SA_MIN_LINES 2000
+/* Parts for each thread, a thread that is done early takes another one. */
+#define SA_PARTS_PER_THREAD 4
+#define SA_MAX_THREADS 16
+
+struct sapart_S
+{
+  linenr_T sp_first;   /* first line of the part */
+  linenr_T sp_last;    /* last line of the part */
+  garray_T sp_matches; /* searchHighlight_T found in the part */
+  pos_T sp_end;        /* where searching the part stopped */
+  int sp_failed;       /* could not be searched in a thread */
+};
+
+struct samatcher_S
+{
+  regmmatch_T sm_regmatch;
+  regexec_T *sm_rex;       /* NULL for matching in the main thread */
+  buf_T *sm_buf;
+  snapshot_T *sm_snapshot; /* the lines of "sm_buf" */
+  int sm_cpo_search;       /* 'cpoptions' has CPO_SEARCH */
+  int sm_failed;           /* matching failed */
+
+  /* The last match found by matching in line "sm_lnum".  When the next
+     * search starts further on in that line, the matches before this one
+     * don't need to be skipped again. */
+  linenr_T sm_lnum;
+  int sm_min_col;          /* skipped the matches before this column */
+  long sm_nmatched;
+  lpos_T sm_startpos;
+  lpos_T sm_endpos;
+};
+
+struct searchall_S
+{
+  sapart_T *sa_parts;
+  int sa_part_count;
+  int sa_next_part;         /* next part to search */
+  pthread_mutex_t sa_mutex; /* protects "sa_next_part" */
+};
+
+typedef struct
+{
+  searchall_T *sw_sa;
+  samatcher_T sw_matcher;
+  pthread_t sw_thread;
+  int sw_started;
+} saworker_T;
+
+static char_u *
+sa_getline(linenr_T lnum, void *cookie)
+{
+  return ml_snapshot_get_line((snapshot_T *)cookie, lnum, NULL);
+}
+
+/*
+ * Get line "lnum" of the snapshot, an empty string when past the end.
+ */
+static char_u *
+sa_line(samatcher_T *sm, linenr_T lnum)
+{
+  char_u *line = ml_snapshot_get_line(sm->sm_snapshot, lnum, NULL);
+
+  return line == NULL ? (char_u *)"" : line;
+}
+
+/*
+ * Like vim_regexec_multi().  Sets "sm_failed" when matching failed: in the
+ * main thread when an error was given, in another thread when the match
+ * needs to be done in the main thread.
+ */
+static long
+sa_regexec(samatcher_T *sm, linenr_T lnum, colnr_T col)
+{
+  long nmatched;
+  int save_called_emsg = called_emsg;
+
+  if (sm->sm_rex != NULL)
+  {
+    nmatched = vim_regexec_ctx_multi(sm->sm_rex, &sm->sm_regmatch,
+                                     sm->sm_buf, lnum, col, NULL, NULL);
+    if (nmatched < 0)
+      sm->sm_failed = TRUE;
+  }
+  else
+  {
+    called_emsg = FALSE;
+    nmatched = vim_regexec_multi(&sm->sm_regmatch, NULL, sm->sm_buf,
+                                 lnum, col, NULL, NULL);
+    if (called_emsg)
+      sm->sm_failed = TRUE;
+    called_emsg |= save_called_emsg;
+  }
+  return sm->sm_failed ? 0 : nmatched;
+}
+
+/*
+ * Find the first match after "pos" in the lines up to "stop_lnum", like
+ * searchit() does searching forward without wrapping around.  "pos" is set
+ * to the start of the match and "end_pos" to its end.
+ * Returns FAIL when there is no match or matching failed.
+ */
+static int
+sa_search(samatcher_T *sm, pos_T *pos, pos_T *end_pos, linenr_T stop_lnum)
+{
+  linenr_T line_count = sm->sm_snapshot->ss_line_count;
+  linenr_T lnum = pos->lnum;
+  colnr_T start_col = pos->col;
+  colnr_T matchcol;
+  lpos_T matchpos;
+  lpos_T endpos;
+  char_u *ptr;
+  long nmatched;
+  int at_first_line = TRUE;
+  int extra_col;
+  int match_ok;
+
+  /* A match at the start position is not accepted. */
+  if (start_col == MAXCOL)
+    extra_col = 0;
+  else if (lnum >= 1 && lnum <= line_count)
+    extra_col = hl_extra_col(sa_line(sm, lnum), start_col);
+  else
+    extra_col = 1;
+  if (lnum == 0)
+  {
+    lnum = 1;
+    at_first_line = FALSE;
+  }
+
+  for (; lnum <= line_count && lnum <= stop_lnum; ++lnum, at_first_line = FALSE)
+  {
+    if (at_first_line && lnum == sm->sm_lnum && (int)start_col + extra_col >= sm->sm_min_col)
+    {
+      nmatched = sm->sm_nmatched;
+      matchpos = sm->sm_startpos;
+      endpos = sm->sm_endpos;
+    }
+    else
+    {
+      nmatched = sa_regexec(sm, lnum, 0);
+      if (sm->sm_failed)
+        return FAIL;
+      if (nmatched == 0)
+        continue;
+      matchpos = sm->sm_regmatch.startpos[0];
+      endpos = sm->sm_regmatch.endpos[0];
+    }
+    ptr = sa_line(sm, lnum + matchpos.lnum);
+
+    /* In the first line, skip matches before the start position. */
+    if (at_first_line)
+    {
+      match_ok = TRUE;
+      while (matchpos.lnum == 0 && (int)matchpos.col - (ptr[matchpos.col] == NUL) < (int)start_col + extra_col)
+      {
+        if (sm->sm_cpo_search)
+        {
+          if (nmatched > 1)
+          {
+            match_ok = FALSE;
+            break;
+          }
+          matchcol = endpos.col;
+          if (matchcol == matchpos.col && ptr[matchcol] != NUL)
+            matchcol += has_mbyte ? (*mb_ptr2len)(ptr + matchcol) : 1;
+        }
+        else
+        {
+          matchcol = matchpos.col;
+          if (ptr[matchcol] != NUL)
+            matchcol += has_mbyte ? (*mb_ptr2len)(ptr + matchcol) : 1;
+        }
+        if (ptr[matchcol] == NUL || (nmatched = sa_regexec(sm, lnum, matchcol)) == 0)
+        {
+          match_ok = FALSE;
+          break;
+        }
+        matchpos = sm->sm_regmatch.startpos[0];
+        endpos = sm->sm_regmatch.endpos[0];
+        ptr = sa_line(sm, lnum + matchpos.lnum);
+      }
+      if (sm->sm_failed)
+        return FAIL;
+      if (!match_ok)
+        continue;
+    }
+
+    sm->sm_lnum = lnum;
+    sm->sm_min_col = at_first_line ? (int)start_col + extra_col : 0;
+    sm->sm_nmatched = nmatched;
+    sm->sm_startpos = matchpos;
+    sm->sm_endpos = endpos;
+
+    pos->lnum = lnum + matchpos.lnum;
+    pos->col = matchpos.col;
+    pos->coladd = 0;
+    end_pos->lnum = lnum + endpos.lnum;
+    end_pos->col = endpos.col;
+    end_pos->coladd = 0;
+
+    /* A pattern like "\n\zs" may go past the last line. */
+    if (pos->lnum > line_count)
+    {
+      pos->lnum = line_count;
+      pos->col = (colnr_T)STRLEN(sa_line(sm, line_count));
+      if (pos->col > 0)
+        --pos->col;
+    }
+    return OK;
+  }
+  return FAIL;
+}
+
+/*
+ * Add the matches after "pos" in the lines up to "last" to "gap", like
+ * search_get_highlights() does, and set "pos" to where searching stopped.
+ * When "sync" is not NULL, stop at a match that part also has and add the
+ * rest of its matches.
+ */
+static void
+sa_search_range(
+    samatcher_T *sm,
+    pos_T *pos,
+    linenr_T last,
+    garray_T *gap,
+    sapart_T *sync)
+{
+  searchHighlight_T *hl;
+  pos_T match_pos;
+  pos_T end_pos;
+  int idx = 0;
+  int count;
+
+  while (pos->lnum < last || (pos->lnum == last && pos->col != MAXCOL))
+  {
+    match_pos = *pos;
+    if (sa_search(sm, &match_pos, &end_pos, last) == FAIL)
+    {
+      if (!sm->sm_failed)
+      {
+        pos->lnum = last;
+        pos->col = MAXCOL;
+      }
+      return;
+    }
+    /* A match past the last line is put on the last line. */
+    if (pos->lnum > 0 && LTOREQ_POS(match_pos, *pos))
+    {
+      pos->lnum = last;
+      pos->col = MAXCOL;
+      return;
+    }
+
+    if (sync != NULL)
+    {
+      hl = (searchHighlight_T *)sync->sp_matches.ga_data;
+      while (idx < sync->sp_matches.ga_len && LT_POS(hl[idx].start, match_pos))
+        ++idx;
+      if (idx < sync->sp_matches.ga_len && EQUAL_POS(hl[idx].start, match_pos) && EQUAL_POS(hl[idx].end, end_pos))
+      {
+        count = sync->sp_matches.ga_len - idx;
+        if (ga_grow(gap, count) == OK)
+        {
+          mch_memmove((searchHighlight_T *)gap->ga_data + gap->ga_len,
+                      hl + idx, sizeof(searchHighlight_T) * count);
+          gap->ga_len += count;
+        }
+        *pos = sync->sp_end;
+        return;
+      }
+    }
+
+    hl_add(gap, match_pos.lnum, match_pos.col, end_pos.lnum, end_pos.col);
+    *pos = end_pos;
+    ++pos->col;
+  }
+}
+
+/*
+ * Search the parts that are not taken yet, until all are done.  A part where
+ * matching failed is marked, to be searched in the main thread.
+ */
+static void
+sa_search_parts(searchall_T *sa, samatcher_T *sm)
+{
+  sapart_T *part;
+  int idx;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&sa->sa_mutex);
+    idx = sa->sa_next_part++;
+    pthread_mutex_unlock(&sa->sa_mutex);
+    if (idx >= sa->sa_part_count)
+      break;
+
+    part = sa->sa_parts + idx;
+    part->sp_end.lnum = part->sp_first - 1;
+    part->sp_end.col = part->sp_first == 1 ? 0 : MAXCOL;
+    sa_search_range(sm, &part->sp_end, part->sp_last, &part->sp_matches,
+                    NULL);
+    if (sm->sm_failed)
+    {
+      part->sp_failed = TRUE;
+      sm->sm_failed = FALSE;
+    }
+  }
+}
+
+static void *
+sa_worker(void *arg)
+{
+  saworker_T *sw = (saworker_T *)arg;
+
+  sa_search_parts(sw->sw_sa, &sw->sw_matcher);
+  return NULL;
+}
+
+/*
+ * Split the lines of snapshot "ss" into parts of whole blocks, enough to keep
+ * "threads" threads busy.  Sets "*countp" to the number of parts.
+ */
+static sapart_T *
+sa_split(snapshot_T *ss, int threads, int *countp)
+{
+  sapart_T *parts;
+  linenr_T size;
+  linenr_T first = 1;
+  int block;
+  int count = 0;
+
+  size = ss->ss_line_count / (threads * SA_PARTS_PER_THREAD);
+  if (size < SA_MIN_LINES)
+    size = SA_MIN_LINES;
+  /* Only the last part can be smaller than "size". */
+  parts = ALLOC_CLEAR_MULT(sapart_T, ss->ss_line_count / size + 1);
+  if (parts == NULL)
+    return NULL;
+  for (block = 0; block < ss->ss_block_count; ++block)
+  {
+    if (ss->ss_last[block] - first + 1 < size && block < ss->ss_block_count - 1)
+      continue;
+    parts[count].sp_first = first;
+    parts[count].sp_last = ss->ss_last[block];
+    ga_init2(&parts[count].sp_matches, (int)sizeof(searchHighlight_T), 100);
+    ++count;
+    first = ss->ss_last[block] + 1;
+  }
+  *countp = count;
+  return parts;
+}
+
+/*
+ * Return the number of threads to search with.
+ */
+static int
+sa_thread_count(void)
+{
+  long n = sa_threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if (n == 0)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (n < 1)
+    return 1;
+  return n > SA_MAX_THREADS ? SA_MAX_THREADS : (int)n;
+}
+#endif /* SEARCH_ALL_THREADS */
+
+/*
+ * Set the number of threads search_all() uses, zero for one per processor.
+ */
+void search_all_set_threads(int count)
+{
+  sa_threads = count < 0 ? 0 : count;
+}
+
+/*
+ * Add all matches of the last search pattern in "buf" to "gap", a growarray
+ * of searchHighlight_T.  These are the same as search_get_highlights() finds
+ * for the whole buffer, but a large buffer is searched with several threads.
+ * A pattern that depends on the line number, cursor, marks or Visual area is
+ * searched for in the main thread only.
+ */
+void search_all(buf_T *buf, garray_T *gap)
+{
+#ifdef SEARCH_ALL_THREADS
+  char_u *pat = get_search_pat();
+  snapshot_T *ss;
+  searchall_T sa;
+  saworker_T *workers;
+  samatcher_T *sm;
+  samatcher_T merge;
+  sapart_T *part;
+  pos_T pos;
+  int threads;
+  int worker_count;
+  int i;
+
+  if (pat == NULL)
+    return;
+  threads = sa_thread_count();
+  if (threads == 1 || buf->b_ml.ml_line_count < SA_MIN_LINES * 2 || !hl_pattern_cacheable(pat))
+  {
+    search_get_highlights(buf, 0, 0, gap);
+    return;
+  }
+
+  vim_memset(&sa, 0, sizeof(sa));
+  if ((ss = ml_snapshot(buf)) == NULL || (sa.sa_parts = sa_split(ss, threads, &sa.sa_part_count)) == NULL || sa.sa_part_count < 2)
+  {
+    vim_free(sa.sa_parts);
+    ml_snapshot_free(ss);
+    search_get_highlights(buf, 0, 0, gap);
+    return;
+  }
+  if (threads > sa.sa_part_count)
+    threads = sa.sa_part_count;
+
+  /* The patterns are compiled in the main thread, one for joining the parts
+     * and one for each thread that isn't shared with others. */
+  vim_memset(&merge, 0, sizeof(merge));
+  merge.sm_buf = buf;
+  merge.sm_snapshot = ss;
+  merge.sm_cpo_search = vim_strchr(p_cpo, CPO_SEARCH) != NULL;
+  if (search_regcomp(pat, RE_SEARCH, RE_SEARCH, SEARCH_KEEP,
+                     &merge.sm_regmatch) == FAIL)
+    threads = 0;
+  workers = threads == 0 ? NULL : ALLOC_CLEAR_MULT(saworker_T, threads);
+  worker_count = workers == NULL ? 0 : threads;
+  for (i = 0; i < worker_count; ++i)
+  {
+    sm = &workers[i].sw_matcher;
+    *sm = merge;
+    sm->sm_regmatch.regprog = NULL;
+    workers[i].sw_sa = &sa;
+    if ((sm->sm_rex = vim_regexec_ctx_alloc()) == NULL || (sm->sm_regmatch.regprog = vim_regcomp(pat, merge.sm_regmatch.regprog->re_flags | RE_NOCACHE)) == NULL)
+      break;
+    vim_regexec_ctx_set_getline(sm->sm_rex, sa_getline, ss, ss->ss_line_count);
+  }
+  threads = i;
+
+  /* The main thread searches with the first matcher. */
+  pthread_mutex_init(&sa.sa_mutex, NULL);
+  for (i = 1; i < threads; ++i)
+    workers[i].sw_started = pthread_create(&workers[i].sw_thread, NULL,
+                                           sa_worker, &workers[i]) == 0;
+  if (threads > 0)
+    sa_search_parts(&sa, &workers[0].sw_matcher);
+  for (i = 1; i < threads; ++i)
+    if (workers[i].sw_started)
+      pthread_join(workers[i].sw_thread, NULL);
+  pthread_mutex_destroy(&sa.sa_mutex);
+
+  /* Join the matches of the parts.  Parts that were not searched are
+     * searched now. */
+  CLEAR_POS(&pos);
+  for (i = 0; i < sa.sa_part_count && merge.sm_regmatch.regprog != NULL && !merge.sm_failed; ++i)
+  {
+    part = sa.sa_parts + i;
+    if (part->sp_failed || i >= sa.sa_next_part)
+      sa_search_range(&merge, &pos, part->sp_last, gap, NULL);
+    else if (pos.lnum == part->sp_first - 1 && pos.col == (i == 0 ? 0 : MAXCOL))
+    {
+      if (ga_grow(gap, part->sp_matches.ga_len) == OK)
+      {
+        mch_memmove((searchHighlight_T *)gap->ga_data + gap->ga_len,
+                    part->sp_matches.ga_data,
+                    sizeof(searchHighlight_T) * part->sp_matches.ga_len);
+        gap->ga_len += part->sp_matches.ga_len;
+      }
+      pos = part->sp_end;
+    }
+    else
+      sa_search_range(&merge, &pos, part->sp_last, gap, part);
+  }
+
+  for (i = 0; i < worker_count; ++i)
+  {
+    vim_regfree(workers[i].sw_matcher.sm_regmatch.regprog);
+    vim_regexec_ctx_free(workers[i].sw_matcher.sm_rex);
+  }
+  vim_free(workers);
+  vim_regfree(merge.sm_regmatch.regprog);
+  for (i = 0; i < sa.sa_part_count; ++i)
+    ga_clear(&sa.sa_parts[i].sp_matches);
+  vim_free(sa.sa_parts);
+  ml_snapshot_free(ss);
+#else
+  search_get_highlights(buf, 0, 0, gap);
+#endif
+}
@@ -31,6 +31,9 @@ typedef struct
 } pos_T;
 
 typedef struct file_buffer buf_T; /* forward declaration */
+typedef struct bufload_S bufload_T; /* defined in fileio.c */
+typedef struct bufsave_S bufsave_T; /* defined in fileio.c */
+typedef struct hlindex_S hlindex_T; /* defined in search.c */
 
 typedef enum
 {
@@ -537,20 +540,31 @@ typedef struct
 
 // One line saved for undo.  After the NUL terminated text there might be text
 // properties, thus ul_len can be larger than STRLEN(ul_line) + 1.
+// A line can also be stored as a delta against the line that is in the buffer
+// when the entry is undone: the first ul_prefix and the last ul_suffix bytes
+// are taken from that line, ul_line only has the bytes in between.
 typedef struct
 {
-  char_u *ul_line; // text of the line
-  long ul_len;     // length of the line including NUL, plus text
-                   // properties
+  char_u *ul_line;     // text of the line, or the changed bytes of a delta
+  long ul_len;         // length of the line including NUL, plus text
+                       // properties; for a delta the length of ul_line
+  colnr_T ul_prefix;   // bytes before ul_line, for a delta
+  colnr_T ul_suffix;   // bytes after ul_line, for a delta
+  colnr_T ul_base_len; // length of the line a delta applies to
 } undoline_T;
 
+// TRUE when "ul" is stored as a delta.
+#define UL_IS_DELTA(ul) ((ul)->ul_prefix + (ul)->ul_suffix > 0)
+
 typedef struct u_entry u_entry_T;
 typedef struct u_header u_header_T;
 struct u_entry
 {
   u_entry_T *ue_next;   /* pointer to next entry in list */
   linenr_T ue_top;      /* number of line above undo block */
-  linenr_T ue_bot;      /* number of line below undo block */
+  linenr_T ue_bot;      /* number of line below undo block, zero or
+                           minus the number of lines from the end of the
+                           buffer, see u_appended_last() */
   linenr_T ue_lcount;   /* linecount when u_save called */
   undoline_T *ue_array; /* array of lines in undo block */
   long ue_size;         /* number of lines in ue_array */
@@ -595,11 +609,47 @@ struct u_header
   time_T uh_time;          /* timestamp when the change was made */
   long uh_save_nr;         /* set when the file was saved after the
 				   changes in this block */
+#ifdef FEAT_PERSISTENT_UNDO
+  int uh_dirty;          /* changed since written to the undo file */
+  long_u uh_entry_pos;   /* when not zero the entries did not change since
+				   they were written at this offset in the
+				   undo file */
+  long_u uh_entry_len;   /* number of bytes of those entries */
+  long_u uh_file_off;    /* when not zero the entries were not read yet,
+				   they are at this offset in
+				   b_u_file->uf_addr */
+  long_u uh_file_len;    /* number of bytes of those entries */
+#endif
 #ifdef U_DEBUG
   int uh_magic; /* magic number to check allocation */
 #endif
 };
 
+#ifdef FEAT_PERSISTENT_UNDO
+/*
+ * The undo file that was last written or read for a buffer.  Headers that
+ * changed are appended to it, as long as nobody else changed the file.
+ * The contents of the file that was read is kept while the entries of some
+ * headers were not read yet, see u_load_entries().
+ */
+typedef struct
+{
+  char_u *uf_name;     /* name of the undo file */
+  off_T uf_size;       /* size of the file after it was written or read */
+  off_T uf_full_size;  /* size after the last time all headers were written */
+#ifdef UNIX
+  dev_t uf_dev;        /* device and inode of the file */
+  ino_t uf_ino;
+#endif
+  char_u *uf_addr;     /* contents of the file that was read or NULL */
+  size_t uf_addr_size; /* number of bytes at "uf_addr" */
+  int uf_mapped;       /* "uf_addr" is a mapping, not allocated */
+  long uf_lazy;        /* number of headers with entries not read yet */
+  linenr_T uf_appended; /* lines appended below the last line since the
+                           file was read, not in the entries not read yet */
+} undofile_T;
+#endif
+
 /* values for uh_flags */
 #define UH_CHANGED 0x01  /* b_changed flag before undo/after redo */
 #define UH_EMPTYBUF 0x02 /* buffer was empty */
@@ -634,6 +684,7 @@ struct m_info
 typedef struct block_hdr bhdr_T;
 typedef struct memfile memfile_T;
 typedef long blocknr_T;
+typedef struct snapblock_S snapblock_T;
 
 /*
  * mf_hashtab_T is a chained hashtable with blocknr_T key and arbitrary
@@ -691,7 +742,12 @@ struct block_hdr
 
 #define BH_DIRTY 1
 #define BH_LOCKED 2
-  char bh_flags; /* BH_DIRTY or BH_LOCKED */
+  char bh_flags;  /* BH_DIRTY or BH_LOCKED */
+  char bh_pooled; /* bh_data is a page from a slab of mf_pool */
+  snapblock_T *bh_snap; /* copy of the unchanged data block for snapshots */
+  time_T bh_used;       /* when the block was last used */
+  char_u *bh_compressed;      /* the compressed block, bh_data is NULL then */
+  unsigned bh_compressed_len; /* number of bytes in bh_compressed */
 };
 
 /*
@@ -822,6 +878,101 @@ typedef struct
 
 #define MF_SEED_LEN 8
 
+#ifdef FEAT_MMAP_FILE
+/*
+ * A file that is read through a read-only mapping.  Each data block of the
+ * file gets a negative block number, the block is only created from the
+ * mapped text when it is used, see ml_fill_mapped().
+ */
+typedef struct mf_map_S
+{
+  char_u *mm_addr;    // start of the mapping
+  size_t mm_size;     // number of bytes mapped
+  int mm_fileformat;  // EOL_UNIX or EOL_DOS
+  blocknr_T mm_first; // block number of the first mapped block
+  blocknr_T mm_count; // number of mapped blocks
+  size_t *mm_offsets; // start of each block, "mm_count" + 1 entries
+} mf_map_T;
+#endif
+
+/*
+ * Memory for the blocks of a memfile.  Blocks of one page are carved from
+ * slabs of pages and freed pages are kept in a list for the next block, so
+ * that loading and editing a file doesn't malloc() and free() every block.
+ * Each slab is twice the size of the previous one, up to MF_SLAB_MAX_PAGES.
+ * Unused block headers are kept for reuse as well.  The slabs are released
+ * when the memfile is closed, or when memory runs low and all pages of a slab
+ * are free.
+ */
+#define MF_SLAB_MIN_PAGES 4
+#define MF_SLAB_MAX_PAGES 64
+
+typedef struct mf_slab_S mf_slab_T;
+struct mf_slab_S
+{
+  mf_slab_T *ms_next; // next older slab
+  char_u *ms_data;    // "ms_pages" pages
+  int ms_pages;       // number of pages in the slab
+};
+
+typedef struct
+{
+  unsigned mp_page_size;  // size of the pages in the slabs
+  mf_slab_T *mp_slabs;    // all slabs, newest first
+  int mp_slab_count;      // number of slabs
+  long mp_slab_pages;     // number of pages in all slabs
+  int mp_fresh;           // pages at the end of the newest slab never used
+  char_u *mp_free_pages;  // freed pages, linked through their first bytes
+  long mp_free_count;     // number of pages in mp_free_pages
+  bhdr_T *mp_free_hdrs;   // unused block headers, linked with bh_next
+  long mp_free_hdr_count; // number of headers in mp_free_hdrs
+  long mp_hdr_count;      // number of block headers allocated
+  long_u mp_other_bytes;  // bytes of blocks allocated outside the slabs
+} mf_pool_T;
+
+/*
+ * Memory used for the blocks of a buffer, see vimBufferGetBlockPoolStats().
+ * The fragmentation is "free" / ("used" + "free").
+ */
+typedef struct
+{
+  long_u used; // bytes of blocks and block headers in use
+  long_u free; // bytes of pages and block headers kept for reuse
+  int slabs;   // number of slabs of pages
+} blockPoolStats_T;
+
+/*
+ * Memory used by a buffer, or by all buffers, see vimGetMemoryStats().
+ * Sizes are in bytes, without the overhead of malloc().
+ */
+typedef struct
+{
+  long_u buffer;         // the buf_T itself, without the marks in it
+  long_u memline;        // blocks in memory with their headers, pages the
+                         // block pool keeps for reuse, the block hash table
+                         // and the line offset index
+  long_u compressed;     // part of "memline" used for compressed blocks
+  long_u compress_saved; // memory saved by compressing blocks
+  long_u snapshots;      // copies of data blocks kept for snapshots
+  long_u line_cache;     // the changed line, the stack of pointer blocks and
+                         // the cache of recently found data blocks
+  long_u undo;           // undo headers, entries and the lines saved in them
+  long_u marks;          // buffer marks; for all buffers also file marks and
+                         // jumplists
+  long_u folds;          // folds of the windows and of remembered window info
+  long_u eval;           // b: variables; for all buffers also g: variables
+  long_u total;          // sum of the sizes above, "compressed" is in
+                         // "memline"
+
+  long blocks;            // memline blocks in memory
+  long compressed_blocks; // blocks that are compressed
+  long cached_blocks;     // data blocks in the cache of found blocks
+  long undo_headers;      // undo states
+  long undo_entries;      // undo entries, each a range of saved lines
+  long undo_lines;        // lines saved in the undo entries
+  int buffers;            // number of buffers counted
+} memoryStats_T;
+
 struct memfile
 {
   char_u *mf_fname;           // name of the file
@@ -842,6 +993,14 @@ struct memfile
   blocknr_T mf_infile_count;  // number of pages in the file
   unsigned mf_page_size;      // number of bytes in a page
   int mf_dirty;               // TRUE if there are dirty blocks
+#ifdef FEAT_MMAP_FILE
+  mf_map_T *mf_map;           // mapped file, NULL if none
+#endif
+  mf_pool_T mf_pool;          // memory for blocks and block headers
+  int mf_all_compressed;      // no block to compress until one is used
+  long mf_compressed_count;   // number of compressed blocks
+  long_u mf_compressed_bytes; // memory used for compressed blocks
+  long_u mf_compressed_size;  // size of those blocks when not compressed
 };
 
 /*
@@ -860,11 +1019,36 @@ typedef struct info_pointer
   int ip_index;      /* index for block with current lnum */
 } infoptr_T;         /* block/index pair */
 
+/*
+ * A data block that ml_find_line() found recently, with the stack of pointer
+ * blocks leading to it.  Used to avoid going down the tree again when lines in
+ * a few distant places of the buffer are used alternately.
+ */
+#define MLC_SIZE 8     /* number of data blocks in ml_cache */
+#define MLC_MAXDEPTH 6 /* deepest stack that is cached */
+
+typedef struct ml_cache
+{
+  blocknr_T mc_bnum;                /* data block number */
+  int mc_page_count;                /* number of pages in the data block */
+  linenr_T mc_low;                  /* first line in the data block */
+  linenr_T mc_high;                 /* last line in the data block */
+  int mc_stack_top;                 /* number of entries in mc_stack */
+  infoptr_T mc_stack[MLC_MAXDEPTH]; /* ml_stack for the data block */
+} mlcache_T;
+
+#define ML_HASH_LANES 4 /* number of values in a content hash */
+
 #ifdef FEAT_BYTEOFF
 typedef struct ml_chunksize
 {
   int mlcs_numlines;
   long mlcs_totalsize;
+#ifdef FEAT_PERSISTENT_UNDO
+  int mlcs_hashed;                   /* mlcs_hash[] is valid */
+  UINT32_T mlcs_hash[ML_HASH_LANES]; /* hash of the lines, see
+					ml_content_hash() */
+#endif
 } chunksize_T;
 
 /* Flags when calling ml_updatechunk() */
@@ -874,6 +1058,35 @@ typedef struct ml_chunksize
 #define ML_CHNK_UPDLINE 3
 #endif
 
+/*
+ * A read-only copy of the text of a data block, for buffer snapshots.  The
+ * copy is shared by the snapshots taken while the block does not change, and
+ * kept with the block in "bh_snap" for the next snapshot.  It is freed when
+ * the last snapshot or block using it lets go, which may happen in another
+ * thread.
+ */
+struct snapblock_S
+{
+  long sb_refcount;  /* number of snapshots and blocks using it */
+  int sb_line_count; /* number of lines */
+  unsigned *sb_index; /* start of each line in sb_text, first line last */
+  char_u *sb_text;   /* the NUL terminated lines, "sb_text_len" bytes */
+  unsigned sb_text_len;
+};
+
+/*
+ * An immutable view of the lines of a buffer at the time it was taken, see
+ * ml_snapshot().  It does not change when the buffer is edited and can be
+ * read by other threads.
+ */
+typedef struct snapshot_S
+{
+  linenr_T ss_line_count;  /* number of lines */
+  int ss_block_count;      /* number of blocks in ss_blocks */
+  snapblock_T **ss_blocks; /* copies of the data blocks, in order */
+  linenr_T *ss_last;       /* last line number in each block */
+} snapshot_T;
+
 /*
  * the memline structure holds all the information about a memline
  */
@@ -901,10 +1114,17 @@ typedef struct memline
   linenr_T ml_locked_low;  /* first line in ml_locked */
   linenr_T ml_locked_high; /* last line in ml_locked */
   int ml_locked_lineadd;   /* number of lines inserted in ml_locked */
+
+  mlcache_T ml_cache[MLC_SIZE]; /* recently found data blocks, MRU first */
+  int ml_cache_len;             /* number of entries used in ml_cache */
+  long ml_cache_hits;           /* lookups found in ml_cache */
+  long ml_cache_misses;         /* lookups that went down the tree */
 #ifdef FEAT_BYTEOFF
   chunksize_T *ml_chunksize;
   int ml_numchunks;
   int ml_usedchunks;
+  chunksize_T *ml_chunktree; /* Fenwick tree of ml_chunksize sums */
+  int ml_chunktree_len;      /* chunks in ml_chunktree, 0 when invalid */
 #endif
 } memline_T;
 
@@ -2112,6 +2332,8 @@ struct file_buffer
 {
   memline_T b_ml; /* associated memline (also contains line
 				   count) */
+  bufload_T *b_load; /* lines still being read, see bufload_open() */
+  bufsave_T *b_save; /* writing in the background, see bufsave_start() */
 
   buf_T *b_next; /* links in list of buffers */
   buf_T *b_prev;
@@ -2182,6 +2404,11 @@ struct file_buffer
   long b_mtime_read; /* last change time when reading */
   off_T b_orig_size; /* size of original file in bytes */
   int b_orig_mode;   /* mode of original file */
+
+  int b_tail;            /* append the lines added to the file instead of
+                            reloading it, see buf_tail_append() */
+  off_T b_tail_offset;   /* bytes of the file read into the buffer */
+  int b_tail_partial;    /* last line read has no NL */
 #ifdef FEAT_VIMINFO
   time_T b_last_used; /* time when the buffer was last used; used
 				 * for viminfo */
@@ -2249,6 +2476,10 @@ struct file_buffer
   long b_u_seq_cur;        /* hu_seq of header below which we are now */
   time_T b_u_time_cur;     /* uh_time of header below which we are now */
   long b_u_save_nr_cur;    /* file write nr after which we are now */
+  long_u b_u_mem_used;     /* bytes used by the headers and entries */
+#ifdef FEAT_PERSISTENT_UNDO
+  undofile_T *b_u_file; /* undo file last written or read, or NULL */
+#endif
 
   /*
      * variables for "U" command in undo.c
@@ -2422,6 +2653,10 @@ struct file_buffer
   list_T *b_recorded_changes;
 #endif
 
+  garray_T b_changes; // bufferChange_T not given to bufferChangeCallback yet
+  garray_T b_update_batch; // merged bufferUpdate_T of the open batch
+  hlindex_T *b_hlindex;    // matches of the search pattern per line
+
 #if defined(FEAT_BEVAL) && defined(FEAT_EVAL)
   char_u *b_p_bexpr;      /* 'balloonexpr' local value */
   long_u b_p_bexpr_flags; /* flags for 'balloonexpr' */
@@ -2495,10 +2730,32 @@ typedef struct
   long xtra;      // number of extra lines (negative when deleting)
 } bufferUpdate_T;
 
+/*
+ * A change in the text of a buffer: the text from "lnum" / "col" up to
+ * "oldEndLnum" / "oldEndCol" was replaced with "newText".  Columns are byte
+ * indexes, a line break counts as one byte.  When "newText" is NULL the whole
+ * text was replaced, e.g. by reading the file.
+ */
+typedef struct
+{
+  buf_T *buf;
+  varnumber_T changedtick; // b:changedtick after the change
+  linenr_T lnum;           // where the change starts
+  colnr_T col;
+  linenr_T oldEndLnum;     // where the replaced text ended
+  colnr_T oldEndCol;
+  long byteOffset;         // offset of "lnum" / "col", -1 when not known
+  long oldLength;          // number of bytes replaced
+  char_u *newText;         // new text, lines separated with NL
+  long newLength;          // number of bytes in "newText"
+} bufferChange_T;
+
 typedef enum
 {
   // The file has been changed since reading
   FILE_CHANGED,
+  // Writing, syncing or renaming the file failed, for vimBufferSaveAsync
+  FILE_WRITE_FAILED,
 } writeFailureReason_T;
 
 typedef struct
@@ -2517,13 +2774,63 @@ typedef struct
   int hidden;
 } optionSet_T;
 
+/* loading a buffer in the background */
+
+typedef enum
+{
+  LOAD_RUNNING,   // lines are still being appended
+  LOAD_DONE,      // the whole file is in the buffer
+  LOAD_CANCELLED, // cancelled, or the buffer was unloaded
+  LOAD_FAILED,    // a read error, the buffer has the lines read before it
+} loadState_T;
+
+typedef struct
+{
+  buf_T *buf;
+  loadState_T state;
+  linenr_T lines;   // lines in the buffer so far
+  off_T bytesRead;  // bytes of the file in the buffer so far
+  off_T totalBytes; // size of the file when it was opened
+} loadProgress_T;
+
+/* saving a buffer in the background */
+
+typedef enum
+{
+  SAVE_RUNNING, // the file is being written
+  SAVE_DONE,    // the file was replaced
+  SAVE_FAILED,  // it could not be written, an error was given
+} saveState_T;
+
+/* how the backup file of the last write was made, see vimGetBackupStats() */
+
+typedef enum
+{
+  BACKUP_NONE,       // no backup was made
+  BACKUP_RENAME,     // the original file was renamed
+  BACKUP_CLONE,      // the copy shares the blocks of the file (FICLONE)
+  BACKUP_COPY_RANGE, // copied by the kernel (copy_file_range())
+  BACKUP_COPY,       // read and written through a buffer
+} backupMethod_T;
+
+typedef struct
+{
+  backupMethod_T bs_method;
+  off_T bs_size;   // size of the file that was backed up
+  long bs_usec;    // time it took to make the backup, in microseconds
+} backupStats_T;
+
 typedef void (*BufferUpdateCallback)(bufferUpdate_T bufferUpdate);
+typedef void (*BufferChangeCallback)(bufferChange_T *change);
+typedef void (*LoadProgressCallback)(loadProgress_T *progress, void *context);
+typedef void (*SaveCompleteCallback)(buf_T *buf, saveState_T state, void *context);
 typedef void (*FileWriteFailureCallback)(writeFailureReason_T failureReason, buf_T *buf);
 typedef void (*MessageCallback)(char_u *title, char_u *msg, msgPriority_T priority);
 typedef void (*DirectoryChangedCallback)(char_u *path);
 typedef void (*QuitCallback)(buf_T *buf, int isForced);
 typedef void (*OptionSetCallback)(optionSet_T *optionSet);
 typedef void (*OutputCallback)(char_u *cmd, char_u *output, int isSilent);
+typedef int (*LineIterCallback)(void *context, linenr_T lnum, char_u *line, size_t len);
 typedef int (*ToggleCommentsCallback)(buf_T *buf, linenr_T startLine, linenr_T endLine, linenr_T *outCount, char_u ***outLines);
 
 #ifdef FEAT_DIFF
@@ -2682,6 +2989,16 @@ typedef struct
   pos_T end;
 } searchHighlight_T;
 
+/*
+ * Array of search highlights that is reused by vimSearchGetHighlightsList()
+ */
+typedef struct
+{
+  searchHighlight_T *highlights;
+  int count; // number of highlights found
+  int size;  // number of entries allocated
+} searchHighlightList_T;
+
 /* number of positions supported by matchaddpos() */
 #define MAXPOSMATCH 8
 
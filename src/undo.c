@@ -86,27 +86,54 @@
 
 #include "vim.h"
 
+#ifdef FEAT_MMAP_FILE
+#include <sys/mman.h>
+#endif
+
 /* Structure passed around between functions.
- * Avoids passing cryptstate_T when encryption not available. */
+ * Avoids passing cryptstate_T when encryption not available.
+ * Writing goes to "bi_fp", when it is NULL the bytes are only counted.
+ * Reading is done from the contents of the file in memory. */
 typedef struct
 {
   buf_T *bi_buf;
   FILE *bi_fp;
+  long_u bi_size; /* offset in the file, counts the bytes written */
+  char_u *bi_ptr; /* next byte to read */
+  char_u *bi_end; /* end of the bytes that can be read */
+  int bi_error;   /* TRUE when reading past "bi_end" was tried */
 } bufinfo_T;
 
 static void u_unch_branch(u_header_T *uhp);
 static u_entry_T *u_get_headentry(void);
 static void u_getbot(void);
 static void u_doit(int count);
-static void u_undoredo(int undo);
+static int u_undoredo(int undo);
 static void u_undo_end(int did_undo, int absolute);
 static void u_add_time(char_u *buf, size_t buflen, time_t tt);
 static void u_freeheader(buf_T *buf, u_header_T *uhp, u_header_T **uhpp);
 static void u_freebranch(buf_T *buf, u_header_T *uhp, u_header_T **uhpp);
 static void u_freeentries(buf_T *buf, u_header_T *uhp, u_header_T **uhpp);
 static void u_freeentry(u_entry_T *, long);
+static long_u u_entry_mem(u_entry_T *uep);
+static void u_delta_entry(u_entry_T *uep);
+static void u_delta_header(u_header_T *uhp);
+static int u_undelta_entry(u_entry_T *uep);
+static int u_line_equal(undoline_T *ul, char_u *line, long len);
+static void u_tree_memory_stats(u_header_T *first_uhp, memoryStats_T *stats);
+static u_header_T *u_walk_next(u_header_T *uhp, int mark);
+static void u_header_changed(u_header_T *uhp);
+static void u_entries_changed(u_header_T *uhp);
+static int u_load_entries(buf_T *buf, u_header_T *uhp);
 #ifdef FEAT_PERSISTENT_UNDO
+static int u_read_entries(buf_T *buf, u_header_T *uhp);
+static void u_load_appended(buf_T *buf);
+static void u_undofile_unmap(undofile_T *uf);
+static void u_undofile_free(buf_T *buf);
 static int undo_read(bufinfo_T *bi, char_u *buffer, size_t size);
+static int undo_read_bytes(bufinfo_T *bi, int len);
+static time_T undo_read_time(bufinfo_T *bi);
+static int unserialize_entries(bufinfo_T *bi, u_header_T *uhp, char_u *file_name);
 static int serialize_uep(bufinfo_T *bi, u_entry_T *uep);
 static u_entry_T *unserialize_uep(bufinfo_T *bi, int *error, char_u *file_name);
 static void serialize_pos(bufinfo_T *bi, pos_T pos);
@@ -344,6 +371,9 @@ u_save_line(undoline_T *ul, linenr_T lnum)
 {
   char_u *line = ml_get(lnum);
 
+  ul->ul_prefix = 0;
+  ul->ul_suffix = 0;
+  ul->ul_base_len = 0;
   if (curbuf->b_ml.ml_line_len == 0)
   {
     ul->ul_len = 1;
@@ -359,6 +389,187 @@ u_save_line(undoline_T *ul, linenr_T lnum)
   return ul->ul_line == NULL ? FAIL : OK;
 }
 
+/*
+ * Lines shorter than this are always saved as a whole.
+ */
+#define UL_DELTA_MIN 64
+
+/*
+ * Store saved line "ul" as a delta against line "lnum", when the bytes that
+ * differ are less than half of it.
+ */
+static void
+u_delta_line(undoline_T *ul, linenr_T lnum)
+{
+  char_u *line;
+  long len;
+  long max;
+  long prefix;
+  long suffix;
+  long mid_len;
+  char_u *mid = NULL;
+
+  if (UL_IS_DELTA(ul) || ul->ul_len < UL_DELTA_MIN)
+    return;
+  line = ml_get(lnum);
+  len = curbuf->b_ml.ml_line_len == 0 ? 1 : curbuf->b_ml.ml_line_len;
+
+  max = len < ul->ul_len ? len : ul->ul_len;
+  for (prefix = 0; prefix < max && line[prefix] == ul->ul_line[prefix];
+       ++prefix)
+    ;
+  for (suffix = 0; suffix < max - prefix &&
+                   line[len - 1 - suffix] == ul->ul_line[ul->ul_len - 1 - suffix];
+       ++suffix)
+    ;
+  mid_len = ul->ul_len - prefix - suffix;
+  if (mid_len > ul->ul_len / 2)
+    return;
+  if (mid_len > 0 && (mid = vim_memsave(ul->ul_line + prefix, mid_len)) == NULL)
+    return;
+
+  curbuf->b_u_mem_used -= ul->ul_len - mid_len;
+  vim_free(ul->ul_line);
+  ul->ul_line = mid;
+  ul->ul_len = mid_len;
+  ul->ul_prefix = (colnr_T)prefix;
+  ul->ul_suffix = (colnr_T)suffix;
+  ul->ul_base_len = (colnr_T)len;
+}
+
+/*
+ * Make saved line "ul" a whole line again, taking the unchanged bytes from
+ * line "lnum".
+ * Returns FAIL when out of memory or "lnum" is too short.
+ */
+static int
+u_undelta_line(undoline_T *ul, linenr_T lnum)
+{
+  char_u *line;
+  long len;
+  long new_len;
+  char_u *p;
+
+  if (!UL_IS_DELTA(ul))
+    return OK;
+  line = ml_get(lnum);
+  len = curbuf->b_ml.ml_line_len == 0 ? 1 : curbuf->b_ml.ml_line_len;
+  if (ul->ul_base_len != len)
+    return FAIL;
+
+  new_len = ul->ul_prefix + ul->ul_len + ul->ul_suffix;
+  if ((p = alloc(new_len)) == NULL)
+    return FAIL;
+  mch_memmove(p, line, ul->ul_prefix);
+  if (ul->ul_len > 0)
+    mch_memmove(p + ul->ul_prefix, ul->ul_line, ul->ul_len);
+  mch_memmove(p + ul->ul_prefix + ul->ul_len, line + len - ul->ul_suffix,
+              ul->ul_suffix);
+
+  curbuf->b_u_mem_used += new_len - ul->ul_len;
+  vim_free(ul->ul_line);
+  ul->ul_line = p;
+  ul->ul_len = new_len;
+  ul->ul_prefix = 0;
+  ul->ul_suffix = 0;
+  ul->ul_base_len = 0;
+  return OK;
+}
+
+/*
+ * Store the lines of entry "uep" as deltas against the lines that are in the
+ * buffer now, where that is smaller.  The buffer must be in the state in
+ * which the entry will be undone.  Only done when the lines were changed one
+ * for one.
+ */
+static void
+u_delta_entry(u_entry_T *uep)
+{
+  linenr_T bot = uep->ue_bot;
+  long i;
+
+  if (bot <= 0)
+    bot = curbuf->b_ml.ml_line_count + 1 + bot;
+  if (uep->ue_size == 0 || bot - uep->ue_top - 1 != uep->ue_size)
+    return;
+  for (i = 0; i < uep->ue_size; ++i)
+    u_delta_line(&uep->ue_array[i], uep->ue_top + 1 + i);
+}
+
+/*
+ * Store the lines of header "uhp" as deltas where that is smaller.  Called
+ * when the next header is started, the buffer is then in the state in which
+ * "uhp" will be undone, and no more changes are made without saving the
+ * lines again.  Older entries are only done when the newer ones below them
+ * did not change the number of lines, thus the lines are still there.
+ */
+static void
+u_delta_header(u_header_T *uhp)
+{
+  u_entry_T *uep;
+  linenr_T bot;
+  linenr_T lowest = MAXLNUM;
+
+  for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+  {
+    bot = uep->ue_bot;
+    if (bot <= 0)
+      bot = curbuf->b_ml.ml_line_count + 1 + bot;
+    if (bot > lowest || bot - uep->ue_top - 1 != uep->ue_size)
+      break;
+    u_delta_entry(uep);
+    lowest = uep->ue_top + 1;
+  }
+}
+
+/*
+ * Make the lines of entry "uep" whole lines again, see u_delta_entry().
+ * Returns FAIL when out of memory or the buffer does not match.
+ */
+static int
+u_undelta_entry(u_entry_T *uep)
+{
+  linenr_T bot = uep->ue_bot;
+  long i;
+
+  if (bot <= 0)
+    bot = curbuf->b_ml.ml_line_count + 1 + bot;
+  for (i = 0; i < uep->ue_size; ++i)
+    if (UL_IS_DELTA(&uep->ue_array[i]) &&
+        (bot - uep->ue_top - 1 != uep->ue_size ||
+         u_undelta_line(&uep->ue_array[i], uep->ue_top + 1 + i) == FAIL))
+      return FAIL;
+  return OK;
+}
+
+/*
+ * Return TRUE when saved line "ul" is equal to "line" with length "len",
+ * which must be the line a delta applies to.
+ */
+static int
+u_line_equal(undoline_T *ul, char_u *line, long len)
+{
+  /* A delta keeps the line when nothing is replaced and nothing is left out
+     * between the prefix and the suffix. */
+  if (UL_IS_DELTA(ul))
+    return ul->ul_len == 0 && ul->ul_base_len == len && ul->ul_prefix + ul->ul_suffix == len;
+  return ul->ul_len == len && memcmp(ul->ul_line, line, len) == 0;
+}
+
+/*
+ * Return the number of bytes used by entry "uep".
+ */
+static long_u
+u_entry_mem(u_entry_T *uep)
+{
+  long_u mem = sizeof(u_entry_T) + uep->ue_size * sizeof(undoline_T);
+  long i;
+
+  for (i = 0; i < uep->ue_size; ++i)
+    mem += uep->ue_array[i].ul_len;
+  return mem;
+}
+
 /*
  * Common code for various ways to save text before a change.
  * "top" is the line above the first changed line.
@@ -426,6 +637,11 @@ int u_savecommon(
     curbuf->b_new_change = TRUE;
 #endif
 
+    /* The newest header is complete, make it smaller before deciding
+	 * which headers to free. */
+    if (curbuf->b_u_curhead == NULL && curbuf->b_u_newhead != NULL)
+      u_delta_header(curbuf->b_u_newhead);
+
     if (get_undolevel() >= 0)
     {
       /*
@@ -456,7 +672,9 @@ int u_savecommon(
     /*
 	 * free headers to keep the size right
 	 */
-    while (curbuf->b_u_numhead > get_undolevel() && curbuf->b_u_oldhead != NULL)
+    while ((curbuf->b_u_numhead > get_undolevel() ||
+            (p_um > 0 && curbuf->b_u_mem_used > (long_u)p_um)) &&
+           curbuf->b_u_oldhead != NULL)
     {
       u_header_T *uhfree = curbuf->b_u_oldhead;
 
@@ -493,15 +711,22 @@ int u_savecommon(
     {
       uhp->uh_alt_prev.ptr = old_curhead->uh_alt_prev.ptr;
       if (uhp->uh_alt_prev.ptr != NULL)
+      {
         uhp->uh_alt_prev.ptr->uh_alt_next.ptr = uhp;
+        u_header_changed(uhp->uh_alt_prev.ptr);
+      }
       old_curhead->uh_alt_prev.ptr = uhp;
+      u_header_changed(old_curhead);
       if (curbuf->b_u_oldhead == old_curhead)
         curbuf->b_u_oldhead = uhp;
     }
     else
       uhp->uh_alt_prev.ptr = NULL;
     if (curbuf->b_u_newhead != NULL)
+    {
       curbuf->b_u_newhead->uh_prev.ptr = uhp;
+      u_header_changed(curbuf->b_u_newhead);
+    }
 
     uhp->uh_seq = ++curbuf->b_u_seq_last;
     curbuf->b_u_seq_cur = uhp->uh_seq;
@@ -512,6 +737,13 @@ int u_savecommon(
     uhp->uh_walk = 0;
     uhp->uh_entry = NULL;
     uhp->uh_getbot_entry = NULL;
+#ifdef FEAT_PERSISTENT_UNDO
+    uhp->uh_dirty = TRUE;
+    uhp->uh_entry_pos = 0;
+    uhp->uh_entry_len = 0;
+    uhp->uh_file_off = 0;
+    uhp->uh_file_len = 0;
+#endif
     uhp->uh_cursor = curwin->w_cursor; /* save cursor pos. for undo */
     if (virtual_active() && curwin->w_cursor.coladd > 0)
       uhp->uh_cursor_vcol = getviscol();
@@ -530,12 +762,18 @@ int u_savecommon(
     if (curbuf->b_u_oldhead == NULL)
       curbuf->b_u_oldhead = uhp;
     ++curbuf->b_u_numhead;
+    curbuf->b_u_mem_used += sizeof(u_header_T);
   }
   else
   {
     if (get_undolevel() < 0) /* no undo at all */
       return OK;
 
+    /* Entries are added to the newest header. */
+    if (u_load_entries(curbuf, curbuf->b_u_newhead) == FAIL)
+      return FAIL;
+    u_entries_changed(curbuf->b_u_newhead);
+
     /*
 	 * When saving a single line, and it has been saved just before, it
 	 * doesn't make sense saving it again.  Saves a lot of memory when
@@ -567,6 +805,9 @@ int u_savecommon(
         /* If it's the same line we can skip saving it again. */
         if (uep->ue_size == 1 && uep->ue_top == top)
         {
+          /* A delta must be made whole, the line will change further. */
+          if (u_undelta_entry(uep) == FAIL)
+            break;
           if (i > 0)
           {
             /* It's not the last entry: get ue_bot for the last
@@ -667,6 +908,7 @@ int u_savecommon(
   }
   else
     uep->ue_array = NULL;
+  curbuf->b_u_mem_used += u_entry_mem(uep);
   uep->ue_next = curbuf->b_u_newhead->uh_entry;
   curbuf->b_u_newhead->uh_entry = uep;
   curbuf->b_u_synced = FALSE;
@@ -698,6 +940,12 @@ nomem:
 #define UF_ENTRY_END_MAGIC 0x3581  /* magic after last entry */
 #define UF_VERSION 2               /* 2-byte undofile version number */
 #define UF_VERSION_CRYPT 0x8002    /* idem, encrypted */
+#define UF_VERSION_DELTA 3         /* lines may be stored as a delta */
+#define UF_VERSION_APPEND 4        /* segments appended after each write */
+#define UF_VERSION_HASH 5          /* hash from ml_content_hash() */
+#define UF_DELTA_LINE (-1)         /* line length for a delta line */
+#define UF_SEGMENT_MAGIC 0x94c1    /* magic at start of a segment */
+#define UF_ENTRY_REF_MAGIC 0x94c2  /* entries written before, at offset */
 
 /* extra fields for header */
 #define UF_LAST_SAVE_NR 1
@@ -705,12 +953,55 @@ nomem:
 /* extra fields for uhp */
 #define UHP_SAVE_NR 1
 
+/*
+ * The state of the buffer and the undo tree at the start of a segment of the
+ * undo file, see serialize_header().
+ */
+typedef struct
+{
+  char_u hash[UNDO_HASH_SIZE];
+  linenr_T line_count;
+  undoline_T line_ptr; /* line for the "U" command */
+  linenr_T line_lnum;
+  colnr_T line_colnr;
+  long old_header_seq;
+  long new_header_seq;
+  long cur_header_seq;
+  long num_head;
+  long seq_last;
+  long seq_cur;
+  time_T seq_time;
+  long last_save_nr;
+  long *seqs; /* uh_seq of each header in the tree, "num_head" of them */
+} ufstate_T;
+
+/*
+ * Where a header was found in the undo file.
+ */
+typedef struct
+{
+  long ur_seq;     /* uh_seq of the header */
+  char_u *ur_ptr;  /* start of its fields */
+  char_u *ur_end;  /* end of its entries */
+} ufrecord_T;
+
 static char_u e_not_open[] = N_("E828: Cannot open undo file for writing: %s");
 
 /*
  * Compute the hash for the current buffer text into hash[UNDO_HASH_SIZE].
+ * The hash of the lines that did not change since the last time is kept.
  */
 void u_compute_hash(char_u *hash)
+{
+  ml_content_hash(curbuf, hash);
+}
+
+/*
+ * Compute the hash used by undo files before UF_VERSION_HASH: SHA-256 of all
+ * the text of the current buffer.
+ */
+static void
+u_compute_text_hash(char_u *hash)
 {
   context_sha256_T ctx;
   linenr_T lnum;
@@ -844,7 +1135,8 @@ u_free_uhp(u_header_T *uhp)
 static int
 undo_write(bufinfo_T *bi, char_u *ptr, size_t len)
 {
-  if (fwrite(ptr, len, (size_t)1, bi->bi_fp) != 1)
+  bi->bi_size += len;
+  if (bi->bi_fp != NULL && fwrite(ptr, len, (size_t)1, bi->bi_fp) != 1)
     return FAIL;
   return OK;
 }
@@ -883,17 +1175,64 @@ put_header_ptr(bufinfo_T *bi, u_header_T *uhp)
 static int
 undo_read(bufinfo_T *bi, char_u *buffer, size_t size)
 {
-  if (fread(buffer, (size_t)size, 1, bi->bi_fp) != 1)
+  if ((size_t)(bi->bi_end - bi->bi_ptr) < size)
   {
     /* Error may be checked for only later.  Fill with zeros,
 	   * so that the reader won't use garbage. */
     vim_memset(buffer, 0, size);
+    bi->bi_ptr = bi->bi_end;
+    bi->bi_error = TRUE;
     return FAIL;
   }
+  mch_memmove(buffer, bi->bi_ptr, size);
+  bi->bi_ptr += size;
 
   return OK;
 }
 
+/*
+ * Read a number of "len" bytes, MSB first, from the undo file.
+ * Must match with undo_write_bytes().
+ * Returns -1 at the end of the file, like getc() and get4c().
+ */
+static int
+undo_read_bytes(bufinfo_T *bi, int len)
+{
+  /* Use unsigned rather than int otherwise result is undefined
+     * when left-shift sets the MSB. */
+  unsigned n = 0;
+
+  if (bi->bi_end - bi->bi_ptr < len)
+  {
+    bi->bi_ptr = bi->bi_end;
+    bi->bi_error = TRUE;
+    return -1;
+  }
+  while (--len >= 0)
+    n = (n << 8) + *bi->bi_ptr++;
+  return (int)n;
+}
+
+/*
+ * Read a time stamp written by time_to_bytes() from the undo file.
+ */
+static time_T
+undo_read_time(bufinfo_T *bi)
+{
+  time_T n = 0;
+  int i;
+
+  if (bi->bi_end - bi->bi_ptr < 8)
+  {
+    bi->bi_ptr = bi->bi_end;
+    bi->bi_error = TRUE;
+    return -1;
+  }
+  for (i = 0; i < 8; ++i)
+    n = (n << 8) + *bi->bi_ptr++;
+  return n;
+}
+
 /*
  * Read a string of length "len" from "bi->bi_fd".
  * "len" can be zero to allocate an empty line.
@@ -921,22 +1260,16 @@ read_string_decrypt(bufinfo_T *bi, int len)
 }
 
 /*
- * Writes the (not encrypted) header and initializes encryption if needed.
+ * Writes the header of a segment: the state of the buffer and the undo tree
+ * when the segment was written.
  */
 static int
 serialize_header(bufinfo_T *bi, char_u *hash)
 {
   long len;
   buf_T *buf = bi->bi_buf;
-  FILE *fp = bi->bi_fp;
   char_u time_buf[8];
 
-  /* Start writing, first the magic marker and undo info version. */
-  if (fwrite(UF_START_MAGIC, (size_t)UF_START_MAGIC_LEN, (size_t)1, fp) != 1)
-    return FAIL;
-
-  undo_write_bytes(bi, (long_u)UF_VERSION, 2);
-
   /* Write a hash of the buffer text, so that we can verify it is still the
      * same when reading the buffer text. */
   if (undo_write(bi, hash, (size_t)UNDO_HASH_SIZE) == FAIL)
@@ -974,16 +1307,19 @@ serialize_header(bufinfo_T *bi, char_u *hash)
   return OK;
 }
 
+/*
+ * Write header "uhp".  When "refer" is TRUE and its entries did not change
+ * since they were written to this file, only refer to them.
+ */
 static int
-serialize_uhp(bufinfo_T *bi, u_header_T *uhp)
+serialize_uhp(bufinfo_T *bi, u_header_T *uhp, int refer)
 {
+  long_u start;
+
   int i;
   u_entry_T *uep;
   char_u time_buf[8];
 
-  if (undo_write_bytes(bi, (long_u)UF_HEADER_MAGIC, 2) == FAIL)
-    return FAIL;
-
   put_header_ptr(bi, uhp->uh_next.ptr);
   put_header_ptr(bi, uhp->uh_prev.ptr);
   put_header_ptr(bi, uhp->uh_alt_next.ptr);
@@ -1006,25 +1342,51 @@ serialize_uhp(bufinfo_T *bi, u_header_T *uhp)
 
   undo_write_bytes(bi, 0, 1); /* end marker */
 
-  /* Write all the entries. */
-  for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+  if (refer && uhp->uh_entry_pos != 0)
+  {
+    undo_write_bytes(bi, (long_u)UF_ENTRY_REF_MAGIC, 2);
+    undo_write_bytes(bi, uhp->uh_entry_pos, 4);
+    return undo_write_bytes(bi, uhp->uh_entry_len, 4);
+  }
+
+  start = bi->bi_size;
+  if (uhp->uh_file_off != 0)
   {
-    undo_write_bytes(bi, (long_u)UF_ENTRY_MAGIC, 2);
-    if (serialize_uep(bi, uep) == FAIL)
+    /* Entries that were not read yet are copied from the file. */
+    if (undo_write(bi, bi->bi_buf->b_u_file->uf_addr + uhp->uh_file_off,
+                   (size_t)uhp->uh_file_len) == FAIL)
       return FAIL;
   }
-  undo_write_bytes(bi, (long_u)UF_ENTRY_END_MAGIC, 2);
+  else
+  {
+    /* Write all the entries. */
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+    {
+      undo_write_bytes(bi, (long_u)UF_ENTRY_MAGIC, 2);
+      if (serialize_uep(bi, uep) == FAIL)
+        return FAIL;
+    }
+    if (undo_write_bytes(bi, (long_u)UF_ENTRY_END_MAGIC, 2) == FAIL)
+      return FAIL;
+  }
+
+  /* Remember where the entries are, a later segment can refer to them. */
+  if (bi->bi_fp != NULL)
+  {
+    uhp->uh_entry_pos = bi->bi_size <= 0x7fffffffL ? start : 0;
+    uhp->uh_entry_len = bi->bi_size - start;
+  }
   return OK;
 }
 
+/*
+ * Read the fields of a header, up to its entries.
+ */
 static u_header_T *
 unserialize_uhp(bufinfo_T *bi, char_u *file_name)
 {
   u_header_T *uhp;
   int i;
-  u_entry_T *uep, *last_uep;
-  int c;
-  int error;
 
   uhp = U_ALLOC_LINE(sizeof(u_header_T));
   if (uhp == NULL)
@@ -1033,11 +1395,11 @@ unserialize_uhp(bufinfo_T *bi, char_u *file_name)
 #ifdef U_DEBUG
   uhp->uh_magic = UH_MAGIC;
 #endif
-  uhp->uh_next.seq = get4c(bi->bi_fp);
-  uhp->uh_prev.seq = get4c(bi->bi_fp);
-  uhp->uh_alt_next.seq = get4c(bi->bi_fp);
-  uhp->uh_alt_prev.seq = get4c(bi->bi_fp);
-  uhp->uh_seq = get4c(bi->bi_fp);
+  uhp->uh_next.seq = undo_read_bytes(bi, 4);
+  uhp->uh_prev.seq = undo_read_bytes(bi, 4);
+  uhp->uh_alt_next.seq = undo_read_bytes(bi, 4);
+  uhp->uh_alt_prev.seq = undo_read_bytes(bi, 4);
+  uhp->uh_seq = undo_read_bytes(bi, 4);
   if (uhp->uh_seq <= 0)
   {
     corruption_error("uh_seq", file_name);
@@ -1045,37 +1407,51 @@ unserialize_uhp(bufinfo_T *bi, char_u *file_name)
     return NULL;
   }
   unserialize_pos(bi, &uhp->uh_cursor);
-  uhp->uh_cursor_vcol = get4c(bi->bi_fp);
-  uhp->uh_flags = get2c(bi->bi_fp);
+  uhp->uh_cursor_vcol = undo_read_bytes(bi, 4);
+  uhp->uh_flags = undo_read_bytes(bi, 2);
   for (i = 0; i < NMARKS; ++i)
     unserialize_pos(bi, &uhp->uh_namedm[i]);
   unserialize_visualinfo(bi, &uhp->uh_visual);
-  uhp->uh_time = get8ctime(bi->bi_fp);
+  uhp->uh_time = undo_read_time(bi);
 
   /* Optional fields. */
   for (;;)
   {
-    int len = getc(bi->bi_fp);
+    int len = undo_read_bytes(bi, 1);
     int what;
 
     if (len == 0)
       break;
-    what = getc(bi->bi_fp);
+    what = undo_read_bytes(bi, 1);
     switch (what)
     {
     case UHP_SAVE_NR:
-      uhp->uh_save_nr = get4c(bi->bi_fp);
+      uhp->uh_save_nr = undo_read_bytes(bi, 4);
       break;
     default:
       /* field not supported, skip */
       while (--len >= 0)
-        (void)getc(bi->bi_fp);
+        (void)undo_read_bytes(bi, 1);
     }
   }
 
-  /* Unserialize the uep list. */
+  return uhp;
+}
+
+/*
+ * Read the entries of header "uhp", up to the entry end marker.
+ * Returns FAIL when the file is corrupted or out of memory, the entries
+ * that were read are in "uhp" then.
+ */
+static int
+unserialize_entries(bufinfo_T *bi, u_header_T *uhp, char_u *file_name)
+{
+  u_entry_T *uep, *last_uep;
+  int c;
+  int error;
+
   last_uep = NULL;
-  while ((c = get2c(bi->bi_fp)) == UF_ENTRY_MAGIC)
+  while ((c = undo_read_bytes(bi, 2)) == UF_ENTRY_MAGIC)
   {
     error = FALSE;
     uep = unserialize_uep(bi, &error, file_name);
@@ -1085,19 +1461,14 @@ unserialize_uhp(bufinfo_T *bi, char_u *file_name)
       last_uep->ue_next = uep;
     last_uep = uep;
     if (uep == NULL || error)
-    {
-      u_free_uhp(uhp);
-      return NULL;
-    }
+      return FAIL;
   }
   if (c != UF_ENTRY_END_MAGIC)
   {
     corruption_error("entry end", file_name);
-    u_free_uhp(uhp);
-    return NULL;
+    return FAIL;
   }
-
-  return uhp;
+  return OK;
 }
 
 /*
@@ -1117,6 +1488,23 @@ serialize_uep(
   undo_write_bytes(bi, (long_u)uep->ue_size, 4);
   for (i = 0; i < uep->ue_size; ++i)
   {
+    undoline_T *ul = &uep->ue_array[i];
+
+    // A delta is written as it is, the buffer text is the same when the
+    // file is read.
+    if (UL_IS_DELTA(ul))
+    {
+      undo_write_bytes(bi, (long_u)UF_DELTA_LINE, 4);
+      undo_write_bytes(bi, (long_u)ul->ul_prefix, 4);
+      undo_write_bytes(bi, (long_u)ul->ul_suffix, 4);
+      undo_write_bytes(bi, (long_u)ul->ul_base_len, 4);
+      if (undo_write_bytes(bi, (long_u)ul->ul_len, 4) == FAIL)
+        return FAIL;
+      if (ul->ul_len > 0 && undo_write(bi, ul->ul_line, ul->ul_len) == FAIL)
+        return FAIL;
+      continue;
+    }
+
     // Text is written without the text properties, since we cannot restore
     // the text property types.
     len = STRLEN(uep->ue_array[i].ul_line);
@@ -1144,10 +1532,10 @@ unserialize_uep(bufinfo_T *bi, int *error, char_u *file_name)
 #ifdef U_DEBUG
   uep->ue_magic = UE_MAGIC;
 #endif
-  uep->ue_top = get4c(bi->bi_fp);
-  uep->ue_bot = get4c(bi->bi_fp);
-  uep->ue_lcount = get4c(bi->bi_fp);
-  uep->ue_size = get4c(bi->bi_fp);
+  uep->ue_top = undo_read_bytes(bi, 4);
+  uep->ue_bot = undo_read_bytes(bi, 4);
+  uep->ue_lcount = undo_read_bytes(bi, 4);
+  uep->ue_size = undo_read_bytes(bi, 4);
   if (uep->ue_size > 0)
   {
     if (uep->ue_size < LONG_MAX / (int)sizeof(char_u *))
@@ -1163,7 +1551,30 @@ unserialize_uep(bufinfo_T *bi, int *error, char_u *file_name)
 
   for (i = 0; i < uep->ue_size; ++i)
   {
-    line_len = get4c(bi->bi_fp);
+    line_len = undo_read_bytes(bi, 4);
+    if (line_len == UF_DELTA_LINE)
+    {
+      array[i].ul_prefix = undo_read_bytes(bi, 4);
+      array[i].ul_suffix = undo_read_bytes(bi, 4);
+      array[i].ul_base_len = undo_read_bytes(bi, 4);
+      line_len = undo_read_bytes(bi, 4);
+      if (line_len < 0 || array[i].ul_prefix < 0 || array[i].ul_suffix < 0 ||
+          array[i].ul_prefix + array[i].ul_suffix == 0 ||
+          array[i].ul_prefix + array[i].ul_suffix > array[i].ul_base_len)
+      {
+        corruption_error("delta line", file_name);
+        *error = TRUE;
+        return uep;
+      }
+      if ((line = read_string_decrypt(bi, line_len)) == NULL)
+      {
+        *error = TRUE;
+        return uep;
+      }
+      array[i].ul_line = line;
+      array[i].ul_len = line_len;
+      continue;
+    }
     if (line_len >= 0)
       line = read_string_decrypt(bi, line_len);
     else
@@ -1176,10 +1587,427 @@ unserialize_uep(bufinfo_T *bi, int *error, char_u *file_name)
       *error = TRUE;
       return uep;
     }
-    array[i].ul_line = line;
-    array[i].ul_len = line_len + 1;
-  }
-  return uep;
+    array[i].ul_line = line;
+    array[i].ul_len = line_len + 1;
+  }
+  return uep;
+}
+
+/*
+ * Write a segment: the state of the buffer and the undo tree, the sequence
+ * numbers of the headers in the tree and the headers themselves, each
+ * preceded by its size.  When "all" is FALSE only the headers that changed
+ * since they were written are included, the others are in the segments
+ * before this one.  Entries that did not change are not written again then.
+ */
+static int
+serialize_segment(bufinfo_T *bi, char_u *hash, int all)
+{
+  buf_T *buf = bi->bi_buf;
+  u_header_T *uhp;
+  bufinfo_T count;
+  int mark;
+
+  if (undo_write_bytes(bi, (long_u)UF_SEGMENT_MAGIC, 2) == FAIL || serialize_header(bi, hash) == FAIL)
+    return FAIL;
+
+  mark = ++lastmark;
+  for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+    if (uhp->uh_walk != mark)
+    {
+      uhp->uh_walk = mark;
+      if (undo_write_bytes(bi, (long_u)uhp->uh_seq, 4) == FAIL)
+        return FAIL;
+    }
+
+  vim_memset(&count, 0, sizeof(count));
+  count.bi_buf = buf;
+  mark = ++lastmark;
+  for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+    if (uhp->uh_walk != mark)
+    {
+      uhp->uh_walk = mark;
+      if (!all && !uhp->uh_dirty)
+        continue;
+      count.bi_size = 0;
+      serialize_uhp(&count, uhp, !all);
+      if (undo_write_bytes(bi, (long_u)UF_HEADER_MAGIC, 2) == FAIL || undo_write_bytes(bi, count.bi_size, 4) == FAIL || serialize_uhp(bi, uhp, !all) == FAIL)
+        return FAIL;
+      uhp->uh_dirty = FALSE;
+    }
+
+  return undo_write_bytes(bi, (long_u)UF_HEADER_END_MAGIC, 2);
+}
+
+/*
+ * Read the state written by serialize_header() into "state".  When "seqs" is
+ * TRUE also read the sequence numbers of the headers written by
+ * serialize_segment().
+ * Returns FAIL when the file is corrupted or out of memory.
+ */
+static int
+unserialize_state(bufinfo_T *bi, ufstate_T *state, int seqs)
+{
+  long str_len;
+  long i;
+
+  undo_read(bi, state->hash, (size_t)UNDO_HASH_SIZE);
+  state->line_count = (linenr_T)undo_read_bytes(bi, 4);
+
+  /* Undo data for "U" command. */
+  str_len = undo_read_bytes(bi, 4);
+  if (str_len < 0)
+    return FAIL;
+  if (str_len > 0)
+  {
+    state->line_ptr.ul_line = read_string_decrypt(bi, str_len);
+    if (state->line_ptr.ul_line == NULL)
+      return FAIL;
+    state->line_ptr.ul_len = str_len + 1;
+  }
+  state->line_lnum = (linenr_T)undo_read_bytes(bi, 4);
+  state->line_colnr = (colnr_T)undo_read_bytes(bi, 4);
+  if (state->line_lnum < 0 || state->line_colnr < 0)
+    return FAIL;
+
+  /* General undo data. */
+  state->old_header_seq = undo_read_bytes(bi, 4);
+  state->new_header_seq = undo_read_bytes(bi, 4);
+  state->cur_header_seq = undo_read_bytes(bi, 4);
+  state->num_head = undo_read_bytes(bi, 4);
+  state->seq_last = undo_read_bytes(bi, 4);
+  state->seq_cur = undo_read_bytes(bi, 4);
+  state->seq_time = undo_read_time(bi);
+  if (state->num_head < 0)
+    return FAIL;
+
+  /* Optional header fields. */
+  for (;;)
+  {
+    int len = undo_read_bytes(bi, 1);
+    int what;
+
+    if (len == 0 || len == EOF)
+      break;
+    what = undo_read_bytes(bi, 1);
+    switch (what)
+    {
+    case UF_LAST_SAVE_NR:
+      state->last_save_nr = undo_read_bytes(bi, 4);
+      break;
+    default:
+      /* field not supported, skip */
+      while (--len >= 0)
+        (void)undo_read_bytes(bi, 1);
+    }
+  }
+
+  if (seqs)
+  {
+    if (state->num_head > (bi->bi_end - bi->bi_ptr) / 4)
+      return FAIL;
+    state->seqs = ALLOC_MULT(long, state->num_head + 1);
+    if (state->seqs == NULL)
+      return FAIL;
+    for (i = 0; i < state->num_head; ++i)
+      state->seqs[i] = undo_read_bytes(bi, 4);
+  }
+  return bi->bi_error ? FAIL : OK;
+}
+
+/*
+ * Free the allocated items in "state".
+ */
+static void
+u_free_state(ufstate_T *state)
+{
+  VIM_CLEAR(state->line_ptr.ul_line);
+  VIM_CLEAR(state->seqs);
+}
+
+/*
+ * Compare function for qsort(): by sequence number, then by position.
+ */
+static int
+record_compare(const void *s1, const void *s2)
+{
+  ufrecord_T *r1 = (ufrecord_T *)s1;
+  ufrecord_T *r2 = (ufrecord_T *)s2;
+
+  if (r1->ur_seq != r2->ur_seq)
+    return r1->ur_seq < r2->ur_seq ? -1 : 1;
+  return r1->ur_ptr < r2->ur_ptr ? -1 : r1->ur_ptr > r2->ur_ptr;
+}
+
+/*
+ * Sort the headers found in the segments of an undo file, and only keep the
+ * last one written for each sequence number.
+ */
+static void
+u_sort_records(garray_T *records)
+{
+  ufrecord_T *recs = (ufrecord_T *)records->ga_data;
+  int i;
+  int len = 0;
+
+  if (records->ga_len == 0)
+    return;
+  qsort(recs, (size_t)records->ga_len, sizeof(ufrecord_T), record_compare);
+  for (i = 0; i < records->ga_len; ++i)
+  {
+    if (len > 0 && recs[len - 1].ur_seq == recs[i].ur_seq)
+      --len;
+    recs[len++] = recs[i];
+  }
+  records->ga_len = len;
+}
+
+/*
+ * Find the header with sequence number "seq" in the sorted "records".
+ */
+static ufrecord_T *
+u_find_record(garray_T *records, long seq)
+{
+  ufrecord_T *recs = (ufrecord_T *)records->ga_data;
+  int lo = 0;
+  int hi = records->ga_len - 1;
+
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    if (recs[mid].ur_seq == seq)
+      return recs + mid;
+    if (recs[mid].ur_seq < seq)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return NULL;
+}
+
+/*
+ * Get the contents of undo file "file_name" in memory, through a read-only
+ * mapping when possible.
+ * Returns NULL when the file cannot be read.
+ */
+static undofile_T *
+u_undofile_read(char_u *file_name)
+{
+  undofile_T *uf;
+  stat_T st;
+  int fd;
+
+  fd = mch_open((char *)file_name, O_RDONLY | O_EXTRA, 0);
+  if (fd < 0)
+    return NULL;
+  uf = ALLOC_CLEAR_ONE(undofile_T);
+  if (uf == NULL || mch_fstat(fd, &st) < 0 || (off_T)(size_t)st.st_size != st.st_size)
+    goto fail;
+  uf->uf_addr_size = (size_t)st.st_size;
+  uf->uf_size = st.st_size;
+#ifdef UNIX
+  uf->uf_dev = st.st_dev;
+  uf->uf_ino = st.st_ino;
+#endif
+#ifdef FEAT_MMAP_FILE
+  if (uf->uf_addr_size > 0)
+  {
+    uf->uf_addr = (char_u *)mmap(NULL, uf->uf_addr_size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+    if (uf->uf_addr == (char_u *)MAP_FAILED)
+      uf->uf_addr = NULL;
+    else
+      uf->uf_mapped = TRUE;
+  }
+#endif
+  if (uf->uf_addr == NULL)
+  {
+    /* One more byte, so that an empty file gets memory too. */
+    uf->uf_addr = alloc(uf->uf_addr_size + 1);
+    if (uf->uf_addr == NULL || read_eintr(fd, uf->uf_addr, uf->uf_addr_size) != (long)uf->uf_addr_size)
+      goto fail;
+  }
+  close(fd);
+  return uf;
+
+fail:
+  close(fd);
+  if (uf != NULL)
+  {
+    u_undofile_unmap(uf);
+    vim_free(uf);
+  }
+  return NULL;
+}
+
+/*
+ * Release the contents of undo file "uf" that was read.
+ */
+static void
+u_undofile_unmap(undofile_T *uf)
+{
+  if (uf->uf_addr == NULL)
+    return;
+#ifdef FEAT_MMAP_FILE
+  if (uf->uf_mapped)
+    munmap(uf->uf_addr, uf->uf_addr_size);
+  else
+#endif
+    vim_free(uf->uf_addr);
+  uf->uf_addr = NULL;
+  uf->uf_addr_size = 0;
+  uf->uf_mapped = FALSE;
+  uf->uf_appended = 0;
+}
+
+/*
+ * Forget about the undo file of "buf".
+ */
+static void
+u_undofile_free(buf_T *buf)
+{
+  if (buf->b_u_file == NULL)
+    return;
+  u_undofile_unmap(buf->b_u_file);
+  vim_free(buf->b_u_file->uf_name);
+  VIM_CLEAR(buf->b_u_file);
+}
+
+/*
+ * Remember undo file "file_name" was written for "buf", so that the next
+ * time the changed headers can be appended.  "all" is TRUE when all headers
+ * were written.  When "ok" is FALSE writing failed and the file is written
+ * again next time.
+ */
+static void
+u_undofile_written(buf_T *buf, char_u *file_name, int ok, int all)
+{
+  undofile_T *uf = buf->b_u_file;
+  stat_T st;
+
+  if (uf == NULL)
+  {
+    if (!ok || (uf = ALLOC_CLEAR_ONE(undofile_T)) == NULL)
+      return;
+    buf->b_u_file = uf;
+  }
+  if (uf->uf_name == NULL || fnamecmp(uf->uf_name, file_name) != 0)
+  {
+    vim_free(uf->uf_name);
+    uf->uf_name = vim_strsave(file_name);
+  }
+  if (!ok || uf->uf_name == NULL || mch_stat((char *)file_name, &st) < 0)
+  {
+    uf->uf_size = -1;
+    return;
+  }
+  uf->uf_size = st.st_size;
+  if (all)
+    uf->uf_full_size = st.st_size;
+#ifdef UNIX
+  uf->uf_dev = st.st_dev;
+  uf->uf_ino = st.st_ino;
+#endif
+}
+
+/*
+ * Return TRUE when the changed headers of "buf" can be appended to undo file
+ * "file_name": it is the file that was last written or read and it did not
+ * change since then.  Not when the appended segments are bigger than the
+ * file was when all headers were written, then it is compacted.
+ */
+static int
+u_can_append(buf_T *buf, char_u *file_name)
+{
+  undofile_T *uf = buf->b_u_file;
+  stat_T st;
+
+  if (uf == NULL || uf->uf_name == NULL || uf->uf_size <= 0 || fnamecmp(uf->uf_name, file_name) != 0)
+    return FALSE;
+  if (buf->b_u_numhead == 0 && buf->b_u_line_ptr.ul_line == NULL)
+    return FALSE;
+  if (uf->uf_size > 2 * uf->uf_full_size)
+    return FALSE;
+  if (mch_stat((char *)file_name, &st) < 0 || st.st_size != uf->uf_size)
+    return FALSE;
+#ifdef UNIX
+  if (st.st_dev != uf->uf_dev || st.st_ino != uf->uf_ino)
+    return FALSE;
+#endif
+  return TRUE;
+}
+
+/*
+ * Read the entries of header "uhp" of buffer "buf" from the contents of the
+ * undo file, they were not read when the file was loaded.
+ * When the file is corrupted the undo tree of "buf" is freed, "uhp" is then
+ * no longer valid, and FAIL is returned.
+ */
+static int
+u_read_entries(buf_T *buf, u_header_T *uhp)
+{
+  undofile_T *uf = buf->b_u_file;
+  bufinfo_T bi;
+  u_entry_T *uep, *nuep;
+
+  vim_memset(&bi, 0, sizeof(bi));
+  bi.bi_buf = buf;
+  bi.bi_ptr = uf->uf_addr + uhp->uh_file_off;
+  bi.bi_end = bi.bi_ptr + uhp->uh_file_len;
+  if (unserialize_entries(&bi, uhp, uf->uf_name) == FAIL)
+  {
+    for (uep = uhp->uh_entry; uep != NULL; uep = nuep)
+    {
+      nuep = uep->ue_next;
+      u_freeentry(uep, uep->ue_array == NULL ? 0 : uep->ue_size);
+    }
+    uhp->uh_entry = NULL;
+
+    /* Without these changes the other headers don't match the text. */
+    emsg(_("E439: undo list corrupt"));
+    u_blockfree(buf);
+    u_clearall(buf);
+    return FAIL;
+  }
+  for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+  {
+    buf->b_u_mem_used += u_entry_mem(uep);
+    /* Lines were appended below the last line, see u_appended_last(). */
+    if (uf->uf_appended != 0 && uep->ue_bot <= 0)
+    {
+      uep->ue_bot -= uf->uf_appended;
+      u_entries_changed(uhp);
+    }
+  }
+
+  uhp->uh_file_off = 0;
+  uhp->uh_file_len = 0;
+  if (--uf->uf_lazy == 0)
+    u_undofile_unmap(uf);
+  return OK;
+}
+
+/*
+ * Read the entries of the headers of "buf" that were not read yet, when
+ * lines were appended below the last line after the undo file was read.
+ * Their entries in the file don't count those lines, they can't be copied.
+ */
+static void
+u_load_appended(buf_T *buf)
+{
+  u_header_T *uhp;
+  int mark;
+
+  if (buf->b_u_file == NULL || buf->b_u_file->uf_appended == 0)
+    return;
+  mark = ++lastmark;
+  for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+    if (uhp->uh_walk != mark)
+    {
+      uhp->uh_walk = mark;
+      if (u_load_entries(buf, uhp) == FAIL)
+        return;
+    }
 }
 
 /*
@@ -1199,13 +2027,13 @@ serialize_pos(bufinfo_T *bi, pos_T pos)
 static void
 unserialize_pos(bufinfo_T *bi, pos_T *pos)
 {
-  pos->lnum = get4c(bi->bi_fp);
+  pos->lnum = undo_read_bytes(bi, 4);
   if (pos->lnum < 0)
     pos->lnum = 0;
-  pos->col = get4c(bi->bi_fp);
+  pos->col = undo_read_bytes(bi, 4);
   if (pos->col < 0)
     pos->col = 0;
-  pos->coladd = get4c(bi->bi_fp);
+  pos->coladd = undo_read_bytes(bi, 4);
   if (pos->coladd < 0)
     pos->coladd = 0;
 }
@@ -1230,12 +2058,16 @@ unserialize_visualinfo(bufinfo_T *bi, visualinfo_T *info)
 {
   unserialize_pos(bi, &info->vi_start);
   unserialize_pos(bi, &info->vi_end);
-  info->vi_mode = get4c(bi->bi_fp);
-  info->vi_curswant = get4c(bi->bi_fp);
+  info->vi_mode = undo_read_bytes(bi, 4);
+  info->vi_curswant = undo_read_bytes(bi, 4);
 }
 
 /*
  * Write the undo tree in an undo file.
+ * When the file is the one that was written or read last for "buf" and it
+ * did not change since then, only the headers that changed are appended to
+ * it.  Once the appended segments are bigger than the file was after writing
+ * all headers, it is written again with all of them.
  * When "name" is not NULL, use it as the name of the undo file.
  * Otherwise use buf->b_ffname to generate the undo file name.
  * "buf" must never be null, buf->b_ffname is used to obtain the original file
@@ -1249,16 +2081,12 @@ void u_write_undo(
     buf_T *buf,
     char_u *hash)
 {
-  u_header_T *uhp;
   char_u *file_name;
-  int mark;
-#ifdef U_DEBUG
-  int headers_written = 0;
-#endif
   int fd;
   FILE *fp = NULL;
   int perm;
   int write_ok = FALSE;
+  int append = FALSE;
 #ifdef UNIX
   int st_old_valid = FALSE;
   stat_T st_old;
@@ -1310,6 +2138,23 @@ void u_write_undo(
   /* strip any s-bit and executable bit */
   perm = perm & 0666;
 
+  u_load_appended(buf);
+  if (u_can_append(buf, file_name))
+  {
+    fd = mch_open((char *)file_name, O_WRONLY | O_APPEND | O_EXTRA | O_NOFOLLOW, 0);
+    if (fd >= 0)
+    {
+      append = TRUE;
+      if (p_verbose > 0)
+      {
+        verbose_enter();
+        smsg(_("Appending to undo file: %s"), file_name);
+        verbose_leave();
+      }
+      goto open_fp;
+    }
+  }
+
   /* If the undo file already exists, verify that it actually is an undo
      * file, and delete it. */
   if (mch_getperm(file_name) >= 0)
@@ -1405,12 +2250,14 @@ void u_write_undo(
 #endif
 #endif
 
-  fp = fdopen(fd, "w");
+open_fp:
+  fp = fdopen(fd, append ? "a" : "w");
   if (fp == NULL)
   {
     semsg(_(e_not_open), file_name);
     close(fd);
-    mch_remove(file_name);
+    if (!append)
+      mch_remove(file_name);
     goto theend;
   }
 
@@ -1418,58 +2265,24 @@ void u_write_undo(
   u_sync(TRUE);
 
   /*
-     * Write the header.  Initializes encryption, if enabled.
+     * Write the magic marker and undo info version, followed by a segment
+     * with all headers or the ones that changed.
      */
   bi.bi_buf = buf;
   bi.bi_fp = fp;
-  if (serialize_header(&bi, hash) == FAIL)
+  if (append)
+    bi.bi_size = (long_u)buf->b_u_file->uf_size;
+  else if (undo_write(&bi, (char_u *)UF_START_MAGIC, (size_t)UF_START_MAGIC_LEN) == FAIL || undo_write_bytes(&bi, (long_u)UF_VERSION_HASH, 2) == FAIL)
     goto write_error;
-
-  /*
-     * Iteratively serialize UHPs and their UEPs from the top down.
-     */
-  mark = ++lastmark;
-  uhp = buf->b_u_oldhead;
-  while (uhp != NULL)
-  {
-    /* Serialize current UHP if we haven't seen it */
-    if (uhp->uh_walk != mark)
-    {
-      uhp->uh_walk = mark;
-#ifdef U_DEBUG
-      ++headers_written;
-#endif
-      if (serialize_uhp(&bi, uhp) == FAIL)
-        goto write_error;
-    }
-
-    /* Now walk through the tree - algorithm from undo_time(). */
-    if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark)
-      uhp = uhp->uh_prev.ptr;
-    else if (uhp->uh_alt_next.ptr != NULL && uhp->uh_alt_next.ptr->uh_walk != mark)
-      uhp = uhp->uh_alt_next.ptr;
-    else if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL && uhp->uh_next.ptr->uh_walk != mark)
-      uhp = uhp->uh_next.ptr;
-    else if (uhp->uh_alt_prev.ptr != NULL)
-      uhp = uhp->uh_alt_prev.ptr;
-    else
-      uhp = uhp->uh_next.ptr;
-  }
-
-  if (undo_write_bytes(&bi, (long_u)UF_HEADER_END_MAGIC, 2) == OK)
+  if (serialize_segment(&bi, hash, !append) == OK)
     write_ok = TRUE;
-#ifdef U_DEBUG
-  if (headers_written != buf->b_u_numhead)
-  {
-    semsg("Written %ld headers, ...", headers_written);
-    semsg("... but numhead is %ld", buf->b_u_numhead);
-  }
-#endif
 
 write_error:
-  fclose(fp);
+  if (fclose(fp) != 0)
+    write_ok = FALSE;
   if (!write_ok)
     semsg(_("E829: write error in undo file: %s"), file_name);
+  u_undofile_written(buf, file_name, write_ok, !append);
 
 #if defined(MSWIN)
   /* Copy file attributes; for systems where this can only be done after
@@ -1500,29 +2313,27 @@ theend:
  * a bit more verbose.
  * Otherwise use curbuf->b_ffname to generate the undo file name.
  * "hash[UNDO_HASH_SIZE]" must be the hash value of the buffer text.
+ * The file is mapped into memory.  For a file with segments only the fields
+ * of the headers are read, their entries are read when they are used.
  */
 void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
 {
   char_u *file_name;
-  FILE *fp;
-  long version, str_len;
-  undoline_T line_ptr;
-  linenr_T line_lnum;
-  colnr_T line_colnr;
-  linenr_T line_count;
-  long num_head = 0;
-  long old_header_seq, new_header_seq, cur_header_seq;
-  long seq_last, seq_cur;
-  long last_save_nr = 0;
+  undofile_T *uf = NULL;
+  long version;
+  ufstate_T state;
+  ufstate_T next;
+  garray_T records;
+  ufrecord_T *rec;
   short old_idx = -1, new_idx = -1, cur_idx = -1;
   long num_read_uhps = 0;
-  time_t seq_time;
   int i, j;
   int c;
   u_header_T *uhp;
+  u_entry_T *uep;
   u_header_T **uhp_table = NULL;
-  char_u read_hash[UNDO_HASH_SIZE];
   char_u magic_buf[UF_START_MAGIC_LEN];
+  char_u text_hash[UNDO_HASH_SIZE];
 #ifdef U_DEBUG
   int *uhp_table_used;
 #endif
@@ -1533,8 +2344,9 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
   bufinfo_T bi;
 
   vim_memset(&bi, 0, sizeof(bi));
-  line_ptr.ul_len = 0;
-  line_ptr.ul_line = NULL;
+  vim_memset(&state, 0, sizeof(state));
+  vim_memset(&next, 0, sizeof(next));
+  ga_init2(&records, (int)sizeof(ufrecord_T), 100);
 
   if (name == NULL)
   {
@@ -1568,43 +2380,106 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
     verbose_leave();
   }
 
-  fp = mch_fopen((char *)file_name, "r");
-  if (fp == NULL)
+  uf = u_undofile_read(file_name);
+  if (uf == NULL)
   {
     if (name != NULL || p_verbose > 0)
       semsg(_("E822: Cannot open undo file for reading: %s"), file_name);
     goto error;
   }
   bi.bi_buf = curbuf;
-  bi.bi_fp = fp;
+  bi.bi_ptr = uf->uf_addr;
+  bi.bi_end = uf->uf_addr + uf->uf_addr_size;
 
   /*
      * Read the undo file header.
      */
-  if (fread(magic_buf, UF_START_MAGIC_LEN, 1, fp) != 1 || memcmp(magic_buf, UF_START_MAGIC, UF_START_MAGIC_LEN) != 0)
+  if (undo_read(&bi, magic_buf, UF_START_MAGIC_LEN) == FAIL || memcmp(magic_buf, UF_START_MAGIC, UF_START_MAGIC_LEN) != 0)
   {
     semsg(_("E823: Not an undo file: %s"), file_name);
     goto error;
   }
-  version = get2c(fp);
+  version = undo_read_bytes(&bi, 2);
   if (version == UF_VERSION_CRYPT)
   {
     semsg(_("E827: Undo file is encrypted: %s"), file_name);
     goto error;
   }
-  else if (version != UF_VERSION)
+  else if (version < UF_VERSION || version > UF_VERSION_HASH)
   {
     semsg(_("E824: Incompatible undo file: %s"), file_name);
     goto error;
   }
 
-  if (undo_read(&bi, read_hash, (size_t)UNDO_HASH_SIZE) == FAIL)
+  if (version >= UF_VERSION_APPEND)
+  {
+    /* Go over the segments, the last complete one has the state to use.
+	 * Only remember where the headers are. */
+    uf->uf_size = -1;
+    while (bi.bi_ptr < bi.bi_end)
+    {
+      int seg_records = records.ga_len;
+
+      c = undo_read_bytes(&bi, 2);
+      if (c != UF_SEGMENT_MAGIC || unserialize_state(&bi, &next, TRUE) == FAIL)
+        c = -1;
+      else
+        while ((c = undo_read_bytes(&bi, 2)) == UF_HEADER_MAGIC)
+        {
+          long len = undo_read_bytes(&bi, 4);
+
+          /* The fields before uh_seq are four header numbers. */
+          if (len < 20 || len > bi.bi_end - bi.bi_ptr || ga_grow(&records, 1) == FAIL)
+          {
+            c = -1;
+            break;
+          }
+          rec = (ufrecord_T *)records.ga_data + records.ga_len++;
+          rec->ur_ptr = bi.bi_ptr;
+          rec->ur_end = bi.bi_ptr + len;
+          bi.bi_ptr += 16;
+          rec->ur_seq = undo_read_bytes(&bi, 4);
+          bi.bi_ptr = rec->ur_end;
+        }
+      if (c != UF_HEADER_END_MAGIC)
+      {
+        /* Writing the segment was not finished, forget about it.  The
+		 * file is not appended to, it gets written again. */
+        records.ga_len = seg_records;
+        u_free_state(&next);
+        if (state.seqs == NULL)
+        {
+          corruption_error("segment", file_name);
+          goto error;
+        }
+        break;
+      }
+      u_free_state(&state);
+      state = next;
+      vim_memset(&next, 0, sizeof(next));
+      uf->uf_size = (off_T)(bi.bi_ptr - uf->uf_addr);
+      if (uf->uf_full_size == 0)
+        uf->uf_full_size = uf->uf_size;
+    }
+    if (state.seqs == NULL)
+    {
+      corruption_error("no segment", file_name);
+      goto error;
+    }
+  }
+  else if (unserialize_state(&bi, &state, FALSE) == FAIL)
   {
-    corruption_error("hash", file_name);
+    corruption_error("header", file_name);
     goto error;
   }
-  line_count = (linenr_T)get4c(bi.bi_fp);
-  if (memcmp(hash, read_hash, UNDO_HASH_SIZE) != 0 || line_count != curbuf->b_ml.ml_line_count)
+
+  /* An older file has the hash of all the text. */
+  if (version < UF_VERSION_HASH)
+  {
+    u_compute_text_hash(text_hash);
+    hash = text_hash;
+  }
+  if (memcmp(hash, state.hash, UNDO_HASH_SIZE) != 0 || state.line_count != curbuf->b_ml.ml_line_count)
   {
     if (p_verbose > 0 || name != NULL)
     {
@@ -1619,92 +2494,95 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
     goto error;
   }
 
-  /* Read undo data for "U" command. */
-  str_len = get4c(bi.bi_fp);
-  if (str_len < 0)
-    goto error;
-  if (str_len > 0)
-  {
-    line_ptr.ul_line = read_string_decrypt(&bi, str_len);
-    line_ptr.ul_len = str_len + 1;
-  }
-  line_lnum = (linenr_T)get4c(bi.bi_fp);
-  line_colnr = (colnr_T)get4c(bi.bi_fp);
-  if (line_lnum < 0 || line_colnr < 0)
-  {
-    corruption_error("line lnum/col", file_name);
-    goto error;
-  }
-
-  /* Begin general undo data */
-  old_header_seq = get4c(bi.bi_fp);
-  new_header_seq = get4c(bi.bi_fp);
-  cur_header_seq = get4c(bi.bi_fp);
-  num_head = get4c(bi.bi_fp);
-  seq_last = get4c(bi.bi_fp);
-  seq_cur = get4c(bi.bi_fp);
-  seq_time = get8ctime(bi.bi_fp);
-
-  /* Optional header fields. */
-  for (;;)
-  {
-    int len = getc(bi.bi_fp);
-    int what;
-
-    if (len == 0 || len == EOF)
-      break;
-    what = getc(bi.bi_fp);
-    switch (what)
-    {
-    case UF_LAST_SAVE_NR:
-      last_save_nr = get4c(bi.bi_fp);
-      break;
-    default:
-      /* field not supported, skip */
-      while (--len >= 0)
-        (void)getc(bi.bi_fp);
-    }
-  }
-
   /* uhp_table will store the freshly created undo headers we allocate
      * until we insert them into curbuf. The table remains sorted by the
      * sequence numbers of the headers.
      * When there are no headers uhp_table is NULL. */
-  if (num_head > 0)
+  if (state.num_head > 0)
   {
-    if (num_head < LONG_MAX / (long)sizeof(u_header_T *))
-      uhp_table = U_ALLOC_LINE(num_head * sizeof(u_header_T *));
+    if (state.num_head < LONG_MAX / (long)sizeof(u_header_T *))
+      uhp_table = U_ALLOC_LINE(state.num_head * sizeof(u_header_T *));
     if (uhp_table == NULL)
       goto error;
   }
 
-  while ((c = get2c(bi.bi_fp)) == UF_HEADER_MAGIC)
+  if (version >= UF_VERSION_APPEND)
   {
-    if (num_read_uhps >= num_head)
+    /* For each header in the tree use the last version that was written.
+	 * Its entries are read when they are needed. */
+    u_sort_records(&records);
+    for (i = 0; i < state.num_head; ++i)
     {
-      corruption_error("num_head too small", file_name);
-      goto error;
-    }
-
-    uhp = unserialize_uhp(&bi, file_name);
-    if (uhp == NULL)
-      goto error;
-    uhp_table[num_read_uhps++] = uhp;
-  }
+      bufinfo_T rbi;
 
-  if (num_read_uhps != num_head)
-  {
-    corruption_error("num_head", file_name);
-    goto error;
+      rec = u_find_record(&records, state.seqs[i]);
+      if (rec == NULL)
+      {
+        corruption_error("missing header", file_name);
+        goto error;
+      }
+      rbi = bi;
+      rbi.bi_ptr = rec->ur_ptr;
+      rbi.bi_end = rec->ur_end;
+      rbi.bi_error = FALSE;
+      uhp = unserialize_uhp(&rbi, file_name);
+      if (uhp == NULL)
+        goto error;
+      uhp_table[num_read_uhps++] = uhp;
+      if (rbi.bi_end - rbi.bi_ptr == 10 && undo_read_bytes(&rbi, 2) == UF_ENTRY_REF_MAGIC)
+      {
+        /* The entries did not change since an earlier segment. */
+        uhp->uh_file_off = (long_u)undo_read_bytes(&rbi, 4);
+        uhp->uh_file_len = (long_u)undo_read_bytes(&rbi, 4);
+      }
+      else
+      {
+        uhp->uh_file_off = (long_u)(rbi.bi_ptr - uf->uf_addr);
+        uhp->uh_file_len = (long_u)(rbi.bi_end - rbi.bi_ptr);
+      }
+      if (rbi.bi_error || uhp->uh_file_len < 2 || uhp->uh_file_off < UF_START_MAGIC_LEN + 2 || uhp->uh_file_off + uhp->uh_file_len > uf->uf_addr_size)
+      {
+        corruption_error("header entries", file_name);
+        goto error;
+      }
+      uhp->uh_entry_pos = uhp->uh_file_off;
+      uhp->uh_entry_len = uhp->uh_file_len;
+      ++uf->uf_lazy;
+    }
   }
-  if (c != UF_HEADER_END_MAGIC)
+  else
   {
-    corruption_error("end marker", file_name);
-    goto error;
+    while ((c = undo_read_bytes(&bi, 2)) == UF_HEADER_MAGIC)
+    {
+      if (num_read_uhps >= state.num_head)
+      {
+        corruption_error("num_head too small", file_name);
+        goto error;
+      }
+
+      uhp = unserialize_uhp(&bi, file_name);
+      if (uhp == NULL)
+        goto error;
+      uhp_table[num_read_uhps++] = uhp;
+      if (unserialize_entries(&bi, uhp, file_name) == FAIL)
+        goto error;
+      uhp->uh_dirty = TRUE;
+    }
+
+    if (num_read_uhps != state.num_head)
+    {
+      corruption_error("num_head", file_name);
+      goto error;
+    }
+    if (c != UF_HEADER_END_MAGIC)
+    {
+      corruption_error("end marker", file_name);
+      goto error;
+    }
   }
 
 #ifdef U_DEBUG
-  uhp_table_used = alloc_clear(sizeof(int) * num_head + 1);
+  uhp_table_used = alloc_clear(sizeof(int) * state.num_head + 1);
 #define SET_FLAG(j) ++uhp_table_used[j]
 #else
 #define SET_FLAG(j)
@@ -1713,56 +2591,56 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
   /* We have put all of the headers into a table. Now we iterate through the
      * table and swizzle each sequence number we have stored in uh_*_seq into
      * a pointer corresponding to the header with that sequence number. */
-  for (i = 0; i < num_head; i++)
+  for (i = 0; i < state.num_head; i++)
   {
     uhp = uhp_table[i];
     if (uhp == NULL)
       continue;
-    for (j = 0; j < num_head; j++)
+    for (j = 0; j < state.num_head; j++)
       if (uhp_table[j] != NULL && i != j && uhp_table[i]->uh_seq == uhp_table[j]->uh_seq)
       {
         corruption_error("duplicate uh_seq", file_name);
         goto error;
       }
-    for (j = 0; j < num_head; j++)
+    for (j = 0; j < state.num_head; j++)
       if (uhp_table[j] != NULL && uhp_table[j]->uh_seq == uhp->uh_next.seq)
       {
         uhp->uh_next.ptr = uhp_table[j];
         SET_FLAG(j);
         break;
       }
-    for (j = 0; j < num_head; j++)
+    for (j = 0; j < state.num_head; j++)
       if (uhp_table[j] != NULL && uhp_table[j]->uh_seq == uhp->uh_prev.seq)
       {
         uhp->uh_prev.ptr = uhp_table[j];
         SET_FLAG(j);
         break;
       }
-    for (j = 0; j < num_head; j++)
+    for (j = 0; j < state.num_head; j++)
       if (uhp_table[j] != NULL && uhp_table[j]->uh_seq == uhp->uh_alt_next.seq)
       {
         uhp->uh_alt_next.ptr = uhp_table[j];
         SET_FLAG(j);
         break;
       }
-    for (j = 0; j < num_head; j++)
+    for (j = 0; j < state.num_head; j++)
       if (uhp_table[j] != NULL && uhp_table[j]->uh_seq == uhp->uh_alt_prev.seq)
       {
         uhp->uh_alt_prev.ptr = uhp_table[j];
         SET_FLAG(j);
         break;
       }
-    if (old_header_seq > 0 && old_idx < 0 && uhp->uh_seq == old_header_seq)
+    if (state.old_header_seq > 0 && old_idx < 0 && uhp->uh_seq == state.old_header_seq)
     {
       old_idx = i;
       SET_FLAG(i);
     }
-    if (new_header_seq > 0 && new_idx < 0 && uhp->uh_seq == new_header_seq)
+    if (state.new_header_seq > 0 && new_idx < 0 && uhp->uh_seq == state.new_header_seq)
     {
       new_idx = i;
       SET_FLAG(i);
     }
-    if (cur_header_seq > 0 && cur_idx < 0 && uhp->uh_seq == cur_header_seq)
+    if (state.cur_header_seq > 0 && cur_idx < 0 && uhp->uh_seq == state.cur_header_seq)
     {
       cur_idx = i;
       SET_FLAG(i);
@@ -1775,21 +2653,42 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
   curbuf->b_u_oldhead = old_idx < 0 ? NULL : uhp_table[old_idx];
   curbuf->b_u_newhead = new_idx < 0 ? NULL : uhp_table[new_idx];
   curbuf->b_u_curhead = cur_idx < 0 ? NULL : uhp_table[cur_idx];
-  curbuf->b_u_line_ptr = line_ptr;
-  curbuf->b_u_line_lnum = line_lnum;
-  curbuf->b_u_line_colnr = line_colnr;
-  curbuf->b_u_numhead = num_head;
-  curbuf->b_u_seq_last = seq_last;
-  curbuf->b_u_seq_cur = seq_cur;
-  curbuf->b_u_time_cur = seq_time;
-  curbuf->b_u_save_nr_last = last_save_nr;
-  curbuf->b_u_save_nr_cur = last_save_nr;
+  curbuf->b_u_line_ptr = state.line_ptr;
+  state.line_ptr.ul_line = NULL;
+  curbuf->b_u_line_lnum = state.line_lnum;
+  curbuf->b_u_line_colnr = state.line_colnr;
+  curbuf->b_u_numhead = state.num_head;
+  curbuf->b_u_seq_last = state.seq_last;
+  curbuf->b_u_seq_cur = state.seq_cur;
+  curbuf->b_u_time_cur = state.seq_time;
+  curbuf->b_u_save_nr_last = state.last_save_nr;
+  curbuf->b_u_save_nr_cur = state.last_save_nr;
+  curbuf->b_u_mem_used = 0;
+  for (i = 0; i < state.num_head; ++i)
+  {
+    curbuf->b_u_mem_used += sizeof(u_header_T);
+    for (uep = uhp_table[i]->uh_entry; uep != NULL; uep = uep->ue_next)
+      curbuf->b_u_mem_used += u_entry_mem(uep);
+  }
+
+  /* Keep the file for appending and for reading entries, only a file with
+     * segments and the current hash can be appended to. */
+  if (version >= UF_VERSION_APPEND)
+  {
+    if (version < UF_VERSION_HASH)
+      uf->uf_size = -1;
+    uf->uf_name = vim_strsave(file_name);
+    curbuf->b_u_file = uf;
+    if (uf->uf_lazy == 0)
+      u_undofile_unmap(uf);
+    uf = NULL;
+  }
 
   curbuf->b_u_synced = TRUE;
   vim_free(uhp_table);
 
 #ifdef U_DEBUG
-  for (i = 0; i < num_head; ++i)
+  for (i = 0; i < state.num_head; ++i)
     if (uhp_table_used[i] == 0)
       semsg("uhp_table entry %ld not used, leaking memory", i);
   vim_free(uhp_table_used);
@@ -1801,7 +2700,6 @@ void u_read_undo(char_u *name, char_u *hash, char_u *orig_name)
   goto theend;
 
 error:
-  vim_free(line_ptr.ul_line);
   if (uhp_table != NULL)
   {
     for (i = 0; i < num_read_uhps; i++)
@@ -1811,8 +2709,14 @@ error:
   }
 
 theend:
-  if (fp != NULL)
-    fclose(fp);
+  u_free_state(&state);
+  ga_clear(&records);
+  if (uf != NULL)
+  {
+    u_undofile_unmap(uf);
+    vim_free(uf->uf_name);
+    vim_free(uf);
+  }
   if (file_name != name)
     vim_free(file_name);
   return;
@@ -1899,7 +2803,8 @@ u_doit(int startcount)
         break;
       }
 
-      u_undoredo(TRUE);
+      if (u_undoredo(TRUE) == FAIL)
+        return;
     }
     else
     {
@@ -1914,7 +2819,8 @@ u_doit(int startcount)
         break;
       }
 
-      u_undoredo(FALSE);
+      if (u_undoredo(FALSE) == FAIL)
+        return;
 
       /* Advance for next redo.  Set "newhead" when at the end of the
 	     * redoable changes. */
@@ -2182,7 +3088,8 @@ target_zero:
       if (uhp == NULL || (target > 0 && uhp->uh_walk != mark) || (uhp->uh_seq == target && !above))
         break;
       curbuf->b_u_curhead = uhp;
-      u_undoredo(TRUE);
+      if (u_undoredo(TRUE) == FAIL)
+        return;
       if (target > 0)
         uhp->uh_walk = nomark; /* don't go back down here */
     }
@@ -2217,19 +3124,28 @@ target_zero:
           while (uhp->uh_alt_prev.ptr != NULL)
             uhp = uhp->uh_alt_prev.ptr;
           if (last->uh_alt_next.ptr != NULL)
+          {
             last->uh_alt_next.ptr->uh_alt_prev.ptr =
                 last->uh_alt_prev.ptr;
+            u_header_changed(last->uh_alt_next.ptr);
+          }
           last->uh_alt_prev.ptr->uh_alt_next.ptr =
               last->uh_alt_next.ptr;
+          u_header_changed(last->uh_alt_prev.ptr);
           last->uh_alt_prev.ptr = NULL;
           last->uh_alt_next.ptr = uhp;
           uhp->uh_alt_prev.ptr = last;
+          u_header_changed(last);
+          u_header_changed(uhp);
 
           if (curbuf->b_u_oldhead == uhp)
             curbuf->b_u_oldhead = last;
           uhp = last;
           if (uhp->uh_next.ptr != NULL)
+          {
             uhp->uh_next.ptr->uh_prev.ptr = uhp;
+            u_header_changed(uhp->uh_next.ptr);
+          }
         }
         curbuf->b_u_curhead = uhp;
 
@@ -2244,7 +3160,8 @@ target_zero:
           break;
         }
 
-        u_undoredo(FALSE);
+        if (u_undoredo(FALSE) == FAIL)
+          return;
 
         /* Advance "curhead" to below the header we last used.  If it
 		 * becomes NULL then we need to set "newhead" to this leaf. */
@@ -2277,8 +3194,9 @@ target_zero:
  * list for the next undo/redo.
  *
  * When "undo" is TRUE we go up in the tree, when FALSE we go down.
+ * Returns FAIL when the lines could not be replaced.
  */
-static void
+static int
 u_undoredo(int undo)
 {
   undoline_T *newarray = NULL;
@@ -2290,6 +3208,7 @@ u_undoredo(int undo)
   long i;
   u_entry_T *uep, *nuep;
   u_entry_T *newlist = NULL;
+  long_u mem;
   int old_flags;
   int new_flags;
   pos_T namedm[NMARKS];
@@ -2304,6 +3223,13 @@ u_undoredo(int undo)
 #ifdef U_DEBUG
   u_check(FALSE);
 #endif
+  /* The entries are swapped with the text in the buffer. */
+  if (u_load_entries(curbuf, curhead) == FAIL)
+  {
+    unblock_autocmds();
+    return FAIL;
+  }
+  u_entries_changed(curhead);
   old_flags = curhead->uh_flags;
   new_flags = (curbuf->b_changed ? UH_CHANGED : 0) +
               ((curbuf->b_ml.ml_flags & ML_EMPTY) ? UH_EMPTYBUF : 0);
@@ -2323,19 +3249,28 @@ u_undoredo(int undo)
   {
     top = uep->ue_top;
     bot = uep->ue_bot;
-    if (bot == 0)
-      bot = curbuf->b_ml.ml_line_count + 1;
+    if (bot <= 0)
+      bot = curbuf->b_ml.ml_line_count + 1 + bot;
     if (top > curbuf->b_ml.ml_line_count || top >= bot || bot > curbuf->b_ml.ml_line_count + 1)
     {
       unblock_autocmds();
       iemsg(_("E438: u_undo: line numbers wrong"));
       changed(); /* don't want UNCHANGED now */
-      return;
+      return FAIL;
     }
 
     oldsize = bot - top - 1; /* number of lines before undo */
     newsize = uep->ue_size;  /* number of lines after undo */
 
+    if (u_undelta_entry(uep) == FAIL)
+    {
+      unblock_autocmds();
+      siemsg(_(e_intern2), "u_undoredo()");
+      changed(); /* don't want UNCHANGED now */
+      return FAIL;
+    }
+    mem = u_entry_mem(uep);
+
     if (top < newlnum)
     {
       /* If the saved cursor is somewhere in this undo block, move it to
@@ -2356,8 +3291,7 @@ u_undoredo(int undo)
         {
           char_u *p = ml_get(top + 1 + i);
 
-          if (curbuf->b_ml.ml_line_len != uep->ue_array[i].ul_len || memcmp(uep->ue_array[i].ul_line, p,
-                                                                            curbuf->b_ml.ml_line_len) != 0)
+          if (!u_line_equal(&uep->ue_array[i], p, curbuf->b_ml.ml_line_len))
             break;
         }
         if (i == newsize && newlnum == MAXLNUM && uep->ue_next == NULL)
@@ -2388,6 +3322,7 @@ u_undoredo(int undo)
         while (uep != NULL)
         {
           nuep = uep->ue_next;
+          curbuf->b_u_mem_used -= u_entry_mem(uep);
           u_freeentry(uep, uep->ue_size);
           uep = nuep;
         }
@@ -2453,6 +3388,10 @@ u_undoredo(int undo)
     uep->ue_size = oldsize;
     uep->ue_array = newarray;
     uep->ue_bot = top + newsize + 1;
+    curbuf->b_u_mem_used += u_entry_mem(uep) - mem;
+
+    /* Redo of this entry starts with the lines that are there now. */
+    u_delta_entry(uep);
 
     /*
 	 * insert this entry in front of the new entry list
@@ -2551,6 +3490,7 @@ u_undoredo(int undo)
 #ifdef U_DEBUG
   u_check(FALSE);
 #endif
+  return OK;
 }
 
 /*
@@ -2834,7 +3774,7 @@ void u_find_first_changed(void)
   {
     char_u *p = ml_get_buf(curbuf, lnum, FALSE);
 
-    if (uep->ue_array[lnum - 1].ul_len != curbuf->b_ml.ml_line_len || memcmp(p, uep->ue_array[lnum - 1].ul_line, uep->ue_array[lnum - 1].ul_len) != 0)
+    if (!u_line_equal(&uep->ue_array[lnum - 1], p, curbuf->b_ml.ml_line_len))
     {
       CLEAR_POS(&(uhp->uh_cursor));
       uhp->uh_cursor.lnum = lnum;
@@ -2865,7 +3805,10 @@ void u_update_save_nr(buf_T *buf)
   else
     uhp = buf->b_u_newhead;
   if (uhp != NULL)
+  {
     uhp->uh_save_nr = buf->b_u_save_nr_last;
+    u_header_changed(uhp);
+  }
 }
 
 static void
@@ -2875,6 +3818,8 @@ u_unch_branch(u_header_T *uhp)
 
   for (uh = uhp; uh != NULL; uh = uh->uh_prev.ptr)
   {
+    if (!(uh->uh_flags & UH_CHANGED))
+      u_header_changed(uh);
     uh->uh_flags |= UH_CHANGED;
     if (uh->uh_alt_next.ptr != NULL)
       u_unch_branch(uh->uh_alt_next.ptr); /* recursive */
@@ -2888,6 +3833,8 @@ u_unch_branch(u_header_T *uhp)
 static u_entry_T *
 u_get_headentry(void)
 {
+  if (u_load_entries(curbuf, curbuf->b_u_newhead) == FAIL)
+    return NULL;
   if (curbuf->b_u_newhead == NULL || curbuf->b_u_newhead->uh_entry == NULL)
   {
     iemsg(_("E439: undo list corrupt"));
@@ -2896,6 +3843,102 @@ u_get_headentry(void)
   return curbuf->b_u_newhead->uh_entry;
 }
 
+/*
+ * Called after "count" lines were appended below the last line without
+ * saving them for undo, because more of the file was read.  u_sync() must
+ * have been called before appending.  Undo entries that go to the end of the
+ * buffer must now stop above the new lines: a negative ue_bot is counted
+ * from the end of the buffer.  Entries that were not read from the undo file
+ * yet are adjusted when they are read.
+ */
+void u_appended_last(linenr_T count)
+{
+  u_header_T *uhp;
+  u_entry_T *uep;
+  int mark;
+
+  mark = ++lastmark;
+  for (uhp = curbuf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+    if (uhp->uh_walk != mark)
+    {
+      uhp->uh_walk = mark;
+      for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+        if (uep->ue_bot <= 0)
+        {
+          uep->ue_bot -= count;
+          u_entries_changed(uhp);
+        }
+    }
+#ifdef FEAT_PERSISTENT_UNDO
+  if (curbuf->b_u_file != NULL && curbuf->b_u_file->uf_lazy > 0)
+    curbuf->b_u_file->uf_appended += count;
+#endif
+}
+
+/*
+ * Return the header to go to after "uhp" when going over all headers of the
+ * undo tree, starting at b_u_oldhead.  Headers that were visited have "mark"
+ * in uh_walk.  Returns NULL after the last one.
+ * Algorithm from undo_time().
+ */
+static u_header_T *
+u_walk_next(u_header_T *uhp, int mark)
+{
+  if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark)
+    return uhp->uh_prev.ptr;
+  if (uhp->uh_alt_next.ptr != NULL && uhp->uh_alt_next.ptr->uh_walk != mark)
+    return uhp->uh_alt_next.ptr;
+  if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL && uhp->uh_next.ptr->uh_walk != mark)
+    return uhp->uh_next.ptr;
+  if (uhp->uh_alt_prev.ptr != NULL)
+    return uhp->uh_alt_prev.ptr;
+  return uhp->uh_next.ptr;
+}
+
+/*
+ * Remember that header "uhp" changed, it must be written to the undo file
+ * again.
+ */
+static void
+u_header_changed(u_header_T *uhp)
+{
+#ifdef FEAT_PERSISTENT_UNDO
+  if (uhp != NULL)
+    uhp->uh_dirty = TRUE;
+#endif
+}
+
+/*
+ * Remember that the entries of header "uhp" changed, they must be written to
+ * the undo file again.
+ */
+static void
+u_entries_changed(u_header_T *uhp)
+{
+#ifdef FEAT_PERSISTENT_UNDO
+  if (uhp != NULL)
+  {
+    uhp->uh_dirty = TRUE;
+    uhp->uh_entry_pos = 0;
+  }
+#endif
+}
+
+/*
+ * Make sure the entries of header "uhp" of buffer "buf" are in memory.  After
+ * loading an undo file they are only read when used.
+ * Returns FAIL when they could not be read, the undo tree is gone then.
+ */
+static int
+u_load_entries(buf_T *buf UNUSED, u_header_T *uhp UNUSED)
+{
+#ifdef FEAT_PERSISTENT_UNDO
+  if (uhp != NULL && uhp->uh_file_off != 0)
+    return u_read_entries(buf, uhp);
+#endif
+  return OK;
+}
+
 /*
  * u_getbot(): compute the line number of the previous u_save
  *		It is called only when b_u_synced is FALSE.
@@ -2930,6 +3973,7 @@ u_getbot(void)
     }
 
     curbuf->b_u_newhead->uh_getbot_entry = NULL;
+    u_entries_changed(curbuf->b_u_newhead);
   }
 
   curbuf->b_u_synced = TRUE;
@@ -2952,20 +3996,29 @@ u_freeheader(
     u_freebranch(buf, uhp->uh_alt_next.ptr, uhpp);
 
   if (uhp->uh_alt_prev.ptr != NULL)
+  {
     uhp->uh_alt_prev.ptr->uh_alt_next.ptr = NULL;
+    u_header_changed(uhp->uh_alt_prev.ptr);
+  }
 
   /* Update the links in the list to remove the header. */
   if (uhp->uh_next.ptr == NULL)
     buf->b_u_oldhead = uhp->uh_prev.ptr;
   else
+  {
     uhp->uh_next.ptr->uh_prev.ptr = uhp->uh_prev.ptr;
+    u_header_changed(uhp->uh_next.ptr);
+  }
 
   if (uhp->uh_prev.ptr == NULL)
     buf->b_u_newhead = uhp->uh_next.ptr;
   else
     for (uhap = uhp->uh_prev.ptr; uhap != NULL;
          uhap = uhap->uh_alt_next.ptr)
+    {
       uhap->uh_next.ptr = uhp->uh_next.ptr;
+      u_header_changed(uhap);
+    }
 
   u_freeentries(buf, uhp, uhpp);
 }
@@ -2991,7 +4044,10 @@ u_freebranch(
   }
 
   if (uhp->uh_alt_prev.ptr != NULL)
+  {
     uhp->uh_alt_prev.ptr->uh_alt_next.ptr = NULL;
+    u_header_changed(uhp->uh_alt_prev.ptr);
+  }
 
   next = uhp;
   while (next != NULL)
@@ -3027,14 +4083,20 @@ u_freeentries(
   for (uep = uhp->uh_entry; uep != NULL; uep = nuep)
   {
     nuep = uep->ue_next;
+    buf->b_u_mem_used -= u_entry_mem(uep);
     u_freeentry(uep, uep->ue_size);
   }
+#ifdef FEAT_PERSISTENT_UNDO
+  if (uhp->uh_file_off != 0 && --buf->b_u_file->uf_lazy == 0)
+    u_undofile_unmap(buf->b_u_file);
+#endif
 
 #ifdef U_DEBUG
   uhp->uh_magic = 0;
 #endif
   vim_free((char_u *)uhp);
   --buf->b_u_numhead;
+  buf->b_u_mem_used -= sizeof(u_header_T);
 }
 
 /*
@@ -3060,6 +4122,7 @@ void u_clearall(buf_T *buf)
   buf->b_u_newhead = buf->b_u_oldhead = buf->b_u_curhead = NULL;
   buf->b_u_synced = TRUE;
   buf->b_u_numhead = 0;
+  buf->b_u_mem_used = 0;
   buf->b_u_line_ptr.ul_line = NULL;
   buf->b_u_line_ptr.ul_len = 0;
   buf->b_u_line_lnum = 0;
@@ -3147,6 +4210,47 @@ void u_blockfree(buf_T *buf)
   while (buf->b_u_oldhead != NULL)
     u_freeheader(buf, buf->b_u_oldhead, NULL);
   vim_free(buf->b_u_line_ptr.ul_line);
+#ifdef FEAT_PERSISTENT_UNDO
+  u_undofile_free(buf);
+#endif
+}
+
+/*
+ * Add the memory used for undo of buffer "buf" to "stats".
+ */
+void u_memory_stats(buf_T *buf, memoryStats_T *stats)
+{
+  u_tree_memory_stats(buf->b_u_oldhead, stats);
+  if (buf->b_u_line_ptr.ul_line != NULL)
+    stats->undo += buf->b_u_line_ptr.ul_len;
+}
+
+/*
+ * Add the memory used by the undo headers from "first_uhp" to the newest one
+ * and their alternate branches to "stats".  Recursive.
+ */
+static void
+u_tree_memory_stats(u_header_T *first_uhp, memoryStats_T *stats)
+{
+  u_header_T *uhp;
+  u_entry_T *uep;
+  long i;
+
+  for (uhp = first_uhp; uhp != NULL; uhp = uhp->uh_prev.ptr)
+  {
+    ++stats->undo_headers;
+    stats->undo += sizeof(u_header_T);
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+    {
+      ++stats->undo_entries;
+      stats->undo_lines += uep->ue_size;
+      stats->undo += sizeof(u_entry_T) + uep->ue_size * sizeof(undoline_T);
+      for (i = 0; i < uep->ue_size; ++i)
+        stats->undo += uep->ue_array[i].ul_len;
+    }
+    if (uhp->uh_alt_next.ptr != NULL)
+      u_tree_memory_stats(uhp->uh_alt_next.ptr, stats);
+  }
 }
 
 /*
@@ -883,6 +883,7 @@ extern int (*dyn_libintl_wputenv)(const wchar_t *envstring);
 #define RE_STRING 2 /* match in string instead of buffer text */
 #define RE_STRICT 4 /* don't allow [abc] without ] */
 #define RE_AUTO 8   /* automatic engine selection */
+#define RE_NOCACHE 16 /* don't share a cached program, see vim_regcomp() */
 
 /* Return values for fullpathcmp() */
 /* Note: can use (fullpathcmp() & FPC_SAME) to check for equal files */